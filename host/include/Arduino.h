@@ -0,0 +1,102 @@
+#ifndef __ZW_HOST_ARDUINO__H__
+#define __ZW_HOST_ARDUINO__H__
+
+// the subset of the ESP32 Arduino core the firmware uses; see host/zw_host.h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <errno.h>
+#include <math.h>
+#include <algorithm>
+
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+#include "IPAddress.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_system.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp32-hal-timer.h"
+
+// RTC slow memory: kept across deep sleep (and only that) by saving this section to the state
+// directory before the process re-executes itself; see zwHostRestart()
+#define RTC_DATA_ATTR __attribute__((section("zw_rtc_data")))
+// likewise, but kept across every reset; only a power-on (starting the process) loses it
+#define RTC_NOINIT_ATTR __attribute__((section("zw_rtc_noinit")))
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x01
+#define OUTPUT 0x02
+#define INPUT_PULLUP 0x05
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// everything written goes to stdout; nothing is ever read
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long baud) {}
+    void end() {}
+
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    void flush() { fflush(stdout); }
+
+    size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+    size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+    using Print::write;
+
+    operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+class EspClass
+{
+public:
+    uint32_t getHeapSize();
+    uint32_t getFreeHeap();
+    uint32_t getMinFreeHeap();
+    uint32_t getMaxAllocHeap();
+
+    uint8_t getChipRevision() { return 1; }
+    const char *getSdkVersion() { return "host"; }
+    uint32_t getCpuFreqMHz() { return 240; }
+    uint32_t getCycleCount();
+    uint64_t getEfuseMac();
+
+    uint32_t getFlashChipSize();
+    uint32_t getSketchSize();
+    String getSketchMD5();
+    uint32_t getFreeSketchSpace();
+
+    void restart();
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef __ZW_HOST_EEPROM__H__
+#define __ZW_HOST_EEPROM__H__
+
+// the ESP32 core's EEPROM (itself emulated, in NVS) as the state directory's eeprom.bin
+
+#include "Arduino.h"
+
+class EEPROMClass
+{
+protected:
+    uint8_t *_data = NULL;
+    size_t _size = 0;
+    bool _dirty = false;
+
+public:
+    ~EEPROMClass() { end(); }
+
+    bool begin(size_t size);
+    void end();
+    bool commit();
+
+    uint8_t read(int address) { return (size_t)address < _size ? _data[address] : 0; }
+    void write(int address, uint8_t val)
+    {
+        if ((size_t)address < _size && _data[address] != val)
+        {
+            _data[address] = val;
+            _dirty = true;
+        }
+    }
+
+    uint8_t *getDataPtr()
+    {
+        _dirty = true;
+        return _data;
+    }
+    uint16_t length() { return _size; }
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __ZW_HOST_HTTPCLIENT__H__
+#define __ZW_HOST_HTTPCLIENT__H__
+
+// plain-HTTP GETs, one request per connection
+
+#include "Arduino.h"
+#include "WiFiClient.h"
+
+#define HTTP_CODE_OK 200
+#define HTTP_CODE_PARTIAL_CONTENT 206
+#define HTTP_CODE_NOT_FOUND 404
+
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+#define HTTPC_ERROR_SEND_HEADER_FAILED (-2)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+#define HTTPC_ERROR_READ_TIMEOUT (-11)
+
+class HTTPClient
+{
+protected:
+    WiFiClient *client = NULL;
+    String host;
+    uint16_t port = 80;
+    String uri;
+    String headers;
+    uint16_t timeoutMs = 5000;
+    int size = -1;
+
+public:
+    HTTPClient() {}
+    ~HTTPClient() { end(); }
+
+    HTTPClient(const HTTPClient &) = delete;
+    HTTPClient &operator=(const HTTPClient &) = delete;
+
+    bool begin(String url);
+    void end();
+
+    void setTimeout(uint16_t timeout) { timeoutMs = timeout; }
+    void setReuse(bool reuse) {}
+    void addHeader(const String &name, const String &value, bool first = false, bool replace = true);
+
+    int GET();
+
+    int getSize() { return size; }
+    bool connected() { return client && client->connected(); }
+    WiFiClient &getStream() { return *client; }
+    WiFiClient *getStreamPtr() { return client; }
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef __ZW_HOST_IPADDRESS__H__
+#define __ZW_HOST_IPADDRESS__H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include "WString.h"
+
+// as the ESP32 core's: the address in network byte order, so operator[] is the dotted order
+class IPAddress
+{
+protected:
+    union
+    {
+        uint8_t bytes[4];
+        uint32_t dword;
+    } address;
+
+public:
+    IPAddress() { address.dword = 0; }
+    IPAddress(uint32_t dword) { address.dword = dword; }
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+        address.bytes[0] = a, address.bytes[1] = b, address.bytes[2] = c, address.bytes[3] = d;
+    }
+
+    operator uint32_t() const { return address.dword; }
+    bool operator==(const IPAddress &other) const { return address.dword == other.address.dword; }
+    uint8_t operator[](int index) const { return address.bytes[index]; }
+    uint8_t &operator[](int index) { return address.bytes[index]; }
+
+    String toString() const
+    {
+        char out[16];
+        snprintf(out, sizeof(out), "%u.%u.%u.%u", address.bytes[0], address.bytes[1], address.bytes[2],
+                 address.bytes[3]);
+        return String(out);
+    }
+};
+
+// <netinet/in.h> has a macro of the same name: the HAL's socket code includes that instead
+#ifndef INADDR_NONE
+extern const IPAddress INADDR_NONE;
+#endif
+
+#endif
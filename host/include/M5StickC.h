@@ -0,0 +1,143 @@
+#ifndef __ZW_HOST_M5STICKC__H__
+#define __ZW_HOST_M5STICKC__H__
+
+// the M5StickC's 160x80 LCD as a headless framebuffer (its text echoed with --show), an AXP192
+// reporting a healthy battery and a BM8563 RTC reading the host's local time
+
+#include "Arduino.h"
+#include <map>
+#include <string>
+
+#define M5_BUTTON_HOME 37
+#define M5_BUTTON_RST 39
+
+#define TFT_WIDTH 80
+#define TFT_HEIGHT 160
+
+#define BLACK 0x0000
+#define NAVY 0x000F
+#define DARKGREEN 0x03E0
+#define DARKCYAN 0x03EF
+#define MAROON 0x7800
+#define PURPLE 0x780F
+#define OLIVE 0x7BE0
+#define LIGHTGREY 0xC618
+#define DARKGREY 0x7BEF
+#define BLUE 0x001F
+#define GREEN 0x07E0
+#define CYAN 0x07FF
+#define RED 0xF800
+#define MAGENTA 0xF81F
+#define YELLOW 0xFFE0
+#define WHITE 0xFFFF
+#define ORANGE 0xFD20
+#define GREENYELLOW 0xAFE5
+#define PINK 0xF81F
+#define TFT_BLACK BLACK
+#define TFT_WHITE WHITE
+
+typedef struct
+{
+    uint8_t Hours;
+    uint8_t Minutes;
+    uint8_t Seconds;
+} RTC_TimeTypeDef;
+
+typedef struct
+{
+    uint8_t WeekDay;
+    uint8_t Month;
+    uint8_t Date;
+    uint16_t Year;
+} RTC_DateTypeDef;
+
+class M5Display : public Print
+{
+protected:
+    uint16_t fb[TFT_WIDTH * TFT_HEIGHT];
+    uint8_t rotation = 0;
+    int16_t cursorX = 0, cursorY = 0;
+    uint8_t font = 1;
+    uint16_t textColor = WHITE, textBgColor = BLACK;
+    String line;
+    // the text last echoed at each row, so that only what changes is echoed again
+    std::map<int16_t, std::string> shownRows;
+
+    int16_t width() const { return rotation & 1 ? TFT_HEIGHT : TFT_WIDTH; }
+    int16_t height() const { return rotation & 1 ? TFT_WIDTH : TFT_HEIGHT; }
+    int16_t fontHeight() const;
+
+public:
+    void begin();
+    void setRotation(uint8_t r) { rotation = r & 3; }
+    void fillScreen(uint32_t color);
+    void fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color);
+    void drawPixel(int32_t x, int32_t y, uint32_t color);
+    void drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color);
+    void setCursor(int16_t x, int16_t y) { cursorX = x, cursorY = y; }
+    void setCursor(int16_t x, int16_t y, uint8_t f) { cursorX = x, cursorY = y, font = f; }
+    void setTextFont(uint8_t f) { font = f; }
+    void setTextColor(uint16_t color) { textColor = color; }
+    void setTextColor(uint16_t fg, uint16_t bg) { textColor = fg, textBgColor = bg; }
+
+    size_t write(uint8_t c);
+    using Print::write;
+};
+
+class AXP192
+{
+public:
+    void begin() {}
+    void ScreenBreath(uint8_t brightness) {}
+    uint16_t GetVbatData() { return 3800; }           // 1.1mV/LSB: 4.18V
+    uint16_t GetIchargeData() { return 0; }           // 0.5mA/LSB
+    uint16_t GetIdischargeData() { return 96; }       // 0.5mA/LSB: 48mA
+    uint16_t GetTempData() { return 1747; }           // 0.1C/LSB from -144.7C: 30C
+    uint8_t GetWarningLeve() { return 0; }
+    uint16_t GetVinData() { return 0; }
+    uint16_t GetIinData() { return 0; }
+    uint16_t GetVusbinData() { return 0; }
+    uint16_t GetIusbinData() { return 0; }
+    uint16_t GetVapsData() { return 3331; }           // 1.4mV/LSB: 4.66V
+    uint32_t GetPowerbatData() { return 0; }
+    uint32_t GetCoulombchargeData() { return 0; }
+    uint32_t GetCoulombdischargeData() { return 0; }
+    void EnableCoulombcounter() {}
+    void DisableCoulombcounter() {}
+    void StopCoulombcounter() {}
+    void ClearCoulombcounter() {}
+    float GetCoulombData() { return 0; }
+};
+
+class RTC
+{
+protected:
+    // what SetTime() moved the clock by, relative to the host's
+    long offsetSeconds = 0;
+
+public:
+    uint8_t Hour = 0, Minute = 0, Second = 0;
+    uint8_t Week = 0, Day = 0, Month = 0;
+    uint16_t Year = 0;
+
+    void begin() {}
+    void GetBm8563Time();
+    void GetTime(RTC_TimeTypeDef *time);
+    void SetTime(RTC_TimeTypeDef *time);
+    void GetData(RTC_DateTypeDef *date);
+    void SetData(RTC_DateTypeDef *date);
+};
+
+class M5StickC
+{
+public:
+    void begin(bool lcdEnable = true, bool powerEnable = true, bool serialEnable = true);
+
+    M5Display Lcd;
+    AXP192 Axp;
+    RTC Rtc;
+};
+
+extern M5StickC M5;
+
+#endif
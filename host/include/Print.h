@@ -0,0 +1,79 @@
+#ifndef __ZW_HOST_PRINT__H__
+#define __ZW_HOST_PRINT__H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include "WString.h"
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+class Print
+{
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size)
+    {
+        size_t n = 0;
+        while (size-- && write(*buffer++))
+            n++;
+        return n;
+    }
+    size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *)buffer, size); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char stackBuf[256];
+        va_list args;
+        va_start(args, format);
+        auto len = vsnprintf(stackBuf, sizeof(stackBuf), format, args);
+        va_end(args);
+
+        if (len < 0)
+            return 0;
+        if ((size_t)len < sizeof(stackBuf))
+            return write((const uint8_t *)stackBuf, len);
+
+        std::string big(len + 1, '\0');
+        va_start(args, format);
+        vsnprintf(&big[0], big.size(), format, args);
+        va_end(args);
+        return write((const uint8_t *)big.data(), len);
+    }
+
+    size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+    size_t print(const char *str) { return write(str); }
+    size_t print(const __FlashStringHelper *str) { return write((const char *)str); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char value, int base = DEC) { return print(String(value, base)); }
+    size_t print(int value, int base = DEC) { return print(String(value, base)); }
+    size_t print(unsigned int value, int base = DEC) { return print(String(value, base)); }
+    size_t print(long value, int base = DEC) { return print(String(value, base)); }
+    size_t print(unsigned long value, int base = DEC) { return print(String(value, base)); }
+    size_t print(long long value, int base = DEC) { return print(String(value, base)); }
+    size_t print(unsigned long long value, int base = DEC) { return print(String(value, base)); }
+    size_t print(double value, int decimals = 2) { return print(String(value, decimals)); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T>
+    size_t println(const T &value)
+    {
+        return print(value) + println();
+    }
+    template <typename T>
+    size_t println(const T &value, int format)
+    {
+        return print(value, format) + println();
+    }
+
+    virtual void flush() {}
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef __ZW_HOST_STREAM__H__
+#define __ZW_HOST_STREAM__H__
+
+#include "Print.h"
+
+unsigned long millis();
+void delay(uint32_t ms);
+
+class Stream : public Print
+{
+protected:
+    unsigned long _timeout = 1000;
+
+    // a byte, or -1 once _timeout passes without one
+    int timedRead()
+    {
+        auto start = millis();
+        do
+        {
+            auto c = read();
+            if (c >= 0)
+                return c;
+            delay(1);
+        } while (millis() - start < _timeout);
+        return -1;
+    }
+
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    unsigned long getTimeout() { return _timeout; }
+
+    size_t readBytes(char *buffer, size_t length)
+    {
+        size_t count = 0;
+        int c;
+        while (count < length && (c = timedRead()) >= 0)
+            buffer[count++] = (char)c;
+        return count;
+    }
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+
+    String readStringUntil(char terminator)
+    {
+        String out;
+        int c;
+        while ((c = timedRead()) >= 0 && c != terminator)
+            out += (char)c;
+        return out;
+    }
+
+    String readString()
+    {
+        String out;
+        int c;
+        while ((c = timedRead()) >= 0)
+            out += (char)c;
+        return out;
+    }
+};
+
+#endif
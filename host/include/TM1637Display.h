@@ -0,0 +1,52 @@
+#ifndef __ZW_HOST_TM1637DISPLAY__H__
+#define __ZW_HOST_TM1637DISPLAY__H__
+
+// avishorp's TM1637 driver, minus the bit-banging: the segments are kept (and with --show,
+// echoed as text) instead
+
+#include <stdint.h>
+
+#define SEG_A 0b00000001
+#define SEG_B 0b00000010
+#define SEG_C 0b00000100
+#define SEG_D 0b00001000
+#define SEG_E 0b00010000
+#define SEG_F 0b00100000
+#define SEG_G 0b01000000
+#define SEG_DP 0b10000000
+
+#define DEFAULT_BIT_DELAY 100
+
+class TM1637Display
+{
+protected:
+    uint8_t m_pinClk;
+    uint8_t m_pinDIO;
+    uint8_t m_brightness = 0;
+    unsigned int m_bitDelay;
+    uint8_t segments[4] = {0};
+
+    void showDots(uint8_t dots, uint8_t *digits);
+    void showNumberBaseEx(int8_t base, uint16_t num, uint8_t dots = 0, bool leading_zero = false,
+                          uint8_t length = 4, uint8_t pos = 0);
+
+public:
+    TM1637Display(uint8_t pinClk, uint8_t pinDIO, unsigned int bitDelay = DEFAULT_BIT_DELAY)
+        : m_pinClk(pinClk), m_pinDIO(pinDIO), m_bitDelay(bitDelay)
+    {
+    }
+
+    void setBrightness(uint8_t brightness, bool on = true) { m_brightness = (brightness & 0x7) | (on ? 0x08 : 0x00); }
+    void setSegments(const uint8_t segments[], uint8_t length = 4, uint8_t pos = 0);
+    void clear();
+    void showNumberDec(int num, bool leading_zero = false, uint8_t length = 4, uint8_t pos = 0);
+    void showNumberDecEx(int num, uint8_t dots = 0, bool leading_zero = false, uint8_t length = 4, uint8_t pos = 0);
+    void showNumberHexEx(uint16_t num, uint8_t dots = 0, bool leading_zero = false, uint8_t length = 4,
+                         uint8_t pos = 0);
+    uint8_t encodeDigit(uint8_t digit);
+
+    // what the four digits show, as text: digits, letters where the segments spell one, '-' and ' '
+    void describe(char *out) const;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef __ZW_HOST_WSTRING__H__
+#define __ZW_HOST_WSTRING__H__
+
+// Arduino's String, over std::string
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <algorithm>
+#include <string>
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *)(s))
+
+class String
+{
+protected:
+    std::string buf;
+
+    static std::string fromInteger(unsigned long long value, unsigned char base, bool negative)
+    {
+        std::string out;
+        do
+        {
+            auto digit = value % base;
+            out.insert(out.begin(), (char)(digit < 10 ? '0' + digit : 'a' + digit - 10));
+            value /= base;
+        } while (value);
+        return negative ? "-" + out : out;
+    }
+
+    static std::string fromSigned(long long value, unsigned char base)
+    {
+        return base == 10 && value < 0 ? fromInteger(-(unsigned long long)value, base, true)
+                                       : fromInteger((unsigned long long)value, base, false);
+    }
+
+    static std::string fromDouble(double value, unsigned char decimals)
+    {
+        char out[64];
+        snprintf(out, sizeof(out), "%.*f", decimals, value);
+        return out;
+    }
+
+public:
+    String(const char *cstr = "") : buf(cstr ? cstr : "") {}
+    String(const __FlashStringHelper *str) : buf((const char *)str) {}
+    explicit String(const std::string &str) : buf(str) {}
+    explicit String(char c) : buf(1, c) {}
+    explicit String(unsigned char value, unsigned char base = 10) : buf(fromInteger(value, base, false)) {}
+    explicit String(int value, unsigned char base = 10) : buf(fromSigned(value, base)) {}
+    explicit String(unsigned int value, unsigned char base = 10) : buf(fromInteger(value, base, false)) {}
+    explicit String(long value, unsigned char base = 10) : buf(fromSigned(value, base)) {}
+    explicit String(unsigned long value, unsigned char base = 10) : buf(fromInteger(value, base, false)) {}
+    explicit String(long long value, unsigned char base = 10) : buf(fromSigned(value, base)) {}
+    explicit String(unsigned long long value, unsigned char base = 10) : buf(fromInteger(value, base, false)) {}
+    explicit String(float value, unsigned char decimals = 2) : buf(fromDouble(value, decimals)) {}
+    explicit String(double value, unsigned char decimals = 2) : buf(fromDouble(value, decimals)) {}
+
+    unsigned char reserve(unsigned int size)
+    {
+        buf.reserve(size);
+        return 1;
+    }
+
+    unsigned int length() const { return buf.size(); }
+    const char *c_str() const { return buf.c_str(); }
+    char *begin() { return &buf[0]; }
+    char *end() { return &buf[0] + buf.size(); }
+
+    unsigned char concat(const String &str) { return buf += str.buf, 1; }
+    unsigned char concat(const char *cstr) { return cstr ? (buf += cstr, 1) : 0; }
+    unsigned char concat(const char *cstr, unsigned int length) { return cstr ? (buf.append(cstr, length), 1) : 0; }
+    unsigned char concat(char c) { return buf += c, 1; }
+    unsigned char concat(unsigned char value) { return concat(String(value)); }
+    unsigned char concat(int value) { return concat(String(value)); }
+    unsigned char concat(unsigned int value) { return concat(String(value)); }
+    unsigned char concat(long value) { return concat(String(value)); }
+    unsigned char concat(unsigned long value) { return concat(String(value)); }
+    unsigned char concat(long long value) { return concat(String(value)); }
+    unsigned char concat(unsigned long long value) { return concat(String(value)); }
+    unsigned char concat(float value) { return concat(String(value)); }
+    unsigned char concat(double value) { return concat(String(value)); }
+
+    template <typename T>
+    String &operator+=(const T &rhs)
+    {
+        concat(rhs);
+        return *this;
+    }
+
+    // the operator bool idiom Arduino uses, so "if (str)" tests for non-empty
+    typedef void (String::*StringIfHelperType)() const;
+    void StringIfHelper() const {}
+    operator StringIfHelperType() const { return buf.empty() ? 0 : &String::StringIfHelper; }
+
+    int compareTo(const String &s) const { return buf.compare(s.buf); }
+    unsigned char equals(const String &s) const { return buf == s.buf; }
+    unsigned char equals(const char *cstr) const { return buf == (cstr ? cstr : ""); }
+    unsigned char equalsIgnoreCase(const String &s) const { return !strcasecmp(c_str(), s.c_str()); }
+    unsigned char operator==(const String &rhs) const { return equals(rhs); }
+    unsigned char operator==(const char *cstr) const { return equals(cstr); }
+    unsigned char operator!=(const String &rhs) const { return !equals(rhs); }
+    unsigned char operator!=(const char *cstr) const { return !equals(cstr); }
+    unsigned char operator<(const String &rhs) const { return compareTo(rhs) < 0; }
+    unsigned char operator>(const String &rhs) const { return compareTo(rhs) > 0; }
+    unsigned char operator<=(const String &rhs) const { return compareTo(rhs) <= 0; }
+    unsigned char operator>=(const String &rhs) const { return compareTo(rhs) >= 0; }
+
+    unsigned char startsWith(const String &prefix) const { return startsWith(prefix, 0); }
+    unsigned char startsWith(const String &prefix, unsigned int offset) const
+    {
+        return offset + prefix.buf.size() <= buf.size() && !buf.compare(offset, prefix.buf.size(), prefix.buf);
+    }
+    unsigned char endsWith(const String &suffix) const
+    {
+        return suffix.buf.size() <= buf.size() &&
+               !buf.compare(buf.size() - suffix.buf.size(), suffix.buf.size(), suffix.buf);
+    }
+
+    char charAt(unsigned int index) const { return index < buf.size() ? buf[index] : 0; }
+    void setCharAt(unsigned int index, char c)
+    {
+        if (index < buf.size())
+            buf[index] = c;
+    }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char &operator[](unsigned int index) { return buf[index]; }
+
+    void getBytes(unsigned char *out, unsigned int size, unsigned int index = 0) const
+    {
+        if (!size || !out)
+            return;
+        auto n = index < buf.size() ? std::min((size_t)size - 1, buf.size() - index) : 0;
+        memcpy(out, buf.data() + index, n);
+        out[n] = 0;
+    }
+    void toCharArray(char *out, unsigned int size, unsigned int index = 0) const
+    {
+        getBytes((unsigned char *)out, size, index);
+    }
+
+    int indexOf(char c, unsigned int from = 0) const
+    {
+        auto at = buf.find(c, from);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    int indexOf(const String &str, unsigned int from = 0) const
+    {
+        auto at = buf.find(str.buf, from);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    int lastIndexOf(char c) const { return lastIndexOf(c, buf.size() - 1); }
+    int lastIndexOf(char c, unsigned int from) const
+    {
+        auto at = buf.rfind(c, from);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+    int lastIndexOf(const String &str) const { return lastIndexOf(str, buf.size()); }
+    int lastIndexOf(const String &str, unsigned int from) const
+    {
+        auto at = buf.rfind(str.buf, from);
+        return at == std::string::npos ? -1 : (int)at;
+    }
+
+    String substring(unsigned int from) const { return substring(from, buf.size()); }
+    String substring(unsigned int from, unsigned int to) const
+    {
+        if (from > to)
+            std::swap(from, to);
+        if (from >= buf.size())
+            return String();
+        return String(buf.substr(from, std::min((size_t)to, buf.size()) - from));
+    }
+
+    void replace(char find, char with)
+    {
+        for (auto &c : buf)
+            if (c == find)
+                c = with;
+    }
+    void replace(const String &find, const String &with)
+    {
+        if (find.buf.empty())
+            return;
+        for (size_t at = 0; (at = buf.find(find.buf, at)) != std::string::npos; at += with.buf.size())
+            buf.replace(at, find.buf.size(), with.buf);
+    }
+    void remove(unsigned int index) { remove(index, (unsigned int)-1); }
+    void remove(unsigned int index, unsigned int count)
+    {
+        if (index < buf.size())
+            buf.erase(index, count);
+    }
+    void toLowerCase()
+    {
+        for (auto &c : buf)
+            c = tolower((unsigned char)c);
+    }
+    void toUpperCase()
+    {
+        for (auto &c : buf)
+            c = toupper((unsigned char)c);
+    }
+    void trim()
+    {
+        auto first = buf.find_first_not_of(" \t\r\n\f\v");
+        if (first == std::string::npos)
+            return buf.clear();
+        buf = buf.substr(first, buf.find_last_not_of(" \t\r\n\f\v") - first + 1);
+    }
+
+    long toInt() const { return atol(buf.c_str()); }
+    float toFloat() const { return atof(buf.c_str()); }
+    double toDouble() const { return atof(buf.c_str()); }
+};
+
+template <typename T>
+inline String operator+(const String &lhs, const T &rhs)
+{
+    String out(lhs);
+    out.concat(rhs);
+    return out;
+}
+
+inline String operator+(const char *lhs, const String &rhs)
+{
+    String out(lhs);
+    out.concat(rhs);
+    return out;
+}
+
+#endif
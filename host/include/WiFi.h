@@ -0,0 +1,76 @@
+#ifndef __ZW_HOST_WIFI__H__
+#define __ZW_HOST_WIFI__H__
+
+// "associates" immediately, and reports the host's own addressing for whichever interface
+// holds the default route
+
+#include "Arduino.h"
+#include "IPAddress.h"
+#include "WiFiClient.h"
+
+typedef enum
+{
+    WL_NO_SHIELD = 255,
+    WL_IDLE_STATUS = 0,
+    WL_NO_SSID_AVAIL,
+    WL_SCAN_COMPLETED,
+    WL_CONNECTED,
+    WL_CONNECT_FAILED,
+    WL_CONNECTION_LOST,
+    WL_DISCONNECTED
+} wl_status_t;
+
+typedef enum
+{
+    WIFI_MODE_NULL = 0,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA,
+} wifi_mode_t;
+
+#define WIFI_STA WIFI_MODE_STA
+
+class WiFiClass
+{
+protected:
+    wl_status_t _status = WL_IDLE_STATUS;
+    int32_t _channel = 6;
+    uint8_t _bssid[6] = {0x02, 0x5a, 0x57, 0x00, 0x00, 0x01};
+    String _hostname = "zerowatch";
+
+public:
+    bool mode(wifi_mode_t mode) { return true; }
+    bool enableAP(bool enable) { return true; }
+    bool persistent(bool persistent) { return true; }
+    bool setAutoReconnect(bool autoReconnect) { return true; }
+    bool setHostname(const char *hostname);
+    const char *getHostname() { return _hostname.c_str(); }
+
+    // a static configuration is accepted and ignored: the host's own addressing is reported regardless
+    bool config(IPAddress localIP, IPAddress gateway, IPAddress subnet, IPAddress dns1 = (uint32_t)0,
+                IPAddress dns2 = (uint32_t)0)
+    {
+        return true;
+    }
+
+    wl_status_t begin(const char *ssid, const char *passphrase = NULL, int32_t channel = 0,
+                      const uint8_t *bssid = NULL, bool connect = true);
+    bool disconnect(bool wifiOff = false, bool eraseAp = false);
+    wl_status_t status() { return _status; }
+    bool isConnected() { return _status == WL_CONNECTED; }
+
+    IPAddress localIP();
+    IPAddress subnetMask();
+    IPAddress gatewayIP();
+    IPAddress dnsIP(uint8_t dnsNo = 0);
+    String macAddress();
+    uint8_t *macAddress(uint8_t *mac);
+
+    uint8_t *BSSID() { return _status == WL_CONNECTED ? _bssid : NULL; }
+    int32_t channel() { return _channel; }
+    int8_t RSSI() { return _status == WL_CONNECTED ? -52 : 0; }
+};
+
+extern WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __ZW_HOST_WIFICLIENT__H__
+#define __ZW_HOST_WIFICLIENT__H__
+
+// a plain TCP socket, with the ESP32 core's semantics: read() is non-blocking (-1 with nothing
+// buffered) and connected() notices a peer that has closed
+
+#include "Arduino.h"
+#include "Client.h"
+
+class WiFiClient : public Client
+{
+protected:
+    int sockfd = -1;
+    bool _connected = false;
+    int timeoutMs = 3000;
+
+public:
+    WiFiClient() {}
+    ~WiFiClient() { stop(); }
+
+    WiFiClient(const WiFiClient &) = delete;
+    WiFiClient &operator=(const WiFiClient &) = delete;
+
+    int connect(IPAddress ip, uint16_t port) { return connect(ip, port, timeoutMs); }
+    int connect(IPAddress ip, uint16_t port, int32_t timeout);
+    int connect(const char *host, uint16_t port) { return connect(host, port, timeoutMs); }
+    int connect(const char *host, uint16_t port, int32_t timeout);
+
+    size_t write(uint8_t data) { return write(&data, 1); }
+    size_t write(const uint8_t *buf, size_t size);
+    using Print::write;
+
+    int available();
+    int read();
+    int read(uint8_t *buf, size_t size);
+    int peek();
+    void flush() {}
+    void stop();
+    uint8_t connected();
+
+    operator bool() { return connected(); }
+
+    int fd() const { return sockfd; }
+    int setNoDelay(bool nodelay);
+    IPAddress remoteIP() const;
+    uint16_t remotePort() const;
+};
+
+#endif
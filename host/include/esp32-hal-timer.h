@@ -0,0 +1,19 @@
+#ifndef __ZW_HOST_ESP32_HAL_TIMER__H__
+#define __ZW_HOST_ESP32_HAL_TIMER__H__
+
+// the hardware timers, counting APB_CLK (80MHz) through the divider; their interrupts are
+// delivered on the main thread between calls to loop()
+
+#include <stdint.h>
+
+typedef struct hw_timer_s hw_timer_t;
+
+hw_timer_t *timerBegin(uint8_t num, uint16_t divider, bool countUp);
+void timerEnd(hw_timer_t *timer);
+void timerAttachInterrupt(hw_timer_t *timer, void (*fn)(void), bool edge);
+void timerDetachInterrupt(hw_timer_t *timer);
+void timerAlarmWrite(hw_timer_t *timer, uint64_t alarmValue, bool autoreload);
+void timerAlarmEnable(hw_timer_t *timer);
+void timerAlarmDisable(hw_timer_t *timer);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef __ZW_HOST_ESP_OTA_OPS__H__
+#define __ZW_HOST_ESP_OTA_OPS__H__
+
+// the running slot is kept in the state directory's otadata; an image "booted" from the other
+// slot only changes what ESP.getSketchMD5() reports, as the host binary itself keeps running
+
+#include "esp_partition.h"
+
+#define ESP_ERR_OTA_BASE 0x1500
+#define ESP_ERR_OTA_VALIDATE_FAILED (ESP_ERR_OTA_BASE + 0x03)
+
+const esp_partition_t *esp_ota_get_running_partition();
+const esp_partition_t *esp_ota_get_boot_partition();
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *startFrom);
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef __ZW_HOST_ESP_PARTITION__H__
+#define __ZW_HOST_ESP_PARTITION__H__
+
+// partitions of the simulated flash (the state directory's flash.bin), laid out as partitions.csv
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_system.h"
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+typedef enum
+{
+    ESP_PARTITION_TYPE_APP = 0x00,
+    ESP_PARTITION_TYPE_DATA = 0x01,
+} esp_partition_type_t;
+
+typedef enum
+{
+    ESP_PARTITION_SUBTYPE_APP_FACTORY = 0x00,
+    ESP_PARTITION_SUBTYPE_APP_OTA_MIN = 0x10,
+    ESP_PARTITION_SUBTYPE_APP_OTA_0 = ESP_PARTITION_SUBTYPE_APP_OTA_MIN + 0,
+    ESP_PARTITION_SUBTYPE_APP_OTA_1 = ESP_PARTITION_SUBTYPE_APP_OTA_MIN + 1,
+    ESP_PARTITION_SUBTYPE_DATA_OTA = 0x00,
+    ESP_PARTITION_SUBTYPE_DATA_NVS = 0x02,
+    ESP_PARTITION_SUBTYPE_DATA_SPIFFS = 0x82,
+    ESP_PARTITION_SUBTYPE_ANY = 0xff,
+} esp_partition_subtype_t;
+
+typedef struct
+{
+    esp_partition_type_t type;
+    esp_partition_subtype_t subtype;
+    uint32_t address;
+    uint32_t size;
+    char label[17];
+    bool encrypted;
+} esp_partition_t;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t srcOffset, void *dst, size_t size);
+// NOR semantics, as the chip: writes can only clear bits, so unerased regions read back garbage
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dstOffset, const void *src, size_t size);
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t startAddr, size_t size);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef __ZW_HOST_ESP_TIMER__H__
+#define __ZW_HOST_ESP_TIMER__H__
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __ZW_HOST_FREERTOS__H__
+#define __ZW_HOST_FREERTOS__H__
+
+// FreeRTOS over pthreads: tasks are threads, queues and semaphores are a mutex and condition
+// variable; priorities, stack sizes and core affinity are accepted and ignored
+
+#include <stdint.h>
+#include <pthread.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct zwHostTask *TaskHandle_t;
+typedef struct zwHostQueue *QueueHandle_t;
+typedef struct zwHostQueue *SemaphoreHandle_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL 0
+#define pdPASS 1
+#define errQUEUE_FULL 0
+#define errQUEUE_EMPTY 0
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms) * configTICK_RATE_HZ / 1000)
+#define tskNO_AFFINITY 0x7fffffff
+#define tskIDLE_PRIORITY 0
+
+// portENTER_CRITICAL() disables interrupts on the device; here the "interrupts" (timer
+// callbacks) run on the main thread, so a recursive mutex is all it needs to be
+typedef struct
+{
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP}
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(&(mux)->mutex)
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux) portEXIT_CRITICAL(mux)
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *created, BaseType_t coreId);
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *param,
+                       UBaseType_t priority, TaskHandle_t *created);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+void vQueueDelete(QueueHandle_t queue);
+
+#define xQueueSendToBack(queue, item, wait) xQueueSend(queue, item, wait)
+
+SemaphoreHandle_t xSemaphoreCreateBinary();
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+#endif
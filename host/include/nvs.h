@@ -0,0 +1,36 @@
+#ifndef __ZW_HOST_NVS__H__
+#define __ZW_HOST_NVS__H__
+
+// NVS as a file per key, under the state directory's nvs/<namespace>/; blobs only
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_system.h"
+
+#define ESP_ERR_NVS_BASE 0x1100
+#define ESP_ERR_NVS_NOT_INITIALIZED (ESP_ERR_NVS_BASE + 0x01)
+#define ESP_ERR_NVS_NOT_FOUND (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_READ_ONLY (ESP_ERR_NVS_BASE + 0x04)
+#define ESP_ERR_NVS_INVALID_HANDLE (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_INVALID_NAME (ESP_ERR_NVS_BASE + 0x09)
+#define ESP_ERR_NVS_INVALID_LENGTH (ESP_ERR_NVS_BASE + 0x0c)
+
+#define NVS_KEY_NAME_MAX_SIZE 16
+
+typedef uint32_t nvs_handle;
+
+typedef enum
+{
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode openMode, nvs_handle *outHandle);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *outValue, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key);
+esp_err_t nvs_erase_all(nvs_handle handle);
+esp_err_t nvs_commit(nvs_handle handle);
+void nvs_close(nvs_handle handle);
+
+#endif
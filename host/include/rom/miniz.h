@@ -0,0 +1,7 @@
+#ifndef __ZW_HOST_ROM_MINIZ__H__
+#define __ZW_HOST_ROM_MINIZ__H__
+
+// the ESP32's ROM carries miniz's inflater; on the host it's miniz itself (MINIZ_DIR in host/Makefile)
+#include <miniz.h>
+
+#endif
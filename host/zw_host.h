@@ -0,0 +1,64 @@
+#ifndef __ZW_HOST__H__
+#define __ZW_HOST__H__
+
+// The POSIX host build (see host/Makefile): the firmware's own setup() and loop() run as a
+// Linux process, with Arduino & ESP-IDF replaced by the thin layer in host/include and the
+// zw_host_*.cpp files behind it. Everything the unit keeps in flash, NVS, EEPROM or RTC memory
+// lives in files under the state directory.
+
+#include <stdint.h>
+#include <string>
+
+// the ESP32's usable heap, which ESP.getFreeHeap() and friends report against
+#define ZW_HOST_HEAP_SIZE (320 * 1024)
+#define ZW_HOST_FLASH_SIZE (4 * 1024 * 1024)
+#define ZW_HOST_STATE_DIR ".zw-host"
+
+struct ZWHostConfig
+{
+    std::string stateDir;
+    // skips idle time: delays and the wait for the next timer interrupt advance the
+    // clock rather than sleeping, so a day of refreshes runs back-to-back
+    bool fast;
+    // mirrors the LCD's text and the segment displays to stdout
+    bool show;
+    // exits once this many simulated seconds have passed, across restarts; 0 runs forever
+    uint64_t runSeconds;
+    // runs the microbenchmarks (zw_bench.h) instead of the firmware, just those starting with benchOnly
+    bool bench;
+    std::string benchOnly;
+    // where to write the metrics (zw_metrics.h) and heap attribution (zw_heap.h) as JSON on
+    // exiting at runSeconds, e.g. to compare firmware versions replaying one capture
+    std::string metricsPath;
+};
+
+extern ZWHostConfig gHostConfig;
+
+// a file under the state directory
+std::string zwHostPath(const char *name);
+
+// microseconds since this "boot", on the simulated clock
+uint64_t zwHostMicros();
+
+// microseconds since the first boot, across restarts and deep sleeps
+uint64_t zwHostElapsed();
+
+// moves the simulated clock forward without sleeping
+void zwHostAdvance(uint64_t us);
+
+// fires every due timer interrupt; returns the microseconds until the next one is due
+uint64_t zwHostRunTimers();
+
+// re-executes the process as the unit would come back from reset, keeping RTC memory
+// (RTC_DATA_ATTR) only across deep sleep and RTC_NOINIT_ATTR memory across any reset
+void zwHostRestart(int resetReason, uint64_t sleptUs);
+
+// what the last restart was, as an esp_reset_reason_t
+int zwHostResetReason();
+
+// called by __haltOrCatchFire(): nothing on the host will ever wake a halted unit
+void zwHostHalt();
+
+void zwHostStorageBegin();
+
+#endif
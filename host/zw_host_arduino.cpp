@@ -0,0 +1,277 @@
+// The simulated clock, the hardware timers and the rest of the Arduino core: Serial, ESP,
+// GPIO and the ESP-IDF sleep & reset calls.
+
+#include <Arduino.h>
+#include <malloc.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include "zw_host.h"
+
+#define ZW_HOST_TIMERS 4
+// the timers count APB_CLK through their divider
+#define ZW_HOST_APB_MHZ 80
+// with no timer running, how long the main loop waits (or in fast mode, skips) between passes
+#define ZW_HOST_IDLE_US 1000
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static uint64_t __monotonicUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t __bootUs = __monotonicUs();
+// how far ahead of real time the simulated clock runs, from fast-mode skips
+static std::atomic<uint64_t> __skippedUs(0);
+
+uint64_t zwHostMicros()
+{
+    return __monotonicUs() - __bootUs + __skippedUs;
+}
+
+void zwHostAdvance(uint64_t us)
+{
+    __skippedUs += us;
+}
+
+unsigned long micros()
+{
+    return (unsigned long)(uint32_t)zwHostMicros();
+}
+
+unsigned long millis()
+{
+    return (unsigned long)(uint32_t)(zwHostMicros() / 1000);
+}
+
+int64_t esp_timer_get_time()
+{
+    return zwHostMicros();
+}
+
+void delayMicroseconds(uint32_t us)
+{
+    usleep(us);
+}
+
+// in fast mode a delay still gives up the CPU for a millisecond, so that whatever it's waiting
+// on (another task, or the network) gets to run, but the rest of it is skipped
+void delay(uint32_t ms)
+{
+    if (!gHostConfig.fast || ms <= 1)
+    {
+        usleep(ms * 1000);
+        return;
+    }
+
+    usleep(1000);
+    zwHostAdvance((ms - 1) * 1000ULL);
+}
+
+void yield()
+{
+    sched_yield();
+}
+
+// buttons read as released (pulled up) and nothing is driven
+void pinMode(uint8_t pin, uint8_t mode) {}
+void digitalWrite(uint8_t pin, uint8_t val) {}
+
+int digitalRead(uint8_t pin)
+{
+    return HIGH;
+}
+
+struct hw_timer_s
+{
+    bool used;
+    bool enabled;
+    bool autoreload;
+    uint16_t divider;
+    uint64_t alarm;
+    void (*fn)(void);
+    uint64_t due;
+};
+
+static hw_timer_s __timers[ZW_HOST_TIMERS];
+
+static uint64_t __timerPeriodUs(const hw_timer_t *timer)
+{
+    return max((uint64_t)1, timer->alarm * timer->divider / ZW_HOST_APB_MHZ);
+}
+
+hw_timer_t *timerBegin(uint8_t num, uint16_t divider, bool countUp)
+{
+    if (num >= ZW_HOST_TIMERS)
+        return NULL;
+
+    auto timer = &__timers[num];
+    bzero(timer, sizeof(*timer));
+    timer->used = true;
+    timer->divider = divider ? divider : 1;
+    return timer;
+}
+
+void timerEnd(hw_timer_t *timer)
+{
+    if (timer)
+        bzero(timer, sizeof(*timer));
+}
+
+void timerAttachInterrupt(hw_timer_t *timer, void (*fn)(void), bool edge)
+{
+    timer->fn = fn;
+}
+
+void timerDetachInterrupt(hw_timer_t *timer)
+{
+    timer->fn = NULL;
+}
+
+void timerAlarmWrite(hw_timer_t *timer, uint64_t alarmValue, bool autoreload)
+{
+    timer->alarm = alarmValue;
+    timer->autoreload = autoreload;
+}
+
+void timerAlarmEnable(hw_timer_t *timer)
+{
+    timer->enabled = true;
+    timer->due = zwHostMicros() + __timerPeriodUs(timer);
+}
+
+void timerAlarmDisable(hw_timer_t *timer)
+{
+    timer->enabled = false;
+}
+
+uint64_t zwHostRunTimers()
+{
+    auto now = zwHostMicros();
+    auto next = UINT64_MAX;
+
+    for (auto &timer : __timers)
+    {
+        if (!timer.used || !timer.enabled)
+            continue;
+
+        // one interrupt per period elapsed, as the hardware would have raised them
+        while (timer.enabled && timer.due <= now)
+        {
+            if (timer.fn)
+                timer.fn();
+
+            if (timer.autoreload)
+                timer.due += __timerPeriodUs(&timer);
+            else
+                timer.enabled = false;
+        }
+
+        if (timer.enabled)
+            next = min(next, timer.due - now);
+    }
+
+    return next == UINT64_MAX ? ZW_HOST_IDLE_US : next;
+}
+
+esp_reset_reason_t esp_reset_reason()
+{
+    return (esp_reset_reason_t)zwHostResetReason();
+}
+
+void esp_restart()
+{
+    zwHostRestart(ESP_RST_SW, 0);
+    abort();
+}
+
+static uint64_t __sleepUs = 0;
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t timeInUs)
+{
+    __sleepUs = timeInUs;
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start()
+{
+    zwHostRestart(ESP_RST_DEEPSLEEP, __sleepUs);
+    abort();
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause()
+{
+    return zwHostResetReason() == ESP_RST_DEEPSLEEP ? ESP_SLEEP_WAKEUP_TIMER : ESP_SLEEP_WAKEUP_UNDEFINED;
+}
+
+void EspClass::restart()
+{
+    esp_restart();
+}
+
+// the heap is the ESP32's, less whatever this process has allocated since it started
+static size_t __heapInUse()
+{
+    static auto baseline = mallinfo2().uordblks;
+    auto used = mallinfo2().uordblks;
+    return used > baseline ? used - baseline : 0;
+}
+
+static std::atomic<uint32_t> __minFreeHeap(ZW_HOST_HEAP_SIZE);
+
+uint32_t EspClass::getHeapSize()
+{
+    return ZW_HOST_HEAP_SIZE;
+}
+
+uint32_t EspClass::getFreeHeap()
+{
+    auto used = __heapInUse();
+    uint32_t free = used < ZW_HOST_HEAP_SIZE ? ZW_HOST_HEAP_SIZE - used : 0;
+
+    auto low = __minFreeHeap.load();
+    while (free < low && !__minFreeHeap.compare_exchange_weak(low, free))
+        ;
+    return free;
+}
+
+uint32_t EspClass::getMinFreeHeap()
+{
+    getFreeHeap();
+    return __minFreeHeap;
+}
+
+// glibc doesn't fragment the way the ESP32's heap does, so this is only the free heap, capped
+// at the largest block the ESP32 could ever hand out
+uint32_t EspClass::getMaxAllocHeap()
+{
+    return min(getFreeHeap(), (uint32_t)(ZW_HOST_HEAP_SIZE / 2));
+}
+
+uint32_t EspClass::getCycleCount()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 240000000 + ts.tv_nsec * 240 / 1000);
+}
+
+// a locally-administered MAC derived from the hostname, stable across runs
+uint64_t EspClass::getEfuseMac()
+{
+    char name[64] = {0};
+    gethostname(name, sizeof(name) - 1);
+
+    uint64_t mac = 0x02;
+    for (auto walk = name; *walk; walk++)
+        mac = mac * 31 + (uint8_t)*walk;
+    return (mac & 0xffffffffff00ULL) | 0x02;
+}
+
+uint32_t EspClass::getFlashChipSize()
+{
+    return ZW_HOST_FLASH_SIZE;
+}
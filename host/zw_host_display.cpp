@@ -0,0 +1,308 @@
+// The M5StickC's LCD, AXP192 and RTC and the TM1637 segment displays: drawn into memory, and
+// with --show echoed to stdout as text ("[lcd] ..." per changed line, "[tm1637 CLK/DIO] ..." per update).
+
+#include <Arduino.h>
+#include <M5StickC.h>
+#include <TM1637Display.h>
+#include <time.h>
+#include "zw_host.h"
+
+M5StickC M5;
+
+void M5StickC::begin(bool lcdEnable, bool powerEnable, bool serialEnable)
+{
+    if (serialEnable)
+        Serial.begin(115200);
+    if (powerEnable)
+        Axp.begin();
+    if (lcdEnable)
+        Lcd.begin();
+    Rtc.begin();
+}
+
+void M5Display::begin()
+{
+    rotation = 0;
+    cursorX = cursorY = 0;
+    line = "";
+    fillScreen(BLACK);
+}
+
+// TFT_eSPI's built-in fonts 1, 2 and 4
+int16_t M5Display::fontHeight() const
+{
+    return font == 4 ? 26 : font == 2 ? 16 : 8;
+}
+
+void M5Display::fillRect(int32_t x, int32_t y, int32_t w, int32_t h, uint32_t color)
+{
+    auto x1 = min(x + w, (int32_t)width()), y1 = min(y + h, (int32_t)height());
+    for (auto row = max(y, 0); row < y1; row++)
+        for (auto col = max(x, 0); col < x1; col++)
+            drawPixel(col, row, color);
+}
+
+void M5Display::fillScreen(uint32_t color)
+{
+    shownRows.clear();
+    for (auto &pixel : fb)
+        pixel = color;
+}
+
+void M5Display::drawPixel(int32_t x, int32_t y, uint32_t color)
+{
+    if (x < 0 || y < 0 || x >= width() || y >= height())
+        return;
+
+    // the panel's own orientation, whatever the rotation
+    int32_t px = x, py = y;
+    switch (rotation)
+    {
+    case 1:
+        px = TFT_WIDTH - 1 - y, py = x;
+        break;
+    case 2:
+        px = TFT_WIDTH - 1 - x, py = TFT_HEIGHT - 1 - y;
+        break;
+    case 3:
+        px = y, py = TFT_HEIGHT - 1 - x;
+        break;
+    }
+
+    fb[py * TFT_WIDTH + px] = color;
+}
+
+void M5Display::drawLine(int32_t x0, int32_t y0, int32_t x1, int32_t y1, uint32_t color)
+{
+    int32_t dx = abs(x1 - x0), dy = -abs(y1 - y0);
+    int32_t sx = x0 < x1 ? 1 : -1, sy = y0 < y1 ? 1 : -1;
+    int32_t err = dx + dy;
+
+    while (true)
+    {
+        drawPixel(x0, y0, color);
+        if (x0 == x1 && y0 == y1)
+            break;
+
+        auto e2 = 2 * err;
+        if (e2 >= dy)
+            err += dy, x0 += sx;
+        if (e2 <= dx)
+            err += dx, y0 += sy;
+    }
+}
+
+// glyphs aren't rendered, only their cells filled, which is about what drawing them costs
+size_t M5Display::write(uint8_t c)
+{
+    auto h = fontHeight();
+
+    if (c == '\n')
+    {
+        auto &shown = shownRows[cursorY];
+        if (gHostConfig.show && shown != line.c_str())
+            ::printf("[lcd] %s\n", line.c_str());
+        shown = line.c_str();
+        line = "";
+        cursorX = 0;
+        cursorY += h;
+        return 1;
+    }
+
+    if (c == '\r')
+        return 1;
+
+    auto w = h / 2 + 1;
+    if (cursorX + w > width())
+    {
+        cursorX = 0;
+        cursorY += h;
+    }
+
+    fillRect(cursorX, cursorY, w, h, textBgColor);
+    cursorX += w;
+    line += (char)c;
+    return 1;
+}
+
+// the BM8563 has no time zone: it holds whatever it was set to, which the firmware keeps as UTC
+static void __rtcNow(long offsetSeconds, struct tm *out)
+{
+    auto now = time(NULL) + offsetSeconds;
+    gmtime_r(&now, out);
+}
+
+void RTC::GetBm8563Time()
+{
+    struct tm now;
+    __rtcNow(offsetSeconds, &now);
+    Hour = now.tm_hour, Minute = now.tm_min, Second = now.tm_sec;
+    Week = now.tm_wday, Day = now.tm_mday, Month = now.tm_mon + 1, Year = now.tm_year + 1900;
+}
+
+void RTC::GetTime(RTC_TimeTypeDef *out)
+{
+    GetBm8563Time();
+    out->Hours = Hour, out->Minutes = Minute, out->Seconds = Second;
+}
+
+void RTC::SetTime(RTC_TimeTypeDef *in)
+{
+    // keeps the date it has
+    struct tm now;
+    __rtcNow(offsetSeconds, &now);
+    offsetSeconds += ((long)in->Hours - now.tm_hour) * 3600 + ((long)in->Minutes - now.tm_min) * 60 +
+                     ((long)in->Seconds - now.tm_sec);
+}
+
+void RTC::SetData(RTC_DateTypeDef *in)
+{
+    // keeps the time of day it has
+    struct tm now, date = {};
+    __rtcNow(offsetSeconds, &now);
+    date.tm_year = in->Year - 1900, date.tm_mon = in->Month - 1, date.tm_mday = in->Date;
+    now.tm_hour = now.tm_min = now.tm_sec = 0;
+    offsetSeconds += (long)(timegm(&date) - timegm(&now));
+}
+
+void RTC::GetData(RTC_DateTypeDef *out)
+{
+    GetBm8563Time();
+    out->WeekDay = Week, out->Month = Month, out->Date = Day, out->Year = Year;
+}
+
+//
+//      A
+//     ---
+//  F |   | B
+//     -G-
+//  E |   | C
+//     ---
+//      D
+static const uint8_t __digitToSegment[] = {
+    0b00111111, 0b00000110, 0b01011011, 0b01001111, 0b01100110, 0b01101101, 0b01111101, 0b00000111,
+    0b01111111, 0b01101111, 0b01110111, 0b01111100, 0b00111001, 0b01011110, 0b01111001, 0b01110001};
+
+static const uint8_t __minusSegments = SEG_G;
+
+void TM1637Display::setSegments(const uint8_t segs[], uint8_t length, uint8_t pos)
+{
+    for (uint8_t i = 0; i < length && pos + i < 4; i++)
+        segments[pos + i] = segs[i];
+
+    if (!gHostConfig.show)
+        return;
+
+    char text[16];
+    describe(text);
+    printf("[tm1637 %u/%u] %s\n", m_pinClk, m_pinDIO, text);
+}
+
+void TM1637Display::clear()
+{
+    uint8_t data[] = {0, 0, 0, 0};
+    setSegments(data);
+}
+
+void TM1637Display::showNumberDec(int num, bool leading_zero, uint8_t length, uint8_t pos)
+{
+    showNumberDecEx(num, 0, leading_zero, length, pos);
+}
+
+void TM1637Display::showNumberDecEx(int num, uint8_t dots, bool leading_zero, uint8_t length, uint8_t pos)
+{
+    showNumberBaseEx(num < 0 ? -10 : 10, num < 0 ? -num : num, dots, leading_zero, length, pos);
+}
+
+void TM1637Display::showNumberHexEx(uint16_t num, uint8_t dots, bool leading_zero, uint8_t length, uint8_t pos)
+{
+    showNumberBaseEx(16, num, dots, leading_zero, length, pos);
+}
+
+// as the library's, down to the number being truncated to 16 bits
+void TM1637Display::showNumberBaseEx(int8_t base, uint16_t num, uint8_t dots, bool leading_zero, uint8_t length,
+                                     uint8_t pos)
+{
+    bool negative = false;
+    if (base < 0)
+    {
+        base = -base;
+        negative = true;
+    }
+
+    uint8_t digits[4];
+
+    if (num == 0 && !leading_zero)
+    {
+        for (uint8_t i = 0; i < (length - 1); i++)
+            digits[i] = 0;
+        digits[length - 1] = encodeDigit(0);
+    }
+    else
+    {
+        for (int i = length - 1; i >= 0; --i)
+        {
+            uint8_t digit = num % base;
+
+            if (digit == 0 && num == 0 && leading_zero == false)
+                digits[i] = 0;
+            else
+                digits[i] = encodeDigit(digit);
+
+            if (digit == 0 && num == 0 && negative)
+            {
+                digits[i] = __minusSegments;
+                negative = false;
+            }
+
+            num /= base;
+        }
+
+        if (dots != 0)
+            showDots(dots, digits);
+    }
+
+    setSegments(digits, length, pos);
+}
+
+void TM1637Display::showDots(uint8_t dots, uint8_t *digits)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        digits[i] |= (dots & 0x80);
+        dots <<= 1;
+    }
+}
+
+uint8_t TM1637Display::encodeDigit(uint8_t digit)
+{
+    return __digitToSegment[digit & 0x0f];
+}
+
+void TM1637Display::describe(char *out) const
+{
+    static const char hex[] = "0123456789AbCdEF";
+
+    for (auto seg : segments)
+    {
+        auto glyph = seg & ~SEG_DP;
+        char c = '?';
+
+        if (!glyph)
+            c = ' ';
+        else if (glyph == __minusSegments)
+            c = '-';
+        else if (glyph == (SEG_A | SEG_B | SEG_F | SEG_G))
+            c = '*'; // a degree sign
+        else
+            for (int i = 0; i < 16; i++)
+                if (glyph == __digitToSegment[i])
+                    c = hex[i];
+
+        *out++ = c;
+        if (seg & SEG_DP)
+            *out++ = '.';
+    }
+
+    *out = 0;
+}
@@ -0,0 +1,203 @@
+// FreeRTOS tasks, queues and semaphores over pthreads. Timed waits are in real time, even in
+// fast mode: they're waits on another task, which runs in real time too.
+
+#include <Arduino.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+struct zwHostTask
+{
+    TaskFunction_t code;
+    void *param;
+    pthread_t thread;
+};
+
+// a semaphore is a queue of zero-size items: a binary semaphore starts empty, a mutex full
+struct zwHostQueue
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t itemSize;
+    UBaseType_t count;
+    UBaseType_t head;
+    std::vector<uint8_t> items;
+};
+
+static void *__taskMain(void *arg)
+{
+    auto task = (zwHostTask *)arg;
+    task->code(task->param);
+    // a FreeRTOS task mustn't return, but if it did it would be as good as deleted
+    delete task;
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stackDepth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *created, BaseType_t coreId)
+{
+    auto task = new zwHostTask{code, param, 0};
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    // the host's stacks need more room than the ESP32's for the same code, but not much more
+    pthread_attr_setstacksize(&attr, max((size_t)PTHREAD_STACK_MIN, (size_t)stackDepth * 4));
+
+    auto err = pthread_create(&task->thread, &attr, __taskMain, task);
+    pthread_attr_destroy(&attr);
+
+    if (err)
+    {
+        delete task;
+        return pdFAIL;
+    }
+
+    pthread_setname_np(task->thread, name);
+    if (created)
+        *created = task;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stackDepth, void *param,
+                       UBaseType_t priority, TaskHandle_t *created)
+{
+    return xTaskCreatePinnedToCore(code, name, stackDepth, param, priority, created, tskNO_AFFINITY);
+}
+
+// only a task deleting itself, which is all the firmware does; its zwHostTask is left behind
+void vTaskDelete(TaskHandle_t task)
+{
+    if (!task)
+        pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep(ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount()
+{
+    return millis() / portTICK_PERIOD_MS;
+}
+
+static zwHostQueue *__queueCreate(UBaseType_t length, UBaseType_t itemSize, UBaseType_t initialCount)
+{
+    auto queue = new zwHostQueue();
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->length = length;
+    queue->itemSize = itemSize;
+    queue->count = initialCount;
+    queue->items.resize(length * itemSize);
+    return queue;
+}
+
+// waits on the queue's condition until ready() holds or the wait expires; mutex held throughout
+template <typename Ready>
+static bool __queueWait(zwHostQueue *queue, TickType_t wait, Ready ready)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    auto deadlineNs = deadline.tv_nsec + (uint64_t)wait * portTICK_PERIOD_MS * 1000000;
+    deadline.tv_sec += deadlineNs / 1000000000;
+    deadline.tv_nsec = deadlineNs % 1000000000;
+
+    while (!ready())
+    {
+        if (!wait)
+            return false;
+
+        if (wait == portMAX_DELAY)
+            pthread_cond_wait(&queue->changed, &queue->mutex);
+        else if (pthread_cond_timedwait(&queue->changed, &queue->mutex, &deadline) == ETIMEDOUT)
+            return ready();
+    }
+
+    return true;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize)
+{
+    return length ? __queueCreate(length, itemSize, 0) : NULL;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait)
+{
+    pthread_mutex_lock(&queue->mutex);
+
+    auto sent = __queueWait(queue, wait, [queue]() { return queue->count < queue->length; });
+    if (sent)
+    {
+        auto slot = (queue->head + queue->count++) % queue->length;
+        if (queue->itemSize)
+            memcpy(&queue->items[slot * queue->itemSize], item, queue->itemSize);
+        pthread_cond_broadcast(&queue->changed);
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+    return sent ? pdPASS : errQUEUE_FULL;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait)
+{
+    pthread_mutex_lock(&queue->mutex);
+
+    auto received = __queueWait(queue, wait, [queue]() { return queue->count > 0; });
+    if (received)
+    {
+        if (queue->itemSize)
+            memcpy(item, &queue->items[queue->head * queue->itemSize], queue->itemSize);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+    return received ? pdPASS : errQUEUE_EMPTY;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    auto count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    if (!queue)
+        return;
+
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->mutex);
+    delete queue;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return __queueCreate(1, 0, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return __queueCreate(1, 0, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait)
+{
+    return xQueueReceive(sem, NULL, wait);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    return xQueueSend(sem, NULL, 0);
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    vQueueDelete(sem);
+}
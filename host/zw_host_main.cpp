@@ -0,0 +1,247 @@
+// The host build's entry point: parses the options, restores whatever the last restart kept
+// and runs the sketch's setup() and loop(), delivering timer interrupts between passes.
+
+#include <Arduino.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include "zw_host.h"
+#include "zw_bench.h"
+#include "zw_metrics.h"
+#include "zw_heap.h"
+
+// the sketch's
+void setup();
+void loop();
+
+#define ZW_HOST_ENV_RESET "ZW_HOST_RESET"
+#define ZW_HOST_ENV_ELAPSED "ZW_HOST_ELAPSED_US"
+#define ZW_HOST_HALT_STATUS 2
+
+ZWHostConfig gHostConfig = {
+    .stateDir = ZW_HOST_STATE_DIR,
+    .fast = false,
+    .show = false,
+    .runSeconds = 0,
+    .bench = false};
+
+static char **__argv;
+static int __resetReason = ESP_RST_POWERON;
+static uint64_t __elapsedAtBoot = 0;
+
+// bounds of the RTC_DATA_ATTR and RTC_NOINIT_ATTR sections, provided by the linker
+extern uint8_t __start_zw_rtc_data[] __attribute__((weak));
+extern uint8_t __stop_zw_rtc_data[] __attribute__((weak));
+extern uint8_t __start_zw_rtc_noinit[] __attribute__((weak));
+extern uint8_t __stop_zw_rtc_noinit[] __attribute__((weak));
+
+std::string zwHostPath(const char *name)
+{
+    return gHostConfig.stateDir + "/" + name;
+}
+
+uint64_t zwHostElapsed()
+{
+    return __elapsedAtBoot + zwHostMicros();
+}
+
+int zwHostResetReason()
+{
+    return __resetReason;
+}
+
+static void __saveRtcMemory(const char *name, uint8_t *start, uint8_t *stop, bool keep)
+{
+    auto path = zwHostPath(name);
+    size_t size = stop - start;
+
+    if (!keep || !size)
+    {
+        unlink(path.c_str());
+        return;
+    }
+
+    auto f = fopen(path.c_str(), "wb");
+    if (!f || fwrite(start, 1, size, f) != size)
+        fprintf(stderr, "zw-host: WARNING: couldn't save RTC memory to %s\n", path.c_str());
+    if (f)
+        fclose(f);
+}
+
+static void __restoreRtcMemory(const char *name, uint8_t *start, uint8_t *stop)
+{
+    size_t size = stop - start;
+    auto f = fopen(zwHostPath(name).c_str(), "rb");
+    if (!f)
+        return;
+
+    // a build with a different RTC layout starts from its initializers, as a reflashed unit would
+    struct stat st;
+    if (!fstat(fileno(f), &st) && (size_t)st.st_size == size)
+        fread(start, 1, size, f);
+    fclose(f);
+}
+
+static void __writeMetrics()
+{
+    static char metrics[4096], heap[1024];
+    zwMetricsAsJson(metrics, sizeof(metrics), false);
+    zwHeapAsJson(heap, sizeof(heap));
+
+    auto out = fopen(gHostConfig.metricsPath.c_str(), "w");
+    if (!out || fprintf(out, "{ \"metrics\": %s, \"heap\": %s }\n", metrics, heap) < 0 || fclose(out))
+        fprintf(stderr, "zw-host: can't write %s: %s\n", gHostConfig.metricsPath.c_str(), strerror(errno));
+}
+
+static void __checkRunTime(uint64_t elapsed)
+{
+    if (!gHostConfig.runSeconds || elapsed < gHostConfig.runSeconds * 1000000)
+        return;
+
+    if (!gHostConfig.metricsPath.empty())
+        __writeMetrics();
+
+    fflush(stdout);
+    fprintf(stderr, "zw-host: ran for %llu simulated seconds\n", (unsigned long long)gHostConfig.runSeconds);
+    exit(EXIT_SUCCESS);
+}
+
+void zwHostRestart(int resetReason, uint64_t sleptUs)
+{
+    fflush(stdout);
+    __saveRtcMemory("rtc.bin", __start_zw_rtc_data, __stop_zw_rtc_data, resetReason == ESP_RST_DEEPSLEEP);
+    __saveRtcMemory("rtc-noinit.bin", __start_zw_rtc_noinit, __stop_zw_rtc_noinit, true);
+
+    if (!gHostConfig.fast)
+    {
+        for (auto left = sleptUs; left;)
+        {
+            auto chunk = min(left, (uint64_t)1000000);
+            usleep(chunk);
+            left -= chunk;
+        }
+    }
+
+    auto elapsed = zwHostElapsed() + (gHostConfig.fast ? sleptUs : 0);
+    // a unit that deep-sleeps never gets as far as loop(), so the time limit is checked here too
+    __checkRunTime(elapsed);
+
+    setenv(ZW_HOST_ENV_RESET, std::to_string(resetReason).c_str(), 1);
+    setenv(ZW_HOST_ENV_ELAPSED, std::to_string(elapsed).c_str(), 1);
+
+    // every other thread, like the unit's other tasks, is gone once this succeeds
+    execv("/proc/self/exe", __argv);
+    fprintf(stderr, "zw-host: restart failed: %s\n", strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+void zwHostHalt()
+{
+    fflush(stdout);
+    fprintf(stderr, "zw-host: halted\n");
+    exit(ZW_HOST_HALT_STATUS);
+}
+
+static void __usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [--state DIR] [--fast] [--show] [--seconds N] [--metrics FILE] [--bench[=PREFIX]]\n"
+            "  --state DIR    keep flash, NVS, EEPROM and RTC memory under DIR (default " ZW_HOST_STATE_DIR ")\n"
+            "  --fast         skip idle time rather than sleeping through it\n"
+            "  --show         echo the LCD's text and the segment displays to stdout\n"
+            "  --seconds N    exit after N simulated seconds, counted across restarts\n"
+            "  --metrics FILE on exiting after --seconds, write this boot's metrics and heap use to FILE as JSON\n"
+            "  --bench        print the microbenchmarks' results (see zw_bench.h) as JSON and exit,\n"
+            "                 running only those whose names start with PREFIX if given\n",
+            name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        {"state", required_argument, NULL, 'd'},
+        {"fast", no_argument, NULL, 'f'},
+        {"show", no_argument, NULL, 's'},
+        {"seconds", required_argument, NULL, 'n'},
+        {"metrics", required_argument, NULL, 'm'},
+        {"bench", optional_argument, NULL, 'b'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    __argv = argv;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:fsn:h", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            gHostConfig.stateDir = optarg;
+            break;
+        case 'f':
+            gHostConfig.fast = true;
+            break;
+        case 's':
+            gHostConfig.show = true;
+            break;
+        case 'n':
+            gHostConfig.runSeconds = strtoull(optarg, NULL, 10);
+            break;
+        case 'm':
+            gHostConfig.metricsPath = optarg;
+            break;
+        case 'b':
+            gHostConfig.bench = true;
+            gHostConfig.benchOnly = optarg ? optarg : "";
+            break;
+        default:
+            __usage(argv[0]);
+        }
+    }
+
+    if (mkdir(gHostConfig.stateDir.c_str(), 0755) && errno != EEXIST)
+    {
+        fprintf(stderr, "zw-host: can't create %s: %s\n", gHostConfig.stateDir.c_str(), strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (auto reset = getenv(ZW_HOST_ENV_RESET))
+        __resetReason = atoi(reset);
+    if (auto elapsed = getenv(ZW_HOST_ENV_ELAPSED))
+        __elapsedAtBoot = strtoull(elapsed, NULL, 10);
+
+    if (__resetReason == ESP_RST_DEEPSLEEP)
+        __restoreRtcMemory("rtc.bin", __start_zw_rtc_data, __stop_zw_rtc_data);
+    if (__resetReason != ESP_RST_POWERON)
+        __restoreRtcMemory("rtc-noinit.bin", __start_zw_rtc_noinit, __stop_zw_rtc_noinit);
+
+    // line-buffered even into a pipe, so logs interleave sensibly with the other tasks'
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    zwHostStorageBegin();
+
+    // before setup(), so no Redis instance is needed; only "provision.read" needs a provisioned state directory
+    if (gHostConfig.bench)
+    {
+        static char results[ZWBENCH_JSON_MAX];
+        zwBenchRun(results, sizeof(results), gHostConfig.benchOnly.c_str());
+        printf("%s\n", results);
+        return EXIT_SUCCESS;
+    }
+
+    setup();
+
+    while (true)
+    {
+        loop();
+        __checkRunTime(zwHostElapsed());
+
+        auto untilTimer = zwHostRunTimers();
+        if (gHostConfig.fast)
+            zwHostAdvance(untilTimer);
+        else
+            usleep(min(untilTimer, (uint64_t)1000));
+    }
+}
@@ -0,0 +1,477 @@
+// Flash, NVS and EEPROM, all kept under the state directory: flash.bin is the whole 4MB chip
+// (mapped, so the critical-event ring and OTA writes land in it directly), nvs/ holds a file
+// per key and eeprom.bin the EEPROM emulation's bytes.
+//
+// Each fresh start (rather than restart) is treated as the build having just been flashed over
+// serial: the executable is copied into app0, which becomes the running slot, so that
+// ESP.getSketchMD5() and binary delta updates work against the running image as on the unit.
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <esp_ota_ops.h>
+#include <nvs.h>
+#include <mbedtls/md5.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "zw_host.h"
+
+#define ZW_HOST_OTADATA_MAGIC 0x5A57F1A5
+#define ZW_HOST_APP_SLOTS 2
+
+EEPROMClass EEPROM;
+
+// as partitions.csv
+static const esp_partition_t __partitions[] = {
+    {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_NVS, 0x9000, 0x5000, "nvs", false},
+    {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_OTA, 0xe000, 0x2000, "otadata", false},
+    {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_0, 0x10000, 0x140000, "app0", false},
+    {ESP_PARTITION_TYPE_APP, ESP_PARTITION_SUBTYPE_APP_OTA_1, 0x150000, 0x140000, "app1", false},
+    {ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_SPIFFS, 0x290000, 0x160000, "spiffs", false},
+    {ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)0x99, 0x3F0000, 0x10000, "zwcrit", false},
+};
+
+static const esp_partition_t *__appSlots[ZW_HOST_APP_SLOTS] = {&__partitions[2], &__partitions[3]};
+
+// the host's stand-in for the otadata partition, which on the unit also lets the bootloader
+// find each image's length from its header; here that is the extent last written to the slot
+struct ZWHostOtaData
+{
+    uint32_t magic;
+    uint32_t bootSlot;
+    uint32_t imageSize[ZW_HOST_APP_SLOTS];
+};
+
+static uint8_t *__flash;
+static std::mutex __flashMutex;
+static ZWHostOtaData __otaData;
+static uint32_t __runningSlot;
+static uint32_t __writtenExtent[ZW_HOST_APP_SLOTS];
+
+static bool __readFile(const std::string &path, std::vector<uint8_t> &out)
+{
+    auto f = fopen(path.c_str(), "rb");
+    if (!f)
+        return false;
+
+    uint8_t buf[4096];
+    size_t got;
+    out.clear();
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0)
+        out.insert(out.end(), buf, buf + got);
+
+    fclose(f);
+    return true;
+}
+
+// via a rename, so a kill mid-write leaves the old contents rather than half of the new
+static bool __writeFile(const std::string &path, const void *data, size_t len)
+{
+    auto tmp = path + ".tmp";
+    auto f = fopen(tmp.c_str(), "wb");
+    if (!f)
+        return false;
+
+    auto ok = fwrite(data, 1, len, f) == len;
+    ok = !fclose(f) && ok;
+    return ok && !rename(tmp.c_str(), path.c_str());
+}
+
+static void __saveOtaData()
+{
+    if (!__writeFile(zwHostPath("otadata"), &__otaData, sizeof(__otaData)))
+        fprintf(stderr, "zw-host: WARNING: couldn't save otadata\n");
+}
+
+static int __slotOf(const esp_partition_t *partition)
+{
+    for (int i = 0; i < ZW_HOST_APP_SLOTS; i++)
+        if (partition == __appSlots[i])
+            return i;
+    return -1;
+}
+
+static void __flashExecutable()
+{
+    std::vector<uint8_t> image;
+    if (!__readFile("/proc/self/exe", image))
+        return;
+
+    // with debug info it won't fit, but what does is all the sketch MD5 and delta updates need
+    // to agree on
+    auto slot = __appSlots[0];
+    image.resize(min(image.size(), (size_t)slot->size));
+
+    memset(__flash + slot->address, 0xff, slot->size);
+    memcpy(__flash + slot->address, image.data(), image.size());
+
+    __otaData.bootSlot = 0;
+    __otaData.imageSize[0] = image.size();
+    __saveOtaData();
+}
+
+void zwHostStorageBegin()
+{
+    auto path = zwHostPath("flash.bin");
+    auto fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st))
+    {
+        fprintf(stderr, "zw-host: can't open %s: %s\n", path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    auto fresh = st.st_size != ZW_HOST_FLASH_SIZE;
+    if (fresh && ftruncate(fd, ZW_HOST_FLASH_SIZE))
+    {
+        fprintf(stderr, "zw-host: can't size %s: %s\n", path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    __flash = (uint8_t *)mmap(NULL, ZW_HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (__flash == MAP_FAILED)
+    {
+        fprintf(stderr, "zw-host: can't map %s: %s\n", path.c_str(), strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // a new chip reads as erased
+    if (fresh)
+        memset(__flash, 0xff, ZW_HOST_FLASH_SIZE);
+
+    std::vector<uint8_t> otaData;
+    if (__readFile(zwHostPath("otadata"), otaData) && otaData.size() == sizeof(__otaData))
+        memcpy(&__otaData, otaData.data(), sizeof(__otaData));
+
+    if (__otaData.magic != ZW_HOST_OTADATA_MAGIC || __otaData.bootSlot >= ZW_HOST_APP_SLOTS)
+    {
+        bzero(&__otaData, sizeof(__otaData));
+        __otaData.magic = ZW_HOST_OTADATA_MAGIC;
+    }
+
+    if (zwHostResetReason() == ESP_RST_POWERON)
+        __flashExecutable();
+
+    __runningSlot = __otaData.bootSlot;
+
+    if (mkdir(zwHostPath("nvs").c_str(), 0755) && errno != EEXIST)
+        fprintf(stderr, "zw-host: WARNING: can't create %s\n", zwHostPath("nvs").c_str());
+}
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char *label)
+{
+    for (auto &partition : __partitions)
+    {
+        if (partition.type == type &&
+            (subtype == ESP_PARTITION_SUBTYPE_ANY || partition.subtype == subtype) &&
+            (!label || !strcmp(label, partition.label)))
+            return &partition;
+    }
+
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t srcOffset, void *dst, size_t size)
+{
+    if (!partition || !dst)
+        return ESP_ERR_INVALID_ARG;
+    if (srcOffset > partition->size || size > partition->size - srcOffset)
+        return ESP_ERR_INVALID_SIZE;
+
+    std::lock_guard<std::mutex> lock(__flashMutex);
+    memcpy(dst, __flash + partition->address + srcOffset, size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dstOffset, const void *src, size_t size)
+{
+    if (!partition || !src)
+        return ESP_ERR_INVALID_ARG;
+    if (dstOffset > partition->size || size > partition->size - dstOffset)
+        return ESP_ERR_INVALID_SIZE;
+
+    std::lock_guard<std::mutex> lock(__flashMutex);
+    auto to = __flash + partition->address + dstOffset;
+    auto from = (const uint8_t *)src;
+    for (size_t i = 0; i < size; i++)
+        to[i] &= from[i];
+
+    auto slot = __slotOf(partition);
+    if (slot >= 0)
+        __writtenExtent[slot] = max(__writtenExtent[slot], (uint32_t)(dstOffset + size));
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t startAddr, size_t size)
+{
+    if (!partition)
+        return ESP_ERR_INVALID_ARG;
+    if (startAddr % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE)
+        return ESP_ERR_INVALID_SIZE;
+    if (startAddr > partition->size || size > partition->size - startAddr)
+        return ESP_ERR_INVALID_SIZE;
+
+    std::lock_guard<std::mutex> lock(__flashMutex);
+    memset(__flash + partition->address + startAddr, 0xff, size);
+
+    // erasing the start of a slot is the start of a new image in it
+    auto slot = __slotOf(partition);
+    if (slot >= 0 && !startAddr)
+        __writtenExtent[slot] = 0;
+    return ESP_OK;
+}
+
+const esp_partition_t *esp_ota_get_running_partition()
+{
+    return __appSlots[__runningSlot];
+}
+
+const esp_partition_t *esp_ota_get_boot_partition()
+{
+    return __appSlots[__otaData.bootSlot];
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *startFrom)
+{
+    auto slot = __slotOf(startFrom ? startFrom : esp_ota_get_running_partition());
+    return slot >= 0 ? __appSlots[(slot + 1) % ZW_HOST_APP_SLOTS] : NULL;
+}
+
+// the unit's bootloader would verify the image here; the host can't run it anyway, so whatever
+// was written is accepted
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    auto slot = __slotOf(partition);
+    if (slot < 0)
+        return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> lock(__flashMutex);
+    if (slot != (int)__runningSlot)
+    {
+        if (!__writtenExtent[slot])
+            return ESP_ERR_OTA_VALIDATE_FAILED;
+        __otaData.imageSize[slot] = __writtenExtent[slot];
+    }
+
+    __otaData.bootSlot = slot;
+    __saveOtaData();
+    return ESP_OK;
+}
+
+uint32_t EspClass::getSketchSize()
+{
+    return __otaData.imageSize[__runningSlot];
+}
+
+String EspClass::getSketchMD5()
+{
+    static String md5;
+    if (md5.length())
+        return md5;
+
+    auto running = esp_ota_get_running_partition();
+    uint8_t digest[16];
+    mbedtls_md5_ret(__flash + running->address, getSketchSize(), digest);
+
+    char hex[33];
+    for (int i = 0; i < 16; i++)
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    return md5 = hex;
+}
+
+uint32_t EspClass::getFreeSketchSpace()
+{
+    return esp_ota_get_next_update_partition(NULL)->size;
+}
+
+bool EEPROMClass::begin(size_t size)
+{
+    if (!size)
+        return false;
+    if (_data && size == _size)
+        return true;
+
+    end();
+    _data = (uint8_t *)calloc(size, 1);
+    _size = size;
+    _dirty = false;
+
+    std::vector<uint8_t> saved;
+    if (__readFile(zwHostPath("eeprom.bin"), saved))
+        memcpy(_data, saved.data(), min(saved.size(), size));
+    return true;
+}
+
+bool EEPROMClass::commit()
+{
+    if (!_data)
+        return false;
+    if (!_dirty)
+        return true;
+
+    // a shorter begin() mustn't truncate what lies beyond it
+    std::vector<uint8_t> image;
+    __readFile(zwHostPath("eeprom.bin"), image);
+    image.resize(max(image.size(), _size));
+    memcpy(image.data(), _data, _size);
+
+    if (!__writeFile(zwHostPath("eeprom.bin"), image.data(), image.size()))
+        return false;
+
+    _dirty = false;
+    return true;
+}
+
+void EEPROMClass::end()
+{
+    if (!_data)
+        return;
+
+    commit();
+    free(_data);
+    _data = NULL;
+    _size = 0;
+}
+
+struct ZWHostNvsHandle
+{
+    std::string dir;
+    bool readOnly;
+};
+
+static std::mutex __nvsMutex;
+static std::vector<ZWHostNvsHandle *> __nvsHandles;
+
+static ZWHostNvsHandle *__nvsHandle(nvs_handle handle)
+{
+    return handle && handle <= __nvsHandles.size() ? __nvsHandles[handle - 1] : NULL;
+}
+
+static bool __nvsValidName(const char *name)
+{
+    return name && *name && strlen(name) < NVS_KEY_NAME_MAX_SIZE && !strchr(name, '/') && name[0] != '.';
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode openMode, nvs_handle *outHandle)
+{
+    if (!__nvsValidName(name) || !outHandle)
+        return ESP_ERR_NVS_INVALID_NAME;
+
+    auto dir = zwHostPath("nvs") + "/" + name;
+    struct stat st;
+    if (stat(dir.c_str(), &st))
+    {
+        if (openMode == NVS_READONLY)
+            return ESP_ERR_NVS_NOT_FOUND;
+        if (mkdir(dir.c_str(), 0755) && errno != EEXIST)
+            return ESP_FAIL;
+    }
+
+    std::lock_guard<std::mutex> lock(__nvsMutex);
+    __nvsHandles.push_back(new ZWHostNvsHandle{dir, openMode == NVS_READONLY});
+    *outHandle = __nvsHandles.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *outValue, size_t *length)
+{
+    std::lock_guard<std::mutex> lock(__nvsMutex);
+    auto h = __nvsHandle(handle);
+    if (!h)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!__nvsValidName(key) || !length)
+        return ESP_ERR_NVS_INVALID_NAME;
+
+    std::vector<uint8_t> value;
+    if (!__readFile(h->dir + "/" + key, value))
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    // a NULL buffer asks only for the length, as does one that's too small (which also fails)
+    if (!outValue)
+    {
+        *length = value.size();
+        return ESP_OK;
+    }
+    if (*length < value.size())
+    {
+        *length = value.size();
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    memcpy(outValue, value.data(), value.size());
+    *length = value.size();
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length)
+{
+    std::lock_guard<std::mutex> lock(__nvsMutex);
+    auto h = __nvsHandle(handle);
+    if (!h)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (h->readOnly)
+        return ESP_ERR_NVS_READ_ONLY;
+    if (!__nvsValidName(key))
+        return ESP_ERR_NVS_INVALID_NAME;
+
+    return __writeFile(h->dir + "/" + key, value, length) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key)
+{
+    std::lock_guard<std::mutex> lock(__nvsMutex);
+    auto h = __nvsHandle(handle);
+    if (!h)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (h->readOnly)
+        return ESP_ERR_NVS_READ_ONLY;
+    if (!__nvsValidName(key))
+        return ESP_ERR_NVS_INVALID_NAME;
+
+    return unlink((h->dir + "/" + key).c_str()) ? ESP_ERR_NVS_NOT_FOUND : ESP_OK;
+}
+
+esp_err_t nvs_erase_all(nvs_handle handle)
+{
+    std::lock_guard<std::mutex> lock(__nvsMutex);
+    auto h = __nvsHandle(handle);
+    if (!h)
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    if (h->readOnly)
+        return ESP_ERR_NVS_READ_ONLY;
+
+    auto dir = opendir(h->dir.c_str());
+    if (!dir)
+        return ESP_FAIL;
+    while (auto entry = readdir(dir))
+        if (entry->d_name[0] != '.')
+            unlink((h->dir + "/" + entry->d_name).c_str());
+    closedir(dir);
+    return ESP_OK;
+}
+
+// every set is written through, so there's nothing left to commit
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    std::lock_guard<std::mutex> lock(__nvsMutex);
+    return __nvsHandle(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+void nvs_close(nvs_handle handle)
+{
+    std::lock_guard<std::mutex> lock(__nvsMutex);
+    if (auto h = __nvsHandle(handle))
+    {
+        delete h;
+        __nvsHandles[handle - 1] = NULL;
+    }
+}
@@ -0,0 +1,429 @@
+// WiFi, WiFiClient and HTTPClient over the host's own network stack
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// <netinet/in.h>'s, which would otherwise hide the Arduino core's IPAddress of the same name
+#undef INADDR_NONE
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include <string>
+
+WiFiClass WiFi;
+const IPAddress INADDR_NONE(0, 0, 0, 0);
+
+// the interface holding the default route and its gateway, from /proc/net/route
+static std::string __routeInterface(uint32_t *gateway)
+{
+    std::string iface;
+    auto f = fopen("/proc/net/route", "r");
+    if (!f)
+        return iface;
+
+    char line[256], name[64];
+    unsigned int dest, gw;
+    while (fgets(line, sizeof(line), f))
+    {
+        // the addresses are printed as the network-order words read in host order
+        if (sscanf(line, "%63s %x %x", name, &dest, &gw) == 3 && !dest)
+        {
+            iface = name;
+            if (gateway)
+                *gateway = gw;
+            break;
+        }
+    }
+
+    fclose(f);
+    return iface;
+}
+
+// the IPv4 address and netmask of the default route's interface, or of the first that isn't loopback
+static bool __interfaceAddress(uint32_t *address, uint32_t *netmask)
+{
+    auto preferred = __routeInterface(NULL);
+    struct ifaddrs *addrs;
+    if (getifaddrs(&addrs))
+        return false;
+
+    struct ifaddrs *found = NULL;
+    for (auto walk = addrs; walk; walk = walk->ifa_next)
+    {
+        if (!walk->ifa_addr || walk->ifa_addr->sa_family != AF_INET || !strcmp(walk->ifa_name, "lo"))
+            continue;
+        if (!found || preferred == walk->ifa_name)
+            found = walk;
+    }
+
+    if (found)
+    {
+        *address = ((struct sockaddr_in *)found->ifa_addr)->sin_addr.s_addr;
+        *netmask = found->ifa_netmask ? ((struct sockaddr_in *)found->ifa_netmask)->sin_addr.s_addr : 0;
+    }
+
+    freeifaddrs(addrs);
+    return found;
+}
+
+bool WiFiClass::setHostname(const char *hostname)
+{
+    _hostname = hostname;
+    return true;
+}
+
+wl_status_t WiFiClass::begin(const char *ssid, const char *passphrase, int32_t channel, const uint8_t *bssid,
+                             bool connect)
+{
+    if (channel)
+        _channel = channel;
+    if (bssid)
+        memcpy(_bssid, bssid, sizeof(_bssid));
+
+    return _status = connect ? WL_CONNECTED : WL_IDLE_STATUS;
+}
+
+bool WiFiClass::disconnect(bool wifiOff, bool eraseAp)
+{
+    _status = WL_DISCONNECTED;
+    return true;
+}
+
+IPAddress WiFiClass::localIP()
+{
+    uint32_t address = htonl(INADDR_LOOPBACK), netmask;
+    __interfaceAddress(&address, &netmask);
+    return IPAddress(address);
+}
+
+IPAddress WiFiClass::subnetMask()
+{
+    uint32_t address, netmask = htonl(0xff000000);
+    __interfaceAddress(&address, &netmask);
+    return IPAddress(netmask);
+}
+
+IPAddress WiFiClass::gatewayIP()
+{
+    uint32_t gateway = 0;
+    __routeInterface(&gateway);
+    return IPAddress(gateway);
+}
+
+IPAddress WiFiClass::dnsIP(uint8_t dnsNo)
+{
+    auto f = fopen("/etc/resolv.conf", "r");
+    if (!f)
+        return INADDR_NONE;
+
+    char line[256], server[64];
+    struct in_addr addr;
+    uint32_t found = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (sscanf(line, "nameserver %63s", server) == 1 && inet_pton(AF_INET, server, &addr) == 1 && !dnsNo--)
+        {
+            found = addr.s_addr;
+            break;
+        }
+    }
+
+    fclose(f);
+    return IPAddress(found);
+}
+
+uint8_t *WiFiClass::macAddress(uint8_t *mac)
+{
+    auto efuse = ESP.getEfuseMac();
+    for (int i = 0; i < 6; i++)
+        mac[i] = efuse >> (i * 8);
+
+    auto iface = __routeInterface(NULL);
+    if (iface.empty())
+        return mac;
+
+    unsigned int bytes[6];
+    auto f = fopen(("/sys/class/net/" + iface + "/address").c_str(), "r");
+    if (f && fscanf(f, "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) == 6)
+        for (int i = 0; i < 6; i++)
+            mac[i] = bytes[i];
+    if (f)
+        fclose(f);
+    return mac;
+}
+
+String WiFiClass::macAddress()
+{
+    uint8_t mac[6];
+    char out[18];
+    macAddress(mac);
+    snprintf(out, sizeof(out), "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    return String(out);
+}
+
+static bool __pollFor(int fd, short events, int timeoutMs)
+{
+    struct pollfd pfd = {fd, events, 0};
+    int ready;
+    while ((ready = poll(&pfd, 1, timeoutMs)) < 0 && errno == EINTR)
+        ;
+    return ready > 0;
+}
+
+int WiFiClient::connect(IPAddress ip, uint16_t port, int32_t timeout)
+{
+    return connect(ip.toString().c_str(), port, timeout);
+}
+
+int WiFiClient::connect(const char *host, uint16_t port, int32_t timeout)
+{
+    stop();
+
+    struct addrinfo hints, *result;
+    bzero(&hints, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    auto gaiErr = getaddrinfo(host, std::to_string(port).c_str(), &hints, &result);
+    if (gaiErr)
+    {
+        errno = gaiErr == EAI_SYSTEM ? errno : EHOSTUNREACH;
+        return 0;
+    }
+
+    // non-blocking throughout, so that read() and available() never wait
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sockfd < 0)
+    {
+        freeaddrinfo(result);
+        return 0;
+    }
+
+    auto rc = ::connect(sockfd, result->ai_addr, result->ai_addrlen);
+    freeaddrinfo(result);
+
+    if (rc && errno == EINPROGRESS)
+    {
+        if (!__pollFor(sockfd, POLLOUT, timeout))
+        {
+            errno = ETIMEDOUT;
+        }
+        else
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &err, &len);
+            errno = err;
+            rc = err ? -1 : 0;
+        }
+    }
+
+    if (rc)
+    {
+        auto err = errno;
+        close(sockfd);
+        sockfd = -1;
+        errno = err;
+        return 0;
+    }
+
+    _connected = true;
+    return 1;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t size)
+{
+    if (!_connected)
+        return 0;
+
+    size_t sent = 0;
+    while (sent < size)
+    {
+        auto n = send(sockfd, buf + sent, size - sent, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            sent += n;
+        }
+        else if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        {
+            if (!__pollFor(sockfd, POLLOUT, timeoutMs))
+                break;
+        }
+        else
+        {
+            _connected = false;
+            break;
+        }
+    }
+
+    return sent;
+}
+
+int WiFiClient::available()
+{
+    if (!_connected)
+        return 0;
+
+    int count = 0;
+    if (ioctl(sockfd, FIONREAD, &count) < 0)
+        return 0;
+    if (!count)
+        connected();
+    return count;
+}
+
+int WiFiClient::read()
+{
+    uint8_t c;
+    return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buf, size_t size)
+{
+    if (sockfd < 0)
+        return -1;
+
+    auto n = recv(sockfd, buf, size, MSG_DONTWAIT);
+    if (n > 0)
+        return n;
+
+    if (!n || (errno != EAGAIN && errno != EINTR))
+    {
+        _connected = false;
+        return -1;
+    }
+
+    return -1;
+}
+
+int WiFiClient::peek()
+{
+    uint8_t c;
+    if (sockfd < 0 || recv(sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 1)
+        return -1;
+    return c;
+}
+
+void WiFiClient::stop()
+{
+    if (sockfd >= 0)
+        close(sockfd);
+    sockfd = -1;
+    _connected = false;
+}
+
+// as the ESP32 core's: a peer that has closed reads as connected until its data is consumed
+uint8_t WiFiClient::connected()
+{
+    if (!_connected)
+        return 0;
+
+    uint8_t c;
+    auto n = recv(sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (!n || (n < 0 && errno != EAGAIN && errno != EINTR))
+        _connected = false;
+    return _connected;
+}
+
+int WiFiClient::setNoDelay(bool nodelay)
+{
+    int flag = nodelay;
+    return setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+IPAddress WiFiClient::remoteIP() const
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (sockfd < 0 || getpeername(sockfd, (struct sockaddr *)&addr, &len))
+        return IPAddress();
+    return IPAddress(addr.sin_addr.s_addr);
+}
+
+uint16_t WiFiClient::remotePort() const
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (sockfd < 0 || getpeername(sockfd, (struct sockaddr *)&addr, &len))
+        return 0;
+    return ntohs(addr.sin_port);
+}
+
+bool HTTPClient::begin(String url)
+{
+    end();
+
+    if (!url.startsWith("http://"))
+        return false;
+
+    auto hostStart = strlen("http://");
+    auto pathStart = url.indexOf('/', hostStart);
+    auto authority = pathStart < 0 ? url.substring(hostStart) : url.substring(hostStart, pathStart);
+    uri = pathStart < 0 ? String("/") : url.substring(pathStart);
+
+    auto colon = authority.indexOf(':');
+    host = colon < 0 ? authority : authority.substring(0, colon);
+    port = colon < 0 ? 80 : authority.substring(colon + 1).toInt();
+    headers = "";
+    size = -1;
+    return host.length() && port;
+}
+
+void HTTPClient::end()
+{
+    delete client;
+    client = NULL;
+}
+
+void HTTPClient::addHeader(const String &name, const String &value, bool first, bool replace)
+{
+    auto line = name + ": " + value + "\r\n";
+    headers = first ? line + headers : headers + line;
+}
+
+// HTTP/1.0, so that the body is never chunked and ends with the connection
+int HTTPClient::GET()
+{
+    delete client;
+    client = new WiFiClient();
+    size = -1;
+
+    if (!client->connect(host.c_str(), port, timeoutMs))
+        return HTTPC_ERROR_CONNECTION_REFUSED;
+
+    auto request = "GET " + uri + " HTTP/1.0\r\nHost: " + host + "\r\nUser-Agent: ESP32HTTPClient\r\n" + headers + "\r\n";
+    if (client->write((const uint8_t *)request.c_str(), request.length()) != request.length())
+        return HTTPC_ERROR_SEND_HEADER_FAILED;
+
+    client->setTimeout(timeoutMs);
+    auto status = client->readStringUntil('\n');
+    if (!status.length())
+        return HTTPC_ERROR_READ_TIMEOUT;
+
+    int code = 0;
+    if (sscanf(status.c_str(), "HTTP/%*d.%*d %d", &code) != 1)
+        return HTTPC_ERROR_CONNECTION_LOST;
+
+    while (true)
+    {
+        auto header = client->readStringUntil('\n');
+        header.trim();
+        if (!header.length())
+            break;
+
+        auto colon = header.indexOf(':');
+        if (colon > 0 && header.substring(0, colon).equalsIgnoreCase("Content-Length"))
+            size = header.substring(colon + 1).toInt();
+    }
+
+    return code;
+}
@@ -1,4 +1,10 @@
 #!/usr/bin/perl
+use File::Basename;
+use Cwd 'abs_path';
+use Compress::Zlib;
+
+# must match OTA_DEFLATE_WINDOW_BITS in zw_ota.h
+my $deflateWindowBits = 12;
 
 # symlink the script as "release-info.pl" to enable this mode
 $infoMode = 1, if ($0 =~ /release-info/i);
@@ -6,11 +12,32 @@ $infoMode = 1, if ($0 =~ /release-info/i);
 my $version = shift || die "version\n\n";
 my $destDir = shift || die "dest dir\n\n";
 my $buildDir = shift || (!$infoMode && die "build dir\n\n");
+# any further arguments are previous versions (already in dest dir) to make deltas from
+my @baseVersions = @ARGV;
+
+# raw deflate (negative window bits: no zlib header) with the small window units decode with
+sub deflateFile {
+    my ($src, $dst) = @_;
+    open(my $in, '<:raw', $src) || die "$src: $!\n\n";
+    my $data = do { local $/; <$in> };
+    close($in);
+
+    my ($d, $status) = deflateInit(-Level => Z_BEST_COMPRESSION, -WindowBits => -$deflateWindowBits, -MemLevel => 9);
+    die "deflateInit failed ($status)\n\n", unless ($d);
+    my ($zData, $zStatus) = $d->deflate($data);
+    my ($zTail, $fStatus) = $d->flush();
+    die "deflate failed ($zStatus, $fStatus)\n\n", unless ($zStatus == Z_OK && $fStatus == Z_OK);
+
+    open(my $out, '>:raw', $dst) || die "$dst: $!\n\n";
+    print $out $zData . $zTail;
+    close($out);
+}
 
 $version =~ s/v//ig;
 
 my $tFile = "zero_watch-v$version.ino.bin";
 my $target = "$destDir/$tFile";
+my $zTarget = "$target.z";
 
 if (!$infoMode) {
     $buildDir .= "/zero_watch.ino.bin";
@@ -34,13 +61,63 @@ my $bSize = (stat($buildDir))[7];
 if (!$infoMode) {
     `cp $buildDir $target`;
     die "Copy failed ($?)\n\n", if ($?);
+
+    deflateFile($buildDir, $zTarget);
+
+    my $srcDir = dirname(abs_path($0)) . "/..";
+
+    # deltas from previous releases; requires tools/zw-delta to be built
+    foreach my $baseVersion (@baseVersions) {
+        $baseVersion =~ s/v//ig;
+        my $baseImage = "$destDir/zero_watch-v$baseVersion.ino.bin";
+        die "$baseImage does not exist\n\n", unless (-e $baseImage);
+        die "$srcDir/tools/zw-delta is not built\n\n", unless (-x "$srcDir/tools/zw-delta");
+
+        my $baseMd5 = (split(/\s/, `md5sum $baseImage`))[0];
+        my $delta = "$destDir/zero_watch-v$baseVersion-to-v$version.delta";
+        `$srcDir/tools/zw-delta diff $baseImage $buildDir $baseMd5 $delta`;
+        die "Delta from $baseVersion failed ($?)\n\n", if ($?);
+        `$srcDir/tools/zw-delta apply $baseImage $delta $delta.check`;
+        die "Delta from $baseVersion doesn't apply ($?)\n\n", if ($? || `cmp $delta.check $buildDir`);
+        unlink("$delta.check");
+
+        deflateFile($delta, "$delta.z");
+        unlink($delta);
+    }
+
+    # call-site table for decoding ZWLOG_BINARY builds' logs; requires tools/zw-logdecode to be built
+    if (-x "$srcDir/tools/zw-logdecode") {
+        `$srcDir/tools/zw-logdecode table $srcDir/*.h $srcDir/*.cpp $srcDir/*.ino > $target.logtable`;
+        warn "Log table generation failed ($?)\n", if ($?);
+    }
+}
+
+# releases made before compressed images existed have none; older firmware ignores zurl/zsize
+my $zFields = "";
+if (-e $zTarget) {
+    my $zSize = (stat($zTarget))[7];
+    $zFields = "\n    \"zurl\": \"zero_watch_updates/$tFile.z\",\n    \"zsize\": $zSize,";
+}
+
+# every delta made for this version, whenever it was made
+my @deltas;
+foreach my $delta (sort glob("$destDir/zero_watch-v*-to-v$version.delta.z")) {
+    next, unless (basename($delta) =~ /^zero_watch-v(.+)-to-v/);
+    my $baseImage = "$destDir/zero_watch-v$1.ino.bin";
+    next, unless (-e $baseImage);
+
+    my $baseMd5 = (split(/\s/, `md5sum $baseImage`))[0];
+    my $dSize = (stat($delta))[7];
+    my $dFile = basename($delta);
+    push(@deltas, "        { \"base\": \"$baseMd5\", \"url\": \"zero_watch_updates/$dFile\", \"size\": $dSize }");
 }
+$zFields .= "\n    \"deltas\": [\n" . join(",\n", @deltas) . "\n    ],", if (@deltas);
 
 print <<__EOF__;
 {
     "url":  "zero_watch_updates/$tFile",
     "md5":  "$md5",
-    "size": $bSize,
+    "size": $bSize,$zFields
     "otp": 0
 }
 __EOF__
\ No newline at end of file
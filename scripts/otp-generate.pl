@@ -17,7 +17,28 @@ if ($redisPassword eq '-D' && int($redisHost) > 0) {
   $currentLc = int($redisHost);
 }
 else {
-  $currentLc = int(`redis-cli -h $redisHost -a '$redisPassword' get $targetHost:heartbeat 2> /dev/null`);
+  my $hb = `redis-cli -h $redisHost -a '$redisPassword' get $targetHost:heartbeat 2> /dev/null`;
+  chomp($hb);
+  # ZWREDIS_TELEMETRY_MSGPACK units store the heartbeat as a MessagePack uint, in
+  # the smallest of its forms that holds the value (as tools/zw-rollout.cpp reads it)
+  if ($hb =~ /^([\x00-\x7f])$/s) {
+    $currentLc = ord($1);
+  }
+  elsif ($hb =~ /^\xcc(.)$/s) {
+    $currentLc = unpack("C", $1);
+  }
+  elsif ($hb =~ /^\xcd(.{2})$/s) {
+    $currentLc = unpack("n", $1);
+  }
+  elsif ($hb =~ /^\xce(.{4})$/s) {
+    $currentLc = unpack("N", $1);
+  }
+  elsif ($hb =~ /^\xcf(.{8})$/s) {
+    $currentLc = unpack("Q>", $1);
+  }
+  else {
+    $currentLc = int($hb);
+  }
 }
 
 if ($currentLc <= 0) {
@@ -8,6 +8,20 @@ my $otp = `$lp/otp-generate.pl $ARGV[2] $ARGV[3] 2> /dev/null`;
 chomp($otp);
 $updateJson =~ s/(\"otp\":\s+)(0)/\1$otp/ig;
 $updateJson =~ s/\s*//ig;
-my $cmd = "redis-cli -h 192.168.1.252 -a '$ARGV[3]' set $ARGV[2]:config:update '$updateJson'";
+my $redisCli = "redis-cli -h 192.168.1.252 -a '$ARGV[3]'";
+
+# "redis" as the last argument serves the images from Redis itself, each at a key named by its url
+if ($ARGV[4] eq "redis") {
+    foreach my $url ($updateJson =~ /"url":"([^"]+)"|"zurl":"([^"]+)"/g) {
+        next, unless ($url);
+        my $file = "$ARGV[1]/" . basename($url);
+        print "UPLOADING:\n\t$file -> $url\n";
+        `$redisCli -x set '$url' < '$file'`;
+        die "Upload failed ($?)\n", if ($?);
+    }
+    $updateJson =~ s/^\{/{"transport":"redis",/;
+}
+
+my $cmd = "$redisCli set $ARGV[2]:config:update '$updateJson'";
 print "SENDING:\n\t$cmd\n";
 print "RESULT:\n\t" . `$cmd`;
@@ -0,0 +1,167 @@
+// zw-bench.cpp
+// (C) 2019 Ryan Joseph <ryan@electricsheep.co>
+// https://github.com/rpj/zw
+//
+// Compares the microbenchmark results (see zw_bench.h) of two firmware versions, as
+// written by "zero_watch --bench" on the host or getValue of "bench" on a unit, which
+// keeps each version's at HOSTNAME:info:bench. Exits non-zero if anything regressed.
+//
+// build: g++ -std=c++11 -O2 -o zw-bench zw-bench.cpp
+//
+// usage, one of:
+// ./zw-bench compare [base.json] [new.json] (threshold percent, default 10)
+//      each benchmark's median time per operation in new.json against base.json's
+// ./zw-bench fetch [redisHost[:port]] [redisPassword] [hostname] (version)
+//      print a unit's stored results for version, or list the versions it has results for
+
+#include "zw_resp.h"
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <regex>
+
+struct BenchResult
+{
+    unsigned long nsMedian;
+    double allocsPerOp;
+};
+
+struct BenchRun
+{
+    std::string ver;
+    std::string platform;
+    std::string variant;
+    std::map<std::string, BenchResult> results;
+};
+
+static std::string jsonString(const std::string &json, const char *name)
+{
+    std::smatch m;
+    std::regex re(std::string("\"") + name + "\"\\s*:\\s*\"([^\"]*)\"");
+    return std::regex_search(json, m, re) ? m[1].str() : "";
+}
+
+static bool load(const char *path, BenchRun &run)
+{
+    std::ifstream in(path);
+    std::string json((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in && json.empty())
+    {
+        std::cerr << path << ": can't read" << std::endl;
+        return false;
+    }
+
+    run.ver = jsonString(json, "ver");
+    run.platform = jsonString(json, "platform");
+    run.variant = jsonString(json, "variant");
+
+    // zwBenchRun()'s fields are always in this order, however the JSON was reformatted since
+    std::regex re("\\{\\s*\"name\"\\s*:\\s*\"([^\"]+)\"[^}]*?\"nsMedian\"\\s*:\\s*(\\d+)"
+                  "[^}]*?\"allocsPerOp\"\\s*:\\s*([0-9.]+|null)[^}]*\\}");
+    for (std::sregex_iterator it(json.begin(), json.end(), re), end; it != end; ++it)
+    {
+        // null where the build didn't count allocations: NAN, which no comparison flags
+        auto allocs = (*it)[3].str();
+        run.results[(*it)[1].str()] = {std::stoul((*it)[2].str()), allocs == "null" ? NAN : std::stod(allocs)};
+    }
+
+    if (run.results.empty())
+    {
+        std::cerr << path << ": no benchmark results" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static int compare(const char *basePath, const char *newPath, double threshold)
+{
+    BenchRun base, next;
+    if (!load(basePath, base) || !load(newPath, next))
+        return -1;
+
+    if (base.platform != next.platform || base.variant != next.variant)
+        std::cerr << "WARNING: comparing " << base.platform << "/" << base.variant << " against "
+                  << next.platform << "/" << next.variant << std::endl;
+
+    printf("%-22s %12s %12s %8s %12s\n", "benchmark", base.ver.c_str(), next.ver.c_str(), "change", "allocs/op");
+
+    int regressions = 0;
+    for (auto &r : next.results)
+    {
+        auto found = base.results.find(r.first);
+        if (found == base.results.end())
+        {
+            printf("%-22s %12s %10luns %8s %12.2f  (new)\n", r.first.c_str(), "-", r.second.nsMedian, "",
+                   r.second.allocsPerOp);
+            continue;
+        }
+
+        auto &was = found->second;
+        auto change = was.nsMedian ? 100.0 * ((double)r.second.nsMedian - was.nsMedian) / was.nsMedian : 0.0;
+        // any new allocation on a hot path is a regression, whatever the timing says
+        auto regressed = change > threshold || r.second.allocsPerOp > was.allocsPerOp + 0.5;
+        regressions += regressed;
+
+        printf("%-22s %10luns %10luns %+7.1f%% %5.2f->%-5.2f%s\n", r.first.c_str(), was.nsMedian,
+               r.second.nsMedian, change, was.allocsPerOp, r.second.allocsPerOp, regressed ? "  REGRESSED" : "");
+    }
+
+    for (auto &r : base.results)
+        if (!next.results.count(r.first))
+            printf("%-22s %10luns %12s %8s %12s  (gone)\n", r.first.c_str(), r.second.nsMedian, "-", "", "");
+
+    return regressions ? 1 : 0;
+}
+
+static int fetch(const std::string &hostPort, const std::string &password, const std::string &unit,
+                 const char *version)
+{
+    std::string host;
+    int port;
+    respParseHostPort(hostPort, host, port);
+
+    RespClient redis;
+    if (!redis.connect(host.c_str(), port) || !redis.auth(password.c_str()))
+    {
+        std::cerr << "can't connect to " << hostPort << std::endl;
+        return -1;
+    }
+
+    auto key = unit + ":info:bench";
+    if (!version)
+    {
+        auto versions = redis.command({"HKEYS", key});
+        for (auto &v : versions.elements)
+            std::cout << v.str << std::endl;
+        return versions.elements.empty() ? -1 : 0;
+    }
+
+    auto results = redis.command({"HGET", key, version});
+    if (!results.ok() || results.null)
+    {
+        std::cerr << "no results for " << unit << " " << version << std::endl;
+        return -1;
+    }
+
+    std::cout << results.str << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+
+    if (mode == "compare" && argc > 3)
+        return compare(argv[2], argv[3], argc > 4 ? atof(argv[4]) : 10.0);
+
+    if (mode == "fetch" && argc > 4)
+        return fetch(argv[2], argv[3], argv[4], argc > 5 ? argv[5] : NULL);
+
+    std::cerr << "usage:\n"
+              << "\tzw-bench compare [base.json] [new.json] (threshold percent)\n"
+              << "\tzw-bench fetch [redisHost[:port]] [redisPassword] [hostname] (version)\n";
+    return -1;
+}
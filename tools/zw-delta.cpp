@@ -0,0 +1,287 @@
+// zw-delta.cpp
+// (C) 2019 Ryan Joseph <ryan@electricsheep.co>
+// https://github.com/rpj/zw
+//
+// Produces (and, to check them, applies) the binary deltas units apply during OTA
+// (see ZWOtaPatcher in zw_ota.h). The matching is bsdiff's, but the control
+// records, differences and literal bytes are interleaved rather than kept in three
+// separate streams, so a unit can apply the patch as it downloads it, reading only
+// the running image alongside. scripts/new-release.pl deflates the result.
+//
+// Format (little-endian):
+//      "ZWD1", base size (u32), target size (u32), base MD5 (16 bytes)
+//      then records until target size bytes are produced:
+//          add length (u32), copy length (u32), base seek (i32),
+//          add length bytes (added to the base's bytes), copy length literal bytes
+//
+// build: g++ -std=c++11 -O2 -o zw-delta zw-delta.cpp
+//
+// usage:
+// ./zw-delta diff [base.bin] [target.bin] [base md5] [out.delta]
+// ./zw-delta apply [base.bin] [in.delta] [out.bin]
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#define ZWDELTA_MAGIC "ZWD1"
+#define ZWDELTA_HEADER_SIZE 28
+#define ZWDELTA_CONTROL_SIZE 12
+
+typedef std::vector<uint8_t> Bytes;
+
+static bool readFile(const char *path, Bytes &out)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static bool writeFile(const char *path, const Bytes &data)
+{
+    std::ofstream out(path, std::ios::binary);
+    out.write((const char *)data.data(), data.size());
+    return (bool)out;
+}
+
+static void put32(Bytes &out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        out.push_back((v >> (i * 8)) & 0xff);
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// prefix doubling; index 0 is the empty suffix, as bsdiff's search expects
+static std::vector<int64_t> suffixArray(const Bytes &s)
+{
+    int64_t n = s.size();
+    std::vector<int64_t> sa(n), rank(n), tmp(n);
+    for (int64_t i = 0; i < n; i++)
+        sa[i] = i, rank[i] = s[i];
+
+    for (int64_t k = 1; n > 1; k <<= 1)
+    {
+        auto key = [&](int64_t i) { return i + k < n ? rank[i + k] : -1; };
+        auto less = [&](int64_t a, int64_t b) { return rank[a] != rank[b] ? rank[a] < rank[b] : key(a) < key(b); };
+        std::sort(sa.begin(), sa.end(), less);
+
+        tmp[sa[0]] = 0;
+        for (int64_t i = 1; i < n; i++)
+            tmp[sa[i]] = tmp[sa[i - 1]] + (less(sa[i - 1], sa[i]) ? 1 : 0);
+        rank.swap(tmp);
+
+        if (rank[sa[n - 1]] == n - 1)
+            break;
+    }
+
+    sa.insert(sa.begin(), n);
+    return sa;
+}
+
+static int64_t matchLen(const uint8_t *a, int64_t aLen, const uint8_t *b, int64_t bLen)
+{
+    int64_t i = 0;
+    while (i < aLen && i < bLen && a[i] == b[i])
+        i++;
+    return i;
+}
+
+static int64_t search(const std::vector<int64_t> &sa, const Bytes &base, const uint8_t *target, int64_t targetLen,
+                      int64_t st, int64_t en, int64_t &pos)
+{
+    int64_t baseLen = base.size();
+    while (en - st >= 2)
+    {
+        auto x = st + (en - st) / 2;
+        if (memcmp(base.data() + sa[x], target, std::min(baseLen - sa[x], targetLen)) < 0)
+            st = x;
+        else
+            en = x;
+    }
+
+    auto x = matchLen(base.data() + sa[st], baseLen - sa[st], target, targetLen);
+    auto y = matchLen(base.data() + sa[en], baseLen - sa[en], target, targetLen);
+    pos = x > y ? sa[st] : sa[en];
+    return std::max(x, y);
+}
+
+static Bytes diff(const Bytes &base, const Bytes &target, const uint8_t baseMd5[16])
+{
+    Bytes out(ZWDELTA_MAGIC, ZWDELTA_MAGIC + 4);
+    put32(out, base.size());
+    put32(out, target.size());
+    out.insert(out.end(), baseMd5, baseMd5 + 16);
+
+    auto sa = suffixArray(base);
+    int64_t baseLen = base.size(), targetLen = target.size();
+    int64_t scan = 0, len = 0, pos = 0, lastScan = 0, lastPos = 0, lastOffset = 0;
+
+    while (scan < targetLen)
+    {
+        int64_t oldScore = 0;
+        for (int64_t scsc = scan += len; scan < targetLen; scan++)
+        {
+            len = search(sa, base, target.data() + scan, targetLen - scan, 0, baseLen, pos);
+
+            for (; scsc < scan + len; scsc++)
+                if (scsc + lastOffset < baseLen && base[scsc + lastOffset] == target[scsc])
+                    oldScore++;
+
+            if ((len == oldScore && len) || len > oldScore + 8)
+                break;
+
+            if (scan + lastOffset < baseLen && base[scan + lastOffset] == target[scan])
+                oldScore--;
+        }
+
+        if (len == oldScore && scan != targetLen)
+            continue;
+
+        // extend the previous match forwards and this one backwards, then split any overlap
+        int64_t s = 0, best = 0, lenF = 0;
+        for (int64_t i = 0; lastScan + i < scan && lastPos + i < baseLen;)
+        {
+            if (base[lastPos + i] == target[lastScan + i])
+                s++;
+            i++;
+            if (s * 2 - i > best * 2 - lenF)
+                best = s, lenF = i;
+        }
+
+        int64_t lenB = 0;
+        if (scan < targetLen)
+        {
+            s = 0, best = 0;
+            for (int64_t i = 1; scan >= lastScan + i && pos >= i; i++)
+            {
+                if (base[pos - i] == target[scan - i])
+                    s++;
+                if (s * 2 - i > best * 2 - lenB)
+                    best = s, lenB = i;
+            }
+        }
+
+        if (lastScan + lenF > scan - lenB)
+        {
+            auto overlap = (lastScan + lenF) - (scan - lenB);
+            int64_t lenS = 0;
+            s = 0, best = 0;
+            for (int64_t i = 0; i < overlap; i++)
+            {
+                if (target[lastScan + lenF - overlap + i] == base[lastPos + lenF - overlap + i])
+                    s++;
+                if (target[scan - lenB + i] == base[pos - lenB + i])
+                    s--;
+                if (s > best)
+                    best = s, lenS = i + 1;
+            }
+            lenF += lenS - overlap;
+            lenB -= lenS;
+        }
+
+        auto copyLen = (scan - lenB) - (lastScan + lenF);
+        put32(out, lenF);
+        put32(out, copyLen);
+        put32(out, (uint32_t)(int32_t)((pos - lenB) - (lastPos + lenF)));
+        for (int64_t i = 0; i < lenF; i++)
+            out.push_back(target[lastScan + i] - base[lastPos + i]);
+        out.insert(out.end(), target.begin() + lastScan + lenF, target.begin() + lastScan + lenF + copyLen);
+
+        lastScan = scan - lenB;
+        lastPos = pos - lenB;
+        lastOffset = pos - scan;
+    }
+
+    return out;
+}
+
+static bool apply(const Bytes &base, const Bytes &delta, Bytes &target)
+{
+    if (delta.size() < ZWDELTA_HEADER_SIZE || memcmp(delta.data(), ZWDELTA_MAGIC, 4))
+        return false;
+
+    auto baseLen = le32(&delta[4]), targetLen = le32(&delta[8]);
+    if (baseLen != base.size())
+        return false;
+
+    size_t at = ZWDELTA_HEADER_SIZE;
+    int64_t basePos = 0;
+    target.clear();
+
+    while (target.size() < targetLen)
+    {
+        if (at + ZWDELTA_CONTROL_SIZE > delta.size())
+            return false;
+        auto addLen = le32(&delta[at]), copyLen = le32(&delta[at + 4]);
+        auto seek = (int32_t)le32(&delta[at + 8]);
+        at += ZWDELTA_CONTROL_SIZE;
+
+        if (at + addLen + copyLen > delta.size() || basePos < 0 || basePos + addLen > baseLen ||
+            target.size() + addLen + copyLen > targetLen)
+            return false;
+
+        for (uint32_t i = 0; i < addLen; i++)
+            target.push_back(delta[at++] + base[basePos++]);
+        target.insert(target.end(), delta.begin() + at, delta.begin() + at + copyLen);
+        at += copyLen;
+        basePos += seek;
+    }
+
+    return at == delta.size();
+}
+
+static bool parseMd5(const char *hex, uint8_t out[16])
+{
+    if (strlen(hex) != 32)
+        return false;
+    for (int i = 0; i < 16; i++)
+        if (sscanf(hex + i * 2, "%2hhx", &out[i]) != 1)
+            return false;
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+    Bytes base, other, out;
+
+    if (mode == "diff" && argc > 5)
+    {
+        uint8_t baseMd5[16];
+        if (!readFile(argv[2], base) || !readFile(argv[3], other) || !parseMd5(argv[4], baseMd5))
+        {
+            std::cerr << "bad input" << std::endl;
+            return -1;
+        }
+
+        out = diff(base, other, baseMd5);
+        std::cerr << out.size() << " byte delta for a " << other.size() << "-byte image" << std::endl;
+        return writeFile(argv[5], out) ? 0 : -1;
+    }
+
+    if (mode == "apply" && argc > 4)
+    {
+        if (!readFile(argv[2], base) || !readFile(argv[3], other) || !apply(base, other, out))
+        {
+            std::cerr << "bad input or delta" << std::endl;
+            return -1;
+        }
+        return writeFile(argv[4], out) ? 0 : -1;
+    }
+
+    std::cerr << "usage:\n"
+              << "\tzw-delta diff [base.bin] [target.bin] [base md5] [out.delta]\n"
+              << "\tzw-delta apply [base.bin] [in.delta] [out.bin]\n";
+    return -1;
+}
@@ -0,0 +1,1024 @@
+// zw-loadsim.cpp
+// (C) 2019 Ryan Joseph <ryan@electricsheep.co>
+// https://github.com/rpj/zw
+//
+// Simulates a fleet of units against one Redis server, to find how many it can carry and to
+// measure protocol changes. Each virtual unit has its own connection and sends exactly what a
+// unit's refresh does (readConfigAndUserKeys(), tick(), heartbeat() and the checkin, from
+// zero_watch.ino and zw_redis.cpp): one command at a time as Arduino-Redis does, pipelined
+// only where the firmware pipelines, with checkins and heartbeats encoded by zw_telemetry.cpp
+// itself. Units boot spread evenly over the first refresh period, as a real fleet's drift apart.
+//
+// Reports each kind of command's latency as the units saw it, and the server's own view from
+// INFO: ops/sec, CPU, memory and each command's cost. Units' keys are seeded beforehand
+// (with the sensor lists the displays read, if missing) and deleted afterwards.
+//
+// build: g++ -std=c++11 -O2 -pthread -DM5STACKC=0 -I.. -o zw-loadsim zw-loadsim.cpp ../zw_telemetry.cpp
+//      (M5STACKC=0 only keeps zw_common.h from including the M5StickC library)
+//
+// usage:
+// ./zw-loadsim [redisHost[:port]] [redisPassword] (options)
+//      --units N            virtual units (default 100)
+//      --refresh S          seconds between refreshes (default 20, the firmware's DEF_REFRESH)
+//      --seconds S          seconds to measure for, once every unit has booted (default 60)
+//      --displays K:S:E,..  list keys and LRANGE ranges each refresh reads (default: the
+//                           M5StickC's first page)
+//      --deep-sleep         units sleep between refreshes, reconnecting each time (deepSleepMode)
+//      --publish-logs       units publish their log lines each refresh (publishLogs)
+//      --msgpack            units are ZWREDIS_TELEMETRY_MSGPACK builds
+//      --tm1637             units drive segment displays and have no RTC, so deep-sleeping ones
+//                           sync their clocks on every wake
+//      --threads N          client threads (default: one per CPU)
+//      --interval S         seconds between progress reports (default 10)
+//      --prefix P           units are named P0001, P0002... (default "loadsim")
+//      --json               print the summary as JSON
+//      --keep               leave the units' keys in place afterwards
+
+#include "zw_resp.h"
+#include "zw_common.h"
+#include "zw_telemetry.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+// must match zero_watch.ino
+#define CHECKIN_EVERY_X_REFRESH 5
+#define CHECKIN_EXPIRY_MULT 2
+#define HEARTBEAT_EXPIRY_MULT 5
+// how long an M5StickC holds its splash screen between reading its config and the first tick
+#define M5_SPLASH_HOLD_MS 2000
+// zw_logqueue.cpp's envelope for published log lines
+#define PUB_FMT_STR "{\"source\":\"%s\",\"type\":\"VALUE\",\"ts\":%lu,\"value\":{\"logline\":\"%s\"}}"
+
+// zw_clock.h's ZWCLOCK_SYNC_INTERVAL_S
+#define LOADSIM_CLOCK_SYNC_S 900
+
+// zw_redis.h's ZWREDIS_CHECKIN_MSGPACK_MAX
+#define LOADSIM_CHECKIN_MSGPACK_MAX 512
+
+#define LOADSIM_POLL_MS 50
+#define LOADSIM_SEED_ELEMENTS 12
+
+typedef std::chrono::steady_clock Clock;
+
+// what each command is for; latency is reported per purpose
+enum Op
+{
+    OP_CONNECT = 0,
+    OP_AUTH,
+    OP_BOOTCOUNT,
+    OP_TIME,
+    OP_CONFIG,
+    OP_USER_KEY,
+    OP_LRANGE,
+    OP_HEARTBEAT,
+    OP_CHECKIN,
+    OP_LOGS,
+    OP_COUNT
+};
+
+static const char *opNames[] = {"connect", "AUTH", "bootcount", "clock sync", "config GET", "user key GET",
+                                "LRANGE", "heartbeat", "checkin", "log PUBLISH"};
+
+struct DisplayRead
+{
+    std::string key;
+    int start;
+    int end;
+};
+
+struct Options
+{
+    int units = 100;
+    int refresh = 20;
+    int seconds = 60;
+    std::vector<DisplayRead> displays = {{"zero:sensor:BME280:temperature:.list", 0, 11},
+                                         {"zero:sensor:DHTXX:temperature_fahrenheit:.list", 0, 11},
+                                         {"zero:sensor:BME280:humidity:.list", 0, 11},
+                                         {"zero:sensor:DHTXX:relative_humidity:.list", 0, 5}};
+    bool deepSleep = false;
+    bool publishLogs = false;
+    bool msgpack = false;
+    bool m5 = true;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+    int interval = 10;
+    std::string prefix = "loadsim";
+    bool json = false;
+    bool keep = false;
+};
+
+static Options gOpts;
+static struct sockaddr_storage gAddr;
+static socklen_t gAddrLen;
+static std::string gPassword;
+static std::atomic<bool> gStop(false);
+
+// one round trip: a command, or several the firmware pipelines; or a pause or disconnect
+struct Step
+{
+    enum Kind
+    {
+        SEND,
+        HOLD,
+        CLOSE
+    } kind;
+    Op op;
+    std::string wire;
+    int replies;
+    int holdMs;
+};
+
+struct Samples
+{
+    std::vector<uint32_t> us[OP_COUNT];
+    uint64_t errors[OP_COUNT] = {};
+    uint64_t commands = 0;
+    uint64_t roundTrips = 0;
+    uint64_t refreshes = 0;
+};
+
+class Unit
+{
+public:
+    int index;
+    std::string name;
+    int fd = -1;
+    bool connecting = false;
+    std::deque<Step> steps;
+    Clock::time_point wake;
+    Clock::time_point holdUntil;
+    Clock::time_point sentAt;
+    Clock::time_point bootedAt;
+    Clock::time_point nextClockSync;
+    int awaiting = 0;
+    int awaitingCommands = 0;
+    Op awaitingOp = OP_CONNECT;
+    std::string wbuf;
+    std::string rbuf;
+    unsigned long bootCount = 0;
+    uint64_t heartbeats = 0;
+    unsigned long lastLatencyUs = 0;
+    unsigned long averageLatencyUs = 0;
+
+    Unit(int i) : index(i)
+    {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s%04d", gOpts.prefix.c_str(), i + 1);
+        name = buf;
+    }
+
+    void send(Op op, const std::vector<std::string> &args)
+    {
+        steps.push_back({Step::SEND, op, respEncode(args), 1, 0});
+    }
+
+    void sendPipelined(Op op, const std::vector<std::vector<std::string>> &commands)
+    {
+        std::string wire;
+        for (auto &args : commands)
+            wire += respEncode(args);
+        steps.push_back({Step::SEND, op, wire, (int)commands.size(), 0});
+    }
+
+    // setup(): connect, AUTH, bump the boot count and read the config
+    void queueBoot()
+    {
+        bootedAt = Clock::now();
+        heartbeats = 0;
+        // without an RTC to start from, every boot syncs the clock straight away
+        if (!gOpts.m5)
+            nextClockSync = Clock::time_point();
+        if (!gPassword.empty())
+            send(OP_AUTH, {"AUTH", gPassword});
+        send(OP_BOOTCOUNT, {"GET", name + ":bootcount"});
+        send(OP_BOOTCOUNT, {"SET", name + ":bootcount", std::to_string(++bootCount)});
+        queueReadConfig();
+        if (gOpts.m5)
+            steps.push_back({Step::HOLD, OP_CONNECT, "", 0, M5_SPLASH_HOLD_MS});
+    }
+
+    void queueReadConfig()
+    {
+        if (Clock::now() >= nextClockSync)
+        {
+            send(OP_TIME, {"TIME"});
+            send(OP_TIME, {"HMGET", "rpjios.__meta.time", "hour", "minute", "second"});
+            nextClockSync = Clock::now() + std::chrono::seconds(LOADSIM_CLOCK_SYNC_S);
+        }
+
+        for (auto field : {"brightness", "refresh", "debug", "publishLogs", "pauseRefresh", "deepSleepMode", "refreshBudget"})
+            send(OP_CONFIG, {"GET", name + ":config:" + field});
+
+        for (auto field : {"getValue", "controlPoint", "update", "displays"})
+            send(OP_USER_KEY, {"GET", name + ":config:" + field});
+    }
+
+    void queueTick(bool withHeartbeat)
+    {
+        for (auto &d : gOpts.displays)
+            send(OP_LRANGE, {"LRANGE", d.key, std::to_string(d.start), std::to_string(d.end)});
+
+        if (withHeartbeat)
+            queueHeartbeat();
+
+        if (gOpts.publishLogs)
+            queueLogs();
+    }
+
+    void queueHeartbeat()
+    {
+        auto key = name + ":heartbeat";
+        auto us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - bootedAt).count();
+        auto expire = std::to_string(gOpts.refresh * HEARTBEAT_EXPIRY_MULT);
+
+        if (gOpts.msgpack)
+        {
+            uint8_t mp[9];
+            auto len = zwTelemetryHeartbeatMsgPack(mp, sizeof(mp), us);
+            sendPipelined(OP_HEARTBEAT, {{"SET", key, std::string((char *)mp, len), "EX", expire}});
+        }
+        else
+        {
+            send(OP_HEARTBEAT, {"SET", key, std::to_string((unsigned long)us)});
+            send(OP_HEARTBEAT, {"EXPIRE", key, expire});
+        }
+
+        if (gOpts.deepSleep || (heartbeats++ % CHECKIN_EVERY_X_REFRESH))
+            queueCheckin();
+    }
+
+    void queueCheckin()
+    {
+        auto key = "rpjios.checkin." + name;
+        auto ticks = gOpts.deepSleep ? bootCount
+                                     : (unsigned long)std::chrono::duration_cast<std::chrono::seconds>(
+                                           Clock::now() - bootedAt).count();
+        char ip[16];
+        snprintf(ip, sizeof(ip), "10.%d.%d.%d", (index >> 16) & 0xff, (index >> 8) & 0xff, index & 0xff);
+        ZWCheckinData data = {name.c_str(), ZEROWATCH_VER, ticks, ip, lastLatencyUs, averageLatencyUs,
+                              gOpts.deepSleep, gOpts.deepSleep, 310, 0, 310,
+                              182344, 182012, 298732, 151020, 113792, 41,
+                              1000, 0, 0, 96, 4012, 212.4f, 31.5f, 185210.0f, 1204.6f, 6380.2f, 912.8f};
+        auto expire = std::to_string(gOpts.refresh * CHECKIN_EVERY_X_REFRESH * CHECKIN_EXPIRY_MULT);
+
+        if (gOpts.msgpack)
+        {
+            uint8_t mp[LOADSIM_CHECKIN_MSGPACK_MAX];
+            auto len = zwTelemetryCheckinMsgPack(mp, sizeof(mp), data);
+            sendPipelined(OP_CHECKIN, {{"HSET", key, "mp", std::string((char *)mp, len)}, {"EXPIRE", key, expire}});
+        }
+        else
+        {
+            char ifaces[1024];
+            zwTelemetryCheckinJson(ifaces, sizeof(ifaces), data);
+            send(OP_CHECKIN, {"HSET", key, "host", name});
+            send(OP_CHECKIN, {"HSET", key, "up", std::to_string(ticks)});
+            send(OP_CHECKIN, {"HSET", key, "ver", ZEROWATCH_VER});
+            send(OP_CHECKIN, {"HSET", key, "ifaces", ifaces});
+            send(OP_CHECKIN, {"EXPIRE", key, expire});
+        }
+    }
+
+    // what a refresh zlog()s: tick()'s "Awake" line and one per display
+    void queueLogs()
+    {
+        auto channel = name + ":info:publishLogs";
+        std::vector<std::vector<std::string>> publishes;
+        char line[160], msg[384];
+        auto ts = (unsigned long)time(NULL);
+        auto up = (unsigned long)std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - bootedAt).count();
+
+        auto publish = [&]() {
+            snprintf(msg, sizeof(msg), PUB_FMT_STR, name.c_str(), ts, line);
+            publishes.push_back({"PUBLISH", channel, msg});
+        };
+
+        snprintf(line, sizeof(line), "Awake at us=%lu tick=%lu", up * 1000000, up);
+        publish();
+        for (auto &d : gOpts.displays)
+        {
+            snprintf(line, sizeof(line), "[%s] count %d val %d immLat %lu gUDRA %lu (delta %ld)",
+                     d.key.c_str(), d.end - d.start + 1, 7215, lastLatencyUs, averageLatencyUs, 0l);
+            publish();
+        }
+        if (gOpts.deepSleep)
+        {
+            snprintf(line, sizeof(line), "Deep-sleeping for %ds...", gOpts.refresh);
+            publish();
+        }
+
+        sendPipelined(OP_LOGS, publishes);
+    }
+
+    // what the unit does when it next wakes: its first boot, a loop() refresh or a deep-sleep wake
+    void queueNext()
+    {
+        if (fd == -1)
+        {
+            queueBoot();
+            // setup()'s tick() only heartbeats (and then sleeps) in deep-sleep mode
+            queueTick(gOpts.deepSleep);
+            if (gOpts.deepSleep)
+                steps.push_back({Step::CLOSE, OP_CONNECT, "", 0, 0});
+        }
+        else
+        {
+            queueReadConfig();
+            queueTick(true);
+        }
+    }
+
+    void close()
+    {
+        if (fd != -1)
+            ::close(fd);
+        fd = -1;
+        connecting = false;
+        awaiting = 0;
+        wbuf.clear();
+        rbuf.clear();
+    }
+
+    bool startConnect()
+    {
+        fd = socket(gAddr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            return false;
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        sentAt = Clock::now();
+        if (::connect(fd, (struct sockaddr *)&gAddr, gAddrLen) && errno != EINPROGRESS)
+            return false;
+
+        connecting = true;
+        awaitingOp = OP_CONNECT;
+        return true;
+    }
+};
+
+class Worker
+{
+protected:
+    std::vector<Unit *> units;
+    std::mutex lock;
+    Samples samples;
+    std::atomic<int> connected;
+
+    void record(Op op, Clock::time_point since, int commands)
+    {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - since).count();
+        std::lock_guard<std::mutex> locked(lock);
+        samples.us[op].push_back((uint32_t)us);
+        samples.commands += commands;
+        samples.roundTrips += op != OP_CONNECT;
+    }
+
+    void fail(Unit *u, Op op)
+    {
+        {
+            std::lock_guard<std::mutex> locked(lock);
+            ++samples.errors[op];
+        }
+        // a unit that loses its connection starts over at its next refresh, as a rebooted one would
+        if (u->fd != -1 && !u->connecting)
+            --connected;
+        u->close();
+        u->steps.clear();
+        u->wake = Clock::now() + std::chrono::seconds(gOpts.refresh);
+    }
+
+    // runs the unit's steps until one has to wait on the network or the clock
+    void advance(Unit *u, Clock::time_point now)
+    {
+        while (u->fd != -1 && !u->connecting && !u->awaiting && u->wbuf.empty() && now >= u->holdUntil)
+        {
+            if (u->steps.empty())
+                return;
+
+            auto step = std::move(u->steps.front());
+            u->steps.pop_front();
+
+            if (step.kind == Step::HOLD)
+            {
+                u->holdUntil = now + std::chrono::milliseconds(step.holdMs);
+            }
+            else if (step.kind == Step::CLOSE)
+            {
+                u->close();
+                --connected;
+                u->wake = now + std::chrono::seconds(gOpts.refresh);
+            }
+            else
+            {
+                u->wbuf = std::move(step.wire);
+                u->awaiting = u->awaitingCommands = step.replies;
+                u->awaitingOp = step.op;
+                u->sentAt = now;
+                flush(u);
+            }
+        }
+    }
+
+    void flush(Unit *u)
+    {
+        while (!u->wbuf.empty())
+        {
+            auto wrote = ::send(u->fd, u->wbuf.data(), u->wbuf.size(), MSG_NOSIGNAL);
+            if (wrote < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    fail(u, u->awaitingOp);
+                return;
+            }
+            u->wbuf.erase(0, wrote);
+        }
+    }
+
+    void receive(Unit *u)
+    {
+        char chunk[16384];
+        auto got = ::recv(u->fd, chunk, sizeof(chunk), 0);
+        if (got <= 0)
+        {
+            if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+                fail(u, u->awaitingOp);
+            return;
+        }
+        u->rbuf.append(chunk, got);
+
+        long len = 0;
+        size_t at = 0;
+        while (u->awaiting && (len = respMessageLength(u->rbuf.data() + at, u->rbuf.size() - at)) > 0)
+        {
+            if (u->rbuf[at] == '-')
+            {
+                std::lock_guard<std::mutex> locked(lock);
+                ++samples.errors[u->awaitingOp];
+            }
+            at += len;
+
+            if (!--u->awaiting)
+            {
+                auto op = u->awaitingOp;
+                record(op, u->sentAt, u->awaitingCommands);
+                if (op == OP_LRANGE)
+                {
+                    u->lastLatencyUs = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - u->sentAt).count();
+                    u->averageLatencyUs = u->averageLatencyUs ? (u->averageLatencyUs + u->lastLatencyUs) / 2 : u->lastLatencyUs;
+                }
+            }
+        }
+        u->rbuf.erase(0, at);
+
+        if (len < 0 || (!u->awaiting && !u->rbuf.empty()))
+            fail(u, u->awaitingOp);
+    }
+
+public:
+    Worker() : connected(0) {}
+
+    Worker(const Worker &) = delete;
+    Worker &operator=(const Worker &) = delete;
+
+    void add(Unit *u) { units.push_back(u); }
+
+    int connectedUnits() { return connected.load(); }
+
+    // hands over everything recorded since the last call
+    Samples take()
+    {
+        Samples out;
+        std::lock_guard<std::mutex> locked(lock);
+        std::swap(out, samples);
+        return out;
+    }
+
+    void run()
+    {
+        std::vector<struct pollfd> pfds;
+        std::vector<Unit *> polled;
+
+        while (!gStop)
+        {
+            auto now = Clock::now();
+            auto nextEvent = now + std::chrono::milliseconds(LOADSIM_POLL_MS);
+
+            for (auto u : units)
+            {
+                if (u->steps.empty() && !u->awaiting && !u->connecting && now >= u->wake)
+                {
+                    bool booting = u->fd == -1;
+                    u->queueNext();
+                    u->wake = now + std::chrono::seconds(gOpts.refresh);
+                    {
+                        std::lock_guard<std::mutex> locked(lock);
+                        ++samples.refreshes;
+                    }
+                    if (booting && !u->startConnect())
+                        fail(u, OP_CONNECT);
+                }
+
+                advance(u, now);
+
+                if (u->fd != -1 && u->holdUntil > now)
+                    nextEvent = std::min(nextEvent, u->holdUntil);
+                else if (u->steps.empty() && !u->awaiting && !u->connecting)
+                    nextEvent = std::min(nextEvent, u->wake);
+            }
+
+            pfds.clear();
+            polled.clear();
+            for (auto u : units)
+            {
+                if (u->fd == -1)
+                    continue;
+                short events = (u->connecting || !u->wbuf.empty() ? POLLOUT : 0) | (u->awaiting ? POLLIN : 0);
+                if (!events)
+                    continue;
+                pfds.push_back({u->fd, events, 0});
+                polled.push_back(u);
+            }
+
+            auto waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(nextEvent - Clock::now()).count();
+            if (poll(pfds.data(), pfds.size(), (int)std::max(0L, (long)waitMs)) <= 0)
+                continue;
+
+            for (size_t i = 0; i < pfds.size(); i++)
+            {
+                auto u = polled[i];
+                // an earlier failure in this pass may have closed (and the fd been reused)
+                if (!pfds[i].revents || u->fd != pfds[i].fd)
+                    continue;
+
+                if (u->connecting)
+                {
+                    int err = 0;
+                    socklen_t errLen = sizeof(err);
+                    getsockopt(u->fd, SOL_SOCKET, SO_ERROR, &err, &errLen);
+                    if (err || (pfds[i].revents & (POLLERR | POLLHUP)))
+                    {
+                        fail(u, OP_CONNECT);
+                        continue;
+                    }
+                    u->connecting = false;
+                    ++connected;
+                    record(OP_CONNECT, u->sentAt, 0);
+                    continue;
+                }
+
+                if (pfds[i].revents & POLLOUT)
+                    flush(u);
+                if (u->fd != -1 && (pfds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+                    receive(u);
+            }
+        }
+
+        for (auto u : units)
+            u->close();
+    }
+};
+
+// INFO's "field:value" lines, with commandstats' "cmdstat_x:calls=..,usec=.." split into cmdstat_x.calls etc.
+static std::map<std::string, double> serverInfo(RespClient &redis)
+{
+    std::map<std::string, double> info;
+    std::istringstream lines(redis.command({"INFO", "all"}).str);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        auto colon = line.find(':');
+        if (line.empty() || line[0] == '#' || colon == std::string::npos)
+            continue;
+
+        auto field = line.substr(0, colon), value = line.substr(colon + 1);
+        if (field.compare(0, 8, "cmdstat_"))
+        {
+            info[field] = atof(value.c_str());
+            continue;
+        }
+
+        std::istringstream pairs(value);
+        std::string pair;
+        while (std::getline(pairs, pair, ','))
+        {
+            auto eq = pair.find('=');
+            if (eq != std::string::npos)
+                info[field + "." + pair.substr(0, eq)] = atof(pair.c_str() + eq + 1);
+        }
+    }
+    return info;
+}
+
+static uint32_t percentile(std::vector<uint32_t> &sorted, int p)
+{
+    return sorted.empty() ? 0 : sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)];
+}
+
+static void merge(Samples &into, Samples &from)
+{
+    for (int i = 0; i < OP_COUNT; i++)
+    {
+        into.us[i].insert(into.us[i].end(), from.us[i].begin(), from.us[i].end());
+        into.errors[i] += from.errors[i];
+    }
+    into.commands += from.commands;
+    into.roundTrips += from.roundTrips;
+    into.refreshes += from.refreshes;
+}
+
+// appends a command to redis's pipeline, counting the replies to read
+struct SeedPipeline
+{
+    RespClient &redis;
+    size_t pending = 0;
+
+    SeedPipeline(RespClient &r) : redis(r) {}
+
+    void command(const std::vector<std::string> &args)
+    {
+        redis.append(args);
+        ++pending;
+    }
+
+    bool exec()
+    {
+        if (!redis.flush())
+            return false;
+
+        bool ok = true;
+        for (; pending; --pending)
+        {
+            RespReply reply;
+            if (!redis.read(reply))
+                return false;
+            ok = ok && reply.ok();
+        }
+        return ok;
+    }
+};
+
+static bool seed(RespClient &redis, std::vector<Unit *> &units, std::vector<std::string> &createdLists)
+{
+    SeedPipeline pipeline(redis);
+    auto now = (long)time(NULL);
+
+    // the sensor lists are shared by every unit, and normally written by the sensors themselves
+    std::set<std::string> seen;
+    for (auto &d : gOpts.displays)
+    {
+        if (!seen.insert(d.key).second || redis.command({"EXISTS", d.key}).integer)
+            continue;
+
+        for (int i = 0; i < std::max(LOADSIM_SEED_ELEMENTS, d.end + 1); i++)
+        {
+            char element[64];
+            snprintf(element, sizeof(element), "[%ld.%06d, %0.2f]", now - i * 60, (i * 7919) % 1000000,
+                     70.0 + (i % 7) * 0.35);
+            pipeline.command({"RPUSH", d.key, element});
+        }
+        createdLists.push_back(d.key);
+    }
+
+    if (!redis.command({"EXISTS", "rpjios.__meta.time"}).integer)
+        pipeline.command({"HSET", "rpjios.__meta.time", "hour", "12", "minute", "0", "second", "0"});
+
+    // each unit's config as a correctly-configured unit finds it, so nothing is rewritten
+    for (auto u : units)
+    {
+        auto prefix = u->name + ":config:";
+        pipeline.command({"SET", prefix + "brightness", "2"});
+        pipeline.command({"SET", prefix + "refresh", std::to_string(gOpts.refresh)});
+        pipeline.command({"SET", prefix + "debug", "0"});
+        pipeline.command({"SET", prefix + "publishLogs", gOpts.publishLogs ? "1" : "0"});
+        pipeline.command({"SET", prefix + "pauseRefresh", "0"});
+        pipeline.command({"SET", prefix + "deepSleepMode", gOpts.deepSleep ? "1" : "0"});
+        pipeline.command({"SET", prefix + "refreshBudget", "0"});
+    }
+
+    return pipeline.exec();
+}
+
+static void cleanup(RespClient &redis, const std::vector<std::string> &createdLists)
+{
+    std::vector<std::string> keys(createdLists);
+    for (auto pattern : {gOpts.prefix + "*", "rpjios.checkin." + gOpts.prefix + "*"})
+    {
+        std::string cursor = "0";
+        do
+        {
+            auto scan = redis.command({"SCAN", cursor, "MATCH", pattern, "COUNT", "1000"});
+            if (scan.elements.size() != 2)
+                break;
+            cursor = scan.elements[0].str;
+            for (auto &k : scan.elements[1].elements)
+                keys.push_back(k.str);
+        } while (cursor != "0");
+    }
+
+    SeedPipeline pipeline(redis);
+    for (auto &k : keys)
+        pipeline.command({"DEL", k});
+    if (!pipeline.exec())
+        std::cerr << "WARNING: failed to delete every key" << std::endl;
+}
+
+static double delta(std::map<std::string, double> &before, std::map<std::string, double> &after, const std::string &field)
+{
+    return after[field] - before[field];
+}
+
+static double cpuSeconds(std::map<std::string, double> &info)
+{
+    return info["used_cpu_sys"] + info["used_cpu_user"];
+}
+
+static void progress(double elapsed, Samples &window, double seconds, int connections,
+                     std::map<std::string, double> &before, std::map<std::string, double> &after)
+{
+    std::sort(window.us[OP_LRANGE].begin(), window.us[OP_LRANGE].end());
+    std::sort(window.us[OP_HEARTBEAT].begin(), window.us[OP_HEARTBEAT].end());
+    uint64_t errors = 0;
+    for (auto e : window.errors)
+        errors += e;
+
+    fprintf(stderr, "[%5.0fs] %d/%d units connected, %.0f cmd/s, %llu errors; server %.0f ops/s, %.1f%% CPU, %.2fMB;"
+                    " LRANGE p50/p99 %u/%uus, heartbeat %u/%uus\n",
+            elapsed, connections, gOpts.units, window.commands / seconds, (unsigned long long)errors,
+            delta(before, after, "total_commands_processed") / seconds,
+            100.0 * (cpuSeconds(after) - cpuSeconds(before)) / seconds, after["used_memory"] / 1048576.0,
+            percentile(window.us[OP_LRANGE], 50), percentile(window.us[OP_LRANGE], 99),
+            percentile(window.us[OP_HEARTBEAT], 50), percentile(window.us[OP_HEARTBEAT], 99));
+}
+
+static void summarize(Samples &total, double seconds, std::map<std::string, double> &before,
+                      std::map<std::string, double> &after)
+{
+    auto ops = delta(before, after, "total_commands_processed") / seconds;
+    auto cpu = 100.0 * (cpuSeconds(after) - cpuSeconds(before)) / seconds;
+    auto refreshes = std::max((uint64_t)1, total.refreshes);
+
+    // each command's server-side cost over the measured window, from INFO commandstats
+    std::map<std::string, double> usecPerCall;
+    for (auto &f : after)
+    {
+        auto dot = f.first.rfind(".calls");
+        if (f.first.compare(0, 8, "cmdstat_") || dot == std::string::npos)
+            continue;
+        auto cmd = f.first.substr(8, dot - 8);
+        auto calls = delta(before, after, f.first);
+        if (calls > 0)
+            usecPerCall[cmd] = delta(before, after, "cmdstat_" + cmd + ".usec") / calls;
+    }
+
+    for (auto &us : total.us)
+        std::sort(us.begin(), us.end());
+
+    if (gOpts.json)
+    {
+        printf("{ \"units\": %d, \"refresh\": %d, \"displays\": %zu, \"deepSleep\": %d, \"publishLogs\": %d,"
+               " \"msgpack\": %d, \"m5\": %d, \"seconds\": %.1f,",
+               gOpts.units, gOpts.refresh, gOpts.displays.size(), gOpts.deepSleep, gOpts.publishLogs,
+               gOpts.msgpack, gOpts.m5, seconds);
+        printf(" \"perRefresh\": { \"commands\": %.2f, \"roundTrips\": %.2f },",
+               (double)total.commands / refreshes, (double)total.roundTrips / refreshes);
+        printf(" \"server\": { \"opsPerSec\": %.1f, \"cpuPercent\": %.2f, \"usedMemory\": %.0f, \"usedMemoryPeak\": %.0f,"
+               " \"usedMemoryRss\": %.0f, \"connectedClients\": %.0f, \"usecPerCall\": {",
+               ops, cpu, after["used_memory"], after["used_memory_peak"], after["used_memory_rss"],
+               after["connected_clients"]);
+        bool first = true;
+        for (auto &c : usecPerCall)
+            printf("%s \"%s\": %.2f", first ? "" : ",", c.first.c_str(), c.second), first = false;
+        printf(" } }, \"latency\": {");
+        for (int i = 0; i < OP_COUNT; i++)
+            printf("%s \"%s\": { \"count\": %zu, \"errors\": %llu, \"p50\": %u, \"p99\": %u, \"max\": %u }",
+                   i ? "," : "", opNames[i], total.us[i].size(), (unsigned long long)total.errors[i],
+                   percentile(total.us[i], 50), percentile(total.us[i], 99), percentile(total.us[i], 100));
+        printf(" } }\n");
+        return;
+    }
+
+    printf("\n%d %s units, refresh %ds, %zu displays%s%s%s; measured over %.0fs\n", gOpts.units,
+           gOpts.m5 ? "M5StickC" : "TM1637", gOpts.refresh, gOpts.displays.size(), gOpts.deepSleep ? ", deep-sleeping" : "",
+           gOpts.msgpack ? ", MessagePack telemetry" : "", gOpts.publishLogs ? ", publishing logs" : "", seconds);
+    printf("per refresh: %.1f commands in %.1f round trips\n", (double)total.commands / refreshes,
+           (double)total.roundTrips / refreshes);
+    printf("server: %.1f ops/s, %.2f%% CPU, %.2fMB used (peak %.2fMB, RSS %.2fMB), %.0f clients\n", ops, cpu,
+           after["used_memory"] / 1048576.0, after["used_memory_peak"] / 1048576.0,
+           after["used_memory_rss"] / 1048576.0, after["connected_clients"]);
+    if (cpu > 0)
+        printf("        one core would run out at around %.0f units like these\n", gOpts.units * 100.0 / cpu);
+    if (!usecPerCall.empty())
+    {
+        printf("server usec per call:");
+        for (auto &c : usecPerCall)
+            printf(" %s %.2f", c.first.c_str(), c.second);
+        printf("\n");
+    }
+
+    printf("\n%-14s %10s %8s %8s %8s %8s   (latency as the units saw it, us)\n", "", "count", "errors", "p50", "p99", "max");
+    for (int i = 0; i < OP_COUNT; i++)
+        if (total.us[i].size() || total.errors[i])
+            printf("%-14s %10zu %8llu %8u %8u %8u\n", opNames[i], total.us[i].size(), (unsigned long long)total.errors[i],
+                   percentile(total.us[i], 50), percentile(total.us[i], 99), percentile(total.us[i], 100));
+}
+
+static bool parseDisplays(const std::string &list)
+{
+    gOpts.displays.clear();
+    std::stringstream in(list);
+    std::string spec;
+    while (std::getline(in, spec, ','))
+    {
+        // keys contain colons themselves, so the range is whatever follows the last two
+        auto endColon = spec.rfind(':');
+        auto startColon = endColon == std::string::npos || !endColon ? std::string::npos : spec.rfind(':', endColon - 1);
+        if (startColon == std::string::npos || !startColon)
+            return false;
+        gOpts.displays.push_back({spec.substr(0, startColon), atoi(spec.c_str() + startColon + 1),
+                                  atoi(spec.c_str() + endColon + 1)});
+    }
+    return !gOpts.displays.empty();
+}
+
+int main(int argc, char **argv)
+{
+    auto usage = [&]() {
+        std::cerr << "usage:\n"
+                  << "\tzw-loadsim [redisHost[:port]] [redisPassword]\n"
+                  << "\t\t(--units N) (--refresh S) (--seconds S) (--displays key:start:end,...)\n"
+                  << "\t\t(--deep-sleep) (--publish-logs) (--msgpack) (--tm1637)\n"
+                  << "\t\t(--threads N) (--interval S) (--prefix P) (--json) (--keep)\n";
+        return -1;
+    };
+
+    if (argc < 3)
+        return usage();
+
+    for (int i = 3; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        auto hasValue = i + 1 < argc;
+
+        if (arg == "--units" && hasValue)
+            gOpts.units = std::max(1, atoi(argv[++i]));
+        else if (arg == "--refresh" && hasValue)
+            gOpts.refresh = std::max(5, atoi(argv[++i]));
+        else if (arg == "--seconds" && hasValue)
+            gOpts.seconds = std::max(1, atoi(argv[++i]));
+        else if (arg == "--displays" && hasValue)
+        {
+            if (!parseDisplays(argv[++i]))
+                return usage();
+        }
+        else if (arg == "--deep-sleep")
+            gOpts.deepSleep = true;
+        else if (arg == "--publish-logs")
+            gOpts.publishLogs = true;
+        else if (arg == "--msgpack")
+            gOpts.msgpack = true;
+        else if (arg == "--tm1637")
+            gOpts.m5 = false;
+        else if (arg == "--threads" && hasValue)
+            gOpts.threads = std::max(1, atoi(argv[++i]));
+        else if (arg == "--interval" && hasValue)
+            gOpts.interval = std::max(1, atoi(argv[++i]));
+        else if (arg == "--prefix" && hasValue)
+            gOpts.prefix = argv[++i];
+        else if (arg == "--json")
+            gOpts.json = true;
+        else if (arg == "--keep")
+            gOpts.keep = true;
+        else
+            return usage();
+    }
+
+    std::string host;
+    int port;
+    respParseHostPort(argv[1], host, port);
+    gPassword = argv[2];
+
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) || !res)
+    {
+        std::cerr << "can't resolve " << host << std::endl;
+        return -1;
+    }
+    memcpy(&gAddr, res->ai_addr, res->ai_addrlen);
+    gAddrLen = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    RespClient redis;
+    if (!redis.connect(host.c_str(), port) || !redis.auth(gPassword.c_str()))
+    {
+        std::cerr << "can't connect to " << argv[1] << std::endl;
+        return -1;
+    }
+
+    std::vector<Unit *> units;
+    for (int i = 0; i < gOpts.units; i++)
+        units.push_back(new Unit(i));
+
+    std::vector<std::string> createdLists;
+    if (!seed(redis, units, createdLists))
+    {
+        std::cerr << "failed to seed the units' keys" << std::endl;
+        return -1;
+    }
+
+    // units boot spread evenly over the first refresh period
+    auto start = Clock::now();
+    auto period = std::chrono::milliseconds(gOpts.refresh * 1000);
+    std::vector<Worker *> workers(std::min(gOpts.threads, gOpts.units));
+    for (auto &w : workers)
+        w = new Worker();
+    for (auto u : units)
+    {
+        u->wake = start + period * u->index / gOpts.units;
+        workers[u->index % workers.size()]->add(u);
+    }
+
+    std::vector<std::thread> threads;
+    for (auto w : workers)
+        threads.emplace_back([w]() { w->run(); });
+
+    auto collect = [&]() {
+        Samples window;
+        int connections = 0;
+        for (auto w : workers)
+        {
+            auto taken = w->take();
+            merge(window, taken);
+            connections += w->connectedUnits();
+        }
+        return std::make_pair(window, connections);
+    };
+    auto seconds = [](Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double>(to - from).count();
+    };
+
+    // measuring starts once every unit has booted and done its first refresh
+    auto measureFrom = start + period + std::chrono::milliseconds(gOpts.m5 ? M5_SPLASH_HOLD_MS : 0);
+    auto measureTo = measureFrom + std::chrono::seconds(gOpts.seconds);
+    auto lastReport = start;
+    auto lastInfo = serverInfo(redis);
+    std::map<std::string, double> measureInfo;
+    Samples total;
+    bool measuring = false;
+
+    fprintf(stderr, "%d units on %zu threads; ramping up for %ds, then measuring for %ds\n", gOpts.units,
+            workers.size(), gOpts.refresh, gOpts.seconds);
+
+    while (true)
+    {
+        auto nextReport = lastReport + std::chrono::seconds(gOpts.interval);
+        auto next = std::min(nextReport, measuring ? measureTo : measureFrom);
+        std::this_thread::sleep_until(next);
+        auto now = Clock::now();
+        auto collected = collect();
+        auto info = serverInfo(redis);
+
+        if (measuring)
+            merge(total, collected.first);
+
+        if (now >= nextReport || (measuring && now >= measureTo))
+        {
+            progress(seconds(start, now), collected.first, seconds(lastReport, now), collected.second, lastInfo, info);
+            lastReport = now;
+            lastInfo = info;
+        }
+
+        if (!measuring && now >= measureFrom)
+        {
+            measuring = true;
+            measureInfo = info;
+        }
+        else if (measuring && now >= measureTo)
+        {
+            summarize(total, seconds(measureFrom, now), measureInfo, info);
+            break;
+        }
+    }
+
+    gStop = true;
+    for (auto &t : threads)
+        t.join();
+
+    if (!gOpts.keep)
+        cleanup(redis, createdLists);
+
+    return 0;
+}
@@ -0,0 +1,648 @@
+// zw-logdecode.cpp
+// (C) 2019 Ryan Joseph <ryan@electricsheep.co>
+// https://github.com/rpj/zw
+//
+// Host-side decoder for ZWLOG_BINARY frames (see zw_binlog.h).
+//
+// build: g++ -std=c++11 -O2 -o zw-logdecode zw-logdecode.cpp
+//
+// usage, one of:
+// ./zw-logdecode table [*.h *.cpp *.ino] > zero_watch-vX.logtable
+//      scan zlog()/dprint() call sites and write the site table
+// ./zw-logdecode selftest
+//      check the scan and decode against sources with macro-expanded call sites
+// ./zw-logdecode serial [logtable] (captureFile)
+//      decode frames from a serial capture (default stdin); other bytes pass through
+// ./zw-logdecode redis [logtable] [targetHostname] (redisHost[:port]) (redisPassword)
+//      subscribe to HOSTNAME:info:publishLogs:bin and decode as frames arrive
+//
+// In place of a logtable file, "-s" followed by source paths (terminated by "--")
+// builds the table on the fly from a checkout matching the running firmware.
+
+#include "zw_resp.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cinttypes>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#define ZWBINLOG_SYNC0 0xA5
+#define ZWBINLOG_SYNC1 0x5A
+#define ZWBINLOG_SITE_DROPPED 0
+
+struct CallSite
+{
+    std::string where;
+    std::string fmt;
+};
+
+typedef std::map<uint32_t, CallSite> SiteTable;
+
+// must match zwBinLogSiteId() in zw_binlog.h
+static uint32_t fnv(const std::string &s, uint32_t h = 2166136261u)
+{
+    for (unsigned char c : s)
+        h = (h ^ c) * 16777619u;
+    return h;
+}
+
+static uint32_t siteId(const std::string &basename, const std::string &fmt)
+{
+    return fnv(fmt, fnv(basename) * 16777619u);
+}
+
+struct Token
+{
+    enum Kind { Ident, String, Punct } kind;
+    std::string text;
+    int line;
+};
+
+static bool isIdentChar(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static std::string unescape(const std::string &lit)
+{
+    std::string out;
+    for (size_t i = 0; i < lit.size(); i++)
+    {
+        if (lit[i] != '\\' || i + 1 == lit.size())
+        {
+            out += lit[i];
+            continue;
+        }
+
+        switch (lit[++i])
+        {
+        case 'n': out += '\n'; break;
+        case 't': out += '\t'; break;
+        case 'r': out += '\r'; break;
+        case '0': out += '\0'; break;
+        default: out += lit[i]; break;
+        }
+    }
+    return out;
+}
+
+// just enough of a C++ lexer to find call sites: skips comments, char literals and
+// preprocessor lines (collecting string-valued #defines into stringMacros as it goes),
+// except for function-like macros' bodies, whose calls are sites like any other
+static std::vector<Token> lex(const std::string &src, std::map<std::string, std::string> &stringMacros,
+                              int firstLine = 1, bool directives = true)
+{
+    std::vector<Token> toks;
+    int line = firstLine;
+    bool lineStart = directives;
+
+    for (size_t i = 0; i < src.size();)
+    {
+        auto c = src[i];
+
+        if (c == '\n')
+        {
+            ++line, ++i, lineStart = directives;
+            continue;
+        }
+
+        if (isspace((unsigned char)c))
+        {
+            ++i;
+            continue;
+        }
+
+        if (lineStart && c == '#')
+        {
+            auto start = i;
+            while (i < src.size() && !(src[i] == '\n' && src[i - 1] != '\\'))
+                line += src[i++] == '\n';
+
+            auto text = src.substr(start + 1, i - start - 1);
+            std::istringstream directive(text);
+            std::string kw, name, rest;
+            directive >> kw >> name;
+            std::getline(directive, rest);
+            auto q0 = rest.find('"'), q1 = rest.rfind('"');
+            auto params = name.find('(');
+            if (kw == "define" && q0 != std::string::npos && q1 > q0 && params == std::string::npos)
+                stringMacros[name] = unescape(rest.substr(q0 + 1, q1 - q0 - 1));
+
+            if (kw == "define" && params != std::string::npos)
+            {
+                // the body follows the parameter list; its continuations' backslashes are dropped
+                auto close = text.find(')', text.find(name) + params);
+                if (close != std::string::npos)
+                {
+                    auto body = text.substr(close + 1);
+                    for (size_t b = 0; b + 1 < body.size(); b++)
+                        if (body[b] == '\\' && (body[b + 1] == '\n' || body[b + 1] == '\r'))
+                            body[b] = ' ';
+                    auto bodyLine = line - (int)std::count(body.begin(), body.end(), '\n');
+                    auto bodyToks = lex(body, stringMacros, bodyLine, false);
+                    toks.insert(toks.end(), bodyToks.begin(), bodyToks.end());
+                }
+            }
+            continue;
+        }
+
+        lineStart = false;
+
+        if (c == '/' && i + 1 < src.size() && src[i + 1] == '/')
+        {
+            while (i < src.size() && src[i] != '\n')
+                ++i;
+        }
+        else if (c == '/' && i + 1 < src.size() && src[i + 1] == '*')
+        {
+            for (i += 2; i + 1 < src.size() && !(src[i] == '*' && src[i + 1] == '/'); i++)
+                line += src[i] == '\n';
+            i += 2;
+        }
+        else if (c == '"' || c == '\'')
+        {
+            auto start = ++i;
+            while (i < src.size() && src[i] != c)
+                i += src[i] == '\\' ? 2 : 1;
+            if (c == '"')
+                toks.push_back({Token::String, unescape(src.substr(start, i - start)), line});
+            ++i;
+        }
+        else if (isIdentChar(c))
+        {
+            auto start = i;
+            while (i < src.size() && isIdentChar(src[i]))
+                ++i;
+            toks.push_back({Token::Ident, src.substr(start, i - start), line});
+        }
+        else
+        {
+            toks.push_back({Token::Punct, std::string(1, c), line});
+            ++i;
+        }
+    }
+
+    return toks;
+}
+
+typedef std::vector<std::pair<std::string, std::string>> Sources;
+
+// sources are (basename, text) pairs
+static void scanTexts(const Sources &sources, SiteTable &table)
+{
+    std::map<std::string, std::string> stringMacros;
+    std::vector<std::pair<std::string, std::vector<Token>>> lexed;
+    for (auto &source : sources)
+        lexed.push_back({source.first, lex(source.second, stringMacros)});
+
+    // macros are collected first so that e.g. "v" ZEROWATCH_VER resolves regardless of file order
+    for (auto &file : lexed)
+    {
+        auto &toks = file.second;
+        for (size_t i = 0; i + 2 < toks.size(); i++)
+        {
+            if (toks[i].kind != Token::Ident || (toks[i].text != "zlog" && toks[i].text != "dprint") ||
+                toks[i + 1].text != "(" || (i && (toks[i - 1].text == "." || toks[i - 1].text == ">")))
+                continue;
+
+            std::string fmt;
+            size_t j = i + 2;
+            for (; j < toks.size() && toks[j].text != "," && toks[j].text != ")"; j++)
+            {
+                if (toks[j].kind == Token::String)
+                    fmt += toks[j].text;
+                else if (toks[j].kind == Token::Ident && stringMacros.count(toks[j].text))
+                    fmt += stringMacros[toks[j].text];
+            }
+
+            // the same format twice in a file is one site, which decodes the same either way
+            auto id = siteId(file.first, fmt);
+            auto where = file.first + ":" + std::to_string(toks[i].line);
+            if (table.count(id) && table[id].fmt != fmt)
+                std::cerr << "WARNING: site ID collision between " << table[id].where
+                          << " and " << where << std::endl;
+            if (!table.count(id))
+                table[id] = {where, fmt};
+        }
+    }
+}
+
+static bool scanSources(const std::vector<std::string> &paths, SiteTable &table)
+{
+    Sources sources;
+    for (auto &path : paths)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            std::cerr << "can't read " << path << std::endl;
+            return false;
+        }
+        std::stringstream ss;
+        ss << in.rdbuf();
+        auto slash = path.find_last_of("/\\");
+        sources.push_back({slash == std::string::npos ? path : path.substr(slash + 1), ss.str()});
+    }
+
+    scanTexts(sources, table);
+    return true;
+}
+
+static std::string escape(const std::string &s)
+{
+    std::string out;
+    for (auto c : s)
+    {
+        if (c == '\n') out += "\\n";
+        else if (c == '\t') out += "\\t";
+        else if (c == '\r') out += "\\r";
+        else if (c == '\\') out += "\\\\";
+        else out += c;
+    }
+    return out;
+}
+
+static bool loadTable(const std::string &path, SiteTable &table)
+{
+    std::ifstream in(path);
+    if (!in)
+        return false;
+
+    std::string line;
+    while (std::getline(in, line))
+    {
+        // <id hex> <file:line> <escaped format>
+        std::istringstream ls(line);
+        std::string idStr, where;
+        if (!(ls >> idStr >> where))
+            continue;
+        std::string fmt;
+        std::getline(ls, fmt);
+        if (!fmt.empty() && fmt[0] == ' ')
+            fmt.erase(0, 1);
+        table[(uint32_t)strtoul(idStr.c_str(), NULL, 16)] = {where, unescape(fmt)};
+    }
+    return true;
+}
+
+struct Arg
+{
+    char tag;
+    uint64_t bits;
+    double d;
+    std::string s;
+};
+
+static bool parseArgs(const uint8_t *p, size_t len, std::vector<Arg> &args)
+{
+    for (size_t i = 0; i < len;)
+    {
+        Arg a = {(char)p[i++], 0, 0.0, ""};
+        switch (a.tag)
+        {
+        case 'i': case 'u': case 'p':
+            if (i + 4 > len) return false;
+            a.bits = (uint32_t)p[i] | (uint32_t)p[i + 1] << 8 | (uint32_t)p[i + 2] << 16 | (uint32_t)p[i + 3] << 24;
+            if (a.tag == 'i')
+                a.bits = (uint64_t)(int64_t)(int32_t)a.bits;
+            i += 4;
+            break;
+        case 'l': case 'L': case 'd':
+            if (i + 8 > len) return false;
+            for (int b = 7; b >= 0; b--)
+                a.bits = (a.bits << 8) | p[i + b];
+            memcpy(&a.d, &a.bits, 8);
+            i += 8;
+            break;
+        case 's':
+            if (i + 1 > len || i + 1 + p[i] > len) return false;
+            a.s.assign((const char *)p + i + 1, p[i]);
+            i += 1 + p[i];
+            break;
+        default:
+            return false;
+        }
+        args.push_back(a);
+    }
+    return true;
+}
+
+// re-runs each conversion spec on the host, letting the on-wire tag (the type the
+// device actually passed) decide the C type rather than the spec's length modifier
+static std::string format(const std::string &fmt, const std::vector<Arg> &args)
+{
+    std::string out;
+    size_t argIdx = 0;
+    char buf[512];
+
+    for (size_t i = 0; i < fmt.size(); i++)
+    {
+        if (fmt[i] != '%')
+        {
+            out += fmt[i];
+            continue;
+        }
+
+        auto start = i++;
+        if (i < fmt.size() && fmt[i] == '%')
+        {
+            out += '%';
+            continue;
+        }
+
+        std::string flags;
+        while (i < fmt.size() && strchr("-+ #0123456789.", fmt[i]))
+            flags += fmt[i++];
+        while (i < fmt.size() && strchr("hljztL", fmt[i]))
+            ++i;
+        if (i >= fmt.size())
+            break;
+
+        auto conv = fmt[i];
+        if (argIdx >= args.size())
+        {
+            out += fmt.substr(start, i - start + 1);
+            continue;
+        }
+
+        auto &a = args[argIdx++];
+        auto intConv = strchr("diouxXc", conv) ? conv : 'd';
+        auto fltConv = strchr("fFeEgGaA", conv) ? conv : 'f';
+
+        switch (a.tag)
+        {
+        case 'i': case 'l':
+            if (strchr("fFeEgGaA", conv))
+                snprintf(buf, sizeof(buf), ("%" + flags + fltConv).c_str(), (double)(int64_t)a.bits);
+            else
+                snprintf(buf, sizeof(buf), ("%" + flags + "ll" + intConv).c_str(), (long long)a.bits);
+            break;
+        case 'u': case 'L':
+            if (strchr("fFeEgGaA", conv))
+                snprintf(buf, sizeof(buf), ("%" + flags + fltConv).c_str(), (double)a.bits);
+            else
+                snprintf(buf, sizeof(buf), ("%" + flags + "ll" + intConv).c_str(), (unsigned long long)a.bits);
+            break;
+        case 'd':
+            snprintf(buf, sizeof(buf), ("%" + flags + fltConv).c_str(), a.d);
+            break;
+        case 'p':
+            snprintf(buf, sizeof(buf), "0x%08" PRIx64, a.bits);
+            break;
+        case 's':
+            snprintf(buf, sizeof(buf), ("%" + flags + "s").c_str(), a.s.c_str());
+            break;
+        }
+        out += buf;
+    }
+
+    return out;
+}
+
+static std::string decodeFrame(const uint8_t *body, size_t len, const SiteTable &table, uint32_t *tsOut)
+{
+    if (len < 8)
+        return "<short frame>";
+
+    uint32_t site, ts;
+    memcpy(&site, body, 4);
+    memcpy(&ts, body + 4, 4);
+    if (tsOut)
+        *tsOut = ts;
+
+    std::vector<Arg> args;
+    auto argsOk = parseArgs(body + 8, len - 8, args);
+
+    std::string fmt;
+    if (site == ZWBINLOG_SITE_DROPPED)
+    {
+        fmt = "[zwlog] dropped %lu lines";
+    }
+    else
+    {
+        auto found = table.find(site);
+        if (found == table.end())
+        {
+            std::string unknown = "<unknown site " + std::to_string(site) + ">";
+            for (auto &a : args)
+                unknown += " " + (a.tag == 's' ? a.s : std::to_string((long long)a.bits));
+            return unknown + "\n";
+        }
+        fmt = found->second.fmt;
+    }
+
+    auto text = format(fmt, args);
+    if (!argsOk)
+        text += " <truncated args>";
+    return text;
+}
+
+static int decodeSerial(std::istream &in, const SiteTable &table)
+{
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    auto p = (const uint8_t *)data.data();
+
+    for (size_t i = 0; i < data.size();)
+    {
+        if (i + 3 <= data.size() && p[i] == ZWBINLOG_SYNC0 && p[i + 1] == ZWBINLOG_SYNC1 &&
+            i + 3 + p[i + 2] <= data.size())
+        {
+            std::cout << decodeFrame(p + i + 3, p[i + 2], table, NULL) << std::flush;
+            i += 3 + p[i + 2];
+        }
+        else
+        {
+            std::cout << (char)p[i++];
+        }
+    }
+
+    return 0;
+}
+
+static int decodeRedis(const std::string &hostname, const std::string &hostPort,
+                       const std::string &password, const SiteTable &table)
+{
+    std::string host;
+    int port;
+    respParseHostPort(hostPort, host, port);
+
+    RespClient redis;
+    if (!redis.connect(host.c_str(), port) || !redis.auth(password.c_str()))
+    {
+        std::cerr << "can't connect to " << hostPort << std::endl;
+        return -1;
+    }
+
+    auto channel = hostname + ":info:publishLogs:bin";
+    redis.append({"SUBSCRIBE", channel});
+    redis.flush();
+    redis.setTimeout(-1);
+    std::cerr << "subscribed to " << channel << std::endl;
+
+    RespReply msg;
+    while (redis.read(msg))
+    {
+        if (msg.elements.size() != 3 || msg.elements[0].str != "message")
+            continue;
+
+        auto &frame = msg.elements[2].str;
+        auto p = (const uint8_t *)frame.data();
+        if (frame.size() < 3 || p[0] != ZWBINLOG_SYNC0 || p[1] != ZWBINLOG_SYNC1)
+        {
+            std::cerr << "<bad frame of " << frame.size() << " bytes>" << std::endl;
+            continue;
+        }
+
+        uint32_t ts = 0;
+        auto text = decodeFrame(p + 3, std::min((size_t)p[2], frame.size() - 3), table, &ts);
+        if (!text.empty() && text.back() == '\n')
+            text.pop_back();
+        std::cout << "[" << hostname << " " << ts << "] " << text << std::endl;
+    }
+
+    return 0;
+}
+
+// scans a source with the awkward kinds of call site (a format built from a string macro,
+// a call spanning lines, calls in macro bodies, one macro expanding another), then decodes
+// frames encoded for each as the device would
+static int selfTest()
+{
+    static const char source[] =
+        "#define VER \"1.2\"\n"
+        "#define UPDATE_IF_CHANGED(field)                    \\\n"
+        "    if (cur.field != last.field)                    \\\n"
+        "    {                                               \\\n"
+        "        zlog(\"[Config] %s -> %d\\n\", #field, cur.field); \\\n"
+        "    }\n"
+        "#define CHECKED(field, cond)                        \\\n"
+        "    if (!(cond))                                    \\\n"
+        "        zlog(\"Redis has invalid %s, %d\\n\",         \\\n"
+        "             #field, cur.field);                    \\\n"
+        "    else                                            \\\n"
+        "        UPDATE_IF_CHANGED(field)\n"
+        "void refresh()\n"
+        "{\n"
+        "    zlog(\"v\" VER \" up %lu\\n\",\n"
+        "         uptime);\n"
+        "    CHECKED(refresh, cur.refresh >= 5);\n"
+        "}\n";
+
+    struct Case
+    {
+        std::string fmt, where, arg;
+        int32_t value;
+        std::string expected;
+    } cases[] = {
+        {"v1.2 up %lu\n", "selftest.ino:15", "", 42, "v1.2 up 42\n"},
+        {"[Config] %s -> %d\n", "selftest.ino:5", "refresh", 10, "[Config] refresh -> 10\n"},
+        {"Redis has invalid %s, %d\n", "selftest.ino:9", "refresh", 2, "Redis has invalid refresh, 2\n"},
+    };
+
+    SiteTable table;
+    scanTexts({{"selftest.ino", source}}, table);
+
+    int failures = 0;
+    if (table.size() != sizeof(cases) / sizeof(cases[0]))
+    {
+        std::cerr << "FAIL: " << table.size() << " sites scanned" << std::endl;
+        ++failures;
+    }
+
+    for (auto &c : cases)
+    {
+        auto id = siteId("selftest.ino", c.fmt);
+        std::string body((const char *)&id, 4);
+        body.append(4, '\0');
+        if (!c.arg.empty())
+            body += 's' + std::string(1, (char)c.arg.size()) + c.arg;
+        body += c.arg.empty() ? 'u' : 'i';
+        body.append((const char *)&c.value, 4);
+
+        auto found = table.find(id);
+        auto text = decodeFrame((const uint8_t *)body.data(), body.size(), table, NULL);
+        if (found == table.end() || found->second.where != c.where || text != c.expected)
+        {
+            std::cerr << "FAIL: \"" << escape(c.fmt) << "\" decoded as \"" << escape(text) << "\""
+                      << (found == table.end() ? " (no site)" : " at " + found->second.where) << std::endl;
+            ++failures;
+        }
+    }
+
+    std::cerr << (failures ? "selftest failed" : "selftest passed") << std::endl;
+    return failures ? -1 : 0;
+}
+
+static int usage()
+{
+    std::cerr << "usage:\n"
+              << "\tzw-logdecode table [sources...]\n"
+              << "\tzw-logdecode selftest\n"
+              << "\tzw-logdecode serial [logtable | -s sources... --] (captureFile)\n"
+              << "\tzw-logdecode redis [logtable | -s sources... --] [hostname] (redisHost[:port]) (redisPassword)\n";
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 2 && std::string(argv[1]) == "selftest")
+        return selfTest();
+
+    if (argc < 3)
+        return usage();
+
+    std::string mode = argv[1];
+    std::vector<std::string> rest(argv + 2, argv + argc);
+    SiteTable table;
+
+    if (mode == "table")
+    {
+        if (!scanSources(rest, table))
+            return -1;
+        for (auto &e : table)
+        {
+            char id[16];
+            snprintf(id, sizeof(id), "%08x", e.first);
+            std::cout << id << " " << e.second.where << " " << escape(e.second.fmt) << "\n";
+        }
+        return 0;
+    }
+
+    size_t next = 0;
+    if (rest[0] == "-s")
+    {
+        std::vector<std::string> sources;
+        for (next = 1; next < rest.size() && rest[next] != "--"; next++)
+            sources.push_back(rest[next]);
+        if (!scanSources(sources, table))
+            return -1;
+        ++next;
+    }
+    else if (!loadTable(rest[next++], table))
+    {
+        std::cerr << "can't read log table " << rest[0] << std::endl;
+        return -1;
+    }
+
+    if (mode == "serial")
+    {
+        if (next < rest.size())
+        {
+            std::ifstream in(rest[next], std::ios::binary);
+            return decodeSerial(in, table);
+        }
+        return decodeSerial(std::cin, table);
+    }
+
+    if (mode == "redis" && next < rest.size())
+    {
+        return decodeRedis(rest[next],
+                           next + 1 < rest.size() ? rest[next + 1] : "127.0.0.1",
+                           next + 2 < rest.size() ? rest[next + 2] : "", table);
+    }
+
+    return usage();
+}
@@ -0,0 +1,580 @@
+// zw-replay.cpp
+// (C) 2019 Ryan Joseph <ryan@electricsheep.co>
+// https://github.com/rpj/zw
+//
+// Serves a capture of a unit's Redis traffic (see zw_capture.h) back to the firmware as a fake
+// Redis server, so a refresh seen in the field -- its list contents, reply sizes and reply
+// latencies -- can be replayed against any firmware version, on a unit or the host build.
+//
+// Each command the firmware sends is matched, by name and key, against the next ones in the
+// capture and gets the reply recorded for it, after the delay that reply took in the field
+// (unless --no-delay). Commands the capture doesn't have (the connection's AUTH, the boot
+// sequence, anything a newer firmware added) get a plausible empty reply and are counted as
+// unexpected; recorded commands the firmware didn't send are counted as skipped. At the end
+// of each recorded refresh its replayed duration -- the firmware's own time between commands,
+// with Redis' held to the recording -- is printed against the recorded one.
+//
+// build: g++ -std=c++11 -O2 -pthread -o zw-replay zw-replay.cpp
+//
+// usage, one of:
+// ./zw-replay fetch [redisHost[:port]] [redisPassword] [hostname] [out.zwc]
+//      save a unit's capture from HOSTNAME:info:capture
+// ./zw-replay serial [out.zwc] (serialLog)
+//      extract the last complete capture dumped in a serial log (default stdin)
+// ./zw-replay show [capture.zwc]
+//      print every command in the capture with its reply and latency
+// ./zw-replay serve [capture.zwc] (port, default 6379) (--no-delay) (--once)
+//      serve it, from the start again once it runs out unless --once (which then exits)
+
+#include "zw_resp.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+#define ZWCAPTURE_MAGIC "ZWCP"
+#define ZWCAPTURE_FORMAT 1
+#define ZWCAPTURE_SERIAL_PREFIX "ZWCAPTURE "
+#define ZWCAPTURE_RECORD_LEN 7
+
+// how far ahead of where the replay has got to a command is looked for
+#define REPLAY_LOOKAHEAD 64
+
+enum ZWCaptureKind
+{
+    ZWCAP_INFO = 0,
+    ZWCAP_CONNECT,
+    ZWCAP_REFRESH,
+    ZWCAP_SENT,
+    ZWCAP_RECEIVED,
+};
+
+// a command and the reply it got, as captured
+struct Exchange
+{
+    std::vector<std::string> args;
+    std::string reply;
+    uint32_t sentUs;
+    uint32_t replyUs;
+    int refresh;
+};
+
+struct Capture
+{
+    std::string info;
+    bool truncated = false;
+    std::vector<Exchange> exchanges;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static std::string upper(std::string s)
+{
+    for (auto &c : s)
+        c = toupper((unsigned char)c);
+    return s;
+}
+
+// the arguments of the complete command at the start of buf, which is consumed
+static bool takeCommand(std::string &buf, std::vector<std::string> &args)
+{
+    auto len = respMessageLength(buf.data(), buf.size());
+    if (len <= 0)
+        return false;
+
+    RespReply command;
+    respParse(buf.data(), len, command);
+    args.clear();
+    for (auto &a : command.elements)
+        args.push_back(a.str);
+    buf.erase(0, len);
+    return !args.empty();
+}
+
+static bool parse(const std::string &raw, Capture &capture)
+{
+    auto p = (const uint8_t *)raw.data();
+    auto end = p + raw.size();
+    if (raw.size() < 5 || raw.compare(0, 4, ZWCAPTURE_MAGIC) || p[4] != ZWCAPTURE_FORMAT)
+    {
+        std::cerr << "not a capture (or not a version this understands)" << std::endl;
+        return false;
+    }
+
+    std::string sent, received;
+    std::vector<size_t> awaiting;
+    uint32_t sentUs = 0;
+    int refresh = 0;
+
+    for (p += 5; p < end;)
+    {
+        if (end - p < ZWCAPTURE_RECORD_LEN)
+        {
+            capture.truncated = true;
+            break;
+        }
+
+        auto us = le32(p);
+        auto kind = p[4];
+        size_t len = p[5] | (p[6] << 8);
+        p += ZWCAPTURE_RECORD_LEN;
+        if ((size_t)(end - p) < len)
+        {
+            capture.truncated = true;
+            break;
+        }
+        std::string data((const char *)p, len);
+        p += len;
+
+        switch (kind)
+        {
+        case ZWCAP_INFO:
+            capture.info = data;
+            break;
+        case ZWCAP_CONNECT:
+            // whatever was in flight on the last connection never got its reply
+            while (!awaiting.empty())
+                capture.exchanges.erase(capture.exchanges.begin() + awaiting.back()), awaiting.pop_back();
+            sent.clear(), received.clear();
+            break;
+        case ZWCAP_REFRESH:
+            refresh = data.size() == 2 ? (uint8_t)data[0] | ((uint8_t)data[1] << 8) : refresh + 1;
+            break;
+        case ZWCAP_SENT:
+        {
+            if (sent.empty())
+                sentUs = us;
+            sent += data;
+            std::vector<std::string> args;
+            while (takeCommand(sent, args))
+            {
+                awaiting.push_back(capture.exchanges.size());
+                capture.exchanges.push_back({args, "", sentUs, 0, refresh});
+            }
+            break;
+        }
+        case ZWCAP_RECEIVED:
+        {
+            received += data;
+            long len;
+            while (!awaiting.empty() && (len = respMessageLength(received.data(), received.size())) > 0)
+            {
+                auto &x = capture.exchanges[awaiting.front()];
+                x.reply = received.substr(0, len);
+                x.replyUs = us;
+                received.erase(0, len);
+                awaiting.erase(awaiting.begin());
+            }
+            break;
+        }
+        default:
+            std::cerr << "WARNING: unknown record kind " << (int)kind << std::endl;
+        }
+    }
+
+    // the capture ended (or was cut short) before these were answered
+    while (!awaiting.empty())
+        capture.exchanges.erase(capture.exchanges.begin() + awaiting.back()), awaiting.pop_back();
+
+    if (capture.truncated)
+        std::cerr << "WARNING: the capture is truncated; replaying what there is of it" << std::endl;
+    return true;
+}
+
+static bool load(const char *path, Capture &capture)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::string raw((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (!in && raw.empty())
+    {
+        std::cerr << path << ": can't read" << std::endl;
+        return false;
+    }
+    return parse(raw, capture);
+}
+
+static bool save(const char *path, const std::string &raw)
+{
+    Capture check;
+    if (!parse(raw, check))
+        return false;
+
+    std::ofstream out(path, std::ios::binary);
+    out.write(raw.data(), raw.size());
+    if (!out)
+    {
+        std::cerr << path << ": can't write" << std::endl;
+        return false;
+    }
+
+    std::cout << check.info << ": " << check.exchanges.size() << " commands, " << raw.size() << " bytes" << std::endl;
+    return true;
+}
+
+static int fetch(const std::string &hostPort, const std::string &password, const std::string &unit, const char *path)
+{
+    std::string host;
+    int port;
+    respParseHostPort(hostPort, host, port);
+
+    RespClient redis;
+    if (!redis.connect(host.c_str(), port) || !redis.auth(password.c_str()))
+    {
+        std::cerr << "can't connect to " << hostPort << std::endl;
+        return -1;
+    }
+
+    auto capture = redis.command({"GET", unit + ":info:capture"});
+    if (!capture.ok() || capture.null)
+    {
+        std::cerr << "no capture for " << unit << std::endl;
+        return -1;
+    }
+
+    return save(path, capture.str) ? 0 : -1;
+}
+
+static int serial(const char *path, std::istream &in)
+{
+    std::string line, hex, complete;
+    while (std::getline(in, line))
+    {
+        auto at = line.find(ZWCAPTURE_SERIAL_PREFIX);
+        if (at == std::string::npos)
+            continue;
+
+        auto rest = line.substr(at + strlen(ZWCAPTURE_SERIAL_PREFIX));
+        while (!rest.empty() && isspace((unsigned char)rest.back()))
+            rest.pop_back();
+
+        if (!rest.compare(0, 4, "end "))
+        {
+            std::string raw;
+            for (size_t i = 0; i + 1 < hex.size(); i += 2)
+                raw += (char)strtoul(hex.substr(i, 2).c_str(), NULL, 16);
+            if (raw.size() == strtoul(rest.c_str() + 4, NULL, 10))
+                complete = raw;
+            else
+                std::cerr << "WARNING: skipping a capture with missing lines" << std::endl;
+            hex.clear();
+        }
+        else
+        {
+            hex += rest;
+        }
+    }
+
+    if (complete.empty())
+    {
+        std::cerr << "no complete capture found" << std::endl;
+        return -1;
+    }
+    return save(path, complete) ? 0 : -1;
+}
+
+static std::string describeReply(const std::string &reply)
+{
+    RespReply r;
+    respParse(reply.data(), reply.size(), r);
+    char out[96];
+    switch (r.type)
+    {
+    case '$':
+        if (r.null)
+            return "(nil)";
+        snprintf(out, sizeof(out), "%zu bytes", r.str.size());
+        return out;
+    case '*':
+        snprintf(out, sizeof(out), "%zu elements, %zu bytes", r.elements.size(), reply.size());
+        return out;
+    case ':':
+        return std::to_string(r.integer);
+    default:
+        return r.str.substr(0, 60);
+    }
+}
+
+static int show(const char *path)
+{
+    Capture capture;
+    if (!load(path, capture))
+        return -1;
+
+    std::cout << capture.info << ", " << capture.exchanges.size() << " commands" << std::endl;
+    int refresh = -1;
+    for (auto &x : capture.exchanges)
+    {
+        if (x.refresh != refresh)
+            std::cout << "refresh " << (refresh = x.refresh) << std::endl;
+
+        std::string command;
+        for (size_t i = 0; i < x.args.size() && i < 3; i++)
+            command += (i ? " " : "") + (x.args[i].size() > 48 ? x.args[i].substr(0, 45) + "..." : x.args[i]);
+        if (x.args.size() > 3)
+            command += " ...";
+
+        printf("  %10.3fms %8uus  %-64s %s\n", x.sentUs / 1000.0, x.replyUs - x.sentUs, command.c_str(),
+               describeReply(x.reply).c_str());
+    }
+    return 0;
+}
+
+// the same command on the same key (and hash field, for the hash commands), whatever its value
+static bool sameTarget(const std::vector<std::string> &args, const std::vector<std::string> &recorded)
+{
+    auto name = upper(args[0]);
+    if (name != upper(recorded[0]) || args.size() != recorded.size() || (args.size() > 1 && args[1] != recorded[1]))
+        return false;
+
+    auto hash = name == "HGET" || name == "HSET" || name == "HDEL" || name == "HEXISTS" || name == "HINCRBY";
+    return !hash || args.size() < 3 || args[2] == recorded[2];
+}
+
+// what a command the capture doesn't have is told, so the firmware carries on
+static std::string fallbackReply(const std::vector<std::string> &args)
+{
+    auto cmd = upper(args.empty() ? "" : args[0]);
+    if (cmd == "AUTH" || cmd == "SET" || cmd == "SELECT")
+        return "+OK\r\n";
+    if (cmd == "PING")
+        return "+PONG\r\n";
+    if (cmd == "GET" || cmd == "HGET" || cmd == "GETRANGE" || cmd == "LINDEX")
+        return "$-1\r\n";
+    if (cmd == "LRANGE" || cmd == "HKEYS" || cmd == "HGETALL" || cmd == "KEYS" || cmd == "SMEMBERS")
+        return "*0\r\n";
+    if (cmd == "HMGET")
+    {
+        std::string reply = "*" + std::to_string(args.size() > 2 ? args.size() - 2 : 0) + "\r\n";
+        for (size_t i = 2; i < args.size(); i++)
+            reply += "$-1\r\n";
+        return reply;
+    }
+    if (cmd == "TIME")
+    {
+        // the real time, so a replayed unit's clock still syncs
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::system_clock::now().time_since_epoch())
+                      .count();
+        auto secs = std::to_string(us / 1000000), micros = std::to_string(us % 1000000);
+        return "*2\r\n$" + std::to_string(secs.size()) + "\r\n" + secs + "\r\n$" +
+               std::to_string(micros.size()) + "\r\n" + micros + "\r\n";
+    }
+    if (cmd == "XADD")
+        return "$3\r\n0-1\r\n";
+    if (cmd == "INCR")
+        return ":1\r\n";
+    if (cmd == "DEL" || cmd == "EXPIRE" || cmd == "HSET" || cmd == "PUBLISH" || cmd == "EXISTS" ||
+        cmd == "RPUSH" || cmd == "LPUSH" || cmd == "HDEL")
+        return ":0\r\n";
+    return "-ERR zw-replay: " + cmd + " isn't in the capture\r\n";
+}
+
+class Replay
+{
+protected:
+    Capture &capture;
+    bool delays;
+    bool once;
+    std::mutex lock;
+    size_t cursor = 0;
+
+    // the recorded refresh being replayed
+    int refresh = -1;
+    int matched = 0, unexpected = 0, skipped = 0;
+    Clock::time_point firstCommand, lastReply;
+    uint32_t recordedFirstUs = 0, recordedLastUs = 0;
+
+    void finishRefresh()
+    {
+        if (refresh < 0)
+            return;
+
+        auto replayedMs = std::chrono::duration<double, std::milli>(lastReply - firstCommand).count();
+        printf("refresh %d: %d commands replayed, %d unexpected, %d skipped; %.1fms (recorded %.1fms)\n", refresh,
+               matched, unexpected, skipped, replayedMs, (recordedLastUs - recordedFirstUs) / 1000.0);
+        fflush(stdout);
+        matched = unexpected = skipped = 0;
+    }
+
+public:
+    Replay(Capture &c, bool replyDelays, bool exitWhenDone) : capture(c), delays(replyDelays), once(exitWhenDone) {}
+
+    Replay(const Replay &) = delete;
+    Replay &operator=(const Replay &) = delete;
+
+    // the reply to args, arriving at arrived, and when to send it
+    std::string respond(const std::vector<std::string> &args, Clock::time_point arrived, Clock::time_point &due)
+    {
+        std::lock_guard<std::mutex> locked(lock);
+        due = arrived;
+
+        if (cursor >= capture.exchanges.size() && !once)
+            cursor = 0;
+
+        auto limit = std::min(capture.exchanges.size(), cursor + REPLAY_LOOKAHEAD);
+        for (auto i = cursor; i < limit; i++)
+        {
+            auto &x = capture.exchanges[i];
+            if (!sameTarget(args, x.args))
+                continue;
+
+            if (x.refresh != refresh)
+            {
+                finishRefresh();
+                refresh = x.refresh;
+                firstCommand = arrived;
+                recordedFirstUs = x.sentUs;
+            }
+
+            skipped += i - cursor;
+            ++matched;
+            cursor = i + 1;
+            recordedLastUs = x.replyUs;
+            if (delays)
+                due += std::chrono::microseconds(x.replyUs - x.sentUs);
+            lastReply = std::max(lastReply, due);
+            return x.reply;
+        }
+
+        ++unexpected;
+        lastReply = std::max(lastReply, arrived);
+        return fallbackReply(args);
+    }
+
+    bool done()
+    {
+        std::lock_guard<std::mutex> locked(lock);
+        return once && cursor >= capture.exchanges.size();
+    }
+
+    void finish()
+    {
+        std::lock_guard<std::mutex> locked(lock);
+        finishRefresh();
+        refresh = -1;
+    }
+};
+
+static void serveClient(int fd, Replay &replay)
+{
+    std::string buf;
+    char chunk[4096];
+    // replies to pipelined commands go in order, none before the one ahead of it
+    auto lastDue = Clock::now();
+
+    while (!replay.done())
+    {
+        auto got = recv(fd, chunk, sizeof(chunk), 0);
+        if (got <= 0)
+            break;
+        buf.append(chunk, got);
+        auto arrived = Clock::now();
+
+        std::vector<std::string> args;
+        while (takeCommand(buf, args))
+        {
+            Clock::time_point due;
+            auto reply = replay.respond(args, arrived, due);
+            lastDue = std::max(lastDue, due);
+            std::this_thread::sleep_until(lastDue);
+            if (send(fd, reply.data(), reply.size(), MSG_NOSIGNAL) != (ssize_t)reply.size())
+                break;
+        }
+    }
+
+    close(fd);
+    if (replay.done())
+    {
+        replay.finish();
+        exit(0);
+    }
+}
+
+static int serve(const char *path, int port, bool delays, bool once)
+{
+    Capture capture;
+    if (!load(path, capture))
+        return -1;
+    if (capture.exchanges.empty())
+    {
+        std::cerr << "the capture has no commands" << std::endl;
+        return -1;
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) || listen(listener, 8))
+    {
+        perror("zw-replay: listen");
+        return -1;
+    }
+
+    std::cerr << "serving " << capture.info << " (" << capture.exchanges.size() << " commands) on port " << port
+              << std::endl;
+
+    Replay replay(capture, delays, once);
+    while (true)
+    {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+            continue;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        std::thread(serveClient, fd, std::ref(replay)).detach();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+
+    if (mode == "fetch" && argc > 5)
+        return fetch(argv[2], argv[3], argv[4], argv[5]);
+
+    if (mode == "serial" && argc > 2)
+    {
+        if (argc < 4)
+            return serial(argv[2], std::cin);
+        std::ifstream in(argv[3]);
+        return serial(argv[2], in);
+    }
+
+    if (mode == "show" && argc > 2)
+        return show(argv[2]);
+
+    if (mode == "serve" && argc > 2)
+    {
+        int port = 6379;
+        bool delays = true, once = false;
+        for (int i = 3; i < argc; i++)
+        {
+            if (!strcmp(argv[i], "--no-delay"))
+                delays = false;
+            else if (!strcmp(argv[i], "--once"))
+                once = true;
+            else
+                port = atoi(argv[i]);
+        }
+        return serve(argv[2], port, delays, once);
+    }
+
+    std::cerr << "usage:\n"
+              << "\tzw-replay fetch [redisHost[:port]] [redisPassword] [hostname] [out.zwc]\n"
+              << "\tzw-replay serial [out.zwc] (serialLog)\n"
+              << "\tzw-replay show [capture.zwc]\n"
+              << "\tzw-replay serve [capture.zwc] (port) (--no-delay) (--once)\n";
+    return -1;
+}
@@ -0,0 +1,666 @@
+// zw-rollout.cpp
+// (C) 2019 Ryan Joseph <ryan@electricsheep.co>
+// https://github.com/rpj/zw
+//
+// Rolls an update out across every unit checking in to a Redis instance, in staged
+// waves, with no more than a given number of units downloading at once so the OTA
+// host isn't saturated. Each unit's OTP is computed as scripts/otp-generate.pl does,
+// timed against its heartbeats so it's still valid when the unit reads the update;
+// a wave counts as done once every unit in it has rebooted and reported the update's
+// MD5 through getValue of "ver". Ends with each unit's download throughput (as the
+// unit measured it, from HOSTNAME:info:lastUpdate) and the fleet-wide rollout time.
+//
+// build: g++ -std=c++11 -O2 -o zw-rollout zw-rollout.cpp
+//
+// usage:
+// ./zw-rollout [redisHost[:port]] [redisPassword] [update.json or -] (options)
+//      update.json is scripts/release-info.pl's output; its "otp" is filled in per unit
+//      --waves 1,4,16      units per wave, the last size repeating (default 1,4,16)
+//      --concurrency N     most units downloading at once (default 4)
+//      --timeout S         most seconds a unit may spend on any one step (default 600)
+//      --attempts N        pushes per unit before it counts as failed (default 3)
+//      --only a,b,...      just these units
+//      --keep-going        start the next wave even if a unit in this one failed
+//      --dry-run           report what each unit is running and stop
+
+#include "zw_resp.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <thread>
+
+// must match zw_otp.h and zw_otp.cpp
+#define OTP_WINDOW_MINUTES 2
+static const uint8_t otpFudgeTable[] = {42, 69, 3, 18, 25, 12, 51, 93, 54, 76};
+
+// an OTP is only pushed if the unit's next refresh falls at least this far from a window edge
+#define ROLLOUT_OTP_MARGIN_US 3000000ULL
+#define ROLLOUT_POLL_MS 250
+
+enum UnitState
+{
+    QUERYING,  // waiting for getValue of "ver"
+    CURRENT,   // already running the update
+    READY,     // waiting for its wave and a download slot
+    SYNCING,   // waiting for a fresh heartbeat to time the OTP against
+    PUSHED,    // waiting for the unit to take the update (it deletes :config:update)
+    VERIFYING, // waiting for the rebooted unit to report its MD5
+    DONE,
+    FAILED,
+    SKIPPED // offline or unresponsive
+};
+
+static const char *stateNames[] = {
+    "querying", "current", "ready", "syncing", "pushed", "verifying", "updated", "FAILED", "skipped"};
+
+struct Unit
+{
+    std::string host;
+    UnitState state = QUERYING;
+    // as reported before the update
+    std::string version;
+    std::string md5;
+    int wave = -1;
+    int attempts = 0;
+    double deadline = 0;
+
+    // the last heartbeat (the unit's micros()), the interval before it and the changes
+    // seen since entering the current state
+    bool hbKnown = false;
+    uint64_t hb = 0;
+    uint64_t hbPeriod = 0;
+    int hbChanges = 0;
+
+    double pushedAt = 0;
+    double downloadedAt = 0;
+    double doneAt = 0;
+    std::string lastUpdate;
+    std::string why;
+};
+
+struct Options
+{
+    std::vector<int> waves = {1, 4, 16};
+    int concurrency = 4;
+    int timeout = 600;
+    int attempts = 3;
+    std::set<std::string> only;
+    bool keepGoing = false;
+    bool dryRun = false;
+};
+
+static std::chrono::steady_clock::time_point gStart = std::chrono::steady_clock::now();
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - gStart).count();
+}
+
+static void event(const Unit &unit, const char *format, ...)
+{
+    char msg[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(msg, sizeof(msg), format, args);
+    va_end(args);
+    fprintf(stderr, "[%8.1fs] %-24s %s\n", now(), unit.host.c_str(), msg);
+}
+
+static uint16_t otpFor(const std::string &host, uint64_t micros)
+{
+    auto lc = micros / (1000000ULL * 60 * OTP_WINDOW_MINUTES);
+    lc += otpFudgeTable[lc % sizeof(otpFudgeTable)];
+    for (auto c : host)
+        lc += c;
+    return lc & 0xFFFF;
+}
+
+// either the text or the ZWREDIS_TELEMETRY_MSGPACK encoding
+static bool parseHeartbeat(const std::string &raw, uint64_t &micros)
+{
+    auto p = (const uint8_t *)raw.data();
+    auto be = [&](int bytes) {
+        uint64_t v = 0;
+        for (int i = 1; i <= bytes; i++)
+            v = (v << 8) | p[i];
+        return v;
+    };
+
+    if (raw.size() == 1 && p[0] < 0x80)
+        micros = p[0];
+    else if (raw.size() == 2 && p[0] == 0xcc)
+        micros = be(1);
+    else if (raw.size() == 3 && p[0] == 0xcd)
+        micros = be(2);
+    else if (raw.size() == 5 && p[0] == 0xce)
+        micros = be(4);
+    else if (raw.size() == 9 && p[0] == 0xcf)
+        micros = be(8);
+    else if (!raw.empty() && raw.find_first_not_of("0123456789") == std::string::npos)
+        micros = strtoull(raw.c_str(), NULL, 10);
+    else
+        return false;
+    return true;
+}
+
+// a string or number field's value, "" if missing
+static std::string jsonField(const std::string &json, const char *name)
+{
+    std::smatch m;
+    std::regex re(std::string("\"") + name + "\"\\s*:\\s*(\"([^\"]*)\"|[-0-9.]+)");
+    if (!std::regex_search(json, m, re))
+        return "";
+    return m[2].matched ? m[2].str() : m[1].str();
+}
+
+static bool terminal(UnitState state)
+{
+    return state == CURRENT || state == DONE || state == FAILED || state == SKIPPED;
+}
+
+class Rollout
+{
+protected:
+    RespClient redis;
+    std::string hostPort;
+    std::string password;
+    Options opts;
+
+    std::string updateJson;
+    std::string targetMd5;
+    size_t targetSize = 0;
+    std::vector<Unit> units;
+
+    double firstPush = -1;
+    double lastDone = -1;
+
+    bool connect()
+    {
+        std::string host;
+        int port;
+        respParseHostPort(hostPort, host, port);
+        return redis.connect(host.c_str(), port) && redis.auth(password.c_str());
+    }
+
+    void fail(Unit &unit, const std::string &why)
+    {
+        unit.state = FAILED;
+        unit.why = why;
+        event(unit, "FAILED: %s", why.c_str());
+
+        // otherwise it retries (and fails the OTP check) every refresh
+        redis.command({"DEL", unit.host + ":config:update"});
+    }
+
+    void enter(Unit &unit, UnitState state)
+    {
+        unit.state = state;
+        unit.hbChanges = 0;
+        unit.deadline = now() + opts.timeout;
+    }
+
+    // asks for getValue of "ver"; the answer's at HOSTNAME:config:getValue:ver a refresh later
+    void requestVer(Unit &unit)
+    {
+        redis.append({"DEL", unit.host + ":config:getValue:ver"});
+        redis.append({"SET", unit.host + ":config:getValue", "ver"});
+        redis.flush();
+        RespReply reply;
+        redis.read(reply);
+        redis.read(reply);
+    }
+
+    void push(Unit &unit)
+    {
+        if (!unit.hbPeriod)
+            return;
+
+        auto div = 1000000ULL * 60 * OTP_WINDOW_MINUTES;
+        // the unit reads :config:update a heartbeat interval after writing this one;
+        // micros() is 32 bits on the ESP32
+        auto next = (unit.hb + unit.hbPeriod) & 0xFFFFFFFFULL;
+
+        if (next < div + ROLLOUT_OTP_MARGIN_US)
+        {
+            event(unit, "up for less than %d minutes, waiting", OTP_WINDOW_MINUTES);
+            return;
+        }
+
+        if ((next - ROLLOUT_OTP_MARGIN_US) / div != (next + ROLLOUT_OTP_MARGIN_US) / div)
+            return;
+
+        auto otp = otpFor(unit.host, next);
+        auto json = std::regex_replace(updateJson, std::regex("\"otp\":\\s*[0-9]+"), "\"otp\":" + std::to_string(otp));
+        if (!redis.command({"SET", unit.host + ":config:update", json}).ok())
+        {
+            fail(unit, "couldn't set :config:update");
+            return;
+        }
+
+        unit.attempts++;
+        if (!unit.pushedAt)
+            unit.pushedAt = now();
+        if (firstPush < 0)
+            firstPush = now();
+
+        enter(unit, PUSHED);
+        event(unit, "pushed (attempt %d, otp %u, every %.1fs)", unit.attempts, otp, unit.hbPeriod / 1e6);
+    }
+
+    void step(Unit &unit, bool hbChanged, const RespReply *exists, const RespReply *ver)
+    {
+        switch (unit.state)
+        {
+        case QUERYING:
+        case VERIFYING:
+            if (ver && !ver->null && ver->ok())
+            {
+                auto md5 = jsonField(ver->str, "sketchMD5");
+                auto version = jsonField(ver->str, "version");
+
+                if (unit.state == QUERYING)
+                {
+                    unit.version = version, unit.md5 = md5;
+                    auto current = !strcasecmp(md5.c_str(), targetMd5.c_str());
+                    unit.state = current ? CURRENT : READY;
+                    event(unit, "running v%s (%s)%s", version.c_str(), md5.c_str(), current ? ", already current" : "");
+                }
+                else if (!strcasecmp(md5.c_str(), targetMd5.c_str()))
+                {
+                    unit.state = DONE;
+                    unit.doneAt = lastDone = now();
+                    unit.lastUpdate = redis.command({"GET", unit.host + ":info:lastUpdate"}).str;
+                    event(unit, "updated to v%s in %.1fs", version.c_str(), unit.doneAt - unit.pushedAt);
+                }
+                else
+                {
+                    fail(unit, "rebooted into " + md5 + " (v" + version + ")");
+                }
+            }
+            else if (now() > unit.deadline)
+            {
+                if (unit.state == QUERYING)
+                {
+                    unit.state = SKIPPED;
+                    unit.why = "no answer to getValue";
+                    event(unit, "skipped: %s", unit.why.c_str());
+                }
+                else
+                {
+                    fail(unit, "no answer to getValue after the update");
+                }
+            }
+            break;
+
+        case SYNCING:
+            if (hbChanged)
+                push(unit);
+            else if (now() > unit.deadline)
+                fail(unit, "no heartbeat");
+            break;
+
+        case PUSHED:
+            if (exists && exists->type == ':' && !exists->integer)
+            {
+                unit.downloadedAt = now();
+                event(unit, "took the update in %.1fs, waiting for it to reboot", unit.downloadedAt - unit.pushedAt);
+                enter(unit, VERIFYING);
+                // answered by the new image, as this pass already handled getValue
+                requestVer(unit);
+            }
+            else if (unit.hbChanges)
+            {
+                // a pass went by without it taking the update: a stale OTP or a failed update
+                if (unit.attempts >= opts.attempts)
+                {
+                    fail(unit, "rejected or failed " + std::to_string(unit.attempts) + " times (see its logs)");
+                    break;
+                }
+                event(unit, "didn't take the update, pushing again");
+                enter(unit, SYNCING);
+                push(unit);
+            }
+            else if (now() > unit.deadline)
+            {
+                fail(unit, "timed out taking the update");
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    // one pipelined round of every non-terminal unit's keys
+    bool poll()
+    {
+        struct Pending
+        {
+            Unit *unit;
+            bool exists;
+            bool ver;
+        };
+        std::vector<Pending> pending;
+
+        for (auto &unit : units)
+        {
+            // READY units too, so the heartbeat interval is known by the time they're pushed
+            if (terminal(unit.state))
+                continue;
+
+            Pending p = {&unit, unit.state == PUSHED, unit.state == QUERYING || unit.state == VERIFYING};
+            redis.append({"GET", unit.host + ":heartbeat"});
+            if (p.exists)
+                redis.append({"EXISTS", unit.host + ":config:update"});
+            if (p.ver)
+                redis.append({"GET", unit.host + ":config:getValue:ver"});
+            pending.push_back(p);
+        }
+
+        if (pending.empty())
+            return true;
+        if (!redis.flush())
+            return false;
+
+        std::vector<RespReply> hbs(pending.size()), exists(pending.size()), vers(pending.size());
+        for (size_t i = 0; i < pending.size(); i++)
+            if (!redis.read(hbs[i]) || (pending[i].exists && !redis.read(exists[i])) ||
+                (pending[i].ver && !redis.read(vers[i])))
+                return false;
+
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            auto &unit = *pending[i].unit;
+            uint64_t hb;
+            auto changed = false;
+
+            // heartbeats expire a few refreshes after the last one
+            if (hbs[i].null && !unit.hbKnown && unit.state == QUERYING)
+            {
+                unit.state = SKIPPED;
+                unit.why = "offline";
+                event(unit, "skipped: no heartbeat");
+                continue;
+            }
+
+            if (!hbs[i].null && parseHeartbeat(hbs[i].str, hb) && (!unit.hbKnown || hb != unit.hb))
+            {
+                // anything else is a reboot (or micros() wrapping): the period's unknown
+                changed = unit.hbKnown;
+                unit.hbPeriod = unit.hbKnown && hb > unit.hb ? hb - unit.hb : 0;
+                unit.hbKnown = true;
+                unit.hb = hb;
+                unit.hbChanges += changed;
+            }
+
+            step(unit, changed, pending[i].exists ? &exists[i] : NULL, pending[i].ver ? &vers[i] : NULL);
+        }
+
+        return true;
+    }
+
+    bool discover()
+    {
+        std::string cursor = "0";
+        do
+        {
+            auto scan = redis.command({"SCAN", cursor, "MATCH", "rpjios.checkin.*", "COUNT", "1000"});
+            if (scan.elements.size() != 2)
+                return false;
+            cursor = scan.elements[0].str;
+            for (auto &k : scan.elements[1].elements)
+            {
+                Unit unit;
+                unit.host = k.str.substr(strlen("rpjios.checkin."));
+                if (opts.only.empty() || opts.only.count(unit.host))
+                    units.push_back(unit);
+            }
+        } while (cursor != "0");
+
+        std::sort(units.begin(), units.end(), [](const Unit &a, const Unit &b) { return a.host < b.host; });
+        units.erase(std::unique(units.begin(), units.end(), [](const Unit &a, const Unit &b) { return a.host == b.host; }),
+                    units.end());
+        return true;
+    }
+
+    void report()
+    {
+        int counts[SKIPPED + 1] = {0};
+        double transferred = 0, kbpsSum = 0;
+        int kbpsCount = 0;
+
+        printf("%-24s %4s  %-9s %-12s %10s %10s %9s %8s\n",
+               "unit", "wave", "result", "from", "transfer", "download", "KB/s", "total");
+        for (auto &unit : units)
+        {
+            counts[unit.state]++;
+            printf("%-24s %4s  %-9s %-12s", unit.host.c_str(),
+                   unit.wave < 0 ? "-" : std::to_string(unit.wave + 1).c_str(), stateNames[unit.state],
+                   unit.version.empty() ? "?" : ("v" + unit.version).c_str());
+
+            if (unit.state == DONE)
+            {
+                // older firmware doesn't report: estimate from when it took the update
+                auto bytes = atof(jsonField(unit.lastUpdate, "transferred").c_str());
+                auto ms = atof(jsonField(unit.lastUpdate, "ms").c_str());
+                auto kbps = atof(jsonField(unit.lastUpdate, "kbps").c_str());
+                auto estimated = !ms;
+                if (estimated)
+                {
+                    bytes = targetSize;
+                    ms = (unit.downloadedAt - unit.pushedAt) * 1000;
+                    kbps = ms ? (bytes / 1024) / (ms / 1000) : 0;
+                }
+
+                transferred += bytes;
+                kbpsSum += kbps, kbpsCount++;
+                printf(" %9.1fK %9.1fs %s%8.1f %7.1fs", bytes / 1024, ms / 1000, estimated ? "~" : " ", kbps,
+                       unit.doneAt - unit.pushedAt);
+            }
+            else if (!unit.why.empty())
+            {
+                printf(" %s", unit.why.c_str());
+            }
+            printf("\n");
+        }
+
+        auto elapsed = firstPush < 0 || lastDone < 0 ? 0 : lastDone - firstPush;
+        printf("\n%d updated, %d already current, %d failed, %d skipped, %d not attempted\n",
+               counts[DONE], counts[CURRENT], counts[FAILED], counts[SKIPPED], counts[READY]);
+        if (counts[DONE])
+            printf("rollout took %.1fs (first push to last verified): %.1fKB at %.1fKB/s per unit, %.1fKB/s fleet-wide\n",
+                   elapsed, transferred / 1024, kbpsSum / kbpsCount, elapsed ? transferred / 1024 / elapsed : 0);
+    }
+
+public:
+    Rollout(const std::string &hostPort, const std::string &password, const Options &opts)
+        : hostPort(hostPort), password(password), opts(opts) {}
+
+    bool load(const std::string &path)
+    {
+        std::stringstream in;
+        if (path == "-")
+            in << std::cin.rdbuf();
+        else
+            in << std::ifstream(path).rdbuf();
+
+        // as scripts/update.pl does; none of the values have whitespace
+        updateJson = std::regex_replace(in.str(), std::regex("\\s+"), "");
+        targetMd5 = jsonField(updateJson, "md5");
+        targetSize = strtoul(jsonField(updateJson, "size").c_str(), NULL, 10);
+        return targetMd5.size() == 32 && targetSize && !jsonField(updateJson, "otp").empty();
+    }
+
+    int run()
+    {
+        if (!connect())
+        {
+            std::cerr << "can't connect to " << hostPort << std::endl;
+            return -1;
+        }
+
+        if (!discover())
+        {
+            std::cerr << "SCAN failed" << std::endl;
+            return -1;
+        }
+
+        fprintf(stderr, "%zu units; rolling out %s (%zu bytes) in waves of ", units.size(), targetMd5.c_str(), targetSize);
+        for (size_t i = 0; i < opts.waves.size(); i++)
+            fprintf(stderr, "%d%s", opts.waves[i], i + 1 < opts.waves.size() ? ", " : "...");
+        fprintf(stderr, " with at most %d downloading\n", opts.concurrency);
+
+        for (auto &unit : units)
+        {
+            enter(unit, QUERYING);
+            requestVer(unit);
+        }
+
+        int wave = -1;
+        size_t nextReady = 0;
+        std::vector<Unit *> ready;
+        auto halted = false;
+
+        while (true)
+        {
+            if (!poll() && !(connect() && poll()))
+            {
+                std::cerr << "lost connection to " << hostPort << std::endl;
+                break;
+            }
+
+            auto querying = std::count_if(units.begin(), units.end(), [](const Unit &u) { return u.state == QUERYING; });
+            if (querying)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(ROLLOUT_POLL_MS));
+                continue;
+            }
+
+            if (opts.dryRun)
+                break;
+
+            if (wave < 0)
+                for (auto &unit : units)
+                    if (unit.state == READY)
+                        ready.push_back(&unit);
+
+            auto waveActive = false, waveFailed = false;
+            for (auto &unit : units)
+                if (unit.wave == wave && wave >= 0)
+                    waveActive |= !terminal(unit.state), waveFailed |= unit.state == FAILED;
+
+            if (!waveActive)
+            {
+                if (waveFailed && !opts.keepGoing)
+                {
+                    fprintf(stderr, "wave %d had failures, stopping (--keep-going to continue)\n", wave + 1);
+                    halted = true;
+                }
+
+                if (halted || nextReady == ready.size())
+                    break;
+
+                wave++;
+                auto size = opts.waves[std::min((size_t)wave, opts.waves.size() - 1)];
+                for (int i = 0; i < size && nextReady < ready.size(); i++)
+                    ready[nextReady++]->wave = wave;
+                auto waveUnits = std::count_if(units.begin(), units.end(), [&](const Unit &u) { return u.wave == wave; });
+                fprintf(stderr, "[%8.1fs] wave %d: %d unit%s\n", now(), wave + 1, (int)waveUnits, waveUnits == 1 ? "" : "s");
+            }
+
+            // download slots: from being pushed until the unit deletes :config:update
+            auto downloading = std::count_if(units.begin(), units.end(), [](const Unit &u) {
+                return u.state == SYNCING || u.state == PUSHED;
+            });
+            for (auto &unit : units)
+            {
+                if (downloading >= opts.concurrency)
+                    break;
+                if (unit.wave == wave && unit.state == READY)
+                {
+                    enter(unit, SYNCING);
+                    downloading++;
+                }
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(ROLLOUT_POLL_MS));
+        }
+
+        report();
+        return std::any_of(units.begin(), units.end(), [](const Unit &u) { return u.state == FAILED; }) || halted ? 1 : 0;
+    }
+};
+
+static std::set<std::string> splitList(const std::string &list)
+{
+    std::set<std::string> out;
+    std::stringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ','))
+        if (!item.empty())
+            out.insert(item);
+    return out;
+}
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    auto usage = [&]() {
+        std::cerr << "usage:\n"
+                  << "\tzw-rollout [redisHost[:port]] [redisPassword] [update.json or -]\n"
+                  << "\t\t(--waves 1,4,16) (--concurrency N) (--timeout S) (--attempts N)\n"
+                  << "\t\t(--only a,b,...) (--keep-going) (--dry-run)\n";
+        return -1;
+    };
+
+    if (argc < 4)
+        return usage();
+
+    for (int i = 4; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        auto hasValue = i + 1 < argc;
+
+        if (arg == "--waves" && hasValue)
+        {
+            opts.waves.clear();
+            std::stringstream in(argv[++i]);
+            std::string size;
+            while (std::getline(in, size, ','))
+                if (atoi(size.c_str()) > 0)
+                    opts.waves.push_back(atoi(size.c_str()));
+            if (opts.waves.empty())
+                return usage();
+        }
+        else if (arg == "--concurrency" && hasValue)
+            opts.concurrency = std::max(1, atoi(argv[++i]));
+        else if (arg == "--timeout" && hasValue)
+            opts.timeout = std::max(1, atoi(argv[++i]));
+        else if (arg == "--attempts" && hasValue)
+            opts.attempts = std::max(1, atoi(argv[++i]));
+        else if (arg == "--only" && hasValue)
+            opts.only = splitList(argv[++i]);
+        else if (arg == "--keep-going")
+            opts.keepGoing = true;
+        else if (arg == "--dry-run")
+            opts.dryRun = true;
+        else
+            return usage();
+    }
+
+    Rollout rollout(argv[1], argv[2], opts);
+    if (!rollout.load(argv[3]))
+    {
+        std::cerr << "bad update JSON: needs md5, size and otp" << std::endl;
+        return -1;
+    }
+
+    return rollout.run();
+}
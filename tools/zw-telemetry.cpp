@@ -0,0 +1,267 @@
+// zw-telemetry.cpp
+// (C) 2019 Ryan Joseph <ryan@electricsheep.co>
+// https://github.com/rpj/zw
+//
+// Host-side reader for checkins and heartbeats, in either the JSON or the
+// ZWREDIS_TELEMETRY_MSGPACK encoding, plus a benchmark of the two encoders.
+//
+// build: g++ -std=c++11 -O2 -I.. -o zw-telemetry zw-telemetry.cpp ../zw_telemetry.cpp
+//
+// usage, one of:
+// ./zw-telemetry dump (redisHost[:port]) (redisPassword) (hostname...)
+//      print every unit's checkin (or just those named) as JSON
+// ./zw-telemetry bench (iterations)
+//      encoded size and encode time of JSON vs MessagePack checkins
+
+#include "zw_resp.h"
+#include "zw_telemetry.h"
+
+#include <chrono>
+#include <iostream>
+#include <set>
+
+// appends the MessagePack value at p as JSON, returning bytes consumed (0 if malformed)
+static size_t msgpackToJson(const uint8_t *p, size_t len, std::string &out)
+{
+    if (!len)
+        return 0;
+
+    auto be = [&](size_t off, int bytes) {
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; i++)
+            v = (v << 8) | p[off + i];
+        return v;
+    };
+
+    auto strAt = [&](size_t off, size_t n) -> size_t {
+        if (off + n > len)
+            return 0;
+        out += '"';
+        for (size_t i = 0; i < n; i++)
+        {
+            auto c = (char)p[off + i];
+            if (c == '"' || c == '\\')
+                out += '\\';
+            out += c;
+        }
+        out += '"';
+        return off + n;
+    };
+
+    auto container = [&](size_t off, size_t count, bool isMap) -> size_t {
+        out += isMap ? "{" : "[";
+        for (size_t i = 0; i < count * (isMap ? 2 : 1); i++)
+        {
+            if (i)
+                out += isMap && (i % 2) ? ": " : ", ";
+            auto used = msgpackToJson(p + off, len - off, out);
+            if (!used)
+                return 0;
+            off += used;
+        }
+        out += isMap ? "}" : "]";
+        return off;
+    };
+
+    auto b = p[0];
+    auto need = [&](size_t n) { return n <= len; };
+
+    if (b < 0x80)
+        return out += std::to_string(b), 1;
+    if (b >= 0xe0)
+        return out += std::to_string((int8_t)b), 1;
+    if ((b & 0xf0) == 0x80)
+        return container(1, b & 0x0f, true);
+    if ((b & 0xf0) == 0x90)
+        return container(1, b & 0x0f, false);
+    if ((b & 0xe0) == 0xa0)
+        return strAt(1, b & 0x1f);
+
+    switch (b)
+    {
+    case 0xc0: return out += "null", 1;
+    case 0xc2: return out += "false", 1;
+    case 0xc3: return out += "true", 1;
+    case 0xcc: return need(2) ? (out += std::to_string(be(1, 1)), 2) : 0;
+    case 0xcd: return need(3) ? (out += std::to_string(be(1, 2)), 3) : 0;
+    case 0xce: return need(5) ? (out += std::to_string(be(1, 4)), 5) : 0;
+    case 0xcf: return need(9) ? (out += std::to_string(be(1, 8)), 9) : 0;
+    case 0xd0: return need(2) ? (out += std::to_string((int8_t)be(1, 1)), 2) : 0;
+    case 0xd1: return need(3) ? (out += std::to_string((int16_t)be(1, 2)), 3) : 0;
+    case 0xd2: return need(5) ? (out += std::to_string((int32_t)be(1, 4)), 5) : 0;
+    case 0xd3: return need(9) ? (out += std::to_string((int64_t)be(1, 8)), 9) : 0;
+    case 0xca:
+    {
+        if (!need(5))
+            return 0;
+        uint32_t bits = (uint32_t)be(1, 4);
+        float f;
+        memcpy(&f, &bits, 4);
+        return out += std::to_string(f), 5;
+    }
+    case 0xd9: return need(2) ? strAt(2, be(1, 1)) : 0;
+    case 0xda: return need(3) ? strAt(3, be(1, 2)) : 0;
+    case 0xdc: return need(3) ? container(3, be(1, 2), false) : 0;
+    case 0xde: return need(3) ? container(3, be(1, 2), true) : 0;
+    }
+
+    return 0;
+}
+
+static std::string heartbeatToString(const std::string &raw)
+{
+    auto p = (const uint8_t *)raw.data();
+    if (!raw.empty() && (p[0] < '0' || p[0] > '9'))
+    {
+        std::string out;
+        if (msgpackToJson(p, raw.size(), out))
+            return out;
+    }
+    return raw;
+}
+
+static int dump(const std::string &hostPort, const std::string &password, const std::set<std::string> &only)
+{
+    std::string host;
+    int port;
+    respParseHostPort(hostPort, host, port);
+
+    RespClient redis;
+    if (!redis.connect(host.c_str(), port) || !redis.auth(password.c_str()))
+    {
+        std::cerr << "can't connect to " << hostPort << std::endl;
+        return -1;
+    }
+
+    std::vector<std::string> keys;
+    std::string cursor = "0";
+    do
+    {
+        auto scan = redis.command({"SCAN", cursor, "MATCH", "rpjios.checkin.*", "COUNT", "1000"});
+        if (scan.elements.size() != 2)
+            return -1;
+        cursor = scan.elements[0].str;
+        for (auto &k : scan.elements[1].elements)
+            keys.push_back(k.str);
+    } while (cursor != "0");
+
+    for (auto &key : keys)
+    {
+        auto unit = key.substr(strlen("rpjios.checkin."));
+        if (!only.empty() && !only.count(unit))
+            continue;
+
+        auto fields = redis.command({"HGETALL", key});
+        auto heartbeat = redis.command({"GET", unit + ":heartbeat"});
+        std::string json;
+
+        for (size_t i = 0; i + 1 < fields.elements.size(); i += 2)
+        {
+            auto &name = fields.elements[i].str;
+            auto &value = fields.elements[i + 1].str;
+
+            if (name == "mp")
+            {
+                json.clear();
+                if (!msgpackToJson((const uint8_t *)value.data(), value.size(), json))
+                    json = "\"<malformed msgpack>\"";
+                break;
+            }
+
+            // the JSON encoding's fields: ifaces is itself JSON
+            json += (json.empty() ? "" : ", ") + ("\"" + name + "\": ") +
+                    (name == "ifaces" ? value : "\"" + value + "\"");
+            if (i + 2 >= fields.elements.size())
+                json = "{ " + json + " }";
+        }
+
+        std::cout << "{ \"unit\": \"" << unit << "\", \"heartbeat\": \"" << heartbeatToString(heartbeat.str)
+                  << "\", \"checkin\": " << (json.empty() ? "null" : json) << " }" << std::endl;
+    }
+
+    return 0;
+}
+
+static int bench(int iterations)
+{
+    ZWCheckinData data = {
+        .host = "stack-livingroom",
+        .version = "0.2.5.20",
+        .ticks = 86400,
+        .localIp = "192.168.1.123",
+        .immediateLatency = 18234,
+        .averageLatency = 20112,
+        .connectCached = true,
+        .connectFast = true,
+        .connectFastMs = 312,
+        .connectFullMs = 0,
+        .connectTotalMs = 312,
+        .memCurrent = 182344,
+        .memLast = 182012,
+        .memHeap = 298732,
+        .memLowWater = 151020,
+        .memLargestBlock = 113792,
+        .allocsPerTick = 41,
+        .budgetMs = 1000,
+        .budgetOverruns = 3,
+        .budgetDeferred = 7,
+        .budgetWorstMs = 1184,
+        .powerMv = 4012,
+        .powerAvgMw = 212.4f,
+        .powerRefreshMj = 31.5f,
+        .powerIdleMj = 185210.0f,
+        .powerWifiMj = 1204.6f,
+        .powerRedisMj = 6380.2f,
+        .powerRenderMj = 912.8f};
+
+    char jsonBuf[1024];
+    uint8_t mpBuf[512];
+    int jsonLen = 0;
+    size_t mpLen = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        data.ticks = i;
+        jsonLen = zwTelemetryCheckinJson(jsonBuf, sizeof(jsonBuf), data);
+        asm volatile("" ::"r"(jsonBuf) : "memory");
+    }
+    auto jsonNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        data.ticks = i;
+        mpLen = zwTelemetryCheckinMsgPack(mpBuf, sizeof(mpBuf), data);
+        asm volatile("" ::"r"(mpBuf) : "memory");
+    }
+    auto mpNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // the JSON encoding also stores host, up & ver as their own hash fields
+    jsonLen += strlen("hostupverifaces") + strlen(data.host) + std::to_string(data.ticks).size() + strlen(data.version);
+    mpLen += strlen("mp");
+
+    printf("{ \"iterations\": %d, \"json\": { \"bytes\": %d, \"nsPerEncode\": %.1f },"
+           " \"msgpack\": { \"bytes\": %zu, \"nsPerEncode\": %.1f } }\n",
+           iterations, jsonLen, jsonNs / iterations, mpLen, mpNs / iterations);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    std::string mode = argc > 1 ? argv[1] : "";
+
+    if (mode == "dump")
+    {
+        std::set<std::string> only(argv + std::min(argc, 4), argv + argc);
+        return dump(argc > 2 ? argv[2] : "127.0.0.1", argc > 3 ? argv[3] : "", only);
+    }
+
+    if (mode == "bench")
+        return bench(argc > 2 ? atoi(argv[2]) : 1000000);
+
+    std::cerr << "usage:\n"
+              << "\tzw-telemetry dump (redisHost[:port]) (redisPassword) (hostname...)\n"
+              << "\tzw-telemetry bench (iterations)\n";
+    return -1;
+}
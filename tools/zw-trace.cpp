@@ -0,0 +1,128 @@
+// zw-trace.cpp
+// (C) 2019 Ryan Joseph <ryan@electricsheep.co>
+// https://github.com/rpj/zw
+//
+// Converts the spans a unit uploads to HOSTNAME:traceStream (getValue "trace",
+// see zw_trace.h) into Chrome trace JSON, for chrome://tracing or ui.perfetto.dev.
+// Each boot becomes its own process; span arguments are the refresh count and,
+// for display spans, the display index.
+//
+// build: g++ -std=c++11 -O2 -o zw-trace zw-trace.cpp
+//
+// usage:
+// ./zw-trace [targetHostname] (redisHost[:port]) (redisPassword) (entries) > trace.json
+//      convert the most recent entries (default: all) of the unit's trace stream
+
+#include "zw_resp.h"
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#define ZWTRACE_SPAN_BYTES 12
+#define ZWTRACE_NO_ARG 0xff
+
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static std::vector<std::string> splitNames(const std::string &names)
+{
+    std::vector<std::string> out;
+    std::stringstream ss(names);
+    std::string name;
+    while (std::getline(ss, name, ','))
+        out.push_back(name);
+    return out;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: zw-trace [targetHostname] (redisHost[:port]) (redisPassword) (entries)\n";
+        return -1;
+    }
+
+    std::string hostname = argv[1], host;
+    int port;
+    respParseHostPort(argc > 2 ? argv[2] : "127.0.0.1", host, port);
+
+    RespClient redis;
+    if (!redis.connect(host.c_str(), port) || !redis.auth(argc > 3 ? argv[3] : ""))
+    {
+        std::cerr << "can't connect to " << host << ":" << port << std::endl;
+        return -1;
+    }
+
+    std::vector<std::string> cmd = {"XREVRANGE", hostname + ":traceStream", "+", "-"};
+    if (argc > 4)
+        cmd.insert(cmd.end(), {"COUNT", argv[4]});
+
+    auto entries = redis.command(cmd);
+    if (!entries.ok())
+    {
+        std::cerr << "XREVRANGE failed: " << entries.str << std::endl;
+        return -1;
+    }
+
+    // micros() wraps every ~71 minutes: unwrap per boot, oldest entries first
+    std::map<uint32_t, std::pair<uint32_t, uint64_t>> lastAndOffset;
+    bool first = true;
+
+    std::cout << "{ \"traceEvents\": [";
+    for (auto entry = entries.elements.rbegin(); entry != entries.elements.rend(); ++entry)
+    {
+        if (entry->elements.size() != 2)
+            continue;
+
+        uint32_t boot = 0;
+        std::vector<std::string> names;
+        const std::string *spans = nullptr;
+
+        auto &fields = entry->elements[1].elements;
+        for (size_t i = 0; i + 1 < fields.size(); i += 2)
+        {
+            if (fields[i].str == "boot")
+                boot = (uint32_t)strtoul(fields[i + 1].str.c_str(), NULL, 10);
+            else if (fields[i].str == "names")
+                names = splitNames(fields[i + 1].str);
+            else if (fields[i].str == "spans")
+                spans = &fields[i + 1].str;
+        }
+
+        if (!spans)
+            continue;
+
+        auto &unwrap = lastAndOffset[boot];
+        auto p = (const uint8_t *)spans->data();
+        for (size_t off = 0; off + ZWTRACE_SPAN_BYTES <= spans->size(); off += ZWTRACE_SPAN_BYTES)
+        {
+            auto start = le32(p + off);
+            auto dur = le32(p + off + 4);
+            auto name = p[off + 8];
+            auto arg = p[off + 9];
+            auto refresh = p[off + 10] | (p[off + 11] << 8);
+
+            // spans are recorded on completion, so a nested span may start before its predecessor
+            if (start < unwrap.first && unwrap.first - start > 0x80000000u)
+                unwrap.second += 0x100000000ull;
+            unwrap.first = start;
+
+            std::cout << (first ? "" : ",") << "\n  { \"name\": \""
+                      << (name < names.size() ? names[name] : "span" + std::to_string(name))
+                      << "\", \"cat\": \"zw\", \"ph\": \"X\", \"ts\": " << unwrap.second + start
+                      << ", \"dur\": " << dur << ", \"pid\": " << boot << ", \"tid\": 0"
+                      << ", \"args\": { \"refresh\": " << refresh;
+            if (arg != ZWTRACE_NO_ARG)
+                std::cout << ", \"display\": " << (int)arg;
+            std::cout << " } }";
+            first = false;
+        }
+    }
+    std::cout << "\n], \"displayTimeUnit\": \"ms\" }" << std::endl;
+
+    return 0;
+}
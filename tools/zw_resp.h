@@ -0,0 +1,327 @@
+// zw_resp.h
+// (C) 2019 Ryan Joseph <ryan@electricsheep.co>
+// https://github.com/rpj/zw
+//
+// Minimal blocking RESP2 client shared by the host tools. Header-only, POSIX sockets.
+
+#ifndef __ZW_RESP__H__
+#define __ZW_RESP__H__
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+struct RespReply
+{
+    char type = 0; // '+', '-', ':', '$', '*' or 0 on I/O failure
+    bool null = false;
+    long long integer = 0;
+    std::string str;
+    std::vector<RespReply> elements;
+
+    bool ok() const { return type && type != '-'; }
+    bool isError() const { return type == '-'; }
+};
+
+// a command as RESP
+inline std::string respEncode(const std::vector<std::string> &args)
+{
+    std::string out = "*" + std::to_string(args.size()) + "\r\n";
+    for (auto &a : args)
+        out += "$" + std::to_string(a.size()) + "\r\n" + a + "\r\n";
+    return out;
+}
+
+// length of the complete RESP message (a reply, or a command) at p, 0 if it hasn't all
+// arrived, -1 if malformed
+inline long respMessageLength(const char *p, size_t len)
+{
+    auto eol = len ? (const char *)memmem(p, len, "\r\n", 2) : NULL;
+    if (!eol)
+        return 0;
+
+    long head = eol - p + 2;
+    switch (*p)
+    {
+    case '+':
+    case '-':
+    case ':':
+        return head;
+    case '$':
+    {
+        auto n = atol(p + 1);
+        if (n < 0)
+            return head;
+        return (long)len >= head + n + 2 ? head + n + 2 : 0;
+    }
+    case '*':
+    {
+        auto n = atol(p + 1);
+        long at = head;
+        for (long i = 0; i < n; i++)
+        {
+            auto got = respMessageLength(p + at, len - at);
+            if (got <= 0)
+                return got;
+            at += got;
+        }
+        return at;
+    }
+    default:
+        return -1;
+    }
+}
+
+// parses the complete RESP message at p (see respMessageLength()); returns its length, or -1
+inline long respParse(const char *p, size_t len, RespReply &out)
+{
+    auto msgLen = respMessageLength(p, len);
+    if (msgLen <= 0)
+        return -1;
+
+    out = RespReply();
+    out.type = *p;
+    auto eol = (const char *)memmem(p, len, "\r\n", 2);
+    long head = eol - p + 2;
+    switch (*p)
+    {
+    case '+':
+    case '-':
+        out.str.assign(p + 1, eol - p - 1);
+        break;
+    case ':':
+        out.integer = atoll(p + 1);
+        break;
+    case '$':
+        out.null = atol(p + 1) < 0;
+        if (!out.null)
+            out.str.assign(p + head, atol(p + 1));
+        break;
+    case '*':
+    {
+        auto n = atol(p + 1);
+        out.null = n < 0;
+        for (long i = 0, at = head; i < n; i++)
+        {
+            out.elements.emplace_back();
+            at += respParse(p + at, len - at, out.elements.back());
+        }
+        break;
+    }
+    }
+    return msgLen;
+}
+
+class RespClient
+{
+protected:
+    int fd = -1;
+    std::string rbuf;
+    size_t rpos = 0;
+    std::string wbuf;
+    int timeoutMs = 5000;
+
+    bool fill()
+    {
+        if (rpos && rpos == rbuf.size())
+            rbuf.clear(), rpos = 0;
+
+        struct pollfd pfd = {fd, POLLIN, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0)
+            return false;
+
+        char chunk[16384];
+        auto got = ::recv(fd, chunk, sizeof(chunk), 0);
+        if (got <= 0)
+            return false;
+
+        rbuf.append(chunk, got);
+        return true;
+    }
+
+    bool readLine(std::string &line)
+    {
+        size_t eol;
+        while ((eol = rbuf.find("\r\n", rpos)) == std::string::npos)
+            if (!fill())
+                return false;
+
+        line.assign(rbuf, rpos, eol - rpos);
+        rpos = eol + 2;
+        return true;
+    }
+
+    bool readExact(std::string &into, size_t len)
+    {
+        while (rbuf.size() - rpos < len + 2)
+            if (!fill())
+                return false;
+
+        into.assign(rbuf, rpos, len);
+        rpos += len + 2;
+        return true;
+    }
+
+public:
+    RespClient() {}
+    ~RespClient() { close(); }
+
+    RespClient(const RespClient &) = delete;
+    RespClient &operator=(const RespClient &) = delete;
+
+    void setTimeout(int ms) { timeoutMs = ms; }
+    int socket() const { return fd; }
+    bool connected() const { return fd != -1; }
+
+    bool connect(const char *host, int port)
+    {
+        close();
+
+        struct addrinfo hints, *res = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        char portStr[8];
+        snprintf(portStr, sizeof(portStr), "%d", port);
+        if (getaddrinfo(host, portStr, &hints, &res) || !res)
+            return false;
+
+        for (auto ai = res; ai && fd == -1; ai = ai->ai_next)
+        {
+            fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd != -1 && ::connect(fd, ai->ai_addr, ai->ai_addrlen))
+                ::close(fd), fd = -1;
+        }
+        freeaddrinfo(res);
+
+        if (fd != -1)
+        {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        return fd != -1;
+    }
+
+    bool auth(const char *password)
+    {
+        if (!password || !*password)
+            return true;
+        return command({"AUTH", password}).ok();
+    }
+
+    void close()
+    {
+        if (fd != -1)
+            ::close(fd), fd = -1;
+        rbuf.clear(), rpos = 0, wbuf.clear();
+    }
+
+    // queues a command without sending it; see flush()
+    void append(const std::vector<std::string> &args)
+    {
+        wbuf += respEncode(args);
+    }
+
+    bool flush()
+    {
+        size_t sent = 0;
+        while (sent < wbuf.size())
+        {
+            auto wrote = ::send(fd, wbuf.data() + sent, wbuf.size() - sent, MSG_NOSIGNAL);
+            if (wrote <= 0)
+                return false;
+            sent += wrote;
+        }
+        wbuf.clear();
+        return true;
+    }
+
+    // reads exactly one reply; reply.type is 0 on I/O failure
+    bool read(RespReply &reply)
+    {
+        reply = RespReply();
+        std::string line;
+        if (!readLine(line) || line.empty())
+            return false;
+
+        auto type = line[0];
+        switch (type)
+        {
+        case '+':
+        case '-':
+            reply.str = line.substr(1);
+            break;
+
+        case ':':
+            reply.integer = atoll(line.c_str() + 1);
+            break;
+
+        case '$':
+        {
+            auto len = atoll(line.c_str() + 1);
+            if (len < 0)
+                reply.null = true;
+            else if (!readExact(reply.str, (size_t)len))
+                return false;
+            break;
+        }
+
+        case '*':
+        {
+            auto count = atoll(line.c_str() + 1);
+            reply.null = count < 0;
+            for (long long i = 0; i < count; i++)
+            {
+                reply.elements.emplace_back();
+                if (!read(reply.elements.back()))
+                    return false;
+            }
+            break;
+        }
+
+        default:
+            return false;
+        }
+
+        reply.type = type;
+        return true;
+    }
+
+    // true if a complete reply may be read without blocking past waitMs
+    bool readable(int waitMs)
+    {
+        if (rpos < rbuf.size())
+            return true;
+        struct pollfd pfd = {fd, POLLIN, 0};
+        return poll(&pfd, 1, waitMs) > 0;
+    }
+
+    RespReply command(const std::vector<std::string> &args)
+    {
+        RespReply reply;
+        append(args);
+        if (flush())
+            read(reply);
+        return reply;
+    }
+};
+
+// "host:port" or "host" (port 6379)
+inline void respParseHostPort(const std::string &spec, std::string &host, int &port)
+{
+    auto colon = spec.rfind(':');
+    host = colon == std::string::npos ? spec : spec.substr(0, colon);
+    port = colon == std::string::npos ? 6379 : atoi(spec.c_str() + colon + 1);
+}
+
+#endif
@@ -3,8 +3,8 @@
 // https://github.com/rpj/zw
 
 #include <WiFi.h>
-#include <Update.h>
 #include <ArduinoJson.h>
+#include <esp_system.h>
 
 #include "zw_common.h"
 #include "zw_logging.h"
@@ -14,6 +14,19 @@
 #include "zw_otp.h"
 #include "zw_ota.h"
 #include "zw_wifi.h"
+#include "zw_boot.h"
+#include "zw_logqueue.h"
+#include "zw_critlog.h"
+#include "zw_metrics.h"
+#include "zw_trace.h"
+#include "zw_heap.h"
+#include "zw_arena.h"
+#include "zw_bench.h"
+#include "zw_capture.h"
+#include "zw_budget.h"
+#include "zw_power.h"
+#include "zw_clock.h"
+#include "zw_cluster.h"
 
 #define DEEP_SLEEP_MODE_ENABLE 1
 
@@ -35,11 +48,17 @@ ZWAppConfig gConfig = {
     .debug = DEBUG,
     .publishLogs = false,
     .pauseRefresh = false,
-    .deepSleepMode = DEEP_SLEEP_MODE_ENABLE};
+    .deepSleepMode = DEEP_SLEEP_MODE_ENABLE,
+    .refreshBudget = ZWBUDGET_DEFAULT_MS};
 ZWRedis *gRedis = NULL;
 DisplaySpec *gDisplays = NULL;
 void (*gPublishLogsEmit)(const char *fmt, ...);
 unsigned long gBootCount = 0;
+// the last boot count Redis gave, kept across resets (but not power loss) so an abnormal reset
+// can be logged with its boot's count before Redis is reachable; the check guards against the
+// garbage left after power-on
+RTC_NOINIT_ATTR static unsigned long __rtcBootCount;
+RTC_NOINIT_ATTR static unsigned long __rtcBootCountCheck;
 unsigned long long gSecondsSinceBoot = 0;
 unsigned long long gLastRefreshTick = 0;
 int _last_free = 0;
@@ -50,6 +69,12 @@ hw_timer_t *__isrTimer = NULL;
 portMUX_TYPE __isrMutex = portMUX_INITIALIZER_UNLOCKED;
 volatile unsigned long __isrCount = 0;
 
+const char *localIpString()
+{
+    auto ip = WiFi.localIP();
+    return zwArenaPrintf("%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+}
+
 bool processGetValue(String &imEmit, ZWRedisResponder &responder)
 {
     bool matched = true;
@@ -57,19 +82,31 @@ bool processGetValue(String &imEmit, ZWRedisResponder &responder)
 
     if (imEmit.startsWith("ip") || imEmit.endsWith("address"))
     {
-        responder.setValue("%s", WiFi.localIP().toString().c_str());
+        responder.setValue("%s", localIpString());
     }
     else if (imEmit.startsWith("mem"))
     {
-        auto cur_free = ESP.getFreeHeap();
+        auto hs = zwHeapStats();
+        char allocs[12] = "null";
+#if ZWHEAP_TRACK_NEW
+        snprintf(allocs, sizeof(allocs), "%u", hs.allocsLastTick);
+#endif
         responder.setValue(
-            "{ \"current\": %d, \"last\": %d, \"delta\": %d, \"heap\": %d }",
-            cur_free, _last_free, cur_free - _last_free, ESP.getHeapSize());
+            "{ \"current\": %d, \"last\": %d, \"delta\": %d, \"heap\": %d, "
+            "\"lowWater\": %u, \"largestBlock\": %u, \"allocsLastTick\": %s }",
+            hs.free, _last_free, hs.free - _last_free, hs.size, hs.lowWater, hs.largestBlock, allocs);
+    }
+    else if (imEmit.equals("heap"))
+    {
+        // per-subsystem attribution, see zw_heap.h
+        char heapBuf[1024];
+        zwHeapAsJson(heapBuf, sizeof(heapBuf));
+        responder.setValue("%s", heapBuf);
     }
     else if (imEmit.startsWith("up"))
     {
         responder.setExpire(5);
-        responder.setValue("%s", String(millis() / 1000).c_str());
+        responder.setValue("%lu", millis() / 1000);
     }
     else if (imEmit.startsWith("ver"))
     {
@@ -83,6 +120,127 @@ bool processGetValue(String &imEmit, ZWRedisResponder &responder)
     {
         demoMode(gDisplays);
     }
+    else if (imEmit.equals("logs"))
+    {
+        auto lqs = zwLogQueueStats();
+        responder.setValue(
+            "{ \"pending\": %lu, \"dropped\": %lu, \"published\": %lu, \"batches\": %lu, \"failedBatches\": %lu }",
+            lqs.pending, lqs.dropped, lqs.published, lqs.batches, lqs.failedBatches);
+    }
+    else if (imEmit.startsWith("telemetry"))
+    {
+        // on-target comparison of the two checkin encodings
+#define TELEMETRY_BENCH_ITERATIONS 100
+        auto data = gRedis->checkinData(gSecondsSinceBoot, localIpString(), immediateLatency, gUDRA);
+        char jsonBuf[1024];
+        uint8_t mpBuf[ZWREDIS_CHECKIN_MSGPACK_MAX];
+        int jsonLen = 0;
+        size_t mpLen = 0;
+
+        auto start = micros();
+        for (int i = 0; i < TELEMETRY_BENCH_ITERATIONS; i++)
+            jsonLen = zwTelemetryCheckinJson(jsonBuf, sizeof(jsonBuf), data);
+        auto jsonUs = micros() - start;
+
+        start = micros();
+        for (int i = 0; i < TELEMETRY_BENCH_ITERATIONS; i++)
+            mpLen = zwTelemetryCheckinMsgPack(mpBuf, sizeof(mpBuf), data);
+        auto mpUs = micros() - start;
+
+        // the JSON form also stores host, up & ver as their own hash fields
+        jsonLen += strlen("hostupverifaces") + strlen(data.host) + snprintf(NULL, 0, "%lu", data.ticks) + strlen(data.version);
+
+        responder.setValue(
+            "{ \"iterations\": %d, \"json\": { \"bytes\": %d, \"usPerEncode\": %0.2f },"
+            " \"msgpack\": { \"bytes\": %d, \"usPerEncode\": %0.2f } }",
+            TELEMETRY_BENCH_ITERATIONS, jsonLen, (float)jsonUs / TELEMETRY_BENCH_ITERATIONS,
+            mpLen + strlen("mp"), (float)mpUs / TELEMETRY_BENCH_ITERATIONS);
+    }
+    else if (imEmit.startsWith("bench"))
+    {
+        // "bench PREFIX" runs just the benchmarks whose names start with PREFIX
+        auto resultsBuf = (char *)malloc(ZWBENCH_JSON_MAX);
+        if (resultsBuf)
+        {
+            auto only = imEmit.length() > 6 ? imEmit.c_str() + 6 : NULL;
+            zwBenchRun(resultsBuf, ZWBENCH_JSON_MAX, only);
+            if (!only && !gRedis->postBenchResults(resultsBuf))
+                zlog("WARNING: failed to store benchmark results\n");
+            responder.setValueRaw(resultsBuf);
+            free(resultsBuf);
+        }
+    }
+    else if (imEmit.equals("crit"))
+    {
+        responder.setValue("{ \"pending\": %u, \"lost\": %u }", zwCritLogPending(), zwCritLogLost());
+    }
+    else if (imEmit.equals("boot"))
+    {
+        char bootBuf[512];
+        zwBootTimelineAsJson(bootBuf, sizeof(bootBuf));
+        responder.setValue("%s", bootBuf);
+    }
+    else if (imEmit.equals("budget"))
+    {
+        // the refresh budget's overruns and deferrals, see zw_budget.h
+        char budgetBuf[256];
+        zwBudgetAsJson(budgetBuf, sizeof(budgetBuf));
+        responder.setValue("%s", budgetBuf);
+    }
+    else if (imEmit.equals("clock"))
+    {
+        // sync state, drift estimates and the local time zone, see zw_clock.h
+        char clockBuf[320];
+        zwClockAsJson(clockBuf, sizeof(clockBuf));
+        responder.setValue("%s", clockBuf);
+    }
+    else if (imEmit.equals("cluster"))
+    {
+        // the slot map and redirects, for ZWREDIS_CLUSTER builds (see zw_cluster.h)
+        char clusterBuf[512];
+        zwClusterAsJson(clusterBuf, sizeof(clusterBuf));
+        responder.setValue("%s", clusterBuf);
+    }
+    else if (imEmit.equals("power"))
+    {
+        // the AXP192's latest reading and the energy accounting, see zw_power.h
+        char powerBuf[512];
+        zwPowerAsJson(powerBuf, sizeof(powerBuf));
+        responder.setValue("%s", powerBuf);
+    }
+    else if (imEmit.startsWith("metrics"))
+    {
+        // "metrics full" includes every histogram's buckets
+#define METRICS_JSON_MAX 4096
+        auto metricsBuf = (char *)malloc(METRICS_JSON_MAX);
+        if (metricsBuf)
+        {
+            zwMetricsAsJson(metricsBuf, METRICS_JSON_MAX, imEmit.endsWith("full"));
+            responder.setValueRaw(metricsBuf);
+            free(metricsBuf);
+        }
+    }
+    else if (imEmit.equals("trace"))
+    {
+        // uploads the buffered spans to HOSTNAME:traceStream; read them with tools/zw-trace
+        auto dropped = zwTraceDropped();
+        auto flushed = gRedis->flushTrace();
+        responder.setValue("{ \"flushed\": %d, \"dropped\": %u }", flushed, dropped);
+    }
+    else if (imEmit.startsWith("capture"))
+    {
+        // "capture [N] [serial]" records the next N refreshes' Redis traffic; replay it with tools/zw-replay
+        auto refreshes = imEmit.length() > 8 ? max(1, min((int)imEmit.substring(8).toInt(), ZWCAPTURE_MAX_REFRESHES)) : 1;
+        auto toSerial = imEmit.endsWith("serial");
+
+        if (gConfig.deepSleepMode)
+            responder.setValue("{ \"error\": \"captures need the unit to stay awake between refreshes\" }");
+        else if (!zwCaptureArm(refreshes, toSerial, gHostname.c_str()))
+            responder.setValue("{ \"error\": \"%s\" }", zwCaptureArmed() ? "already capturing" : "out of memory");
+        else
+            responder.setValue("{ \"refreshes\": %d, \"bufferBytes\": %d, \"to\": \"%s\" }",
+                               refreshes, ZWCAPTURE_BUFLEN, toSerial ? "serial" : "redis");
+    }
     else if (imEmit.equals("latency"))
     {
         responder.setValue("{ \"immediate\": %d, \"rollingAvg\": %d }",
@@ -96,11 +254,56 @@ bool processGetValue(String &imEmit, ZWRedisResponder &responder)
     return matched;
 }
 
+void redis_publish_logs_emit(const char *fmt, ...)
+{
+    // never touches the network: lines are queued and go out in batches via flushLogs()
+    // stamped with UTC epoch seconds once the clock is set, seconds since boot before then
+    auto now = zwClockSeconds();
+    va_list args;
+    va_start(args, fmt);
+    zwLogQueuePush(now ? now : (unsigned long)gSecondsSinceBoot, fmt, args);
+    va_end(args);
+}
+
+#if ZWLOG_BINARY
+void redis_publish_logs_emit_binary(const uint8_t *frame, size_t len)
+{
+    zwLogQueuePushRaw(frame, len);
+}
+#endif
+
+static unsigned long __lastLogFlush = 0;
+void flushLogs()
+{
+    ZWTraceScope traced(ZWT_LOG_FLUSH);
+    ZWHeapScope heapScope(ZWHEAP_LOGGING);
+    ZWPowerScope powered(ZWP_REDIS);
+    if (gRedis && zwLogQueueFlush(gRedis, gHostname.c_str()) < 0)
+        Serial.printf("WARNING: log flush failed (%lu pending)\n", zwLogQueuePending());
+    __lastLogFlush = millis();
+}
+
+void storeCapture()
+{
+    size_t len;
+    auto trace = zwCaptureTrace(&len);
+
+    if (zwCaptureToSerial())
+        zwCaptureDumpSerial();
+    else if (!gRedis->postCapture(trace, len))
+        zlog("WARNING: failed to store the %u byte capture\n", len);
+    else
+        zlog("Stored a %u byte capture%s\n", len, zwCaptureTruncated() ? " (truncated)" : "");
+
+    zwCaptureRelease();
+}
+
 bool ctrlPoint_reset()
 {
     dprint("[CMD] RESETING!\n");
     zlog("[CMD] RESETING!");
     gRedis->clearControlPoint();
+    flushLogs();
     ESP.restart();
     return true; // never reached
 }
@@ -160,12 +363,28 @@ bool processControlPoint(String &imEmit, ZWRedisResponder &responder)
 
 void preUpdateIRQDisableFunc()
 {
+    // a failed delta update falls back to the full image, calling this again
+    if (!__isrTimer)
+        return;
+
     zlog("preUpdateIRQDisableFunc disabling __isrTimer\n");
     timerEnd(__isrTimer);
+    __isrTimer = NULL;
+}
+
+// "transport": "redis" images live at keys named as their urls would be
+bool redisOtaFetch(const char *key, size_t offset, size_t size, ZWOtaSink &sink)
+{
+    return gRedis->streamRange(key, offset, size, [&](const uint8_t *data, size_t len) {
+        return sink.write(data, len);
+    }) == (long)(size - offset);
 }
 
 bool processUpdate(String &updateJson, ZWRedisResponder &responder)
 {
+    ZWHeapScope heapScope(ZWHEAP_OTA);
+    // deltas make the update JSON big enough to need all of jsonBuf
+    jsonBuf.clear();
     JsonObject &updateObj = jsonBuf.parseObject(updateJson.c_str());
 
     if (updateObj.success())
@@ -174,6 +393,16 @@ bool processUpdate(String &updateJson, ZWRedisResponder &responder)
         auto md5 = updateObj.get<char *>("md5");
         auto szb = updateObj.get<int>("size");
         auto otp = updateObj.get<unsigned long>("otp");
+        // the compressed image, if the release has one; url stays the raw image for older firmware
+        auto zurl = updateObj.get<char *>("zurl");
+        auto zszb = updateObj.get<int>("zsize");
+        // deltas from previous releases' images, each identified by that image's MD5
+        auto &deltas = updateObj.get<JsonArray &>("deltas");
+        auto transport = updateObj.get<char *>("transport");
+        ZWOtaFetcher fetch = transport && !strcmp(transport, "redis") ? redisOtaFetch : NULL;
+        auto source = [&](const char *path) {
+            return fetch ? path : zwArenaPrintf("%s/%s", EEPROMCFG_OTAHost, path);
+        };
 
         if (!otpCheck(otp))
         {
@@ -185,35 +414,83 @@ bool processUpdate(String &updateJson, ZWRedisResponder &responder)
 
         if (url && md5 && szb > 0)
         {
-            auto fqUrlLen = strlen(EEPROMCFG_OTAHost) + strlen(url) + 2;
-            char *fqUrl = (char *)malloc(fqUrlLen);
-            bzero(fqUrl, fqUrlLen);
-
-            auto fqWrote = snprintf(fqUrl, fqUrlLen, "%s/%s", EEPROMCFG_OTAHost, url);
-            if (fqWrote != fqUrlLen - 1)
-                zlog("WARNING: wrote %d of expected %d bytes for fqUrl\n", fqWrote, fqUrlLen);
-
-            zlog("Starting OTA update of %0.2fKB\n", (szb / 1024.0));
-            zlog("Image source (md5=%s):\n\t%s\n", md5, fqUrl);
-
-            if (runUpdate(fqUrl, md5, szb, preUpdateIRQDisableFunc, []() {
-                    if (gRedis->incrementBootcount(true) != 0)
-                        zlog("WARNING: unable to reset bootcount!\n");
-                    return gRedis->postCompletedUpdate();
-                }))
+            ZWOtaRequest request = {
+                .url = source(url),
+                .md5 = md5,
+                .size = (size_t)szb,
+                .encoding = ZWOTA_RAW,
+                .transferSize = (size_t)szb,
+                .fetch = fetch};
+
+            // an interrupted download of the raw image picks up where it left off instead
+            auto resuming = otaCanResume(md5, szb);
+
+            if (zurl && zszb > 0 && !resuming)
+            {
+                request.url = source(zurl);
+                request.encoding = ZWOTA_DEFLATE;
+                request.transferSize = zszb;
+            }
+
+            bool (*completed)(const ZWOtaProgress &, size_t) = [](const ZWOtaProgress &p, size_t transferred) {
+                if (gRedis->incrementBootcount(true) != 0)
+                    zlog("WARNING: unable to reset bootcount!\n");
+                // read back by tools/zw-rollout for per-unit throughput
+                return gRedis->postCompletedUpdate(zwArenaPrintf(
+                    "{ \"size\": %u, \"transferred\": %u, \"ms\": %lu, \"kbps\": %0.1f, "
+                    "\"netWaitMs\": %lu, \"flashWaitMs\": %lu }",
+                    p.written, transferred, p.elapsedMs, p.kbps, p.netWaitMs, p.flashWaitMs));
+            };
+
+            auto updated = false;
+            auto running = ESP.getSketchMD5();
+
+            for (size_t i = 0; i < deltas.size() && !resuming; i++)
+            {
+                auto &delta = deltas.get<JsonObject &>(i);
+                auto base = delta.get<char *>("base");
+                auto deltaUrl = delta.get<char *>("url");
+                auto deltaSzb = delta.get<int>("size");
+
+                if (!base || !deltaUrl || deltaSzb <= 0 || strcasecmp(base, running.c_str()))
+                    continue;
+
+                ZWOtaRequest deltaRequest = {
+                    .url = source(deltaUrl),
+                    .md5 = md5,
+                    .size = (size_t)szb,
+                    .encoding = ZWOTA_DEFLATE_DELTA,
+                    .transferSize = (size_t)deltaSzb,
+                    .fetch = fetch};
+
+                zlog("Starting OTA delta update of %0.2fKB (%0.2fKB transferred)\n", (szb / 1024.0), (deltaSzb / 1024.0));
+                zlog("Delta source (base=%s):\n\t%s\n", base, deltaRequest.url);
+
+                if (!(updated = runUpdate(deltaRequest, preUpdateIRQDisableFunc, completed)))
+                    zlog("WARNING: delta update failed (%s), falling back to the full image\n", otaLastError());
+                break;
+            }
+
+            if (!updated)
+            {
+                zlog("Starting OTA update of %0.2fKB (%0.2fKB transferred)\n", (szb / 1024.0), (request.transferSize / 1024.0));
+                zlog("Image source (md5=%s):\n\t%s\n", md5, request.url);
+                updated = runUpdate(request, preUpdateIRQDisableFunc, completed);
+            }
+
+            if (updated)
             {
                 zlog("OTA update wrote successfully! Restarting in %d seconds...\n",
                      OTA_RESET_DELAY);
+                flushLogs();
                 delay(OTA_RESET_DELAY * 1000);
                 ESP.restart();
                 return true; // never reached
             }
             else
             {
-                zlog("ERROR: OTA failed! %d\n", Update.getError());
+                zlog("ERROR: OTA failed: %s\n", otaLastError());
             }
-
-            free(fqUrl);
         }
         else
         {
@@ -230,38 +507,15 @@ bool processUpdate(String &updateJson, ZWRedisResponder &responder)
 
 bool processDisplaysConfig(String &updateJson, ZWRedisResponder &responder)
 {
+    ZWHeapScope heapScope(ZWHEAP_DISPLAYS);
     dprint("GOT DISPLAYS CONFIG: %s\n", updateJson.c_str());
     return false;
 }
 
-void redis_publish_logs_emit(const char *fmt, ...)
-{
-    // this function should never be called before gRedis is valid
-    zwassert(gRedis != NULL);
-
-    char buf[1024];
-    bzero(buf, 1024);
-    va_list args;
-    va_start(args, fmt);
-    vsprintf(buf, fmt, args);
-    va_end(args);
-
-    auto len = strlen(buf);
-
-    if (buf[len - 1] == '\n')
-        buf[len - 1] = '\0';
-
-#define PUB_FMT_STR "{\"source\":\"%s\",\"type\":\"VALUE\",\"ts\":%s,\"value\":{\"logline\":\"%s\"}}"
-    auto tickStr = String((unsigned long)gSecondsSinceBoot);
-    auto pubLen = strlen(PUB_FMT_STR) + len + gHostname.length() + tickStr.length();
-    char *jbuf = (char *)malloc(pubLen);
-    bzero(jbuf, pubLen);
-    snprintf(jbuf, pubLen, PUB_FMT_STR, gHostname.c_str(), tickStr.c_str(), buf);
-    gRedis->publishLog(jbuf);
-    free(jbuf);
-}
-
 #if M5STACKC
+// the network bring-up task logs to the LCD concurrently with setup()
+SemaphoreHandle_t __lcdLogMutex = NULL;
+
 void M5Stack_publish_logs_emit(const char *fmt, ...)
 {
     char buf[1024];
@@ -276,35 +530,28 @@ void M5Stack_publish_logs_emit(const char *fmt, ...)
     if (buf[len - 1] == '\n')
         buf[len - 1] = '\0';
 
+    if (__lcdLogMutex)
+        xSemaphoreTake(__lcdLogMutex, portMAX_DELAY);
     M5.Lcd.println(buf);
     Serial.println(buf);
+    if (__lcdLogMutex)
+        xSemaphoreGive(__lcdLogMutex);
 }
 #endif
 
-#if M5STACKC
-void readAndSetTime()
+// the clock keeps time locally and only goes back to Redis every ZWCLOCK_SYNC_INTERVAL_S
+void syncClock()
 {
-    RTC_TimeTypeDef ts;
-    bzero(&ts, sizeof(ts));
-    gRedis->getTime(&ts.Hours, &ts.Minutes, &ts.Seconds);
-    if (!(!ts.Hours && !ts.Minutes && !ts.Seconds))
-    {
-        M5.Rtc.SetTime(&ts);
-        zlog("Set time: %02d:%02d\n", ts.Hours, ts.Minutes);
-    }
-    else
-    {
-        zlog("Failed to get time from Redis (or it is exactly midnight!)\n");
-    }
+    if (zwClockSyncDue())
+        zwClockSync(gRedis);
 }
-#else
-// TODO need to make this functional for all other devices!!
-#define readAndSetTime()
-#endif
 
 void readConfigAndUserKeys()
 {
-    readAndSetTime();
+    ZWTraceScope traced(ZWT_READ_CONFIG);
+    ZWHeapScope heapScope(ZWHEAP_REDIS);
+    ZWPowerScope powered(ZWP_REDIS);
+    syncClock();
 
     auto curCfg = gRedis->readConfig();
     bool dirty = false;
@@ -354,6 +601,9 @@ void readConfigAndUserKeys()
 
     UPDATE_IF_CHANGED(deepSleepMode);
 
+    // unset reads as 0, the default
+    UPDATE_IF_CHANGED_ELSE_MARKED_DIRTY_WITH_EXTRA(refreshBudget, curCfg.refreshBudget >= 0);
+
     if (dirty)
     {
         auto badCount = gRedis->updateConfig(curCfg);
@@ -363,8 +613,16 @@ void readConfigAndUserKeys()
         }
     }
 
-    if (!gConfig.pauseRefresh)
+    // over budget these wait at most one refresh, so a budget set too small can still be undone
+    static bool __keys_deferred = false;
+    if (!gConfig.pauseRefresh && !__keys_deferred && !zwBudgetLeft())
+    {
+        __keys_deferred = true;
+        zwBudgetDefer(ZWB_USER_KEYS);
+    }
+    else if (!gConfig.pauseRefresh)
     {
+        __keys_deferred = false;
         gRedis->handleUserKey(":config:getValue", processGetValue);
         gRedis->handleUserKey(":config:controlPoint", processControlPoint);
         gRedis->handleUserKey(":config:update", processUpdate);
@@ -375,16 +633,40 @@ void readConfigAndUserKeys()
 void heartbeat()
 {
     static uint64_t __hb_count = 0;
+    ZWTraceScope traced(ZWT_HEARTBEAT);
+    ZWHeapScope heapScope(ZWHEAP_REDIS);
+    ZWPowerScope powered(ZWP_REDIS);
+    // over budget, each is put off only while the key it refreshes has a refresh or more to live
+    static int __hb_deferred = 0;
+    static int __checkin_deferred = 0;
     if (gRedis)
     {
-        if (!gRedis->heartbeat(gConfig.refresh * HEARTBEAT_EXPIRY_MULT))
+        zwMetricSet(ZWG_WIFI_RSSI, WiFi.RSSI());
+        auto checkinDue = gConfig.deepSleepMode || (__hb_count++ % CHECKIN_EVERY_X_REFRESH) || __checkin_deferred;
+
+        if (!zwBudgetLeft() && __hb_deferred < HEARTBEAT_EXPIRY_MULT - 2)
+        {
+            ++__hb_deferred;
+            zwBudgetDefer(ZWB_HEARTBEAT);
+        }
+        else
         {
-            zlog("WARNING: heartbeat failed!\n");
+            __hb_deferred = 0;
+            if (!gRedis->heartbeat(gConfig.refresh * HEARTBEAT_EXPIRY_MULT))
+            {
+                zlog("WARNING: heartbeat failed!\n");
+            }
         }
 
-        if (gConfig.deepSleepMode || (__hb_count++ % CHECKIN_EVERY_X_REFRESH))
+        if (checkinDue && !zwBudgetLeft() && __checkin_deferred < CHECKIN_EVERY_X_REFRESH)
+        {
+            ++__checkin_deferred;
+            zwBudgetDefer(ZWB_CHECKIN);
+        }
+        else if (checkinDue)
         {
-            gRedis->checkin(gConfig.deepSleepMode ? gBootCount : gSecondsSinceBoot, WiFi.localIP().toString().c_str(),
+            __checkin_deferred = 0;
+            gRedis->checkin(gConfig.deepSleepMode ? gBootCount : gSecondsSinceBoot, localIpString(),
                             immediateLatency, gUDRA, gConfig.refresh * CHECKIN_EVERY_X_REFRESH * CHECKIN_EXPIRY_MULT);
         }
     }
@@ -440,14 +722,12 @@ void zwM5StickC_UpdateBrightnessMeter()
 
 void zwM5StickC_UpdateBatteryDisplay()
 {
-    double vbat = 0.0;
-    int discharge, charge;
-    double temp = 0.0;
-
-    vbat = M5.Axp.GetVbatData() * 1.1 / 1000;
-    charge = M5.Axp.GetIchargeData() / 2;
-    discharge = M5.Axp.GetIdischargeData() / 2;
-    temp = -144.7 + M5.Axp.GetTempData() * 0.1;
+    // at most once a second between refreshes, which is also the power accounting's idle rate
+    auto &power = zwPowerSample();
+    double vbat = power.vbat;
+    int charge = (int)power.chargeMa;
+    int discharge = (int)power.dischargeMa;
+    double temp = power.tempC;
 
     const int xOff = 94;
     const int yIncr = 16;
@@ -460,7 +740,7 @@ void zwM5StickC_UpdateBatteryDisplay()
     M5.Lcd.setCursor(xOff, yOff, battFont);
 
     uint16_t voltageColor = RED;
-    if (!M5.Axp.GetWarningLeve())
+    if (!power.lowBattery)
         voltageColor = vbat > 3.9 ? GREEN : (vbat > 3.7 ? YELLOW : ORANGE);
     M5.Lcd.setTextColor(voltageColor, BLACK);
     M5.Lcd.printf("%.3fV\n", vbat); //battery voltage
@@ -485,10 +765,13 @@ void zwM5StickC_UpdateBatteryDisplay()
         M5.Lcd.setTextColor(LIGHTGREY, BLACK);
     }
 
-    M5.Rtc.GetBm8563Time();
+    uint8_t hour, minute;
     M5.Lcd.setCursor(xOff, 65 - 8, 4);
     M5.Lcd.setTextColor(CYAN, BLACK);
-    M5.Lcd.printf("%02d:%02d\n", M5.Rtc.Hour % 12, M5.Rtc.Minute);
+    if (zwClockLocal(&hour, &minute, NULL))
+        M5.Lcd.printf("%02d:%02d\n", hour % 12, minute);
+    else
+        M5.Lcd.printf("--:--\n");
     M5.Lcd.setTextColor(WHITE, BLACK);
 
     zwM5StickC_UpdateBrightnessMeter();
@@ -502,6 +785,7 @@ void zwM5StickC_UpdateBatteryDisplay()
 #define PAGE_SIZE 4
 static int __dispPage = 0;
 static int __dispPages = 0;
+static int __dispResume = 0;
 
 void tick(bool forceUpdate = false)
 {
@@ -510,17 +794,46 @@ void tick(bool forceUpdate = false)
             return;
 
     zlog("Awake at us=%lu tick=%lld\n", micros(), gSecondsSinceBoot);
+    ZWTraceScope traced(ZWT_TICK);
 
 #if M5STACKC
-    M5.Lcd.fillScreen(TFT_BLACK);
-    zwM5StickC_UpdateBatteryDisplay();
-    M5.Lcd.setCursor(0, 0, 2);
+    {
+        ZWTraceScope statusTraced(ZWT_STATUS_RENDER);
+        ZWPowerScope powered(ZWP_RENDER);
+        M5.Lcd.fillScreen(TFT_BLACK);
+        zwM5StickC_UpdateBatteryDisplay();
+        M5.Lcd.setCursor(0, 0, 2);
+    }
 #endif
 
-    for (DisplaySpec *w = (gDisplays + (__dispPage * PAGE_SIZE));
-         (w - (gDisplays + (__dispPage * PAGE_SIZE))) < PAGE_SIZE && (w->clockPin != -1 && w->dioPin != -1);
-         w++) 
-            updateDisplay(w);
+    auto page = gDisplays + (__dispPage * PAGE_SIZE);
+    int onPage = 0;
+    while (onPage < PAGE_SIZE && page[onPage].clockPin != -1 && page[onPage].dioPin != -1)
+        ++onPage;
+
+    // fetched starting with any the budget cut off last time, so none starves; rendered in page order
+    bool fresh[PAGE_SIZE] = {false};
+    bool deferred[PAGE_SIZE] = {false};
+    for (int i = 0; i < onPage; i++)
+    {
+        auto idx = (__dispResume + i) % onPage;
+        // at least one display is fetched each refresh, however small the budget
+        if (i && !zwBudgetLeft())
+        {
+            for (int j = i; j < onPage; j++)
+                deferred[(__dispResume + j) % onPage] = true;
+            zwBudgetDefer(ZWB_DISPLAYS, onPage - i);
+            __dispResume = idx;
+            break;
+        }
+        fresh[idx] = fetchDisplay(page + idx);
+        if (i == onPage - 1)
+            __dispResume = 0;
+    }
+
+    for (int i = 0; i < onPage; i++)
+        if (fresh[i] || (deferred[i] && page[i].spec.lastTs != 0.0))
+            renderDisplay(page + i);
 
 #if M5STACKC
     M5.Lcd.setTextColor(NAVY, BLACK);
@@ -528,11 +841,15 @@ void tick(bool forceUpdate = false)
 #endif
 
     _last_free = ESP.getFreeHeap();
+    zwMetricSet(ZWG_FREE_HEAP, _last_free);
 
     if (gConfig.deepSleepMode)
     {
+        // closes the refresh the caller opened, so this wake's checkin includes it
+        zwPowerRefreshEnd();
         heartbeat();
         zlog("Deep-sleeping for %ds...\n", gConfig.refresh);
+        flushLogs();
         Serial.flush();
         esp_sleep_enable_timer_wakeup(gConfig.refresh * 1e6);
         esp_deep_sleep_start();
@@ -546,11 +863,18 @@ void IRAM_ATTR __isr()
     portEXIT_CRITICAL(&__isrMutex);
 }
 
+#if M5STACKC
 static bool __lastHome = true;
 static bool __lastRst = true;
 static uint64_t __rstDebounce = 0;
+#endif
+static uint16_t __refreshCount = 0;
+
 void loop()
 {
+    // nothing from the previous pass may still be holding arena memory
+    zwArenaReset();
+
     if (__isrCount)
     {
         portENTER_CRITICAL(&__isrMutex);
@@ -560,9 +884,11 @@ void loop()
         zwM5StickC_UpdateBatteryDisplay();
     }
 
+    bool forceTick = false;
+
+#if M5STACKC
     auto curHome = digitalRead(M5_BUTTON_HOME);
     auto curRst = digitalRead(M5_BUTTON_RST);
-    bool forceTick = false;
 
     if (curHome != __lastHome)
     {
@@ -571,6 +897,7 @@ void loop()
             if (__dispPages)
             {
                 __dispPage = (__dispPage + 1) % (__dispPages + 1);
+                __dispResume = 0;
             }
 
             forceTick = true;
@@ -589,6 +916,7 @@ void loop()
 
     __lastHome = curHome;
     __lastRst = curRst;
+#endif
 
     if (forceTick || (!(gSecondsSinceBoot % gConfig.refresh) && gLastRefreshTick != gSecondsSinceBoot))
     {
@@ -600,18 +928,127 @@ void loop()
         }
 
         gLastRefreshTick = gSecondsSinceBoot;
+        zwTraceSetRefresh(++__refreshCount);
+        zwCaptureRefreshStart(__refreshCount);
+        ZWMetricScope refreshTimed(ZWH_REFRESH);
+        ZWTraceScope refreshTraced(ZWT_REFRESH);
+        zwMetricInc(ZWC_REFRESHES);
+        zwBudgetBegin(gConfig.refreshBudget);
+        zwPowerRefreshStart();
         readConfigAndUserKeys();
-        tick();
+        zwMetricTime(ZWH_TICK, []() { tick(); });
         heartbeat();
+        if (zwBudgetLeft())
+        {
+            // picks up anything logged while the connection was down
+            {
+                ZWHeapScope heapScope(ZWHEAP_LOGGING);
+                ZWPowerScope powered(ZWP_REDIS);
+                gRedis->drainCriticalLog();
+            }
+            flushLogs();
+        }
+        else
+        {
+            // the queue goes out between refreshes instead, see below
+            zwBudgetDefer(ZWB_LOGS);
+        }
+        zwBudgetEnd();
+        zwPowerRefreshEnd();
+        if (zwCaptureRefreshEnd())
+            storeCapture();
+        zwHeapTickBoundary();
+    }
+    else if (zwLogQueuePending() && millis() - __lastLogFlush > ZWLOG_FLUSH_INTERVAL_MS)
+    {
+        flushLogs();
+    }
+}
+
+#define NET_INIT_OK 0
+#define NET_INIT_WIFI_FAILED 1
+#define NET_INIT_REDIS_FAILED 2
+#define NET_INIT_TASK_STACK 8192
+static volatile bool __netInitDone = false;
+static volatile int __netInitStatus = NET_INIT_OK;
+static char __redisRetriedCrit[ZWCRITLOG_FORMAT_MAX] = "";
+
+bool redisConnect()
+{
+    ZWHeapScope heapScope(ZWHEAP_REDIS);
+#define NUM_RETRIES 5
+    int redisConnectRetries = NUM_RETRIES;
+    float redisWaitRetryTime = 50;
+    float redisWaitRetryBackoffMult = 1.37;
+
+    int errnos[NUM_RETRIES];
+    bzero(errnos, sizeof(errnos));
+    while (!gRedis->connect() && --redisConnectRetries)
+    {
+        // seen: ECONNABORTED (makes sense)
+        errnos[NUM_RETRIES - (redisConnectRetries + 1)] = errno;
+        zlog("Redis connect failed but %d retries left, waiting %0.2fs and trying again (m=%0.3f)\n",
+             redisConnectRetries, redisWaitRetryTime, redisWaitRetryBackoffMult);
+        redisWaitRetryTime *= redisWaitRetryBackoffMult;
+        redisWaitRetryBackoffMult *= redisWaitRetryBackoffMult;
+        delay(redisWaitRetryTime);
+    }
+
+    if (!redisConnectRetries)
+    {
+        zlog("ERROR: redis init failed!\n");
+        return false;
     }
+
+    if (redisConnectRetries != NUM_RETRIES)
+    {
+        String seenErrnos = "";
+        for (int i = 0; i < NUM_RETRIES && errnos[i]; i++)
+            seenErrnos += String(errnos[i]) + " ";
+        zlog("Redis connection had to be retried %d times. Saw: %s\n",
+             NUM_RETRIES - redisConnectRetries, seenErrnos.c_str());
+        // this runs on the network bring-up task, which mustn't touch the main task's arena
+        // (ZWRedis::logCritical would upload immediately), and before the boot count is known:
+        // setup() appends it once it is, then drains it
+        snprintf(__redisRetriedCrit, sizeof(__redisRetriedCrit), "Redis connection had to be retried %d times. Saw: %s",
+                 NUM_RETRIES - redisConnectRetries, seenErrnos.c_str());
+    }
+
+    return true;
+}
+
+// runs WiFi association and the Redis connect underneath display init and the splash holds
+void netInitTask(void *arg)
+{
+    // the main task owns the I2C bus, so this only keeps time
+    ZWPowerScope powered(ZWP_WIFI, false);
+    if (!zwWiFiInit(gHostname.c_str(), gConfig))
+    {
+        __netInitStatus = NET_INIT_WIFI_FAILED;
+    }
+    else
+    {
+        zwBootMark(ZWBOOT_WIFI);
+
+        if (!redisConnect())
+            __netInitStatus = NET_INIT_REDIS_FAILED;
+        else
+            zwBootMark(ZWBOOT_REDIS);
+    }
+
+    __netInitDone = true;
+    vTaskDelete(NULL);
 }
 
 void setup()
 {
+    zwBootMark(ZWBOOT_START);
+
 #if M5STACKC
     M5.begin();
     pinMode(M5_BUTTON_HOME, INPUT_PULLUP);
     pinMode(M5_BUTTON_RST, INPUT_PULLUP);
+    __lcdLogMutex = xSemaphoreCreateMutex();
     zlog("Built for M5StickC\n");
     gConfig.publishLogs = true;
     gPublishLogsEmit = M5Stack_publish_logs_emit;
@@ -620,18 +1057,58 @@ void setup()
     Serial.begin(SER_BAUD);
 #endif
 
-    verifyProvisioning();
+    if (zwCritLogBegin())
+    {
+        auto resetReason = esp_reset_reason();
+        if (resetReason == ESP_RST_PANIC || resetReason == ESP_RST_BROWNOUT || resetReason == ESP_RST_INT_WDT ||
+            resetReason == ESP_RST_TASK_WDT || resetReason == ESP_RST_WDT)
+        {
+            char resetMsg[40];
+            snprintf(resetMsg, sizeof(resetMsg), "Abnormal reset (reason %d)", resetReason);
+            // incrementBootcount() will give this boot the count after the last one's
+            zwCritLogAppend(__rtcBootCountCheck == ~__rtcBootCount ? __rtcBootCount + 1 : 0, resetMsg);
+        }
+    }
+
+    // before any log lines, so they can be stamped with the RTC's time if it has it
+    zwClockBegin();
 
+    // WiFi & Redis credentials come from here, so it's as early as the network can start
+    {
+        ZWHeapScope heapScope(ZWHEAP_PROVISIONING);
+        verifyProvisioning();
+    }
+    zwBootMark(ZWBOOT_PROVISIONED);
+
+    ZWRedisHostConfig redisConfig = {
+        .host = EEPROMCFG_RedisHost,
+        .port = EEPROMCFG_RedisPort,
+        .password = EEPROMCFG_RedisPass};
+
+    gRedis = new ZWRedis(gHostname, redisConfig);
+
+    if (xTaskCreate(netInitTask, "zwNetInit", NET_INIT_TASK_STACK, NULL, 1, NULL) != pdPASS)
+    {
+        zlog("WARNING: couldn't start async network init, running it inline\n");
+        netInitTask(NULL);
+    }
+    zwBootMark(ZWBOOT_NET_STARTED);
+
+#if M5STACKC
+    xSemaphoreTake(__lcdLogMutex, portMAX_DELAY);
+#endif
     if (!(gDisplays = zwdisplayInit(gHostname)))
     {
         dprint("Display init failed, halting forever\n");
         __haltOrCatchFire();
     }
+    zwBootMark(ZWBOOT_DISPLAYS);
 
     auto buildVariant = "";
 #if M5STACKC
     buildVariant = "-M5SC";
     M5.Lcd.setCursor(0, 0, 1);
+    xSemaphoreGive(__lcdLogMutex);
 
     //zwM5StickC_DrawBitmap(10, 10, 8, 8, (uint16_t*)brightIcon);
     //delay(120000);
@@ -643,72 +1120,70 @@ void setup()
     for (; dWalk->clockPin != -1 && dWalk->dioPin != -1; dWalk++);
     __dispPages = (int)((dWalk - gDisplays) / PAGE_SIZE) - (!((dWalk - gDisplays) % PAGE_SIZE) ? 1 : 0);
 
+    // the holds below used to be serial delay()s; they are now minimum on-screen times
+    // measured from here, so WiFi & Redis bring-up happen within them instead of after
+    auto splashStart = millis();
+    unsigned long splashHold = 0;
+    zwBootMark(ZWBOOT_SPLASH);
+
     if (!gConfig.deepSleepMode)
     {
 #if !M5STACKC
         auto verNum = String(ZEROWATCH_VER);
         verNum.replace(".", "");
         gDisplays[0].disp->showNumberDec(verNum.toInt(), true);
-        delay(2000);
+        splashHold += 2000;
 #endif
     }
 
-    if (!zwWiFiInit(gHostname.c_str(), gConfig))
-    {
-        dprint("WiFi init failed, halting forever\n");
-        __haltOrCatchFire();
-    }
-
-    ZWRedisHostConfig redisConfig = {
-        .host = EEPROMCFG_RedisHost,
-        .port = EEPROMCFG_RedisPort,
-        .password = EEPROMCFG_RedisPass};
-
-    gRedis = new ZWRedis(gHostname, redisConfig);
-
-#define NUM_RETRIES 5
-    int redisConnectRetries = NUM_RETRIES;
-    float redisWaitRetryTime = 50;
-    float redisWaitRetryBackoffMult = 1.37;
+    while (!__netInitDone)
+        delay(5);
+    zwBootMark(ZWBOOT_NET_READY);
 
-    int errnos[NUM_RETRIES];
-    while (!gRedis->connect() && --redisConnectRetries)
+    if (__netInitStatus == NET_INIT_WIFI_FAILED)
     {
-        // seen: ECONNABORTED (makes sense)
-        errnos[NUM_RETRIES - (redisConnectRetries + 1)] = errno;
-        zlog("Redis connect failed but %d retries left, waiting %0.2fs and trying again (m=%0.3f)\n",
-             redisConnectRetries, redisWaitRetryTime, redisWaitRetryBackoffMult);
-        redisWaitRetryTime *= redisWaitRetryBackoffMult;
-        redisWaitRetryBackoffMult *= redisWaitRetryBackoffMult;
-        delay(redisWaitRetryTime);
-    }
+        if (gConfig.deepSleepMode)
+        {
+            zlog("WiFi init failed, deep-sleeping for %ds and trying again\n", gConfig.refresh);
+            Serial.flush();
+            esp_sleep_enable_timer_wakeup(gConfig.refresh * 1e6);
+            esp_deep_sleep_start();
+        }
 
-    if (!redisConnectRetries)
-    {
-        zlog("ERROR: redis init failed!\n");
+        dprint("WiFi init failed, halting forever\n");
         __haltOrCatchFire();
     }
-
-    if (redisConnectRetries != NUM_RETRIES)
+    else if (__netInitStatus == NET_INIT_REDIS_FAILED)
     {
-        String seenErrnos = "";
-        for (int i = 0; i < NUM_RETRIES && errnos[i]; i++)
-            seenErrnos += String(errnos[i]) + " ";
-        zlog("Redis connection had to be retried %d times. Saw: %s\n",
-             NUM_RETRIES - redisConnectRetries, seenErrnos.c_str());
-        gRedis->logCritical("Redis connection had to be retried %d times. Saw: %s",
-                            NUM_RETRIES - redisConnectRetries, seenErrnos.c_str());
+        __haltOrCatchFire();
     }
 
     gBootCount = gRedis->incrementBootcount();
+    __rtcBootCount = gBootCount;
+    __rtcBootCountCheck = ~gBootCount;
+
+    if (*__redisRetriedCrit)
+        zwCritLogAppend(gBootCount, __redisRetriedCrit);
+
+    if (zwCritLogPending())
+        zlog("Uploaded %d pending critical events\n", gRedis->drainCriticalLog());
 
     zlog("Initialized! (debug %s)\n", gConfig.debug ? "on" : "off");
     zlog("Boot count: %lu\n", gBootCount);
 
     readConfigAndUserKeys();
+    zwBootMark(ZWBOOT_CONFIG);
 
     if (gConfig.debug && !gConfig.deepSleepMode)
-        delay(5000);
+        splashHold += 5000;
+
+#if M5STACKC
+    splashHold += gConfig.debug ? 10000 : 2000;
+#endif
+
+    while (millis() - splashStart < splashHold)
+        delay(5);
+    zwBootMark(ZWBOOT_HOLD_DONE);
 
     __isrTimer = timerBegin(0, 80, true);
     timerAttachInterrupt(__isrTimer, &__isr, true);
@@ -716,13 +1191,23 @@ void setup()
     timerAlarmEnable(__isrTimer);
 
 #if M5STACKC
-    delay(gConfig.debug ? 10000 : 2000);
     gPublishLogsEmit = NULL;
     M5.Lcd.setCursor(0, 0, 2);
     M5.Lcd.fillScreen(TFT_BLACK);
 #endif
 
     gPublishLogsEmit = redis_publish_logs_emit;
+#if ZWLOG_BINARY
+    gPublishLogsEmitBinary = redis_publish_logs_emit_binary;
+#endif
 
+    // in deep-sleep mode this is the wake's only refresh, and tick() ends it
+    zwPowerRefreshStart();
     tick(true);
+    zwPowerRefreshEnd();
+    zwBootMark(ZWBOOT_FIRST_TICK);
+
+    char bootBuf[512];
+    zwBootTimelineAsJson(bootBuf, sizeof(bootBuf));
+    zlog("Boot timeline (ms): %s\n", bootBuf);
 }
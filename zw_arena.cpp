@@ -0,0 +1,82 @@
+#include "zw_arena.h"
+#include "zw_metrics.h"
+
+static uint8_t __arena[ZWARENA_SIZE] __attribute__((aligned(ZWARENA_ALIGN)));
+static size_t __used = 0;
+static size_t __highWater = 0;
+
+// spilled allocations are chained through a header so reset can free them
+struct ZWArenaSpill
+{
+    ZWArenaSpill *next;
+};
+static ZWArenaSpill *__spills = NULL;
+
+void *zwArenaAlloc(size_t size)
+{
+    auto aligned = (size + ZWARENA_ALIGN - 1) & ~(size_t)(ZWARENA_ALIGN - 1);
+    if (aligned <= ZWARENA_SIZE - __used)
+    {
+        auto ptr = __arena + __used;
+        __used += aligned;
+        __highWater = max(__highWater, __used);
+        return ptr;
+    }
+
+    auto spill = (ZWArenaSpill *)malloc(sizeof(ZWArenaSpill) + size);
+    if (!spill)
+        return NULL;
+
+    zwMetricInc(ZWC_ARENA_SPILLS);
+    spill->next = __spills;
+    __spills = spill;
+    return spill + 1;
+}
+
+char *zwArenaPrintf(const char *format, ...)
+{
+    static char __empty[1];
+    va_list args;
+
+    va_start(args, format);
+    auto len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    auto buf = len < 0 ? NULL : (char *)zwArenaAlloc(len + 1);
+    if (!buf)
+        return __empty;
+
+    va_start(args, format);
+    vsnprintf(buf, len + 1, format, args);
+    va_end(args);
+    return buf;
+}
+
+void zwArenaReset()
+{
+    while (__spills)
+    {
+        auto next = __spills->next;
+        free(__spills);
+        __spills = next;
+    }
+
+    __used = 0;
+    zwMetricSet(ZWG_ARENA_HIGH_WATER, __highWater);
+}
+
+void zwArenaRewind(size_t mark)
+{
+    if (mark < __used)
+        __used = mark;
+}
+
+size_t zwArenaUsed()
+{
+    return __used;
+}
+
+size_t zwArenaHighWater()
+{
+    return __highWater;
+}
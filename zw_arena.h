@@ -0,0 +1,27 @@
+#ifndef __ZW_ARENA__H__
+#define __ZW_ARENA__H__
+
+#include <Arduino.h>
+
+// Bump-pointer arena for the short-lived strings and buffers built while handling
+// a pass of loop(): everything allocated here is released at once when the next
+// pass begins (zwArenaReset()), so none of it can fragment the heap. Requests that
+// don't fit "spill" to malloc() and are freed at the same reset. Main loop only.
+#define ZWARENA_SIZE 3072
+#define ZWARENA_ALIGN 4
+
+void *zwArenaAlloc(size_t size);
+
+// never NULL: returns "" if even the spill allocation failed
+char *zwArenaPrintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+void zwArenaReset();
+
+// releases what was allocated since zwArenaUsed() returned mark; spills wait for the next reset
+void zwArenaRewind(size_t mark);
+
+size_t zwArenaUsed();
+
+size_t zwArenaHighWater();
+
+#endif
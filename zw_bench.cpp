@@ -0,0 +1,155 @@
+#include "zw_bench.h"
+#include "zw_common.h"
+#include "zw_displays.h"
+#include "zw_logqueue.h"
+#include "zw_provision.h"
+#include "zw_redis.h"
+#include "zw_telemetry.h"
+#include "zw_arena.h"
+#include "zw_heap.h"
+#include <algorithm>
+
+extern DisplaySpec *gDisplays;
+
+// an LRANGE reply as the sensor lists hold them, as long as the display specs' 0..10 ranges
+static const char *__lrangeFixture[] = {
+    "[1571529602.4432569, 71.78]", "[1571529542.1120388, 71.82]", "[1571529482.0051205, 71.82]",
+    "[1571529421.8861482, 71.87]", "[1571529361.7630224, 71.91]", "[1571529301.6419132, 71.91]",
+    "[1571529241.5207911, 71.96]", "[1571529181.3996775, 72.01]", "[1571529121.2785583, 72.01]",
+    "[1571529061.1574402, 72.05]", "[1571529001.0363216, 72.1]"};
+
+static DisplaySpec __displayFixture[] = {
+    {18, 19, nullptr, {"zero:sensor:BME280:temperature:.list", 0, 10, 0.0, 7215, [](int i) { return i; }, d_tempf}},
+    {13, 14, nullptr, {"zero:sensor:BME280:humidity:.list", 0, 10, 0.0, 4530, [](int i) { return i; }, d_humidPercent}},
+    {33, 32, nullptr, {"zero:sensor:BME280:pressure:.list", 0, 4, 0.0, 1013, [](int i) { return i / 100; }, d_def}},
+    {26, 25, nullptr, {"zed:sensor:SPS30:mc_2p5:.list", 0, 4, 0.0, 12, [](int i) { return i / 100; }, d_def}},
+    {-1, -1, nullptr, {nullptr, -1, -1, -1.0, -1, [](int i) { return i; }, d_def}}};
+
+struct ZWBenchResult
+{
+    uint32_t ops;
+    uint32_t nsMin;
+    uint32_t nsMedian;
+    uint32_t nsMax;
+    float allocsPerOp;
+};
+
+// operator new calls, when ZWHEAP_TRACK_NEW is counting them
+static uint32_t __allocs()
+{
+    uint32_t total = 0;
+    for (int i = 0; i < ZWHEAP_SUBSYSTEM_COUNT; i++)
+        total += zwHeapSubsystemStats((ZWHeapSubsystem)i).allocs;
+    return total;
+}
+
+template <typename F>
+static ZWBenchResult __bench(F op)
+{
+    // anything op puts in the arena is released after each run, so none of it spills
+    auto mark = zwArenaUsed();
+    auto batch = [&](uint32_t ops) {
+        auto start = micros();
+        for (uint32_t i = 0; i < ops; i++)
+        {
+            op();
+            zwArenaRewind(mark);
+        }
+        return (uint32_t)(micros() - start);
+    };
+
+    uint32_t ops = 1;
+    while (batch(ops) < ZWBENCH_BATCH_US && ops < (1 << 20))
+        ops *= 2;
+
+    uint32_t ns[ZWBENCH_BATCHES];
+    auto allocs = __allocs();
+    for (int i = 0; i < ZWBENCH_BATCHES; i++)
+        ns[i] = (uint32_t)((uint64_t)batch(ops) * 1000 / ops);
+    allocs = __allocs() - allocs;
+
+    std::sort(ns, ns + ZWBENCH_BATCHES);
+    return {ops, ns[0], ns[ZWBENCH_BATCHES / 2], ns[ZWBENCH_BATCHES - 1],
+            (float)allocs / (ops * ZWBENCH_BATCHES)};
+}
+
+// what redis_publish_logs_emit() costs the caller: the formatting into a queue slot
+static size_t __logEmit(char *line, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    auto len = zwLogQueueFormat(line, fmt, args);
+    va_end(args);
+    return len;
+}
+
+int zwBenchRun(char *buf, size_t bufLen, const char *only)
+{
+    int wrote = 0;
+    bool first = true;
+
+    auto run = [&](const char *name, std::function<void()> op) {
+        if (only && *only && strncmp(name, only, strlen(only)))
+            return;
+
+        auto r = __bench(op);
+        char allocs[16] = "null";
+#if ZWHEAP_TRACK_NEW
+        snprintf(allocs, sizeof(allocs), "%0.2f", r.allocsPerOp);
+#endif
+        APPEND("%s { \"name\": \"%s\", \"ops\": %u, \"nsMin\": %u, \"nsMedian\": %u, \"nsMax\": %u, \"allocsPerOp\": %s }",
+               first ? "" : ",", name, r.ops, r.nsMin, r.nsMedian, r.nsMax, allocs);
+        first = false;
+    };
+
+#if ZW_HOST
+    APPEND("{ \"ver\": \"%s\", \"platform\": \"host\", ", ZEROWATCH_VER);
+#else
+    APPEND("{ \"ver\": \"%s\", \"platform\": \"esp32\", ", ZEROWATCH_VER);
+#endif
+    APPEND("\"variant\": \"%s\", \"results\": [", M5STACKC ? "m5stickc" : "tm1637");
+
+    std::vector<String> lrVec(__lrangeFixture, __lrangeFixture + sizeof(__lrangeFixture) / sizeof(__lrangeFixture[0]));
+    DisplaySpec parsed = __displayFixture[0];
+    run("display.parse", [&]() { parseDisplayValues(&parsed, lrVec); });
+
+    run("display.config", [&]() { displayConfigAsJson(__displayFixture); });
+
+    // the segment displays' formatters need a real display to drive
+    auto render = [&](DisplaySpec *d) {
+#if M5STACKC
+        M5.Lcd.setCursor(0, 0, 2);
+#endif
+        d->spec.dispFunc(d);
+    };
+    if (M5STACKC || (gDisplays && gDisplays->disp))
+    {
+        DisplaySpec tempf = __displayFixture[0], humid = __displayFixture[1], def = __displayFixture[2];
+        tempf.disp = humid.disp = def.disp = gDisplays ? gDisplays->disp : nullptr;
+        run("render.tempf", [&]() { render(&tempf); });
+        run("render.humidpercent", [&]() { render(&humid); });
+        run("render.def", [&]() { render(&def); });
+    }
+
+    char line[ZWLOG_LINE_MAX];
+    run("log.emit", [&]() {
+        __logEmit(line, "[%s] count %d val %d immLat %lu gUDRA %lu (delta %ld)\n",
+                  __displayFixture[0].spec.listKey, 11, 7215, 41235ul, 40120ul, 1115l);
+    });
+
+    ZWRedis redis(gHostname, {"", 0, ""});
+    char jsonBuf[1024];
+    uint8_t mpBuf[ZWREDIS_CHECKIN_MSGPACK_MAX];
+    run("checkin.json", [&]() {
+        zwTelemetryCheckinJson(jsonBuf, sizeof(jsonBuf), redis.checkinData(86400, "192.168.1.123", 41235, 40120));
+    });
+    run("checkin.msgpack", [&]() {
+        zwTelemetryCheckinMsgPack(mpBuf, sizeof(mpBuf), redis.checkinData(86400, "192.168.1.123", 41235, 40120));
+    });
+
+    if (zwProvisionCheck())
+        run("provision.read", [&]() { zwProvisionCheck(); });
+
+    APPEND(" ] }");
+    return wrote;
+}
@@ -0,0 +1,24 @@
+#ifndef __ZW_BENCH__H__
+#define __ZW_BENCH__H__
+
+#include <Arduino.h>
+
+// Microbenchmarks of the code each refresh runs, against fixed, realistic inputs, so their
+// CPU cost can be compared between releases: on the unit through getValue of "bench" (which
+// also keeps the results at HOSTNAME:info:bench, a hash field per ZEROWATCH_VER) and on the
+// host with "zero_watch --bench". tools/zw-bench compares two sets of results.
+//
+// Each benchmark runs in ZWBENCH_BATCHES batches, each repeating the operation for at least
+// ZWBENCH_BATCH_US so that micros() is precise enough; the results are per operation.
+#define ZWBENCH_BATCHES 11
+#define ZWBENCH_BATCH_US 2000
+#define ZWBENCH_JSON_MAX 2048
+
+// Runs every benchmark whose name starts with only (all of them if NULL or empty) and writes
+//   { "ver": .., "platform": .., "results": [ { "name": .., "ops": .., "nsMin": .., "nsMedian": ..,
+//     "nsMax": .., "allocsPerOp": .. }, .. ] }
+// allocsPerOp is null unless ZWHEAP_TRACK_NEW counts allocations. Benchmarks that can't run here (e.g. no provisioning to read) are left out. Main loop only,
+// as some reuse the loop's buffers; returns the length written, as snprintf.
+int zwBenchRun(char *buf, size_t bufLen, const char *only = NULL);
+
+#endif
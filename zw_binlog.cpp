@@ -0,0 +1,31 @@
+#include "zw_logging.h"
+#include "zw_binlog.h"
+#include "zw_clock.h"
+
+void (*gPublishLogsEmitBinary)(const uint8_t *frame, size_t len) = NULL;
+
+extern unsigned long long gSecondsSinceBoot;
+
+void zwBinLogBegin(ZWBinLogFrame &frame, uint32_t site)
+{
+    // as redis_publish_logs_emit's: UTC epoch seconds once the clock is set, uptime before
+    auto ts = (uint32_t)zwClockSeconds();
+    if (!ts)
+        ts = (uint32_t)gSecondsSinceBoot;
+    frame.len = 0;
+    frame.buf[frame.len++] = ZWBINLOG_SYNC0;
+    frame.buf[frame.len++] = ZWBINLOG_SYNC1;
+    frame.buf[frame.len++] = 0;
+    frame.put(&site, 4);
+    frame.put(&ts, 4);
+}
+
+void zwBinLogEmit(ZWBinLogFrame &frame, bool publish)
+{
+    frame.buf[2] = (uint8_t)(frame.len - 3);
+
+    if (publish && gPublishLogsEmitBinary)
+        gPublishLogsEmitBinary(frame.buf, frame.len);
+    else
+        Serial.write(frame.buf, frame.len);
+}
@@ -0,0 +1,142 @@
+#ifndef __ZW_BINLOG__H__
+#define __ZW_BINLOG__H__
+
+#include <Arduino.h>
+#include <type_traits>
+
+// Binary log frames: only a per-call-site ID and the raw arguments leave the
+// device. tools/zw-logdecode rebuilds the text from a table of call sites
+// scanned out of the sources (see scripts/new-release.pl). A site's ID hashes
+// its file and format string rather than its line, which a call inside a macro
+// body would share with every other call the macro expands to.
+//
+//   0xA5 0x5A | len u8 | site u32 | ts u32 | args...
+//
+// len counts the bytes after itself; integers are little-endian. Each argument
+// is a tag byte followed by its payload:
+//   'i' i32, 'u' u32, 'l' i64, 'L' u64, 'd' double, 'p' u32 pointer,
+//   's' u8 length + bytes (no terminator, truncated at ZWBINLOG_STR_MAX)
+
+#define ZWBINLOG_SYNC0 0xA5
+#define ZWBINLOG_SYNC1 0x5A
+#define ZWBINLOG_HEADER_LEN 11
+#define ZWBINLOG_FRAME_MAX 128
+#define ZWBINLOG_STR_MAX 48
+
+// reserved site IDs for frames the device synthesizes itself
+#define ZWBINLOG_SITE_DROPPED 0
+
+constexpr uint32_t __zwBinLogFnv(const char *s, uint32_t h = 2166136261u)
+{
+    return *s ? __zwBinLogFnv(s + 1, (h ^ (uint8_t)*s) * 16777619u) : h;
+}
+
+constexpr const char *__zwBinLogBasename(const char *p, const char *last)
+{
+    return *p ? __zwBinLogBasename(p + 1, (*p == '/' || *p == '\\') ? p + 1 : last) : last;
+}
+
+// build directories differ between machines, so only the file's basename is hashed,
+// then a NUL and the format
+constexpr uint32_t zwBinLogSiteId(const char *file, const char *fmt)
+{
+    return __zwBinLogFnv(fmt, __zwBinLogFnv(__zwBinLogBasename(file, file)) * 16777619u);
+}
+
+#define ZWBINLOG_SITE_ID(fmt) zwBinLogSiteId(__FILE__, fmt)
+
+struct ZWBinLogFrame
+{
+    uint8_t buf[ZWBINLOG_FRAME_MAX];
+    size_t len;
+
+    void put(const void *data, size_t n)
+    {
+        if (len + n <= ZWBINLOG_FRAME_MAX)
+        {
+            memcpy(buf + len, data, n);
+            len += n;
+        }
+    }
+
+    void putTagged(char tag, const void *data, size_t n)
+    {
+        if (len + n + 1 <= ZWBINLOG_FRAME_MAX)
+        {
+            buf[len++] = (uint8_t)tag;
+            put(data, n);
+        }
+    }
+};
+
+// extern so that the emitter can be swapped without including the sketch
+extern void (*gPublishLogsEmitBinary)(const uint8_t *frame, size_t len);
+
+void zwBinLogBegin(ZWBinLogFrame &frame, uint32_t site);
+void zwBinLogEmit(ZWBinLogFrame &frame, bool publish);
+
+template <typename T>
+typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+zwBinLogArg(ZWBinLogFrame &f, T v)
+{
+    if (sizeof(T) > 4)
+    {
+        auto w = (uint64_t)v;
+        f.putTagged(std::is_signed<T>::value ? 'l' : 'L', &w, 8);
+    }
+    else
+    {
+        auto w = (uint32_t)v;
+        f.putTagged(std::is_signed<T>::value ? 'i' : 'u', &w, 4);
+    }
+}
+
+template <typename T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+zwBinLogArg(ZWBinLogFrame &f, T v)
+{
+    auto d = (double)v;
+    f.putTagged('d', &d, 8);
+}
+
+inline void zwBinLogArg(ZWBinLogFrame &f, const char *s)
+{
+    auto n = s ? strnlen(s, ZWBINLOG_STR_MAX) : 0;
+    if (f.len + n + 2 <= ZWBINLOG_FRAME_MAX)
+    {
+        f.buf[f.len++] = 's';
+        f.buf[f.len++] = (uint8_t)n;
+        f.put(s, n);
+    }
+}
+
+inline void zwBinLogArg(ZWBinLogFrame &f, char *s)
+{
+    zwBinLogArg(f, (const char *)s);
+}
+
+inline void zwBinLogArg(ZWBinLogFrame &f, const void *p)
+{
+    auto w = (uint32_t)(uintptr_t)p;
+    f.putTagged('p', &w, 4);
+}
+
+inline void __zwBinLogArgs(ZWBinLogFrame &f) {}
+
+template <typename T, typename... Rest>
+void __zwBinLogArgs(ZWBinLogFrame &f, T first, Rest... rest)
+{
+    zwBinLogArg(f, first);
+    __zwBinLogArgs(f, rest...);
+}
+
+template <typename... Args>
+void zwBinLog(bool publish, uint32_t site, Args... args)
+{
+    ZWBinLogFrame frame;
+    zwBinLogBegin(frame, site);
+    __zwBinLogArgs(frame, args...);
+    zwBinLogEmit(frame, publish);
+}
+
+#endif
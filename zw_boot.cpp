@@ -0,0 +1,39 @@
+#include "zw_boot.h"
+
+static const char *__bootPhaseNames[ZWBOOT_PHASE_COUNT] = {
+    "start",
+    "provisioned",
+    "netStarted",
+    "displays",
+    "splash",
+    "wifi",
+    "redis",
+    "netReady",
+    "config",
+    "holdDone",
+    "firstTick"};
+
+// each phase is only ever written by one task, so no locking is needed
+static volatile long __bootTimeline[ZWBOOT_PHASE_COUNT] = {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
+
+void zwBootMark(ZWBootPhase phase)
+{
+    if (phase < ZWBOOT_PHASE_COUNT && __bootTimeline[phase] == -1)
+        __bootTimeline[phase] = (long)millis();
+}
+
+unsigned long zwBootPhaseTime(ZWBootPhase phase)
+{
+    return phase < ZWBOOT_PHASE_COUNT && __bootTimeline[phase] != -1 ? __bootTimeline[phase] : 0;
+}
+
+int zwBootTimelineAsJson(char *buf, size_t bufLen)
+{
+    int wrote = snprintf(buf, bufLen, "{");
+    for (int i = 0; i < ZWBOOT_PHASE_COUNT && wrote > 0 && wrote < (int)bufLen; i++)
+    {
+        wrote += snprintf(buf + wrote, bufLen - wrote, " \"%s\": %ld%s",
+                          __bootPhaseNames[i], __bootTimeline[i], i < ZWBOOT_PHASE_COUNT - 1 ? "," : " }");
+    }
+    return wrote;
+}
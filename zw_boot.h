@@ -0,0 +1,30 @@
+#ifndef __ZW_BOOT__H__
+#define __ZW_BOOT__H__
+
+#include <Arduino.h>
+
+enum ZWBootPhase
+{
+    ZWBOOT_START = 0,
+    ZWBOOT_PROVISIONED,
+    ZWBOOT_NET_STARTED,
+    ZWBOOT_DISPLAYS,
+    ZWBOOT_SPLASH,
+    ZWBOOT_WIFI,
+    ZWBOOT_REDIS,
+    ZWBOOT_NET_READY,
+    ZWBOOT_CONFIG,
+    ZWBOOT_HOLD_DONE,
+    ZWBOOT_FIRST_TICK,
+    ZWBOOT_PHASE_COUNT
+};
+
+// records millis() for the phase; safe to call from the network bring-up task
+void zwBootMark(ZWBootPhase phase);
+
+unsigned long zwBootPhaseTime(ZWBootPhase phase);
+
+// writes e.g. { "start": 0, "provisioned": 41, ... } (unreached phases are -1) into buf
+int zwBootTimelineAsJson(char *buf, size_t bufLen);
+
+#endif
@@ -0,0 +1,72 @@
+#include "zw_budget.h"
+#include "zw_common.h"
+#include "zw_metrics.h"
+
+static ZWBudgetStats __stats = {.budgetMs = ZWBUDGET_DEFAULT_MS};
+static unsigned long __startMs = 0;
+static bool __running = false;
+static bool __overrun = false;
+
+static const char *__workNames[ZWB_WORK_COUNT] = {
+    "userKeys",
+    "displays",
+    "heartbeat",
+    "checkin",
+    "logs"};
+
+void zwBudgetBegin(uint32_t budgetMs)
+{
+    __stats.budgetMs = budgetMs ? budgetMs : ZWBUDGET_DEFAULT_MS;
+    __startMs = millis();
+    __running = true;
+    __overrun = false;
+}
+
+bool zwBudgetLeft()
+{
+    if (!__running)
+        return true;
+    if (__overrun)
+        return false;
+
+    if (millis() - __startMs < __stats.budgetMs)
+        return true;
+
+    __overrun = true;
+    ++__stats.overruns;
+    zwMetricInc(ZWC_BUDGET_OVERRUNS);
+    return false;
+}
+
+void zwBudgetDefer(ZWBudgetWork work, uint32_t count)
+{
+    __stats.deferred[work] += count;
+    zwMetricInc(ZWC_BUDGET_DEFERRALS, count);
+}
+
+void zwBudgetEnd()
+{
+    if (!__running)
+        return;
+
+    __running = false;
+    __stats.lastMs = millis() - __startMs;
+    __stats.worstMs = max(__stats.worstMs, __stats.lastMs);
+    ++__stats.refreshes;
+}
+
+const ZWBudgetStats &zwBudgetStats()
+{
+    return __stats;
+}
+
+int zwBudgetAsJson(char *buf, size_t bufLen)
+{
+    int wrote = 0;
+    APPEND("{ \"ms\": %u, \"refreshes\": %u, \"overruns\": %u, \"lastMs\": %u, \"worstMs\": %u, \"deferred\": {",
+           __stats.budgetMs, __stats.refreshes, __stats.overruns, __stats.lastMs, __stats.worstMs);
+    for (int i = 0; i < ZWB_WORK_COUNT; i++)
+        APPEND("%s \"%s\": %u", i ? "," : "", __workNames[i], __stats.deferred[i]);
+    APPEND(" } }");
+    return wrote;
+}
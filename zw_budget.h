@@ -0,0 +1,55 @@
+#ifndef __ZW_BUDGET__H__
+#define __ZW_BUDGET__H__
+
+#include <Arduino.h>
+
+// A time budget for each refresh, so a slow Redis can't stall the main loop (the buttons, the
+// battery display and the 1Hz timer's accounting) for many seconds. The refresh does its work
+// in priority order -- the visible page's displays, the heartbeat, then the checkin and the log
+// uploads -- asking zwBudgetLeft() before each piece. Once the deadline has passed it finishes
+// with what it has (displays keep their last values) and puts the rest off to the next refresh,
+// which does it first. Set per unit with HOSTNAME:config:refreshBudget (milliseconds).
+//
+// The default is one period of the 1Hz timer, so at most one of its interrupts waits.
+#define ZWBUDGET_DEFAULT_MS 1000
+
+enum ZWBudgetWork
+{
+    ZWB_USER_KEYS = 0,
+    ZWB_DISPLAYS,
+    ZWB_HEARTBEAT,
+    ZWB_CHECKIN,
+    ZWB_LOGS,
+    ZWB_WORK_COUNT
+};
+
+struct ZWBudgetStats
+{
+    uint32_t budgetMs;
+    uint32_t refreshes;
+    // refreshes that ran past their deadline
+    uint32_t overruns;
+    // pieces of work put off, by ZWBudgetWork
+    uint32_t deferred[ZWB_WORK_COUNT];
+    uint32_t lastMs;
+    uint32_t worstMs;
+};
+
+// starts a refresh's budget; 0 is ZWBUDGET_DEFAULT_MS
+void zwBudgetBegin(uint32_t budgetMs);
+
+// true if there's time left for more work, or no budgeted refresh is under way (setup()
+// and deep sleep's single refresh per wake run unbudgeted); the first call to find the
+// deadline passed counts the overrun
+bool zwBudgetLeft();
+
+void zwBudgetDefer(ZWBudgetWork work, uint32_t count = 1);
+
+void zwBudgetEnd();
+
+const ZWBudgetStats &zwBudgetStats();
+
+// "{ "ms": .., "overruns": .., "worstMs": .., "deferred": { "displays": .., .. } }"
+int zwBudgetAsJson(char *buf, size_t bufLen);
+
+#endif
@@ -0,0 +1,171 @@
+#include "zw_capture.h"
+#include "zw_common.h"
+#include "zw_logging.h"
+
+#define NO_RECORD ((size_t)-1)
+
+static uint8_t *__buf = nullptr;
+static size_t __used = 0;
+static size_t __last = NO_RECORD;
+static unsigned long __startUs = 0;
+static uint8_t __refreshesLeft = 0;
+static bool __recording = false;
+static bool __truncated = false;
+static bool __toSerial = false;
+
+// only the main loop talks to Redis, so none of this needs locking
+static void __record(ZWCaptureKind kind, const uint8_t *data, size_t len)
+{
+    if (!__recording)
+        return;
+
+    ZWCaptureRecord last;
+    if (__last != NO_RECORD)
+        memcpy(&last, __buf + __last, sizeof(last));
+
+    auto coalesce = __last != NO_RECORD && last.kind == kind && (kind == ZWCAP_SENT || kind == ZWCAP_RECEIVED) &&
+                    last.len + len <= UINT16_MAX;
+    auto need = len + (coalesce ? 0 : sizeof(ZWCaptureRecord));
+
+    if (__used + need > ZWCAPTURE_BUFLEN || len > UINT16_MAX)
+    {
+        // a gap would desynchronize the replay, so nothing after it is kept either
+        __recording = false;
+        __truncated = true;
+        return;
+    }
+
+    if (coalesce)
+    {
+        last.len += len;
+        memcpy(__buf + __last, &last, sizeof(last));
+    }
+    else
+    {
+        ZWCaptureRecord rec = {.us = (uint32_t)(micros() - __startUs), .kind = (uint8_t)kind, .len = (uint16_t)len};
+        __last = __used;
+        memcpy(__buf + __used, &rec, sizeof(rec));
+        __used += sizeof(rec);
+    }
+
+    memcpy(__buf + __used, data, len);
+    __used += len;
+}
+
+bool zwCaptureArm(uint8_t refreshes, bool toSerial, const char *hostname)
+{
+    if (__buf)
+        return false;
+
+    if (!(__buf = (uint8_t *)malloc(ZWCAPTURE_BUFLEN)))
+    {
+        zlog("WARNING: no memory for a %d byte capture\n", ZWCAPTURE_BUFLEN);
+        return false;
+    }
+
+    memcpy(__buf, ZWCAPTURE_MAGIC, strlen(ZWCAPTURE_MAGIC));
+    __buf[strlen(ZWCAPTURE_MAGIC)] = ZWCAPTURE_FORMAT;
+    __used = strlen(ZWCAPTURE_MAGIC) + 1;
+    __last = NO_RECORD;
+    __refreshesLeft = max((uint8_t)1, min(refreshes, (uint8_t)ZWCAPTURE_MAX_REFRESHES));
+    __truncated = false;
+    __toSerial = toSerial;
+    __startUs = micros();
+
+    char info[64];
+    auto infoLen = snprintf(info, sizeof(info), "%s %s %s", ZEROWATCH_VER, hostname, M5STACKC ? "m5stickc" : "tm1637");
+    __recording = true;
+    __record(ZWCAP_INFO, (const uint8_t *)info, min(infoLen, (int)sizeof(info) - 1));
+    // the refreshes to be captured are the next ones, not the rest of this one
+    __recording = false;
+    return true;
+}
+
+bool zwCaptureArmed()
+{
+    return __buf != nullptr;
+}
+
+void zwCaptureRefreshStart(uint16_t refresh)
+{
+    if (!__buf || !__refreshesLeft || __truncated)
+        return;
+
+    __recording = true;
+    __record(ZWCAP_REFRESH, (const uint8_t *)&refresh, sizeof(refresh));
+}
+
+bool zwCaptureRefreshEnd()
+{
+    if (!__buf || !__refreshesLeft || (!__recording && !__truncated))
+        return false;
+
+    if (--__refreshesLeft && !__truncated)
+        return false;
+
+    __recording = false;
+    __refreshesLeft = 0;
+    if (__truncated)
+        zlog("WARNING: capture truncated at %u bytes\n", __used);
+    return true;
+}
+
+void zwCaptureConnected()
+{
+    __record(ZWCAP_CONNECT, (const uint8_t *)"", 0);
+}
+
+bool zwCaptureToSerial()
+{
+    return __toSerial;
+}
+
+bool zwCaptureTruncated()
+{
+    return __truncated;
+}
+
+const uint8_t *zwCaptureTrace(size_t *len)
+{
+    *len = __used;
+    return __buf;
+}
+
+void zwCaptureDumpSerial()
+{
+    char line[ZWCAPTURE_SERIAL_LINE * 2 + 1];
+    for (size_t at = 0; __buf && at < __used; at += ZWCAPTURE_SERIAL_LINE)
+    {
+        auto n = min((size_t)ZWCAPTURE_SERIAL_LINE, __used - at);
+        for (size_t i = 0; i < n; i++)
+            sprintf(line + i * 2, "%02x", __buf[at + i]);
+        Serial.printf(ZWCAPTURE_SERIAL_PREFIX "%s\n", line);
+    }
+    Serial.printf(ZWCAPTURE_SERIAL_PREFIX "end %u\n", __used);
+}
+
+void zwCaptureRelease()
+{
+    free(__buf);
+    __buf = nullptr;
+    __used = 0;
+    __last = NO_RECORD;
+    __refreshesLeft = 0;
+    __recording = false;
+}
+
+size_t ZWCaptureClient::write(const uint8_t *buf, size_t size)
+{
+    auto wrote = WiFiClient::write(buf, size);
+    if (wrote > 0)
+        __record(ZWCAP_SENT, buf, wrote);
+    return wrote;
+}
+
+int ZWCaptureClient::read(uint8_t *buf, size_t size)
+{
+    auto got = WiFiClient::read(buf, size);
+    if (got > 0)
+        __record(ZWCAP_RECEIVED, buf, got);
+    return got;
+}
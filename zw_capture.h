@@ -0,0 +1,84 @@
+#ifndef __ZW_CAPTURE__H__
+#define __ZW_CAPTURE__H__
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+// Records the Redis connection's traffic, both ways and timestamped, so that a refresh seen in
+// the field (its list contents, reply sizes and latencies) can be served back to the firmware by
+// tools/zw-replay standing in for Redis. getValue of "capture [N] [serial]" records the next N
+// refreshes (default 1), then stores the trace at HOSTNAME:info:capture or prints it to serial.
+//
+// A trace is ZWCAPTURE_MAGIC, a format version byte, then records: a ZWCaptureRecord followed
+// by len bytes. Successive writes (or reads) coalesce into one record, stamped with the time of
+// its first byte. Recording stops if the buffer fills, which leaves the trace truncated.
+#define ZWCAPTURE_MAGIC "ZWCP"
+#define ZWCAPTURE_FORMAT 1
+#define ZWCAPTURE_BUFLEN (16 * 1024)
+#define ZWCAPTURE_MAX_REFRESHES 8
+#define ZWCAPTURE_EXPIRY (7 * 86400)
+
+// serial dumps are lines of this prefix and hex, ended by ZWCAPTURE_SERIAL_PREFIX "end LENGTH"
+#define ZWCAPTURE_SERIAL_PREFIX "ZWCAPTURE "
+#define ZWCAPTURE_SERIAL_LINE 32
+
+enum ZWCaptureKind
+{
+    // "ZEROWATCH_VER HOSTNAME VARIANT", the first record of every trace
+    ZWCAP_INFO = 0,
+    // the connection was (re)established
+    ZWCAP_CONNECT,
+    // a refresh starts: its uint16_t count
+    ZWCAP_REFRESH,
+    ZWCAP_SENT,
+    ZWCAP_RECEIVED,
+    ZWCAP_KIND_COUNT
+};
+
+// little-endian, as is the rest of the trace
+struct __attribute__((packed)) ZWCaptureRecord
+{
+    uint32_t us; // since the capture started
+    uint8_t kind;
+    uint16_t len;
+};
+
+// allocates the buffer and starts recording at the next refresh; false if a capture is already
+// under way or there isn't the memory for one
+bool zwCaptureArm(uint8_t refreshes, bool toSerial, const char *hostname);
+
+bool zwCaptureArmed();
+
+// call at the start of every refresh, and at its end; the latter returns true once the armed
+// refreshes have all been recorded, when the trace should be stored and then released
+void zwCaptureRefreshStart(uint16_t refresh);
+bool zwCaptureRefreshEnd();
+
+void zwCaptureConnected();
+
+bool zwCaptureToSerial();
+bool zwCaptureTruncated();
+const uint8_t *zwCaptureTrace(size_t *len);
+
+void zwCaptureDumpSerial();
+
+void zwCaptureRelease();
+
+// what ZWRedis connects with: a WiFiClient whose traffic is recorded while a capture runs
+class ZWCaptureClient : public WiFiClient
+{
+public:
+    ZWCaptureClient() {}
+
+    ZWCaptureClient(const ZWCaptureClient &) = delete;
+    ZWCaptureClient &operator=(const ZWCaptureClient &) = delete;
+
+    // the single-byte forms go through these, on the ESP32 core as on the host
+    size_t write(const uint8_t *buf, size_t size) override;
+    int read(uint8_t *buf, size_t size) override;
+
+    using WiFiClient::read;
+    using WiFiClient::write;
+};
+
+#endif
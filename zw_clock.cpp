@@ -0,0 +1,289 @@
+#include "zw_clock.h"
+#include "zw_common.h"
+#include "zw_logging.h"
+#include "zw_redis.h"
+#include <esp_timer.h>
+#include <math.h>
+
+#define ZWCLOCK_STATE_MAGIC 0x5a57434b
+
+// kept across every reset short of a power loss (which the magic number shows), as the RTC
+// keeps time across them
+struct ZWClockState
+{
+    uint32_t magic;
+    int32_t utcOffsetS;
+    float timerPpm;
+    float rtcPpm;
+    bool timerPpmValid;
+    bool rtcPpmValid;
+    // UTC seconds when the RTC was last set, 0 if it hasn't been since it last lost power
+    uint32_t rtcSetEpoch;
+    uint32_t lastSyncEpoch;
+};
+
+RTC_NOINIT_ATTR static ZWClockState __state;
+
+static portMUX_TYPE __clockMux = portMUX_INITIALIZER_UNLOCKED;
+static bool __valid = false;
+// the clock is __baseEpochUs at esp_timer_get_time() == __baseLocalUs, running at the timer's rate less its drift
+static uint64_t __baseEpochUs = 0;
+static int64_t __baseLocalUs = 0;
+// this boot's last sync to measure the timer's drift from
+static bool __syncedThisBoot = false;
+static uint64_t __driftFromEpochUs = 0;
+static int64_t __driftFromLocalUs = 0;
+static int64_t __nextSyncUs = 0;
+static ZWClockStats __stats = {};
+
+static const char *__sourceNames[] = {"none", "rtc", "redis"};
+
+// callers hold __clockMux
+static uint64_t __nowAt(int64_t localUs)
+{
+    auto elapsed = localUs - __baseLocalUs;
+    auto correction = __state.timerPpmValid ? (int64_t)(elapsed * (double)__state.timerPpm / 1e6) : 0;
+    return __baseEpochUs + elapsed - correction;
+}
+
+static void __setBase(uint64_t epochUs, int64_t localUs)
+{
+    portENTER_CRITICAL(&__clockMux);
+    __baseEpochUs = epochUs;
+    __baseLocalUs = localUs;
+    __valid = true;
+    portEXIT_CRITICAL(&__clockMux);
+}
+
+#if M5STACKC
+// days since the epoch of a proleptic Gregorian date
+static int32_t __daysFromCivil(int32_t y, uint32_t m, uint32_t d)
+{
+    y -= m <= 2;
+    auto era = (y >= 0 ? y : y - 399) / 400;
+    auto yoe = (uint32_t)(y - era * 400);
+    auto doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    auto doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + (int32_t)doe - 719468;
+}
+
+static void __civilFromDays(int32_t z, uint16_t *y, uint8_t *m, uint8_t *d)
+{
+    z += 719468;
+    auto era = (z >= 0 ? z : z - 146096) / 146097;
+    auto doe = (uint32_t)(z - era * 146097);
+    auto yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    auto doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    auto mp = (5 * doy + 2) / 153;
+    *d = (uint8_t)(doy - (153 * mp + 2) / 5 + 1);
+    *m = (uint8_t)(mp < 10 ? mp + 3 : mp - 9);
+    *y = (uint16_t)(yoe + era * 400 + (*m <= 2));
+}
+
+// the RTC's UTC seconds since the epoch, or 0 if it can't have been set by us
+static uint32_t __rtcRead()
+{
+    RTC_TimeTypeDef before, time;
+    RTC_DateTypeDef date;
+    M5.Rtc.GetTime(&before);
+    M5.Rtc.GetData(&date);
+    M5.Rtc.GetTime(&time);
+    // a date read across midnight belongs with the later time
+    if (time.Hours < before.Hours)
+        M5.Rtc.GetData(&date);
+
+    if (date.Year < 2020 || !date.Month || date.Month > 12 || !date.Date)
+        return 0;
+
+    return (uint32_t)__daysFromCivil(date.Year, date.Month, date.Date) * 86400 +
+           time.Hours * 3600 + time.Minutes * 60 + time.Seconds;
+}
+
+static void __rtcSet(uint32_t epoch)
+{
+    RTC_TimeTypeDef time = {.Hours = (uint8_t)(epoch % 86400 / 3600),
+                            .Minutes = (uint8_t)(epoch % 3600 / 60),
+                            .Seconds = (uint8_t)(epoch % 60)};
+    RTC_DateTypeDef date;
+    auto days = (int32_t)(epoch / 86400);
+    // 1970-01-01 was a Thursday
+    date.WeekDay = (uint8_t)((days + 4) % 7);
+    __civilFromDays(days, &date.Year, &date.Month, &date.Date);
+    M5.Rtc.SetData(&date);
+    M5.Rtc.SetTime(&time);
+}
+
+static void __rtcSync(uint64_t trueUs)
+{
+    auto trueS = (uint32_t)((trueUs + 500000) / 1000000);
+    auto rtc = __rtcRead();
+    auto span = (int32_t)(trueS - __state.rtcSetEpoch);
+
+    // measured from when it was last set, so each estimate supersedes the last
+    if (rtc && __state.rtcSetEpoch && span >= ZWCLOCK_RTC_MIN_DRIFT_SPAN_S)
+    {
+        auto ppm = ((double)(rtc - __state.rtcSetEpoch) - span) / span * 1e6;
+        if (fabs(ppm) <= ZWCLOCK_MAX_DRIFT_PPM)
+            __state.rtcPpm = ppm, __state.rtcPpmValid = true;
+    }
+
+    if (!rtc || !__state.rtcSetEpoch || abs((int32_t)(rtc - trueS)) >= ZWCLOCK_RTC_MAX_ERROR_S)
+    {
+        __rtcSet(trueS);
+        __state.rtcSetEpoch = trueS;
+    }
+}
+#else
+#define __rtcSync(trueUs)
+#endif
+
+void zwClockBegin()
+{
+    if (__state.magic != ZWCLOCK_STATE_MAGIC)
+    {
+        bzero(&__state, sizeof(__state));
+        __state.magic = ZWCLOCK_STATE_MAGIC;
+    }
+
+#if M5STACKC
+    uint32_t rtc;
+    if (!__state.rtcSetEpoch || !(rtc = __rtcRead()))
+        return;
+
+    auto since = (double)(rtc - __state.rtcSetEpoch);
+    auto corrected = (uint32_t)(rtc - (__state.rtcPpmValid ? lround(since * __state.rtcPpm / 1e6) : 0));
+    auto now = esp_timer_get_time();
+    // the RTC only has whole seconds: on average it's half of one behind
+    __setBase((uint64_t)corrected * 1000000 + 500000, now);
+    __stats.source = ZWCLOCK_RTC;
+
+    auto sinceSync = (int32_t)(corrected - __state.lastSyncEpoch);
+    if (sinceSync >= 0 && sinceSync < ZWCLOCK_SYNC_INTERVAL_S)
+        __nextSyncUs = now + (int64_t)(ZWCLOCK_SYNC_INTERVAL_S - sinceSync) * 1000000;
+
+    zlog("Clock from RTC (%lus since it was set, %.1fppm)\n", (unsigned long)since, __state.rtcPpm);
+#endif
+}
+
+bool zwClockSyncDue()
+{
+    return esp_timer_get_time() >= __nextSyncUs;
+}
+
+bool zwClockSync(ZWRedis *redis)
+{
+    uint64_t serverUs;
+    unsigned long rttUs = 0;
+    int64_t localUs;
+    if (!redis->serverTime(&serverUs, &rttUs, &localUs) || rttUs > ZWCLOCK_MAX_RTT_US)
+    {
+        ++__stats.failures;
+        __nextSyncUs = esp_timer_get_time() + (int64_t)ZWCLOCK_RETRY_INTERVAL_S * 1000000;
+        zlog("WARNING: clock sync failed (rtt %luus)\n", rttUs);
+        return false;
+    }
+
+    // the server read its clock somewhere in the round trip: the middle is the best guess
+    auto trueUs = serverUs + rttUs / 2;
+    __stats.lastRttUs = rttUs;
+
+    if (__valid)
+    {
+        portENTER_CRITICAL(&__clockMux);
+        auto error = (int64_t)(__nowAt(localUs) - trueUs);
+        portEXIT_CRITICAL(&__clockMux);
+        __stats.lastErrorUs = (int32_t)max((int64_t)INT32_MIN, min((int64_t)INT32_MAX, error));
+    }
+
+    if (!__syncedThisBoot)
+    {
+        __driftFromEpochUs = trueUs, __driftFromLocalUs = localUs;
+        __syncedThisBoot = true;
+    }
+    else if (trueUs - __driftFromEpochUs >= (uint64_t)ZWCLOCK_MIN_DRIFT_SPAN_S * 1000000)
+    {
+        auto span = (double)(trueUs - __driftFromEpochUs);
+        auto ppm = ((localUs - __driftFromLocalUs) - span) / span * 1e6;
+        if (fabs(ppm) <= ZWCLOCK_MAX_DRIFT_PPM)
+        {
+            __state.timerPpm = __state.timerPpmValid ? (3 * __state.timerPpm + ppm) / 4 : ppm;
+            __state.timerPpmValid = true;
+        }
+        __driftFromEpochUs = trueUs, __driftFromLocalUs = localUs;
+    }
+
+    __setBase(trueUs, localUs);
+    __stats.source = ZWCLOCK_REDIS;
+    ++__stats.syncs;
+
+    // the local time zone, to the quarter hour (rpjios.__meta.time is only as fresh as its publisher)
+    uint8_t hour, minute, second;
+    redis->getTime(&hour, &minute, &second);
+    if (hour || minute || second)
+    {
+        int32_t offset = (hour * 3600 + minute * 60 + second) - (int32_t)(trueUs / 1000000 % 86400);
+        offset = (offset + 43200 + 86400) % 86400 - 43200;
+        __state.utcOffsetS = (offset >= 0 ? offset + 450 : offset - 450) / 900 * 900;
+    }
+
+    __rtcSync(trueUs);
+    __state.lastSyncEpoch = (uint32_t)(trueUs / 1000000);
+    __nextSyncUs = localUs + (int64_t)ZWCLOCK_SYNC_INTERVAL_S * 1000000;
+
+    zlog("Clock synced: rtt %luus, was off by %ldus, drift %.2fppm, UTC%+ld:%02ld\n", rttUs,
+         (long)__stats.lastErrorUs, __state.timerPpm, (long)__state.utcOffsetS / 3600,
+         (long)abs(__state.utcOffsetS) % 3600 / 60);
+    return true;
+}
+
+uint64_t zwClockNowUs()
+{
+    if (!__valid)
+        return 0;
+
+    portENTER_CRITICAL(&__clockMux);
+    auto now = __nowAt(esp_timer_get_time());
+    portEXIT_CRITICAL(&__clockMux);
+    return now;
+}
+
+unsigned long zwClockSeconds()
+{
+    return (unsigned long)(zwClockNowUs() / 1000000);
+}
+
+bool zwClockLocal(uint8_t *hour, uint8_t *minute, uint8_t *second)
+{
+    auto now = zwClockSeconds();
+    if (!now)
+        return false;
+
+    auto timeOfDay = (uint32_t)((int64_t)now + __state.utcOffsetS) % 86400;
+    if (hour)
+        *hour = (uint8_t)(timeOfDay / 3600);
+    if (minute)
+        *minute = (uint8_t)(timeOfDay % 3600 / 60);
+    if (second)
+        *second = (uint8_t)(timeOfDay % 60);
+    return true;
+}
+
+const ZWClockStats &zwClockStats()
+{
+    __stats.timerPpm = __state.timerPpm;
+    __stats.rtcPpm = __state.rtcPpm;
+    __stats.utcOffsetS = __state.utcOffsetS;
+    return __stats;
+}
+
+int zwClockAsJson(char *buf, size_t bufLen)
+{
+    int wrote = 0;
+    auto &stats = zwClockStats();
+    APPEND("{ \"source\": \"%s\", \"now\": %lu, \"utcOffset\": %ld, \"syncs\": %u, \"failures\": %u, "
+           "\"lastRttUs\": %lu, \"lastErrorUs\": %ld, \"timerPpm\": %.2f, \"rtcPpm\": %.2f, \"nextSyncS\": %ld }",
+           __sourceNames[stats.source], zwClockSeconds(), (long)stats.utcOffsetS, stats.syncs, stats.failures,
+           stats.lastRttUs, (long)stats.lastErrorUs, stats.timerPpm, stats.rtcPpm,
+           (long)((__nextSyncUs - esp_timer_get_time()) / 1000000));
+    return wrote;
+}
@@ -0,0 +1,69 @@
+#ifndef __ZW_CLOCK__H__
+#define __ZW_CLOCK__H__
+
+#include <Arduino.h>
+
+class ZWRedis;
+
+// A wall clock kept on the ESP32's timer between occasional syncs with Redis' TIME, each
+// corrected by half its round trip. Consecutive syncs give the timer's drift, which is taken
+// out between them. On the M5StickC the BM8563 RTC is kept in UTC and its drift estimated
+// too, so that after a deep sleep or any reset short of a power loss (which loses the drift
+// estimates) the clock starts from it rather than waiting for Redis. rpjios.__meta.time's
+// hour and minute, read at each sync, give the local time zone's offset for the LCD clock.
+#define ZWCLOCK_SYNC_INTERVAL_S 900
+#define ZWCLOCK_RETRY_INTERVAL_S 30
+// a reply slower than this says more about the network than about the time
+#define ZWCLOCK_MAX_RTT_US 250000
+// drift is only measured over spans this long, so the round trips' error is small against it
+#define ZWCLOCK_MIN_DRIFT_SPAN_S 600
+// the RTC only counts whole seconds, so its drift needs a much longer span
+#define ZWCLOCK_RTC_MIN_DRIFT_SPAN_S (6 * 3600)
+// the RTC is only set when it's this far off, which restarts its drift measurement
+#define ZWCLOCK_RTC_MAX_ERROR_S 2
+// crystals are good to tens of ppm: anything past this is a time jump, not drift
+#define ZWCLOCK_MAX_DRIFT_PPM 500
+
+enum ZWClockSource
+{
+    ZWCLOCK_NONE = 0,
+    ZWCLOCK_RTC,
+    ZWCLOCK_REDIS
+};
+
+struct ZWClockStats
+{
+    ZWClockSource source;
+    uint32_t syncs;
+    uint32_t failures;
+    unsigned long lastRttUs;
+    // how far the local clock was from Redis at the last sync
+    int32_t lastErrorUs;
+    float timerPpm;
+    float rtcPpm;
+    int32_t utcOffsetS;
+};
+
+// seeds the clock from the RTC where there is one and an earlier boot's sync set it
+void zwClockBegin();
+
+bool zwClockSyncDue();
+
+// one TIME round trip (and one for rpjios.__meta.time), so only call it when due
+bool zwClockSync(ZWRedis *redis);
+
+// UTC microseconds since the epoch, or 0 if the clock has never been set
+uint64_t zwClockNowUs();
+
+// UTC seconds since the epoch, or 0 if the clock has never been set. Safe from any task.
+unsigned long zwClockSeconds();
+
+// the local time of day; false if the clock has never been set
+bool zwClockLocal(uint8_t *hour, uint8_t *minute, uint8_t *second);
+
+const ZWClockStats &zwClockStats();
+
+// "{ "source": .., "now": .., "utcOffset": .., "syncs": .., .., "timerPpm": .., "rtcPpm": .. }"
+int zwClockAsJson(char *buf, size_t bufLen);
+
+#endif
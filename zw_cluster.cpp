@@ -0,0 +1,154 @@
+#include "zw_cluster.h"
+#include "zw_common.h"
+#include "zw_logging.h"
+
+struct ZWClusterRange
+{
+    uint16_t first;
+    uint16_t last;
+    uint8_t node;
+};
+
+static ZWClusterNode __nodes[ZWCLUSTER_MAX_NODES];
+static ZWClusterRange __ranges[ZWCLUSTER_MAX_RANGES];
+static ZWClusterRange __loading[ZWCLUSTER_MAX_RANGES];
+static int __loadingCount = 0;
+static bool __loadOverflowed = false;
+static ZWClusterStats __stats = {.homeSlot = 0, .homeNode = -1};
+
+// CRC16-CCITT (XMODEM), as Redis Cluster hashes keys with
+static uint16_t __crc16(const char *data, size_t len)
+{
+    uint16_t crc = 0;
+    while (len--)
+    {
+        crc ^= (uint16_t)(uint8_t)*data++ << 8;
+        for (int i = 0; i < 8; i++)
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+uint16_t zwClusterKeySlot(const char *key, size_t len)
+{
+    auto open = (const char *)memchr(key, '{', len);
+    if (open)
+    {
+        auto tag = open + 1;
+        auto close = (const char *)memchr(tag, '}', len - (tag - key));
+        if (close && close > tag)
+            return __crc16(tag, close - tag) & (ZWCLUSTER_SLOTS - 1);
+    }
+    return __crc16(key, len) & (ZWCLUSTER_SLOTS - 1);
+}
+
+static int __nodeForSlot(uint16_t slot)
+{
+    for (int i = 0; i < __stats.ranges; i++)
+        if (slot >= __ranges[i].first && slot <= __ranges[i].last)
+            return __ranges[i].node;
+    return -1;
+}
+
+void zwClusterSetHome(const char *hostname)
+{
+    __stats.homeSlot = __crc16(hostname, strlen(hostname)) & (ZWCLUSTER_SLOTS - 1);
+    __stats.homeNode = __nodeForSlot(__stats.homeSlot);
+}
+
+void zwClusterBeginLoad()
+{
+    __loadingCount = 0;
+    __loadOverflowed = false;
+}
+
+bool zwClusterAddRange(uint16_t first, uint16_t last, const char *host, uint16_t port)
+{
+    auto node = zwClusterNodeIndex(host, port);
+    if (node < 0 || __loadingCount == ZWCLUSTER_MAX_RANGES || first > last || last >= ZWCLUSTER_SLOTS)
+    {
+        __loadOverflowed = true;
+        return false;
+    }
+
+    __loading[__loadingCount++] = {first, last, (uint8_t)node};
+    return true;
+}
+
+void zwClusterEndLoad(bool complete)
+{
+    if (!complete || __loadOverflowed || !__loadingCount)
+    {
+        zlog("WARNING: cluster slot map not loaded (%d ranges%s)\n", __loadingCount,
+             __loadOverflowed ? ", too many" : "");
+        return;
+    }
+
+    memcpy(__ranges, __loading, __loadingCount * sizeof(ZWClusterRange));
+    __stats.ranges = __loadingCount;
+    __stats.homeNode = __nodeForSlot(__stats.homeSlot);
+    ++__stats.loads;
+}
+
+int zwClusterNodeIndex(const char *host, uint16_t port)
+{
+    for (int i = 0; i < __stats.nodes; i++)
+        if (__nodes[i].port == port && !strcmp(__nodes[i].host, host))
+            return i;
+
+    if (__stats.nodes == ZWCLUSTER_MAX_NODES || strlen(host) >= ZWCLUSTER_HOST_MAX)
+    {
+        zlog("WARNING: no room for cluster node %s:%u\n", host, port);
+        return -1;
+    }
+
+    auto &node = __nodes[__stats.nodes];
+    strcpy(node.host, host);
+    node.port = port;
+    return __stats.nodes++;
+}
+
+const ZWClusterNode &zwClusterNode(int index)
+{
+    return __nodes[index];
+}
+
+int zwClusterNodeForKey(const char *key)
+{
+    return __nodeForSlot(zwClusterKeySlot(key, strlen(key)));
+}
+
+int zwClusterHomeNode()
+{
+    return __stats.homeNode;
+}
+
+void zwClusterNoteRedirect(bool ask)
+{
+    if (ask)
+        ++__stats.asks;
+    else
+        ++__stats.moved;
+}
+
+const ZWClusterStats &zwClusterStats()
+{
+    return __stats;
+}
+
+int zwClusterAsJson(char *buf, size_t bufLen)
+{
+    int wrote = 0;
+    APPEND("{ \"homeSlot\": %u, \"homeNode\": %d, \"loads\": %u, \"moved\": %u, \"asks\": %u, \"nodes\": [",
+           __stats.homeSlot, __stats.homeNode, __stats.loads, __stats.moved, __stats.asks);
+    for (int n = 0; n < __stats.nodes; n++)
+    {
+        unsigned slots = 0;
+        for (int i = 0; i < __stats.ranges; i++)
+            if (__ranges[i].node == n)
+                slots += __ranges[i].last - __ranges[i].first + 1;
+        APPEND("%s { \"addr\": \"%s:%u\", \"slots\": %u }", n ? "," : "", __nodes[n].host, __nodes[n].port, slots);
+    }
+    APPEND(" ] }");
+    return wrote;
+}
@@ -0,0 +1,63 @@
+#ifndef __ZW_CLUSTER__H__
+#define __ZW_CLUSTER__H__
+
+#include <Arduino.h>
+
+// Redis Cluster's slot map, for ZWREDIS_CLUSTER builds (see zw_redis.h). A key belongs to one
+// of ZWCLUSTER_SLOTS slots, the CRC16 of its hash tag (what's between its first '{' and the
+// next '}', if that isn't empty) or else of the whole key; each master serves ranges of them,
+// as CLUSTER SLOTS lists. Nodes keep their index for as long as the unit runs, whatever the
+// map later says, so ZWRedis can keep a connection per index.
+#define ZWCLUSTER_SLOTS 16384
+#define ZWCLUSTER_MAX_NODES 8
+#define ZWCLUSTER_MAX_RANGES 32
+#define ZWCLUSTER_HOST_MAX 48
+
+struct ZWClusterNode
+{
+    char host[ZWCLUSTER_HOST_MAX];
+    uint16_t port;
+};
+
+struct ZWClusterStats
+{
+    // the slot of the unit's own (hash-tagged) keys, and the node serving it
+    uint16_t homeSlot;
+    int homeNode;
+    int nodes;
+    int ranges;
+    // slot maps loaded
+    uint32_t loads;
+    uint32_t moved;
+    uint32_t asks;
+};
+
+uint16_t zwClusterKeySlot(const char *key, size_t len);
+
+// the unit's keys are "{HOSTNAME}..."
+void zwClusterSetHome(const char *hostname);
+
+// a map is loaded by a zwClusterAddRange() per range, between these; it replaces the
+// current one only if complete
+void zwClusterBeginLoad();
+bool zwClusterAddRange(uint16_t first, uint16_t last, const char *host, uint16_t port);
+void zwClusterEndLoad(bool complete);
+
+// the node's index, added if it's new; -1 if there are already ZWCLUSTER_MAX_NODES
+int zwClusterNodeIndex(const char *host, uint16_t port);
+
+const ZWClusterNode &zwClusterNode(int index);
+
+// the index of the node serving key, or -1 if no map has been loaded
+int zwClusterNodeForKey(const char *key);
+
+int zwClusterHomeNode();
+
+void zwClusterNoteRedirect(bool ask);
+
+const ZWClusterStats &zwClusterStats();
+
+// "{ "homeSlot": .., "homeNode": .., "loads": .., "moved": .., "asks": .., "nodes": [ { "addr": "..", "slots": .. }, .. ] }"
+int zwClusterAsJson(char *buf, size_t bufLen);
+
+#endif
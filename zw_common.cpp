@@ -1,10 +1,30 @@
 #include "zw_common.h"
 #include <Arduino.h>
 
+#if ZW_HOST
+#include <zw_host.h>
+#endif
+
 void __haltOrCatchFire()
 {
+#if ZW_HOST
+    zwHostHalt();
+#endif
     while (1)
     {
         delay(1);
     }
+}
+
+uint32_t zwCrc32(const void *data, size_t len, uint32_t crc)
+{
+    auto walk = (const uint8_t *)data;
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *walk++;
+        for (int i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
 }
\ No newline at end of file
@@ -1,9 +1,14 @@
 #ifndef __ZW_COMMON__H__
 #define __ZW_COMMON__H__
 
+#include <stdint.h>
+#include <stddef.h>
+
 #define ZEROWATCH_VER "0.2.5.20"
 #define DEBUG 1
+#ifndef M5STACKC
 #define M5STACKC 1
+#endif
 
 #if M5STACKC
 #include <M5StickC.h>
@@ -17,10 +22,24 @@ struct ZWAppConfig
     bool publishLogs;
     bool pauseRefresh;
     bool deepSleepMode;
+    // milliseconds, see zw_budget.h
+    int refreshBudget;
 };
 
 void __haltOrCatchFire();
 
+// standard (reflected, 0xEDB88320) CRC-32; pass a previous result as crc to continue it
+uint32_t zwCrc32(const void *data, size_t len, uint32_t crc = 0);
+
+// for the zwXAsJson(buf, bufLen) functions: appends to buf at wrote, snprintf()'s running
+// total; once that reaches bufLen the output has been cut short and later appends are skipped
+#define APPEND(...)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (wrote >= 0 && (size_t)wrote < bufLen)                          \
+            wrote += snprintf(buf + wrote, bufLen - wrote, ##__VA_ARGS__); \
+    } while (0)
+
 #define zwassert(cond)                                                                      \
     do                                                                                      \
     {                                                                                       \
@@ -0,0 +1,199 @@
+#include "zw_critlog.h"
+#include "zw_common.h"
+#include "zw_logging.h"
+#include <esp_partition.h>
+
+#define CRITLOG_MAGIC 0x5A57C417
+#define CRITLOG_PENDING 0xFFFFFFFF
+#define CRITLOG_UPLOADED 0
+
+struct ZWCritLogRecord
+{
+    uint32_t magic;
+    // erased flash reads as all ones, and 1 -> 0 transitions need no erase,
+    // so this is cleared in place once the record has been uploaded
+    uint32_t pending;
+    uint32_t seq;
+    uint32_t bootCount;
+    uint32_t uptimeMs;
+    uint32_t crc;
+    char msg[ZWCRITLOG_MSG_MAX];
+};
+
+static_assert(sizeof(ZWCritLogRecord) == ZWCRITLOG_RECORD_SIZE, "critlog record size");
+static_assert(!(SPI_FLASH_SEC_SIZE % ZWCRITLOG_RECORD_SIZE), "critlog records must tile a sector");
+
+#define RECORDS_PER_SECTOR (SPI_FLASH_SEC_SIZE / ZWCRITLOG_RECORD_SIZE)
+
+static const esp_partition_t *__part = NULL;
+static uint32_t __slots = 0;
+static uint32_t __nextSlot = 0;
+static uint32_t __nextSeq = 1;
+static unsigned __pending = 0;
+static unsigned __lost = 0;
+
+static uint32_t __recordCrc(const ZWCritLogRecord &rec)
+{
+    // everything after the crc field, plus the identifying fields before it (but not
+    // pending, which legitimately changes after the record is written)
+    auto crc = zwCrc32(&rec.seq, sizeof(rec.seq) + sizeof(rec.bootCount) + sizeof(rec.uptimeMs));
+    return zwCrc32(rec.msg, sizeof(rec.msg), crc);
+}
+
+static bool __readRecord(uint32_t slot, ZWCritLogRecord &rec)
+{
+    return esp_partition_read(__part, slot * ZWCRITLOG_RECORD_SIZE, &rec, sizeof(rec)) == ESP_OK &&
+           rec.magic == CRITLOG_MAGIC && rec.crc == __recordCrc(rec);
+}
+
+static bool __slotErased(uint32_t slot)
+{
+    uint32_t words[ZWCRITLOG_RECORD_SIZE / sizeof(uint32_t)];
+    if (esp_partition_read(__part, slot * ZWCRITLOG_RECORD_SIZE, words, sizeof(words)) != ESP_OK)
+        return false;
+
+    for (auto word : words)
+        if (word != 0xFFFFFFFF)
+            return false;
+    return true;
+}
+
+bool zwCritLogBegin()
+{
+    __part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                      (esp_partition_subtype_t)ZWCRITLOG_PARTITION_SUBTYPE,
+                                      ZWCRITLOG_PARTITION_LABEL);
+    if (!__part)
+    {
+        zlog("WARNING: no '%s' partition, critical events will not persist\n", ZWCRITLOG_PARTITION_LABEL);
+        return false;
+    }
+
+    __slots = (__part->size / SPI_FLASH_SEC_SIZE) * RECORDS_PER_SECTOR;
+
+    // the newest valid record marks the write cursor
+    uint32_t maxSeq = 0;
+    ZWCritLogRecord rec;
+    for (uint32_t slot = 0; slot < __slots; slot++)
+    {
+        if (!__readRecord(slot, rec))
+            continue;
+
+        __pending += rec.pending == CRITLOG_PENDING;
+        if (rec.seq > maxSeq)
+        {
+            maxSeq = rec.seq;
+            __nextSlot = (slot + 1) % __slots;
+        }
+    }
+
+    // a write cut off by a reset leaves a slot that's neither valid nor erased just past the
+    // newest record, which can't be written again until its sector is: skip to an erased one
+    // (appending at the next sector boundary erases that sector first)
+    auto skipped = 0;
+    while (__nextSlot % RECORDS_PER_SECTOR && !__slotErased(__nextSlot))
+    {
+        __nextSlot = (__nextSlot + 1) % __slots;
+        ++skipped;
+    }
+    if (skipped)
+        zlog("WARNING: critlog skipped %d unerased slots\n", skipped);
+
+    __nextSeq = maxSeq + 1;
+    dprint("critlog: %d slots, next %d (seq %d), %d pending\n", __slots, __nextSlot, __nextSeq, __pending);
+    return true;
+}
+
+bool zwCritLogAppend(uint32_t bootCount, const char *msg)
+{
+    if (!__part)
+        return false;
+
+    if (!(__nextSlot % RECORDS_PER_SECTOR))
+    {
+        // about to reuse the oldest sector: account for anything in it never uploaded
+        ZWCritLogRecord old;
+        for (uint32_t slot = __nextSlot; slot < __nextSlot + RECORDS_PER_SECTOR; slot++)
+        {
+            if (__readRecord(slot, old) && old.pending == CRITLOG_PENDING)
+            {
+                --__pending;
+                ++__lost;
+            }
+        }
+
+        if (esp_partition_erase_range(__part, __nextSlot * ZWCRITLOG_RECORD_SIZE, SPI_FLASH_SEC_SIZE) != ESP_OK)
+            return false;
+    }
+
+    ZWCritLogRecord rec;
+    bzero(&rec, sizeof(rec));
+    rec.magic = CRITLOG_MAGIC;
+    rec.pending = CRITLOG_PENDING;
+    rec.seq = __nextSeq;
+    rec.bootCount = bootCount;
+    rec.uptimeMs = millis();
+    strncpy(rec.msg, msg, sizeof(rec.msg) - 1);
+    if (strlen(msg) >= sizeof(rec.msg))
+        memcpy(rec.msg + sizeof(rec.msg) - 4, "...", 3);
+    rec.crc = __recordCrc(rec);
+
+    if (esp_partition_write(__part, __nextSlot * ZWCRITLOG_RECORD_SIZE, &rec, sizeof(rec)) != ESP_OK)
+        return false;
+
+    ++__nextSeq;
+    ++__pending;
+    __nextSlot = (__nextSlot + 1) % __slots;
+    return true;
+}
+
+int zwCritLogForEachPending(std::function<bool(const ZWCritLogEntry &)> handler)
+{
+    if (!__part || !__pending)
+        return 0;
+
+    // oldest first: walk the ring starting at the write cursor
+    int count = 0;
+    ZWCritLogRecord rec;
+    for (uint32_t i = 0; i < __slots; i++)
+    {
+        auto slot = (__nextSlot + i) % __slots;
+        if (!__readRecord(slot, rec) || rec.pending != CRITLOG_PENDING)
+            continue;
+
+        ZWCritLogEntry entry = {rec.seq, rec.bootCount, rec.uptimeMs, rec.msg};
+        ++count;
+        if (!handler(entry))
+            break;
+    }
+
+    return count;
+}
+
+void zwCritLogMarkUploaded(uint32_t uptoSeq)
+{
+    if (!__part)
+        return;
+
+    const uint32_t uploaded = CRITLOG_UPLOADED;
+    ZWCritLogRecord rec;
+    for (uint32_t slot = 0; slot < __slots && __pending; slot++)
+    {
+        if (__readRecord(slot, rec) && rec.pending == CRITLOG_PENDING && rec.seq <= uptoSeq)
+        {
+            esp_partition_write(__part, slot * ZWCRITLOG_RECORD_SIZE + offsetof(ZWCritLogRecord, pending),
+                                &uploaded, sizeof(uploaded));
+            --__pending;
+        }
+    }
+}
+
+unsigned zwCritLogPending()
+{
+    return __pending;
+}
+
+unsigned zwCritLogLost()
+{
+    return __lost;
+}
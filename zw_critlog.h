@@ -0,0 +1,43 @@
+#ifndef __ZW_CRITLOG__H__
+#define __ZW_CRITLOG__H__
+
+#include <Arduino.h>
+#include <functional>
+
+// Critical events are written to a dedicated flash partition (see partitions.csv)
+// before anything else happens to them, so they survive resets, deep sleep and OTA
+// and are captured even when Redis is unreachable. Records are appended round-robin
+// across the whole partition, so every sector is erased equally often.
+#define ZWCRITLOG_PARTITION_LABEL "zwcrit"
+#define ZWCRITLOG_PARTITION_SUBTYPE 0x99
+#define ZWCRITLOG_RECORD_SIZE 128
+// including the terminator; longer messages are cut short, ending in "..."
+#define ZWCRITLOG_MSG_MAX (ZWCRITLOG_RECORD_SIZE - 24)
+// a buffer to format messages into: one more character than fits, so one that's too long is seen to be
+#define ZWCRITLOG_FORMAT_MAX (ZWCRITLOG_MSG_MAX + 1)
+
+struct ZWCritLogEntry
+{
+    uint32_t seq;
+    // 0 if it wasn't known when the entry was written
+    uint32_t bootCount;
+    uint32_t uptimeMs;
+    const char *msg;
+};
+
+bool zwCritLogBegin();
+
+bool zwCritLogAppend(uint32_t bootCount, const char *msg);
+
+// calls handler for each not-yet-uploaded entry, oldest first, until it returns false
+int zwCritLogForEachPending(std::function<bool(const ZWCritLogEntry &)> handler);
+
+// marks every pending entry up to and including seq as uploaded
+void zwCritLogMarkUploaded(uint32_t uptoSeq);
+
+unsigned zwCritLogPending();
+
+// pending entries overwritten by the ring wrapping before they could be uploaded
+unsigned zwCritLogLost();
+
+#endif
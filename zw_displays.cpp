@@ -2,11 +2,18 @@
 #include "zw_logging.h"
 #include "zw_common.h"
 #include "zw_provision.h"
+#include "zw_metrics.h"
+#include "zw_trace.h"
+#include "zw_heap.h"
+#include "zw_arena.h"
+#include "zw_budget.h"
+#include "zw_power.h"
 
 // TODO: get rid of these externs! (and associated includes!)
 extern unsigned long immediateLatency;
 extern unsigned long gUDRA;
 extern ZWAppConfig gConfig;
+extern DisplaySpec *gDisplays;
 #include "zw_redis.h"
 extern ZWRedis *gRedis;
 #include <ArduinoJson.h>
@@ -39,25 +46,33 @@ void __runAnimation(TM1637Display *d, AnimStep *anim, bool cE = false, int s = 0
     }
 }
 
-String __dispSpecNameComp(DisplaySpec* d, int cLimit, int lenLimit = 4)
+// the result lives in the per-pass arena
+const char* __dispSpecNameComp(DisplaySpec* d, int cLimit, int lenLimit = 4)
 {
-    auto sName = String(d->spec.listKey);
-    sName.replace(":.list", "");
+    auto sName = zwArenaPrintf("%s", d->spec.listKey);
+    char* listSuffix;
+    while ((listSuffix = strstr(sName, ":.list")))
+        memmove(listSuffix, listSuffix + 6, strlen(listSuffix + 6) + 1);
+
     auto cIdx = -1;
     for (int i = 0; i < cLimit; i++)
-        cIdx = sName.indexOf(":", cIdx + 1);
-    auto retVal = sName.substring(cIdx + 1);
-    if (retVal.length() > lenLimit)
-        retVal = retVal.substring(0, lenLimit);
+    {
+        auto found = strchr(sName + cIdx + 1, ':');
+        cIdx = found ? found - sName : -1;
+    }
+
+    auto retVal = sName + cIdx + 1;
+    if (strlen(retVal) > lenLimit)
+        retVal[lenLimit] = '\0';
     return retVal;
 }
 
-String getDispSpecShortName(DisplaySpec* d)
+const char* getDispSpecShortName(DisplaySpec* d)
 {
     return __dispSpecNameComp(d, 3);
 }
 
-String getDispSpecSensorName(DisplaySpec* d)
+const char* getDispSpecSensorName(DisplaySpec* d)
 {
     return __dispSpecNameComp(d, 2, 3);
 }
@@ -72,7 +87,7 @@ void d_def(DisplaySpec *d)
 { 
 #if M5STACKC
     M5.Lcd.setTextColor(DARKGREY, BLACK);
-    M5.Lcd.printf("%s:  ", getDispSpecShortName(d).c_str());
+    M5.Lcd.printf("%s:  ", getDispSpecShortName(d));
     M5.Lcd.setTextColor(WHITE, BLACK);
     M5.Lcd.printf("%d\n", d->spec.lastVal);
 #else
@@ -88,7 +103,7 @@ void d_tempf(DisplaySpec *d)
         (curVal > 85.0 ? YELLOW : (curVal > 65.0 ? GREEN : 
         (curVal > 55.0 ? CYAN : (curVal > 40.0 ? BLUE : PURPLE)))));
     M5.Lcd.setTextColor(DARKGREY, BLACK);
-    M5.Lcd.printf("%s:  ", getDispSpecSensorName(d).c_str());
+    M5.Lcd.printf("%s:  ", getDispSpecSensorName(d));
     M5.Lcd.setTextColor(tempColor, BLACK);
     M5.Lcd.printf("%.1fF\n", curVal);
     M5.Lcd.setTextColor(WHITE, BLACK);
@@ -110,7 +125,7 @@ void d_humidPercent(DisplaySpec *d)
 {
 #if M5STACKC
     M5.Lcd.setTextColor(DARKGREY, BLACK);
-    M5.Lcd.printf("%s:  ", getDispSpecSensorName(d).c_str());
+    M5.Lcd.printf("%s:  ", getDispSpecSensorName(d));
     M5.Lcd.setTextColor(WHITE, BLACK);
     M5.Lcd.printf("%.1f%%\n", (float)d->spec.lastVal / 100.0);
 #else
@@ -211,40 +226,82 @@ DisplaySpec *zwdisplayInit(String &hostname)
     return retSpec;
 }
 
-void updateDisplay(DisplaySpec *disp)
+void parseDisplayValues(DisplaySpec *disp, const std::vector<String> &lrVec)
 {
-    if (gConfig.debug)
+    double acc = 0.0;
+    for (auto &lrStr : lrVec)
+    {
+        if (lrStr.length() < 256)
+        {
+            jsonBuf.clear();
+            JsonArray &jsRoot = jsonBuf.parseArray(lrStr.c_str());
+            disp->spec.lastTs = (double)jsRoot[0];
+            acc += (double)jsRoot[1];
+        }
+        else
+        {
+            zwMetricInc(ZWC_DISPLAY_SKIPPED_ELEMENTS);
+        }
+    }
+
+    disp->spec.lastVal = disp->spec.adjFunc((int)((acc * 100.0) / lrVec.size()));
+}
+
+bool fetchDisplay(DisplaySpec *disp)
+{
+    if (gConfig.debug && zwBudgetLeft())
         __runAnimation(disp->disp, full_loop);
 
+    auto dispIdx = (uint8_t)(disp - gDisplays);
+    ZWTraceScope traced(ZWT_UPDATE_DISPLAY, dispIdx);
+    ZWHeapScope heapScope(ZWHEAP_DISPLAYS);
+    ZWPowerScope powered(ZWP_REDIS);
+
     auto __s = LAT_FUNC();
-    auto lrVec = gRedis->getRange(disp->spec.listKey, disp->spec.startIdx, disp->spec.endIdx);
+    auto lrVec = zwHeapAttribute(ZWHEAP_REDIS, [&]() {
+        return gRedis->getRange(disp->spec.listKey, disp->spec.startIdx, disp->spec.endIdx);
+    });
     immediateLatency = LAT_FUNC() - __s;
+    zwTraceRecord(ZWT_DISPLAY_FETCH, dispIdx, __s, immediateLatency);
+    zwMetricObserve((ZWHistogramId)(ZWH_DISPLAY_FETCH_0 + min((int)dispIdx, ZWMETRICS_MAX_DISPLAYS - 1)),
+                    immediateLatency);
     auto newUDRA = gUDRA == 0 ? immediateLatency : (gUDRA + immediateLatency) / 2;
     auto deltaUDRA = newUDRA - gUDRA;
     gUDRA = newUDRA;
 
-    if (lrVec.size())
+    if (!lrVec.size())
     {
-        double acc = 0.0;
-        for (auto lrStr : lrVec)
-        {
-            if (lrStr.length() < 256)
-            {
-                jsonBuf.clear();
-                JsonArray &jsRoot = jsonBuf.parseArray(lrStr.c_str());
-                disp->spec.lastTs = (double)jsRoot[0];
-                acc += (double)jsRoot[1];
-            }
-        }
+        zwMetricInc(ZWC_DISPLAY_EMPTY_FETCHES);
+        return false;
+    }
 
-        if (gConfig.debug)
-            __runAnimation(disp->disp, light_loop, true);
+    __s = LAT_FUNC();
+    parseDisplayValues(disp, lrVec);
+    auto parseUs = LAT_FUNC() - __s;
+    zwMetricObserve(ZWH_DISPLAY_PARSE, parseUs);
+    zwTraceRecord(ZWT_DISPLAY_PARSE, dispIdx, __s, parseUs);
 
-        disp->spec.lastVal = disp->spec.adjFunc((int)((acc * 100.0) / lrVec.size()));
+    zlog("[%s] count %d val %d immLat %lu gUDRA %lu (delta %ld)\n",
+         disp->spec.listKey, lrVec.size(), disp->spec.lastVal, immediateLatency, gUDRA, deltaUDRA);
+    return true;
+}
+
+void renderDisplay(DisplaySpec *disp)
+{
+    ZWPowerScope powered(ZWP_RENDER);
+    if (gConfig.debug && zwBudgetLeft())
+        __runAnimation(disp->disp, light_loop, true);
+
+    zwMetricTime(ZWH_DISPLAY_RENDER, [&]() {
+        ZWTraceScope renderTraced(ZWT_DISPLAY_RENDER, (uint8_t)(disp - gDisplays));
         disp->spec.dispFunc(disp);
-        zlog("[%s] count %d val %d immLat %lu gUDRA %lu (delta %ld)\n",
-             disp->spec.listKey, lrVec.size(), disp->spec.lastVal, immediateLatency, gUDRA, deltaUDRA);
-    }
+    });
+}
+
+void updateDisplay(DisplaySpec *disp)
+{
+    if (fetchDisplay(disp))
+        renderDisplay(disp);
 }
 
 void blink(int d)
@@ -300,19 +357,24 @@ void demoMode(DisplaySpec *displayListStart)
     EXEC_WITH_EACH_DISP(displayListStart, demoForDisp);
 }
 
-String displayConfigAsJson(DisplaySpec* displayListStart)
+const char* displayConfigAsJson(DisplaySpec* displayListStart)
 {
-#define BUFLEN 512
-    static char _buf[BUFLEN];
-    bzero(_buf, BUFLEN);
-    String build = "[";
+#define DISPLAY_CONFIG_FMT "{\"clockPin\":%d,\"dioPin\":%d,\"listKey\":\"%s\",\"startIdx\":%d,\"endIdx\":%d}%s"
+#define DISPLAY_CONFIG_ARGS(walk) \
+    walk->clockPin, walk->dioPin, walk->spec.listKey, walk->spec.startIdx, walk->spec.endIdx, ((walk+1)->clockPin != -1 ? "," : "")
+
+    // sized up front so the whole thing is one arena allocation
+    size_t len = 3;
     for (DisplaySpec *walk = displayListStart; walk->clockPin != -1 && walk->dioPin != -1; walk++)
-    {
-        snprintf(_buf, BUFLEN, 
-            "{\"clockPin\":%d,\"dioPin\":%d,\"listKey\":\"%s\",\"startIdx\":%d,\"endIdx\":%d}",
-            walk->clockPin, walk->dioPin, walk->spec.listKey, walk->spec.startIdx, walk->spec.endIdx);
-        build += String(_buf) + ((walk+1)->clockPin != -1 ? "," : ""); 
-    }
-    build += "]";
+        len += snprintf(NULL, 0, DISPLAY_CONFIG_FMT, DISPLAY_CONFIG_ARGS(walk));
+
+    auto build = (char*)zwArenaAlloc(len);
+    if (!build)
+        return "[]";
+
+    size_t wrote = snprintf(build, len, "[");
+    for (DisplaySpec *walk = displayListStart; walk->clockPin != -1 && walk->dioPin != -1; walk++)
+        wrote += snprintf(build + wrote, len - wrote, DISPLAY_CONFIG_FMT, DISPLAY_CONFIG_ARGS(walk));
+    snprintf(build + wrote, len - wrote, "]");
     return build;
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <TM1637Display.h>
 #include <Arduino.h>
 #include <functional>
+#include <vector>
 
 #define LED_BLTIN_H LOW
 #define LED_BLTIN_L HIGH
@@ -33,15 +34,29 @@ struct DisplaySpec
 
 DisplaySpec *zwdisplayInit(String &hostname);
 
+// the formatters display specs use as their dispFunc
+void d_def(DisplaySpec *d);
+void d_tempf(DisplaySpec *d);
+void d_humidPercent(DisplaySpec *d);
+
+// fetchDisplay reads and parses the display's list, true if it had values for renderDisplay
+// to show; the refresh budget can put time between the two (see tick())
+bool fetchDisplay(DisplaySpec *disp);
+void renderDisplay(DisplaySpec *disp);
 void updateDisplay(DisplaySpec *disp);
 
+// averages the values of an LRANGE reply's "[ts, value]" elements into lastVal (through
+// adjFunc), leaving the last element's timestamp in lastTs; lrVec must not be empty
+void parseDisplayValues(DisplaySpec *disp, const std::vector<String> &lrVec);
+
 void blink(int d = 50);
 
 void runAnimation(TM1637Display *d, String animation, bool cE = false, int s = 0);
 
 void demoMode(DisplaySpec* displayListStart);
 
-String displayConfigAsJson(DisplaySpec* displayListStart);
+// the result lives in the per-pass arena (see zw_arena.h)
+const char* displayConfigAsJson(DisplaySpec* displayListStart);
 
 #define EXEC_ALL_DISPS(DISPLIST_START, EXEC_ME)                                                      \
     do                                                                                               \
@@ -0,0 +1,147 @@
+#include "zw_heap.h"
+#include "zw_common.h"
+#include <new>
+
+static ZWHeapSubsystemStats __subsystems[ZWHEAP_SUBSYSTEM_COUNT];
+static uint32_t __allocsAtTick[ZWHEAP_SUBSYSTEM_COUNT];
+static volatile ZWHeapSubsystem __current = ZWHEAP_OTHER;
+static int32_t __nestedRetained = 0;
+static uint32_t __badFrees = 0;
+
+static const char *__subsystemNames[ZWHEAP_SUBSYSTEM_COUNT] = {
+    "other",
+    "redis",
+    "displays",
+    "logging",
+    "ota",
+    "provisioning"};
+
+ZWHeapScope::ZWHeapScope(ZWHeapSubsystem subsystem) : previous(__current), freeAtStart(ESP.getFreeHeap()),
+                                                      outerNested(__nestedRetained)
+{
+    __nestedRetained = 0;
+    __current = subsystem;
+}
+
+ZWHeapScope::~ZWHeapScope()
+{
+    auto retained = freeAtStart - (int32_t)ESP.getFreeHeap();
+    __subsystems[__current].retainedBytes += retained - __nestedRetained;
+    __nestedRetained = outerNested + retained;
+    __current = previous;
+}
+
+void zwHeapTickBoundary()
+{
+    for (int i = 0; i < ZWHEAP_SUBSYSTEM_COUNT; i++)
+    {
+        auto allocs = __subsystems[i].allocs;
+        __subsystems[i].allocsLastTick = allocs - __allocsAtTick[i];
+        __allocsAtTick[i] = allocs;
+    }
+}
+
+ZWHeapStats zwHeapStats()
+{
+    uint32_t allocsLastTick = 0;
+    for (int i = 0; i < ZWHEAP_SUBSYSTEM_COUNT; i++)
+        allocsLastTick += __subsystems[i].allocsLastTick;
+
+    return {
+        .free = ESP.getFreeHeap(),
+        .lowWater = ESP.getMinFreeHeap(),
+        .largestBlock = ESP.getMaxAllocHeap(),
+        .size = ESP.getHeapSize(),
+        .allocsLastTick = allocsLastTick,
+        .badFrees = __badFrees};
+}
+
+const ZWHeapSubsystemStats &zwHeapSubsystemStats(ZWHeapSubsystem subsystem)
+{
+    return __subsystems[subsystem < ZWHEAP_SUBSYSTEM_COUNT ? subsystem : ZWHEAP_OTHER];
+}
+
+int zwHeapAsJson(char *buf, size_t bufLen)
+{
+    auto stats = zwHeapStats();
+    int wrote = 0;
+    APPEND("{ \"free\": %u, \"lowWater\": %u, \"largestBlock\": %u, \"heap\": %u, ",
+           stats.free, stats.lowWater, stats.largestBlock, stats.size);
+#if ZWHEAP_TRACK_NEW
+    APPEND("\"allocsLastTick\": %u, \"badFrees\": %u, \"subsystems\": {", stats.allocsLastTick, stats.badFrees);
+#else
+    // nothing counts allocations, so rather than zeroes there's nothing to report
+    APPEND("\"allocsLastTick\": null, \"badFrees\": null, \"subsystems\": {");
+#endif
+
+    for (int i = 0; i < ZWHEAP_SUBSYSTEM_COUNT; i++)
+    {
+        auto &s = __subsystems[i];
+        APPEND(" \"%s\": {", __subsystemNames[i]);
+#if ZWHEAP_TRACK_NEW
+        APPEND(" \"liveBytes\": %d, \"liveAllocs\": %d, \"allocs\": %u, \"allocsLastTick\": %u,",
+               s.liveBytes, s.liveAllocs, s.allocs, s.allocsLastTick);
+#endif
+        APPEND(" \"retained\": %d }%s", s.retainedBytes, i < ZWHEAP_SUBSYSTEM_COUNT - 1 ? "," : " } }");
+    }
+
+    return wrote;
+}
+
+#if ZWHEAP_TRACK_NEW
+#define ZWHEAP_HEADER_MAGIC 0x5A48
+
+// keeps the 8-byte alignment malloc() gives us
+struct ZWHeapHeader
+{
+    uint32_t size;
+    uint16_t magic;
+    uint8_t subsystem;
+    uint8_t reserved;
+};
+
+static void *__trackedAlloc(size_t size)
+{
+    auto header = (ZWHeapHeader *)malloc(size + sizeof(ZWHeapHeader));
+    if (!header)
+        return nullptr;
+
+    auto subsystem = __current;
+    *header = {.size = (uint32_t)size, .magic = ZWHEAP_HEADER_MAGIC, .subsystem = (uint8_t)subsystem, .reserved = 0};
+    __atomic_add_fetch(&__subsystems[subsystem].liveBytes, (int32_t)size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&__subsystems[subsystem].liveAllocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&__subsystems[subsystem].allocs, 1, __ATOMIC_RELAXED);
+    return header + 1;
+}
+
+static void __trackedFree(void *ptr)
+{
+    if (!ptr)
+        return;
+
+    auto header = (ZWHeapHeader *)ptr - 1;
+    if (header->magic != ZWHEAP_HEADER_MAGIC || header->subsystem >= ZWHEAP_SUBSYSTEM_COUNT)
+    {
+        // every new has a header, so this is a double delete or a corrupt pointer, either of
+        // which free() would turn into heap corruption: leak it, and count it
+        __atomic_add_fetch(&__badFrees, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    header->magic = 0;
+    __atomic_sub_fetch(&__subsystems[header->subsystem].liveBytes, (int32_t)header->size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&__subsystems[header->subsystem].liveAllocs, 1, __ATOMIC_RELAXED);
+    free(header);
+}
+
+void *operator new(size_t size) { return __trackedAlloc(size); }
+void *operator new[](size_t size) { return __trackedAlloc(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return __trackedAlloc(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return __trackedAlloc(size); }
+void operator delete(void *ptr) noexcept { __trackedFree(ptr); }
+void operator delete[](void *ptr) noexcept { __trackedFree(ptr); }
+void operator delete(void *ptr, size_t) noexcept { __trackedFree(ptr); }
+void operator delete[](void *ptr, size_t) noexcept { __trackedFree(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { __trackedFree(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { __trackedFree(ptr); }
+#endif
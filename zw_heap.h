@@ -0,0 +1,82 @@
+#ifndef __ZW_HEAP__H__
+#define __ZW_HEAP__H__
+
+#include <Arduino.h>
+
+// 1 to replace the global operator new/delete so that every C++ allocation is
+// attributed to the subsystem whose ZWHeapScope is active (costs an 8-byte header
+// on each, so it's off by default). malloc()/String allocations aren't seen there,
+// but are caught by each scope's net change in free heap ("retained"), which is
+// kept either way.
+#ifndef ZWHEAP_TRACK_NEW
+#define ZWHEAP_TRACK_NEW 0
+#endif
+
+enum ZWHeapSubsystem
+{
+    ZWHEAP_OTHER = 0,
+    ZWHEAP_REDIS,
+    ZWHEAP_DISPLAYS,
+    ZWHEAP_LOGGING,
+    ZWHEAP_OTA,
+    ZWHEAP_PROVISIONING,
+    ZWHEAP_SUBSYSTEM_COUNT
+};
+
+struct ZWHeapSubsystemStats
+{
+    int32_t liveBytes;
+    int32_t liveAllocs;
+    uint32_t allocs;
+    uint32_t allocsLastTick;
+    int32_t retainedBytes;
+};
+
+struct ZWHeapStats
+{
+    uint32_t free;
+    uint32_t lowWater;
+    uint32_t largestBlock;
+    uint32_t size;
+    uint32_t allocsLastTick;
+    // deletes of pointers without a valid header (double deletes, say), left unfreed
+    uint32_t badFrees;
+};
+
+// called once per refresh: latches each subsystem's allocation count since the last call
+void zwHeapTickBoundary();
+
+ZWHeapStats zwHeapStats();
+
+const ZWHeapSubsystemStats &zwHeapSubsystemStats(ZWHeapSubsystem subsystem);
+
+// { "free": .., "lowWater": .., "largestBlock": .., "allocsLastTick": .., "badFrees": .., "subsystems": { "redis": {..}, .. } };
+// without ZWHEAP_TRACK_NEW the allocation counts are null and each subsystem has only "retained"
+int zwHeapAsJson(char *buf, size_t bufLen);
+
+// Attributes allocations made while in scope to the given subsystem. Scopes nest;
+// an inner scope's retained bytes are not also counted against the outer one.
+// The active subsystem is global, so allocations on other tasks are misattributed.
+class ZWHeapScope
+{
+protected:
+    ZWHeapSubsystem previous;
+    int32_t freeAtStart;
+    int32_t outerNested;
+
+public:
+    ZWHeapScope(ZWHeapSubsystem subsystem);
+    ~ZWHeapScope();
+
+    ZWHeapScope(const ZWHeapScope &) = delete;
+    ZWHeapScope &operator=(const ZWHeapScope &) = delete;
+};
+
+template <typename F>
+auto zwHeapAttribute(ZWHeapSubsystem subsystem, F func) -> decltype(func())
+{
+    ZWHeapScope scope(subsystem);
+    return func();
+}
+
+#endif
@@ -3,19 +3,73 @@
 
 #include "zw_common.h"
 
+// set to 1 to emit compact binary frames (see zw_binlog.h) instead of formatted
+// text; decode them on the host with tools/zw-logdecode
+#ifndef ZWLOG_BINARY
+#define ZWLOG_BINARY 0
+#endif
+
+#define ZWLOG_LEVEL_DEBUG 0
+#define ZWLOG_LEVEL_INFO 1
+#define ZWLOG_LEVEL_WARN 2
+#define ZWLOG_LEVEL_ERROR 3
+
+// call sites below this level are compiled out entirely, format strings included
+#ifndef ZWLOG_MIN_LEVEL
+#define ZWLOG_MIN_LEVEL ZWLOG_LEVEL_DEBUG
+#endif
+
 extern ZWAppConfig gConfig;
 extern void (*gPublishLogsEmit)(const char* fmt, ...);
 
+constexpr bool __zwLogPrefixed(const char *s, const char *p)
+{
+    return !*p || (*s == *p && __zwLogPrefixed(s + 1, p + 1));
+}
+
+// zlog's level comes from its format string's conventional prefix
+constexpr int zwLogLevelOf(const char *fmt)
+{
+    return __zwLogPrefixed(fmt, "ERROR") ? ZWLOG_LEVEL_ERROR :
+        (__zwLogPrefixed(fmt, "WARNING") ? ZWLOG_LEVEL_WARN : ZWLOG_LEVEL_INFO);
+}
+
+#define ZWLOG_ENABLED(level) ((level) >= ZWLOG_MIN_LEVEL)
+
+#if ZWLOG_BINARY
+#include "zw_binlog.h"
+
 #define dprint(fmt, ...) do { \
-    if (gConfig.debug) { \
-        Serial.printf("[%s:%d] " fmt, __FILE__, __LINE__, ##__VA_ARGS__); \
+    if (ZWLOG_ENABLED(ZWLOG_LEVEL_DEBUG) && gConfig.debug) { \
+        constexpr uint32_t __zwSite = ZWBINLOG_SITE_ID(fmt); \
+        zwBinLog(false, __zwSite, ##__VA_ARGS__); \
     } } while (0)
 
+// the M5's LCD console is for humans, so it stays text; elsewhere this branch (and
+// with it the format string) is compiled out
+#define ZWLOG_TEXT_CONSOLE M5STACKC
+
 #define zlog(fmt, ...) do { \
-    if (gConfig.publishLogs && gPublishLogsEmit) { \
-        gPublishLogsEmit(fmt, ##__VA_ARGS__); \
-    } else { \
-        Serial.printf(fmt, ##__VA_ARGS__); \
+    if (ZWLOG_ENABLED(zwLogLevelOf(fmt))) { \
+        if (ZWLOG_TEXT_CONSOLE && gConfig.publishLogs && gPublishLogsEmit && !gPublishLogsEmitBinary) { \
+            gPublishLogsEmit(fmt, ##__VA_ARGS__); \
+        } else { \
+            constexpr uint32_t __zwSite = ZWBINLOG_SITE_ID(fmt); \
+            zwBinLog(gConfig.publishLogs, __zwSite, ##__VA_ARGS__); \
+        } } } while (0)
+#else
+#define dprint(fmt, ...) do { \
+    if (ZWLOG_ENABLED(ZWLOG_LEVEL_DEBUG) && gConfig.debug) { \
+        Serial.printf("[%s:%d] " fmt, __FILE__, __LINE__, ##__VA_ARGS__); \
     } } while (0)
 
+#define zlog(fmt, ...) do { \
+    if (ZWLOG_ENABLED(zwLogLevelOf(fmt))) { \
+        if (gConfig.publishLogs && gPublishLogsEmit) { \
+            gPublishLogsEmit(fmt, ##__VA_ARGS__); \
+        } else { \
+            Serial.printf(fmt, ##__VA_ARGS__); \
+        } } } while (0)
+#endif
+
 #endif
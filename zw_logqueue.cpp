@@ -0,0 +1,170 @@
+#include "zw_logqueue.h"
+#include "zw_redis.h"
+#include "zw_logging.h"
+#include "zw_binlog.h"
+#include <atomic>
+
+#define PUB_FMT_STR "{\"source\":\"%s\",\"type\":\"VALUE\",\"ts\":%lu,\"value\":{\"logline\":\"%s\"}}"
+
+struct ZWLogSlot
+{
+    std::atomic<bool> ready;
+    unsigned long ts;
+    uint16_t len;
+    char line[ZWLOG_LINE_MAX];
+};
+
+static ZWLogSlot __slots[ZWLOG_RING_SLOTS];
+// __head is the next slot a producer may claim, __tail the next the consumer reads;
+// both only ever increase (and wrap harmlessly, as slot count is a power of two)
+static std::atomic<uint32_t> __head(0);
+static std::atomic<uint32_t> __tail(0);
+static std::atomic<uint32_t> __dropped(0);
+static unsigned long __reportedDropped = 0;
+static unsigned long __published = 0;
+static unsigned long __batches = 0;
+static unsigned long __failedBatches = 0;
+
+static_assert(!(ZWLOG_RING_SLOTS & (ZWLOG_RING_SLOTS - 1)), "ZWLOG_RING_SLOTS must be a power of two");
+
+static ZWLogSlot *__claimSlot()
+{
+    auto head = __head.load();
+    do
+    {
+        if (head - __tail.load() >= ZWLOG_RING_SLOTS)
+        {
+            ++__dropped;
+            return NULL;
+        }
+    } while (!__head.compare_exchange_weak(head, head + 1));
+
+    return &__slots[head % ZWLOG_RING_SLOTS];
+}
+
+size_t zwLogQueueFormat(char *line, const char *fmt, va_list args)
+{
+    auto full = vsnprintf(line, ZWLOG_LINE_MAX, fmt, args);
+
+    auto len = strlen(line);
+    if (len && line[len - 1] == '\n')
+        line[--len] = '\0';
+
+    // all but a newline was cut off: end with an ellipsis so what's read isn't taken as the whole line
+    auto fmtLen = strlen(fmt);
+    if (full > (int)len + (fmtLen && fmt[fmtLen - 1] == '\n'))
+        memcpy(line + len - strlen(ZWLOG_TRUNCATED), ZWLOG_TRUNCATED, strlen(ZWLOG_TRUNCATED));
+    return len;
+}
+
+bool zwLogQueuePush(unsigned long ts, const char *fmt, va_list args)
+{
+    auto slot = __claimSlot();
+    if (!slot)
+        return false;
+
+    slot->ts = ts;
+    slot->len = zwLogQueueFormat(slot->line, fmt, args);
+
+    slot->ready.store(true);
+    return true;
+}
+
+bool zwLogQueuePushRaw(const uint8_t *frame, size_t len)
+{
+    auto slot = __claimSlot();
+    if (!slot)
+        return false;
+
+    slot->len = min(len, (size_t)ZWLOG_LINE_MAX);
+    memcpy(slot->line, frame, slot->len);
+
+    slot->ready.store(true);
+    return true;
+}
+
+static size_t __formatDropped(char *msgBuf, size_t msgBufLen, const char *source, unsigned long count)
+{
+#if ZWLOG_BINARY
+    ZWBinLogFrame frame;
+    zwBinLogBegin(frame, ZWBINLOG_SITE_DROPPED);
+    zwBinLogArg(frame, count);
+    frame.buf[2] = (uint8_t)(frame.len - 3);
+    memcpy(msgBuf, frame.buf, min(frame.len, msgBufLen));
+    return min(frame.len, msgBufLen);
+#else
+    char note[48];
+    snprintf(note, sizeof(note), "[zwlog] dropped %lu lines", count);
+    return snprintf(msgBuf, msgBufLen, PUB_FMT_STR, source, 0ul, note);
+#endif
+}
+
+static size_t __formatSlot(char *msgBuf, size_t msgBufLen, const char *source, ZWLogSlot *slot)
+{
+#if ZWLOG_BINARY
+    memcpy(msgBuf, slot->line, min((size_t)slot->len, msgBufLen));
+    return min((size_t)slot->len, msgBufLen);
+#else
+    return min((size_t)snprintf(msgBuf, msgBufLen, PUB_FMT_STR, source, slot->ts, slot->line), msgBufLen - 1);
+#endif
+}
+
+int zwLogQueueFlush(ZWRedis *redis, const char *source)
+{
+    if (!redis || (__tail.load() == __head.load() && __reportedDropped == __dropped.load()))
+        return 0;
+
+    auto tail = __tail.load();
+    auto dropped = __dropped.load();
+    auto reported = __reportedDropped;
+    uint32_t taken = 0;
+
+    auto published = redis->publishLogs([&](char *msgBuf, size_t msgBufLen) -> size_t {
+        if (dropped != __reportedDropped)
+        {
+            auto len = __formatDropped(msgBuf, msgBufLen, source, dropped - __reportedDropped);
+            __reportedDropped = dropped;
+            return len;
+        }
+
+        // stops at the first claimed-but-unfinished slot; it goes out next flush
+        auto slot = &__slots[tail % ZWLOG_RING_SLOTS];
+        if (tail == __head.load() || !slot->ready.load())
+            return 0;
+
+        auto len = __formatSlot(msgBuf, msgBufLen, source, slot);
+        slot->ready.store(false);
+        __tail.store(++tail);
+        ++taken;
+        return len;
+    });
+
+    ++__batches;
+    if (published < 0)
+    {
+        // the slots are free again already, so the batch's lines are gone: count them as
+        // dropped, and report the earlier drops with them next time
+        ++__failedBatches;
+        __dropped += taken;
+        __reportedDropped = reported;
+    }
+    else
+        __published += published;
+
+    return published;
+}
+
+unsigned long zwLogQueuePending()
+{
+    return __head.load() - __tail.load();
+}
+
+ZWLogQueueStats zwLogQueueStats()
+{
+    return {
+        .pending = zwLogQueuePending(),
+        .dropped = __dropped.load(),
+        .published = __published,
+        .batches = __batches,
+        .failedBatches = __failedBatches};
+}
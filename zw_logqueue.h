@@ -0,0 +1,43 @@
+#ifndef __ZW_LOGQUEUE__H__
+#define __ZW_LOGQUEUE__H__
+
+#include <Arduino.h>
+#include <stdarg.h>
+
+#define ZWLOG_RING_SLOTS 32
+// longer lines are cut short, ending in ZWLOG_TRUNCATED instead
+#define ZWLOG_LINE_MAX 160
+#define ZWLOG_TRUNCATED "..."
+#define ZWLOG_FLUSH_INTERVAL_MS 1000
+
+class ZWRedis;
+
+struct ZWLogQueueStats
+{
+    unsigned long pending;
+    unsigned long dropped;
+    unsigned long published;
+    unsigned long batches;
+    unsigned long failedBatches;
+};
+
+// Formats into the next free slot without blocking or allocating; when the
+// ring is full the line is dropped and counted instead. Safe from any task.
+bool zwLogQueuePush(unsigned long ts, const char *fmt, va_list args);
+
+// as above, for already-encoded binary log frames (ZWLOG_BINARY builds)
+bool zwLogQueuePushRaw(const uint8_t *frame, size_t len);
+
+// what zwLogQueuePush() does to each line, into ZWLOG_LINE_MAX bytes of line: returns its length
+size_t zwLogQueueFormat(char *line, const char *fmt, va_list args);
+
+// Publishes everything queued in one pipelined round-trip; if that fails, its lines
+// are lost and counted as dropped. Single consumer: only ever call this from the
+// loop task, as it owns the Redis connection.
+int zwLogQueueFlush(ZWRedis *redis, const char *source);
+
+unsigned long zwLogQueuePending();
+
+ZWLogQueueStats zwLogQueueStats();
+
+#endif
@@ -0,0 +1,138 @@
+#include "zw_metrics.h"
+#include "zw_common.h"
+
+static uint32_t __counters[ZWC_COUNT];
+static int32_t __gauges[ZWG_COUNT];
+static ZWHistogram __histograms[ZWH_COUNT];
+
+static const char *__counterNames[ZWC_COUNT] = {
+    "refreshes",
+    "redisFailures",
+    "displayEmptyFetches",
+    "displaySkippedElements",
+    "arenaSpills",
+    "budgetOverruns",
+    "budgetDeferrals",
+    "redisRedirects"};
+
+static const char *__gaugeNames[ZWG_COUNT] = {
+    "freeHeap",
+    "wifiRSSI",
+    "arenaHighWater"};
+
+static const char *__histogramNames[ZWH_DISPLAY_FETCH_0] = {
+    "redis.get",
+    "redis.set",
+    "redis.del",
+    "redis.expire",
+    "redis.hget",
+    "redis.hset",
+    "redis.lrange",
+    "redis.publish",
+    "redis.auth",
+    "redis.pipeline",
+    "redis.getrange",
+    "redis.time",
+    "display.parse",
+    "display.render",
+    "heartbeat",
+    "checkin",
+    "tick",
+    "refresh"};
+
+void zwMetricInc(ZWCounterId id, uint32_t by)
+{
+    if (id < ZWC_COUNT)
+        __counters[id] += by;
+}
+
+void zwMetricSet(ZWGaugeId id, int32_t value)
+{
+    if (id < ZWG_COUNT)
+        __gauges[id] = value;
+}
+
+void zwMetricObserve(ZWHistogramId id, uint32_t us)
+{
+    if (id >= ZWH_COUNT)
+        return;
+
+    auto &h = __histograms[id];
+    auto bucket = us ? 31 - __builtin_clz(us) : 0;
+    ++h.buckets[bucket < ZWMETRICS_HIST_BUCKETS ? bucket : ZWMETRICS_HIST_BUCKETS - 1];
+    h.minUs = !h.count || us < h.minUs ? us : h.minUs;
+    h.maxUs = us > h.maxUs ? us : h.maxUs;
+    h.sumUs += us;
+    ++h.count;
+}
+
+const ZWHistogram &zwMetricHistogram(ZWHistogramId id)
+{
+    return __histograms[id < ZWH_COUNT ? id : 0];
+}
+
+uint32_t zwMetricPercentile(ZWHistogramId id, int percentile)
+{
+    auto &h = zwMetricHistogram(id);
+    if (!h.count)
+        return 0;
+
+    auto want = ((uint64_t)h.count * percentile + 99) / 100;
+    uint64_t seen = 0;
+    for (int i = 0; i < ZWMETRICS_HIST_BUCKETS; i++)
+    {
+        seen += h.buckets[i];
+        if (seen >= want)
+            return min((uint32_t)((2ull << i) - 1), h.maxUs);
+    }
+    return h.maxUs;
+}
+
+int zwMetricsAsJson(char *buf, size_t bufLen, bool full)
+{
+    int wrote = 0;
+
+    APPEND("{ \"counters\": {");
+    for (int i = 0; i < ZWC_COUNT; i++)
+        APPEND("%s \"%s\": %u", i ? "," : "", __counterNames[i], __counters[i]);
+
+    APPEND(" }, \"gauges\": {");
+    for (int i = 0; i < ZWG_COUNT; i++)
+        APPEND("%s \"%s\": %d", i ? "," : "", __gaugeNames[i], __gauges[i]);
+
+    APPEND(" }, \"histograms\": {");
+    bool first = true;
+    for (int i = 0; i < ZWH_COUNT; i++)
+    {
+        auto &h = __histograms[i];
+        if (!h.count)
+            continue;
+
+        if (i < ZWH_DISPLAY_FETCH_0)
+            APPEND("%s \"%s\": {", first ? "" : ",", __histogramNames[i]);
+        else
+            APPEND("%s \"display.fetch.%d\": {", first ? "" : ",", i - ZWH_DISPLAY_FETCH_0);
+        first = false;
+
+        APPEND(" \"n\": %u, \"mean\": %u, \"min\": %u, \"p50\": %u, \"p99\": %u, \"max\": %u",
+               h.count, (uint32_t)(h.sumUs / h.count), h.minUs,
+               zwMetricPercentile((ZWHistogramId)i, 50), zwMetricPercentile((ZWHistogramId)i, 99), h.maxUs);
+
+        if (full)
+        {
+            // trailing empty buckets are trimmed
+            int last = ZWMETRICS_HIST_BUCKETS - 1;
+            while (last > 0 && !h.buckets[last])
+                --last;
+            APPEND(", \"buckets\": [");
+            for (int b = 0; b <= last; b++)
+                APPEND("%s%u", b ? "," : "", h.buckets[b]);
+            APPEND("]");
+        }
+
+        APPEND(" }");
+    }
+    APPEND(" } }");
+
+    return wrote;
+}
@@ -0,0 +1,103 @@
+#ifndef __ZW_METRICS__H__
+#define __ZW_METRICS__H__
+
+#include <Arduino.h>
+
+// Static, allocation-free metrics: every counter, gauge and histogram is a slot
+// in a fixed array indexed by the enums below. Histograms are log2-bucketed in
+// microseconds: bucket i holds [2^i, 2^(i+1)), the last bucket everything above.
+#define ZWMETRICS_HIST_BUCKETS 24
+#define ZWMETRICS_MAX_DISPLAYS 8
+
+enum ZWCounterId
+{
+    ZWC_REFRESHES = 0,
+    ZWC_REDIS_FAILURES,
+    ZWC_DISPLAY_EMPTY_FETCHES,
+    ZWC_DISPLAY_SKIPPED_ELEMENTS,
+    ZWC_ARENA_SPILLS,
+    ZWC_BUDGET_OVERRUNS,
+    ZWC_BUDGET_DEFERRALS,
+    ZWC_REDIS_REDIRECTS,
+    ZWC_COUNT
+};
+
+enum ZWGaugeId
+{
+    ZWG_FREE_HEAP = 0,
+    ZWG_WIFI_RSSI,
+    ZWG_ARENA_HIGH_WATER,
+    ZWG_COUNT
+};
+
+enum ZWHistogramId
+{
+    ZWH_REDIS_GET = 0,
+    ZWH_REDIS_SET,
+    ZWH_REDIS_DEL,
+    ZWH_REDIS_EXPIRE,
+    ZWH_REDIS_HGET,
+    ZWH_REDIS_HSET,
+    ZWH_REDIS_LRANGE,
+    ZWH_REDIS_PUBLISH,
+    ZWH_REDIS_AUTH,
+    ZWH_REDIS_PIPELINE,
+    ZWH_REDIS_GETRANGE,
+    ZWH_REDIS_TIME,
+    ZWH_DISPLAY_PARSE,
+    ZWH_DISPLAY_RENDER,
+    ZWH_HEARTBEAT,
+    ZWH_CHECKIN,
+    ZWH_TICK,
+    ZWH_REFRESH,
+    // one per display slot, in display list order
+    ZWH_DISPLAY_FETCH_0,
+    ZWH_COUNT = ZWH_DISPLAY_FETCH_0 + ZWMETRICS_MAX_DISPLAYS
+};
+
+struct ZWHistogram
+{
+    uint32_t count;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint64_t sumUs;
+    uint32_t buckets[ZWMETRICS_HIST_BUCKETS];
+};
+
+void zwMetricInc(ZWCounterId id, uint32_t by = 1);
+
+void zwMetricSet(ZWGaugeId id, int32_t value);
+
+void zwMetricObserve(ZWHistogramId id, uint32_t us);
+
+const ZWHistogram &zwMetricHistogram(ZWHistogramId id);
+
+// upper bound of the bucket holding the given percentile (0-100), in microseconds
+uint32_t zwMetricPercentile(ZWHistogramId id, int percentile);
+
+// JSON snapshot of everything recorded; full includes each histogram's buckets,
+// otherwise just count/mean/p50/p99/max. Unrecorded histograms are omitted.
+int zwMetricsAsJson(char *buf, size_t bufLen, bool full);
+
+class ZWMetricScope
+{
+protected:
+    ZWHistogramId id;
+    unsigned long start;
+
+public:
+    ZWMetricScope(ZWHistogramId histogram) : id(histogram), start(micros()) {}
+    ~ZWMetricScope() { zwMetricObserve(id, micros() - start); }
+
+    ZWMetricScope(const ZWMetricScope &) = delete;
+    ZWMetricScope &operator=(const ZWMetricScope &) = delete;
+};
+
+template <typename F>
+auto zwMetricTime(ZWHistogramId id, F func) -> decltype(func())
+{
+    ZWMetricScope scope(id);
+    return func();
+}
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef __ZW_MSGPACK__H__
+#define __ZW_MSGPACK__H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Minimal MessagePack writer into a caller-provided buffer: no heap, no Arduino
+// dependencies (it's shared with the host tools). Overflow sets a sticky flag
+// instead of writing past the end; check ok() once encoding is done.
+class ZWMsgPackWriter
+{
+protected:
+    uint8_t *buf;
+    size_t cap;
+    size_t used = 0;
+    bool overflow = false;
+
+    void put(const void *data, size_t len)
+    {
+        if (overflow || used + len > cap)
+        {
+            overflow = true;
+            return;
+        }
+        memcpy(buf + used, data, len);
+        used += len;
+    }
+
+    void putByte(uint8_t b) { put(&b, 1); }
+
+    void putBE(uint8_t tag, uint64_t v, int bytes)
+    {
+        uint8_t tmp[9];
+        tmp[0] = tag;
+        for (int i = 0; i < bytes; i++)
+            tmp[bytes - i] = (uint8_t)(v >> (i * 8));
+        put(tmp, bytes + 1);
+    }
+
+public:
+    ZWMsgPackWriter(uint8_t *buffer, size_t capacity) : buf(buffer), cap(capacity) {}
+
+    size_t length() const { return used; }
+    bool ok() const { return !overflow; }
+
+    void map(uint32_t entries)
+    {
+        if (entries < 16)
+            putByte(0x80 | entries);
+        else
+            putBE(0xde, entries, 2);
+    }
+
+    void array(uint32_t entries)
+    {
+        if (entries < 16)
+            putByte(0x90 | entries);
+        else
+            putBE(0xdc, entries, 2);
+    }
+
+    void str(const char *s, size_t len)
+    {
+        if (len < 32)
+            putByte(0xa0 | len);
+        else if (len < 256)
+            putBE(0xd9, len, 1);
+        else
+            putBE(0xda, len, 2);
+        put(s, len);
+    }
+
+    void str(const char *s) { str(s ? s : "", s ? strlen(s) : 0); }
+
+    void uint(uint64_t v)
+    {
+        if (v < 128)
+            putByte((uint8_t)v);
+        else if (v < 0x100)
+            putBE(0xcc, v, 1);
+        else if (v < 0x10000)
+            putBE(0xcd, v, 2);
+        else if (v < 0x100000000ULL)
+            putBE(0xce, v, 4);
+        else
+            putBE(0xcf, v, 8);
+    }
+
+    void sint(int64_t v)
+    {
+        if (v >= 0)
+            uint((uint64_t)v);
+        else if (v >= -32)
+            putByte((uint8_t)(int8_t)v);
+        else if (v >= -128)
+            putBE(0xd0, (uint64_t)v, 1);
+        else if (v >= -32768)
+            putBE(0xd1, (uint64_t)v, 2);
+        else if (v >= INT32_MIN)
+            putBE(0xd2, (uint64_t)v, 4);
+        else
+            putBE(0xd3, (uint64_t)v, 8);
+    }
+
+    void boolean(bool b) { putByte(b ? 0xc3 : 0xc2); }
+
+    void nil() { putByte(0xc0); }
+
+    void f32(float f)
+    {
+        uint32_t bits;
+        memcpy(&bits, &f, 4);
+        putBE(0xca, bits, 4);
+    }
+
+    // key/value shorthands for maps
+    void kv(const char *k, uint64_t v) { str(k), uint(v); }
+    void kvs(const char *k, int64_t v) { str(k), sint(v); }
+    void kv(const char *k, const char *v) { str(k), str(v); }
+    void kvb(const char *k, bool v) { str(k), boolean(v); }
+    void kvf(const char *k, float v) { str(k), f32(v); }
+};
+
+#endif
@@ -1,89 +1,738 @@
 #include "zw_ota.h"
 #include "zw_logging.h"
+#include "zw_heap.h"
 #include <Arduino.h>
 #include <HTTPClient.h>
-#include <Update.h>
+#include <esp_ota_ops.h>
+#include <rom/miniz.h>
+#include <nvs.h>
 
-void updateProg(size_t s1, size_t s2)
+static char __otaLastError[OTA_ERROR_MAX];
+
+const char *otaLastError()
+{
+    return __otaLastError;
+}
+
+struct ZWOtaCheckpoint
+{
+    uint32_t magic;
+    uint32_t partitionAddress;
+    uint32_t size;
+    uint32_t flashed;
+    char md5[33];
+    mbedtls_md5_context md5State;
+};
+
+static bool __loadCheckpoint(ZWOtaCheckpoint &checkpoint)
+{
+    nvs_handle handle;
+    if (nvs_open(ZWPROV_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return false;
+
+    size_t len = sizeof(checkpoint);
+    auto err = nvs_get_blob(handle, OTA_CHECKPOINT_NVS_KEY, &checkpoint, &len);
+    nvs_close(handle);
+    return err == ESP_OK && len == sizeof(checkpoint) && checkpoint.magic == OTA_CHECKPOINT_MAGIC;
+}
+
+// a checkpoint is only good for the same image going to the same partition
+static bool __findCheckpoint(ZWOtaCheckpoint &checkpoint, const char *md5, size_t size)
+{
+    auto partition = esp_ota_get_next_update_partition(NULL);
+    return md5 && partition && __loadCheckpoint(checkpoint) &&
+           checkpoint.partitionAddress == partition->address && checkpoint.size == size &&
+           checkpoint.flashed < size && !strcasecmp(checkpoint.md5, md5);
+}
+
+bool otaCanResume(const char *md5, size_t size)
+{
+    ZWOtaCheckpoint checkpoint;
+    return __findCheckpoint(checkpoint, md5, size);
+}
+
+void updateProg(const ZWOtaProgress &progress)
 {
-    static int lastUpdate = 0;
-    auto curPercent = ((double)s1 / s2) * 100.0;
+    static unsigned lastUpdate = 0;
+    auto curPercent = progress.total ? ((double)progress.written / progress.total) * 100.0 : 0.0;
+    if ((unsigned)curPercent < lastUpdate)
+        lastUpdate = 0;
+
     if ((unsigned)curPercent >= lastUpdate + OTA_UPDATE_PRCNT_REPORT)
     {
         lastUpdate = (unsigned)curPercent;
         dprint("%d.. %s", lastUpdate, (lastUpdate == 100 ? "\n" : ""));
-        zlog("OTA update progress: %0.2f%% (%d)\n", curPercent, s1);
+        zlog("OTA update progress: %0.2f%% (%d) %0.1fKB/s, waited %lums on network, %lums on flash\n",
+             curPercent, progress.written, progress.kbps, progress.netWaitMs, progress.flashWaitMs);
     }
 }
 
-bool runUpdate(
-    const char *url, 
-    const char *md5, 
-    size_t sizeInBytes, 
-    void (*preUpdateIRQDisable)(),
-    bool (*completedCallback)())
+bool ZWOtaSink::fail(const char *format, ...)
 {
-    HTTPClient http;
-    if (http.begin(url))
+    va_list args;
+    va_start(args, format);
+    vsnprintf(lastError, OTA_ERROR_MAX, format, args);
+    va_end(args);
+    failed = true;
+    return false;
+}
+
+bool ZWOtaWriter::begin(size_t size, const char *md5Hex)
+{
+    partition = esp_ota_get_next_update_partition(NULL);
+    if (!partition)
+        return fail("no OTA partition");
+
+    if (size > partition->size)
+        return fail("image of %u bytes exceeds the %u-byte partition", size, partition->size);
+
+    for (int i = 0; i < OTA_CHUNK_COUNT; i++)
     {
-        auto code = http.GET();
-        if (code > 0)
+        chunks[i] = (uint8_t *)malloc(OTA_CHUNK_SIZE);
+        if (!chunks[i])
         {
-            auto dataStream = http.getStream();
-            auto avail = dataStream.available();
-            if (avail == 0)
-            {
-                zlog("ERROR: no bytes available!\n");
-                return false;
-            }
+            auto heap = zwHeapStats();
+            return fail("chunk allocation failed (free %u, largest block %u)", heap.free, heap.largestBlock);
+        }
+    }
 
-            if (Update.begin(sizeInBytes))
-            {
-                Update.onProgress(updateProg);
-                Update.setMD5(md5);
-
-                if (preUpdateIRQDisable)
-                    preUpdateIRQDisable();
-
-                dprint("OTA start szb=%d\n", sizeInBytes);
-                auto updateTook = Update.writeStream(dataStream);
-                if (updateTook == sizeInBytes && !Update.hasError())
-                {
-                    if (completedCallback && !completedCallback())
-                    {
-                        zlog("WARNING: unable to delete update key!\n");
-                    }
-
-                    if (!Update.end())
-                    {
-                        zlog("UPDATE END FAILED!? WTF mate\n");
-                        Update.abort();
-                        return false;
-                    }
-
-                    return true;
-                }
-                else
-                {
-                    zlog("UPDATE FAILED: %d\n", Update.getError());
-                    Update.abort();
-                }
-            }
+    freeChunks = xQueueCreate(OTA_CHUNK_COUNT, sizeof(int));
+    fullChunks = xQueueCreate(OTA_CHUNK_COUNT + 1, sizeof(Chunk));
+    writerDone = xSemaphoreCreateBinary();
+    if (!freeChunks || !fullChunks || !writerDone)
+        return fail("queue allocation failed");
+
+    for (int i = 1; i < OTA_CHUNK_COUNT; i++)
+        xQueueSend(freeChunks, &i, 0);
+    current = 0;
+
+    imageSize = size;
+    mbedtls_md5_init(&md5);
+
+    ZWOtaCheckpoint checkpoint;
+    if (__findCheckpoint(checkpoint, md5Hex, size))
+    {
+        // checkpoints fall on sector boundaries; anything written past one is erased again
+        resumed = flashed = submitted = erasedTo = checkpoint.flashed;
+        md5 = checkpoint.md5State;
+    }
+    else
+    {
+        // whatever an earlier checkpoint described is about to be overwritten
+        clearCheckpoint();
+        mbedtls_md5_starts_ret(&md5);
+    }
+
+    if (md5Hex)
+        snprintf(checkpointMd5, sizeof(checkpointMd5), "%s", md5Hex);
+    started = millis();
+
+    if (xTaskCreate(writerTask, "zwOtaWriter", OTA_WRITER_STACK, this, OTA_WRITER_PRIORITY, NULL) != pdPASS)
+        return fail("writer task creation failed");
+
+    writerRunning = true;
+    return true;
+}
+
+void ZWOtaWriter::writerTask(void *arg)
+{
+    auto self = (ZWOtaWriter *)arg;
+    self->writerLoop();
+    xSemaphoreGive(self->writerDone);
+    vTaskDelete(NULL);
+}
+
+// called by the writer task, between chunks, so flashed and md5 agree
+void ZWOtaWriter::saveCheckpoint()
+{
+    ZWOtaCheckpoint checkpoint;
+    checkpoint.magic = OTA_CHECKPOINT_MAGIC;
+    checkpoint.partitionAddress = partition->address;
+    checkpoint.size = imageSize;
+    checkpoint.flashed = flashed;
+    memcpy(checkpoint.md5, checkpointMd5, sizeof(checkpoint.md5));
+    checkpoint.md5State = md5;
+
+    nvs_handle handle;
+    if (nvs_open(ZWPROV_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        return;
+
+    if (nvs_set_blob(handle, OTA_CHECKPOINT_NVS_KEY, &checkpoint, sizeof(checkpoint)) != ESP_OK ||
+        nvs_commit(handle) != ESP_OK)
+        dprint("OTA checkpoint at %u failed\n", flashed);
+
+    nvs_close(handle);
+}
+
+void ZWOtaWriter::clearCheckpoint()
+{
+    nvs_handle handle;
+    if (nvs_open(ZWPROV_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        return;
+
+    if (nvs_erase_key(handle, OTA_CHECKPOINT_NVS_KEY) == ESP_OK)
+        nvs_commit(handle);
+    nvs_close(handle);
+}
+
+bool ZWOtaWriter::eraseThrough(size_t offset)
+{
+    while (erasedTo < offset)
+    {
+        if (esp_partition_erase_range(partition, erasedTo, SPI_FLASH_SEC_SIZE) != ESP_OK)
+            return fail("erase at %u failed", erasedTo);
+        erasedTo += SPI_FLASH_SEC_SIZE;
+    }
+    return true;
+}
+
+void ZWOtaWriter::writerLoop()
+{
+    auto imageEnd = (imageSize + SPI_FLASH_SEC_SIZE - 1) & ~(size_t)(SPI_FLASH_SEC_SIZE - 1);
+
+    for (;;)
+    {
+        // with nothing to write yet, erase ahead one sector at a time so a chunk arriving is never kept waiting long
+        auto eraseTarget = min(imageEnd, flashed + OTA_ERASE_AHEAD_SECTORS * SPI_FLASH_SEC_SIZE);
+        auto canEraseAhead = !failed && erasedTo < eraseTarget;
+
+        Chunk chunk;
+        if (xQueueReceive(fullChunks, &chunk, canEraseAhead ? 0 : portMAX_DELAY) != pdTRUE)
+        {
+            eraseThrough(erasedTo + SPI_FLASH_SEC_SIZE);
+            continue;
+        }
+
+        if (!chunk.length)
+            return;
+
+        if (!failed && eraseThrough(flashed + chunk.length))
+        {
+            if (esp_partition_write(partition, flashed, chunks[chunk.index], chunk.length) != ESP_OK)
+                fail("write of %u bytes at %u failed", chunk.length, flashed);
             else
+                mbedtls_md5_update_ret(&md5, chunks[chunk.index], chunk.length);
+            flashed += chunk.length;
+
+            if (checkpointMd5[0] && !failed && flashed < imageSize && !(flashed % OTA_CHECKPOINT_INTERVAL))
+                saveCheckpoint();
+        }
+
+        xQueueSend(freeChunks, &chunk.index, portMAX_DELAY);
+    }
+}
+
+bool ZWOtaWriter::submit()
+{
+    if (!currentFill)
+        return true;
+
+    Chunk chunk = {.index = current, .length = currentFill};
+    xQueueSend(fullChunks, &chunk, portMAX_DELAY);
+    submitted += currentFill;
+    currentFill = 0;
+
+    auto waitStart = millis();
+    auto gotChunk = xQueueReceive(freeChunks, &current, pdMS_TO_TICKS(OTA_STALL_TIMEOUT_MS)) == pdTRUE;
+    flashWaitMs += millis() - waitStart;
+
+    if (!gotChunk)
+    {
+        current = -1;
+        return fail("flash writer stalled");
+    }
+    return true;
+}
+
+bool ZWOtaWriter::write(const uint8_t *data, size_t len)
+{
+    if (failed || !writerRunning)
+        return false;
+
+    if (submitted + currentFill + len > imageSize)
+        return fail("more than the expected %u bytes", imageSize);
+
+    while (len)
+    {
+        auto take = min(len, (size_t)(OTA_CHUNK_SIZE - currentFill));
+        memcpy(chunks[current] + currentFill, data, take);
+        currentFill += take;
+        data += take;
+        len -= take;
+
+        if (currentFill == OTA_CHUNK_SIZE && !submit())
+            return false;
+    }
+
+    return !failed;
+}
+
+bool ZWOtaWriter::stopWriter()
+{
+    if (!writerRunning)
+        return false;
+
+    Chunk stop = {.index = -1, .length = 0};
+    xQueueSend(fullChunks, &stop, portMAX_DELAY);
+    xSemaphoreTake(writerDone, portMAX_DELAY);
+    writerRunning = false;
+    return true;
+}
+
+bool ZWOtaWriter::finish(const char *md5Hex)
+{
+    if (!failed && currentFill)
+    {
+        // the last chunk needn't be full, and there's no next chunk to wait for
+        Chunk chunk = {.index = current, .length = currentFill};
+        xQueueSend(fullChunks, &chunk, portMAX_DELAY);
+        submitted += currentFill;
+        currentFill = 0;
+    }
+
+    if (!stopWriter() || failed)
+        return false;
+
+    if (flashed != imageSize)
+        return fail("wrote %u of %u bytes", flashed, imageSize);
+
+    uint8_t digest[16];
+    char digestHex[33];
+    mbedtls_md5_finish_ret(&md5, digest);
+    for (int i = 0; i < 16; i++)
+        snprintf(digestHex + i * 2, 3, "%02x", digest[i]);
+
+    // either way, there's nothing left to resume
+    clearCheckpoint();
+
+    if (!md5Hex || strcasecmp(md5Hex, digestHex))
+        return fail("MD5 mismatch: expected %s, got %s", md5Hex ? md5Hex : "(none)", digestHex);
+
+    auto p = progress();
+    zlog("OTA image verified: %u bytes in %lums (%0.1fKB/s), waited %lums on network, %lums on flash\n",
+         p.written, p.elapsedMs, p.kbps, p.netWaitMs, p.flashWaitMs);
+    return true;
+}
+
+bool ZWOtaWriter::activate()
+{
+    if (failed || writerRunning || flashed != imageSize)
+        return false;
+
+    // this also validates the image's structure and checksums
+    auto err = esp_ota_set_boot_partition(partition);
+    if (err != ESP_OK)
+        return fail("esp_ota_set_boot_partition failed: %d", err);
+    return true;
+}
+
+void ZWOtaWriter::abort()
+{
+    stopWriter();
+
+    for (int i = 0; i < OTA_CHUNK_COUNT; i++)
+        free(chunks[i]), chunks[i] = nullptr;
+
+    if (freeChunks)
+        vQueueDelete(freeChunks), freeChunks = nullptr;
+    if (fullChunks)
+        vQueueDelete(fullChunks), fullChunks = nullptr;
+    if (writerDone)
+        vSemaphoreDelete(writerDone), writerDone = nullptr;
+
+    mbedtls_md5_free(&md5);
+}
+
+ZWOtaProgress ZWOtaWriter::progress()
+{
+    auto elapsed = millis() - started;
+    return {
+        .written = flashed,
+        .total = imageSize,
+        .elapsedMs = elapsed,
+        .kbps = elapsed ? ((flashed - resumed) / 1024.0f) / (elapsed / 1000.0f) : 0.0f,
+        .netWaitMs = netWaitMs,
+        .flashWaitMs = flashWaitMs};
+}
+
+ZWOtaInflater::~ZWOtaInflater()
+{
+    free(decomp);
+    free(window);
+}
+
+bool ZWOtaInflater::begin()
+{
+    decomp = malloc(sizeof(tinfl_decompressor));
+    window = (uint8_t *)malloc(OTA_DEFLATE_WINDOW);
+    if (!decomp || !window)
+    {
+        auto heap = zwHeapStats();
+        return fail("inflater allocation failed (free %u, largest block %u)", heap.free, heap.largestBlock);
+    }
+
+    tinfl_init((tinfl_decompressor *)decomp);
+    status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    return true;
+}
+
+bool ZWOtaInflater::write(const uint8_t *data, size_t len)
+{
+    if (failed)
+        return false;
+
+    // window is a ring (tinfl's "wrapping" mode): everything decoded into it is passed on
+    // straight away, and it only has to keep the last OTA_DEFLATE_WINDOW bytes for back-references
+    while (len || status == TINFL_STATUS_HAS_MORE_OUTPUT)
+    {
+        if (status == TINFL_STATUS_DONE)
+            return fail("%u bytes past the end of the compressed stream", len);
+
+        size_t inBytes = len;
+        size_t outBytes = OTA_DEFLATE_WINDOW - windowPos;
+        status = tinfl_decompress((tinfl_decompressor *)decomp, data, &inBytes,
+                                  window, window + windowPos, &outBytes, TINFL_FLAG_HAS_MORE_INPUT);
+        data += inBytes;
+        len -= inBytes;
+
+        if (status < TINFL_STATUS_DONE)
+            return fail("inflate failed: %d", status);
+
+        if (outBytes && !next.write(window + windowPos, outBytes))
+            return fail("%s", next.error());
+
+        windowPos = (windowPos + outBytes) & (OTA_DEFLATE_WINDOW - 1);
+    }
+
+    return true;
+}
+
+bool ZWOtaInflater::finish()
+{
+    if (!failed && status != TINFL_STATUS_DONE)
+        return fail("compressed stream ended early");
+    return !failed;
+}
+
+static uint32_t __le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool ZWOtaPatcher::begin(size_t imageSize)
+{
+    base = esp_ota_get_running_partition();
+    block = (uint8_t *)malloc(OTA_DELTA_BLOCK);
+    if (!base || !block)
+        return fail("patcher setup failed");
+
+    targetSize = imageSize;
+    return true;
+}
+
+bool ZWOtaPatcher::parseHeader()
+{
+    if (memcmp(field, OTA_DELTA_MAGIC, 4))
+        return fail("not a delta image");
+
+    baseSize = __le32(field + 4);
+    if (__le32(field + 8) != targetSize)
+        return fail("delta produces %u bytes, expected %u", __le32(field + 8), targetSize);
+
+    char baseMd5[33];
+    for (int i = 0; i < 16; i++)
+        snprintf(baseMd5 + i * 2, 3, "%02x", field[12 + i]);
+
+    if (baseSize != ESP.getSketchSize() || strcasecmp(baseMd5, ESP.getSketchMD5().c_str()))
+        return fail("delta base %s doesn't match the running image", baseMd5);
+
+    state = CONTROL;
+    return true;
+}
+
+bool ZWOtaPatcher::parseControl()
+{
+    addLeft = __le32(field);
+    copyLeft = __le32(field + 4);
+    seek = (int32_t)__le32(field + 8);
+
+    if (produced + addLeft + copyLeft > targetSize || basePos + addLeft > baseSize)
+        return fail("bad delta record at %u", produced);
+
+    state = ADD;
+    return advance();
+}
+
+// moves past any finished part of the current record
+bool ZWOtaPatcher::advance()
+{
+    if (state == ADD && !addLeft)
+        state = COPY;
+
+    if (state == COPY && !copyLeft)
+    {
+        auto newPos = (int64_t)basePos + seek;
+        if (newPos < 0 || newPos > (int64_t)baseSize)
+            return fail("bad delta seek at %u", produced);
+
+        basePos = newPos;
+        state = produced == targetSize ? DONE : CONTROL;
+    }
+
+    return true;
+}
+
+bool ZWOtaPatcher::write(const uint8_t *data, size_t len)
+{
+    while (len && !failed)
+    {
+        size_t take;
+
+        switch (state)
+        {
+        case HEADER:
+        case CONTROL:
+        {
+            auto fieldSize = state == HEADER ? OTA_DELTA_HEADER_SIZE : OTA_DELTA_CONTROL_SIZE;
+            take = min(len, (size_t)(fieldSize - fieldFill));
+            memcpy(field + fieldFill, data, take);
+            fieldFill += take;
+
+            if (fieldFill == fieldSize)
             {
-                zlog("UPDATE couldn't start: %d\n", Update.getError());
-                Update.abort();
+                fieldFill = 0;
+                if (!(state == HEADER ? parseHeader() : parseControl()))
+                    return false;
             }
+            break;
+        }
+
+        case ADD:
+            take = min(len, min(addLeft, (size_t)OTA_DELTA_BLOCK));
+            if (esp_partition_read(base, basePos, block, take) != ESP_OK)
+                return fail("base read at %u failed", basePos);
+
+            for (size_t i = 0; i < take; i++)
+                block[i] += data[i];
+
+            if (!next.write(block, take))
+                return fail("%s", next.error());
+
+            basePos += take;
+            addLeft -= take;
+            produced += take;
+            advance();
+            break;
+
+        case COPY:
+            take = min(len, copyLeft);
+            if (!next.write(data, take))
+                return fail("%s", next.error());
+
+            copyLeft -= take;
+            produced += take;
+            advance();
+            break;
+
+        default:
+            return fail("%u bytes past the end of the delta", len);
         }
-        else
+
+        data += take;
+        len -= take;
+    }
+
+    return !failed;
+}
+
+bool ZWOtaPatcher::finish()
+{
+    if (!failed && state != DONE)
+        return fail("delta ended early (%u of %u bytes)", produced, targetSize);
+    return !failed;
+}
+
+// Between the source and the first stage: reports progress, and counts the time
+// between the source's writes as time it spent waiting on the network.
+class ZWOtaSourceSink : public ZWOtaSink
+{
+protected:
+    ZWOtaSink &next;
+    ZWOtaWriter &writer;
+    unsigned long lastReturn;
+
+public:
+    size_t received = 0;
+
+    ZWOtaSourceSink(ZWOtaSink &next, ZWOtaWriter &writer) : next(next), writer(writer), lastReturn(millis()) {}
+
+    bool write(const uint8_t *data, size_t len) override
+    {
+        writer.addNetWait(millis() - lastReturn);
+        auto ok = next.write(data, len);
+        lastReturn = millis();
+
+        if (!ok)
+            return fail("%s", next.error());
+
+        received += len;
+        updateProg(writer.progress());
+        return true;
+    }
+};
+
+#define OTA_READ_BUFLEN 1460
+
+static bool __httpFetch(const char *url, size_t offset, size_t size, ZWOtaSink &sink)
+{
+    HTTPClient http;
+
+    if (!http.begin(url))
+    {
+        snprintf(__otaLastError, OTA_ERROR_MAX, "HTTPClient.begin() failed");
+        return false;
+    }
+
+    if (offset)
+    {
+        char range[24];
+        snprintf(range, sizeof(range), "bytes=%u-%u", offset, size - 1);
+        http.addHeader("Range", range);
+    }
+
+    auto code = http.GET();
+    if (code != HTTP_CODE_OK && !(offset && code == HTTP_CODE_PARTIAL_CONTENT))
+    {
+        snprintf(__otaLastError, OTA_ERROR_MAX, "HTTP GET returned %d", code);
+        http.end();
+        return false;
+    }
+
+    auto stream = http.getStreamPtr();
+    uint8_t buf[OTA_READ_BUFLEN];
+    // a server that ignores Range sends it all, so the part already written is skipped
+    size_t received = code == HTTP_CODE_OK ? 0 : offset;
+
+    while (received < size)
+    {
+        auto waitStart = millis();
+        int avail;
+        while (!(avail = stream->available()) && stream->connected() &&
+               millis() - waitStart < OTA_STALL_TIMEOUT_MS)
+            delay(1);
+
+        if (!avail)
         {
-            zlog("HTTPClient.get() failed: %d\n", code);
+            snprintf(__otaLastError, OTA_ERROR_MAX, "download %s at %u of %u bytes",
+                     stream->connected() ? "stalled" : "dropped", received, size);
+            break;
         }
+
+        auto got = stream->read(buf, min((size_t)avail, min(sizeof(buf), size - received)));
+        if (got <= 0)
+            break;
+
+        auto skip = received < offset ? min((size_t)got, offset - received) : 0;
+        if (got > skip && !sink.write(buf + skip, got - skip))
+            break;
+
+        received += got;
     }
-    else
+
+    http.end();
+    return received == size;
+}
+
+bool runUpdate(
+    const ZWOtaRequest &request,
+    void (*preUpdateIRQDisable)(),
+    bool (*completedCallback)(const ZWOtaProgress &progress, size_t transferred))
+{
+    __otaLastError[0] = '\0';
+
+    // source -> [inflater ->] [patcher ->] writer
+    ZWOtaWriter writer;
+    ZWOtaPatcher patcher(writer);
+    ZWOtaSink *decoded = &writer;
+    // only raw images can resume: the decoders' state isn't checkpointed
+    auto resumable = request.encoding == ZWOTA_RAW;
+    auto ready = writer.begin(request.size, resumable ? request.md5 : nullptr);
+
+    if (ready && request.encoding == ZWOTA_DEFLATE_DELTA)
+    {
+        ready = patcher.begin(request.size);
+        decoded = &patcher;
+    }
+
+    ZWOtaInflater inflater(*decoded);
+    ZWOtaSink *first = decoded;
+
+    if (ready && request.encoding != ZWOTA_RAW)
+    {
+        ready = inflater.begin();
+        first = &inflater;
+    }
+
+    ZWOtaSourceSink source(*first, writer);
+
+    if (ready)
     {
-        zlog("HTTPClient.begin() failed\n");
+        if (preUpdateIRQDisable)
+            preUpdateIRQDisable();
+
+        dprint("OTA start szb=%d transfer=%d\n", request.size, request.transferSize);
+        auto fetch = request.fetch ? request.fetch : __httpFetch;
+        auto fetched = false;
+
+        source.received = writer.resumedFrom();
+        if (source.received)
+            zlog("Resuming OTA at %u of %u bytes\n", source.received, request.transferSize);
+
+        for (int attempt = 1; !fetched; attempt++)
+        {
+            fetched = fetch(request.url, source.received, request.transferSize, source) &&
+                      source.received == request.transferSize;
+
+            // a failure past the source (flash, decoding) won't go away by fetching again
+            if (fetched || !resumable || source.hasFailed() || attempt == OTA_FETCH_ATTEMPTS)
+                break;
+
+            zlog("WARNING: OTA fetch interrupted at %u of %u bytes (%s); retrying\n",
+                 source.received, request.transferSize, __otaLastError[0] ? __otaLastError : "fetch failed");
+            __otaLastError[0] = '\0';
+            delay(OTA_FETCH_RETRY_DELAY_MS);
+        }
+
+        if (fetched &&
+            (first == decoded || inflater.finish()) &&
+            (decoded == &writer || patcher.finish()) &&
+            writer.finish(request.md5))
+        {
+            auto p = writer.progress();
+            updateProg(p);
+
+            if (request.encoding != ZWOTA_RAW)
+                zlog("OTA transferred %u bytes for a %u-byte image (%0.1f%%)\n",
+                     source.received, p.written, (source.received * 100.0) / p.written);
+
+            if (completedCallback && !completedCallback(p, source.received))
+            {
+                zlog("WARNING: unable to delete update key!\n");
+            }
+
+            if (writer.activate())
+                return true;
+        }
     }
 
+    // each stage's error, if it has one, carries those of the stages after it
+    if (!__otaLastError[0])
+        snprintf(__otaLastError, OTA_ERROR_MAX, "%s",
+                 inflater.hasFailed()  ? inflater.error()
+                 : patcher.hasFailed() ? patcher.error()
+                 : writer.hasFailed()  ? writer.error()
+                 : source.hasFailed()  ? source.error()
+                                       : "fetch failed");
+    zlog("UPDATE FAILED: %s\n", __otaLastError);
     return false;
-}
\ No newline at end of file
+}
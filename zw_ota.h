@@ -2,15 +2,258 @@
 #define __ZW_OTA__H__
 
 #include "zw_provision.h"
+#include <freertos/FreeRTOS.h>
+#include <esp_partition.h>
+#include <mbedtls/md5.h>
 
 #define OTA_RESET_DELAY 5
 #define OTA_UPDATE_PRCNT_REPORT 10
 
+// Downloading and flashing overlap: the source fills one sector-sized chunk while
+// the writer task flashes the other, erasing up to OTA_ERASE_AHEAD_SECTORS past its
+// write cursor whenever it would otherwise be waiting for data.
+#define OTA_CHUNK_SIZE 4096
+#define OTA_CHUNK_COUNT 2
+#define OTA_ERASE_AHEAD_SECTORS 8
+#define OTA_WRITER_STACK 4096
+#define OTA_WRITER_PRIORITY 2
+#define OTA_STALL_TIMEOUT_MS 20000
+#define OTA_ERROR_MAX 96
+
+// Raw images checkpoint their progress (bytes flashed and the MD5 state) to NVS every
+// OTA_CHECKPOINT_INTERVAL bytes, so an interrupted download resumes with an HTTP Range
+// request (or a later GETRANGE) rather than from the start, even after a reboot.
+#define OTA_CHECKPOINT_INTERVAL (64 * 1024)
+#define OTA_CHECKPOINT_NVS_KEY "otaresume"
+#define OTA_CHECKPOINT_MAGIC 0x5A57524D
+#define OTA_FETCH_ATTEMPTS 4
+#define OTA_FETCH_RETRY_DELAY_MS 2000
+
+// Compressed images are raw deflate streams (no zlib header) made with at most this
+// window, so decoding needs only a window-sized ring rather than deflate's usual 32KB.
+#define OTA_DEFLATE_WINDOW_BITS 12
+#define OTA_DEFLATE_WINDOW (1 << OTA_DEFLATE_WINDOW_BITS)
+
+// Delta images are made by tools/zw-delta.cpp against a previous release and applied
+// while streaming, reading the running image OTA_DELTA_BLOCK bytes at a time.
+#define OTA_DELTA_MAGIC "ZWD1"
+#define OTA_DELTA_HEADER_SIZE 28
+#define OTA_DELTA_CONTROL_SIZE 12
+#define OTA_DELTA_BLOCK 1024
+
+enum ZWOtaEncoding
+{
+    ZWOTA_RAW,
+    ZWOTA_DEFLATE,
+    // a deflated delta against the running image
+    ZWOTA_DEFLATE_DELTA
+};
+
+class ZWOtaSink;
+
+// Streams bytes offset through size of the image at url to sink, returning false on
+// failure; for transports other than zw_ota's own HTTP (see ZWRedis::streamRange()).
+typedef bool (*ZWOtaFetcher)(const char *url, size_t offset, size_t size, ZWOtaSink &sink);
+
+struct ZWOtaRequest
+{
+    // a key, for fetchers that read from Redis
+    const char *url;
+    // of the image as flashed, whatever the encoding
+    const char *md5;
+    size_t size;
+    ZWOtaEncoding encoding;
+    // bytes fetched from url: size, unless encoded
+    size_t transferSize;
+    // NULL to fetch url over HTTP
+    ZWOtaFetcher fetch;
+};
+
+struct ZWOtaProgress
+{
+    size_t written;
+    size_t total;
+    unsigned long elapsedMs;
+    float kbps;
+    // time the source spent waiting on the network, and waiting for the writer to free a chunk
+    unsigned long netWaitMs;
+    unsigned long flashWaitMs;
+};
+
+void updateProg(const ZWOtaProgress &progress);
+
+// Anything a source's bytes are written to: the writer itself, or a decoder in front of it.
+class ZWOtaSink
+{
+protected:
+    volatile bool failed = false;
+    char lastError[OTA_ERROR_MAX];
+
+    bool fail(const char *format, ...);
+
+public:
+    ZWOtaSink() { lastError[0] = '\0'; }
+    virtual ~ZWOtaSink() {}
+
+    virtual bool write(const uint8_t *data, size_t len) = 0;
+
+    bool hasFailed() { return failed; }
+    const char *error() { return lastError; }
+};
+
+// Writes an image into the next OTA partition; see the OTA_CHUNK_* comment above.
+// Not reusable: one instance per update.
+class ZWOtaWriter : public ZWOtaSink
+{
+protected:
+    struct Chunk
+    {
+        int index;
+        size_t length; // 0 tells the writer task to stop
+    };
+
+    const esp_partition_t *partition = nullptr;
+    size_t imageSize = 0;
+    uint8_t *chunks[OTA_CHUNK_COUNT] = {nullptr};
+    char checkpointMd5[33] = {0};
+    size_t resumed = 0;
+    QueueHandle_t freeChunks = nullptr;
+    QueueHandle_t fullChunks = nullptr;
+    SemaphoreHandle_t writerDone = nullptr;
+    bool writerRunning = false;
+
+    int current = -1;
+    size_t currentFill = 0;
+    size_t submitted = 0;
+
+    // owned by the writer task until writerDone is given
+    volatile size_t flashed = 0;
+    size_t erasedTo = 0;
+    mbedtls_md5_context md5;
+
+    unsigned long started = 0;
+    unsigned long netWaitMs = 0;
+    unsigned long flashWaitMs = 0;
+
+    static void writerTask(void *arg);
+    void writerLoop();
+    bool eraseThrough(size_t offset);
+    bool submit();
+    bool stopWriter();
+    void saveCheckpoint();
+    void clearCheckpoint();
+
+public:
+    ZWOtaWriter() {}
+    ~ZWOtaWriter() { abort(); }
+
+    ZWOtaWriter(const ZWOtaWriter &) = delete;
+    ZWOtaWriter &operator=(const ZWOtaWriter &) = delete;
+
+    // with md5Hex set, progress is checkpointed and an earlier checkpoint of the same
+    // image is resumed: resumedFrom() says where the source should start
+    bool begin(size_t size, const char *md5Hex = nullptr);
+    size_t resumedFrom() { return resumed; }
+
+    // copies into the current chunk, handing it to the writer task once full
+    bool write(const uint8_t *data, size_t len) override;
+
+    // flushes the last chunk, waits for the writer and checks the size and MD5 (hex)
+    bool finish(const char *md5Hex);
+
+    // makes the verified image the one booted next
+    bool activate();
+
+    void abort();
+
+    // for sources to account their own waiting in progress()
+    void addNetWait(unsigned long ms) { netWaitMs += ms; }
+
+    ZWOtaProgress progress();
+};
+
+// Inflates a ZWOTA_DEFLATE image into the next sink, using the ROM's tinfl.
+class ZWOtaInflater : public ZWOtaSink
+{
+protected:
+    ZWOtaSink &next;
+    void *decomp = nullptr;
+    uint8_t *window = nullptr;
+    size_t windowPos = 0;
+    int status;
+
+public:
+    ZWOtaInflater(ZWOtaSink &next) : next(next) {}
+    ~ZWOtaInflater();
+
+    ZWOtaInflater(const ZWOtaInflater &) = delete;
+    ZWOtaInflater &operator=(const ZWOtaInflater &) = delete;
+
+    bool begin();
+    bool write(const uint8_t *data, size_t len) override;
+
+    // true once the whole stream has been decoded
+    bool finish();
+};
+
+// Applies a zw-delta patch against the running image, writing the result to the next sink.
+class ZWOtaPatcher : public ZWOtaSink
+{
+protected:
+    enum State
+    {
+        HEADER,
+        CONTROL,
+        ADD,
+        COPY,
+        DONE
+    };
+
+    ZWOtaSink &next;
+    const esp_partition_t *base = nullptr;
+    uint8_t *block = nullptr;
+    State state = HEADER;
+
+    // the header or control record being assembled
+    uint8_t field[OTA_DELTA_HEADER_SIZE];
+    size_t fieldFill = 0;
+
+    size_t baseSize = 0;
+    size_t targetSize = 0;
+    size_t produced = 0;
+    size_t basePos = 0;
+    size_t addLeft = 0;
+    size_t copyLeft = 0;
+    int32_t seek = 0;
+
+    bool parseHeader();
+    bool parseControl();
+    bool advance();
+
+public:
+    ZWOtaPatcher(ZWOtaSink &next) : next(next) {}
+    ~ZWOtaPatcher() { free(block); }
+
+    ZWOtaPatcher(const ZWOtaPatcher &) = delete;
+    ZWOtaPatcher &operator=(const ZWOtaPatcher &) = delete;
+
+    bool begin(size_t imageSize);
+    bool write(const uint8_t *data, size_t len) override;
+
+    // true once the whole target image has been produced
+    bool finish();
+};
+
+// completedCallback is given the verified image's final progress and the bytes fetched for it
 bool runUpdate(
-    const char *url, 
-    const char *md5, 
-    size_t sizeInBytes,
+    const ZWOtaRequest &request,
     void (*preUpdateIRQDisable)(),
-    bool (*completedCallback)());
+    bool (*completedCallback)(const ZWOtaProgress &progress, size_t transferred));
+
+// why the last runUpdate() failed
+const char *otaLastError();
+
+// true if a raw update of this image was interrupted and can be resumed
+bool otaCanResume(const char *md5, size_t size);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,150 @@
+#include "zw_power.h"
+#include "zw_common.h"
+
+static ZWPowerReading __reading = {};
+// kept over deep sleep, so each wake adds to the last's
+RTC_DATA_ATTR static ZWPowerStats __stats = {};
+static ZWPowerPhase __phase = ZWP_IDLE;
+static unsigned long __phaseSinceUs = 0;
+// each phase's time since the last sample, to split its energy by
+static unsigned long __phaseUs[ZWP_PHASE_COUNT] = {0};
+static unsigned long __lastSampleUs = 0;
+static bool __sampled = false;
+static uint64_t __refreshStartUj = 0;
+// the network bring-up switches phases from its own task
+static portMUX_TYPE __powerMux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *__phaseNames[ZWP_PHASE_COUNT] = {
+    "idle",
+    "wifi",
+    "redis",
+    "render"};
+
+static void __closePhase(unsigned long now)
+{
+    __phaseUs[__phase] += now - __phaseSinceUs;
+    __stats.phaseUs[__phase] += now - __phaseSinceUs;
+    __phaseSinceUs = now;
+}
+
+static uint64_t __totalUj()
+{
+    uint64_t total = 0;
+    for (auto uj : __stats.phaseUj)
+        total += uj;
+    return total;
+}
+
+const ZWPowerReading &zwPowerSample(bool force)
+{
+#if M5STACKC
+    auto now = micros();
+    auto interval = (__phase == ZWP_IDLE ? ZWPOWER_IDLE_INTERVAL_MS : ZWPOWER_ACTIVE_INTERVAL_MS) * 1000UL;
+    if (!force && __sampled && now - __lastSampleUs < interval)
+        return __reading;
+
+    auto lastMw = __reading.drawMw;
+    __reading.vbat = M5.Axp.GetVbatData() * 1.1 / 1000;
+    __reading.chargeMa = M5.Axp.GetIchargeData() / 2.0;
+    __reading.dischargeMa = M5.Axp.GetIdischargeData() / 2.0;
+    __reading.vbus = M5.Axp.GetVusbinData() * 1.7 / 1000;
+    __reading.busMa = M5.Axp.GetIusbinData() * 0.375;
+    __reading.tempC = -144.7 + M5.Axp.GetTempData() * 0.1;
+    __reading.lowBattery = M5.Axp.GetWarningLeve() != 0;
+    // on USB, whatever goes into the battery isn't the unit's
+    __reading.drawMw = max(0.0f, __reading.vbat * (__reading.dischargeMa - __reading.chargeMa) +
+                                     __reading.vbus * __reading.busMa);
+
+    portENTER_CRITICAL(&__powerMux);
+    __closePhase(now);
+    unsigned long phasesUs = 0;
+    for (auto us : __phaseUs)
+        phasesUs += us;
+
+    // the first sample stands in for everything since boot, network bring-up included
+    if (!__sampled)
+        lastMw = __reading.drawMw;
+
+    // mW * ms = uJ
+    auto intervalUj = (lastMw + __reading.drawMw) / 2 * (phasesUs / 1000.0);
+    for (int i = 0; phasesUs && i < ZWP_PHASE_COUNT; i++)
+        __stats.phaseUj[i] += (uint64_t)(intervalUj * __phaseUs[i] / phasesUs);
+
+    bzero(__phaseUs, sizeof(__phaseUs));
+    __lastSampleUs = now;
+    __sampled = true;
+    ++__stats.samples;
+    portEXIT_CRITICAL(&__powerMux);
+#endif
+    return __reading;
+}
+
+ZWPowerPhase zwPowerEnter(ZWPowerPhase phase, bool sample)
+{
+    portENTER_CRITICAL(&__powerMux);
+    auto previous = __phase;
+    if (phase != previous)
+    {
+        __closePhase(micros());
+        __phase = phase;
+    }
+    portEXIT_CRITICAL(&__powerMux);
+
+    if (phase != previous && sample)
+        zwPowerSample();
+    return previous;
+}
+
+void zwPowerRefreshStart()
+{
+    zwPowerSample(true);
+    portENTER_CRITICAL(&__powerMux);
+    __refreshStartUj = __totalUj();
+    portEXIT_CRITICAL(&__powerMux);
+}
+
+void zwPowerRefreshEnd()
+{
+    zwPowerSample(true);
+    portENTER_CRITICAL(&__powerMux);
+    __stats.lastRefreshUj = (uint32_t)(__totalUj() - __refreshStartUj);
+    __stats.refreshUj += __stats.lastRefreshUj;
+    ++__stats.refreshes;
+    portEXIT_CRITICAL(&__powerMux);
+}
+
+ZWPowerStats zwPowerStats()
+{
+    portENTER_CRITICAL(&__powerMux);
+    auto stats = __stats;
+    portEXIT_CRITICAL(&__powerMux);
+    return stats;
+}
+
+float zwPowerAverageMw()
+{
+    auto stats = zwPowerStats();
+    uint64_t us = 0, uj = 0;
+    for (int i = 0; i < ZWP_PHASE_COUNT; i++)
+    {
+        us += stats.phaseUs[i];
+        uj += stats.phaseUj[i];
+    }
+    return us ? (float)uj / (us / 1000.0) : 0.0;
+}
+
+int zwPowerAsJson(char *buf, size_t bufLen)
+{
+    auto stats = zwPowerStats();
+    int wrote = 0;
+    APPEND("{ \"mV\": %d, \"mW\": %.1f, \"avgMw\": %.1f, \"chargeMa\": %.1f, \"dischargeMa\": %.1f, \"busMa\": %.1f, "
+           "\"samples\": %u, \"refreshes\": %u, \"refreshMj\": %.3f, \"lastRefreshMj\": %.3f, \"phases\": {",
+           (int)(__reading.vbat * 1000), __reading.drawMw, zwPowerAverageMw(), __reading.chargeMa,
+           __reading.dischargeMa, __reading.busMa, stats.samples, stats.refreshes,
+           stats.refreshes ? stats.refreshUj / 1000.0 / stats.refreshes : 0.0, stats.lastRefreshUj / 1000.0);
+    for (int i = 0; i < ZWP_PHASE_COUNT; i++)
+        APPEND("%s \"%s\": { \"mJ\": %.3f, \"ms\": %llu }", i ? "," : "", __phaseNames[i],
+               stats.phaseUj[i] / 1000.0, (unsigned long long)(stats.phaseUs[i] / 1000));
+    APPEND(" } }");
+    return wrote;
+}
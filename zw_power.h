@@ -0,0 +1,87 @@
+#ifndef __ZW_POWER__H__
+#define __ZW_POWER__H__
+
+#include <Arduino.h>
+
+// Energy accounting from the M5StickC's AXP192, so refresh and deep-sleep settings can be
+// tuned by what they cost. Each sample reads the battery and USB voltages and currents and
+// integrates the unit's draw (trapezoidally) since the last one, splitting it between the
+// phases that ran in between by their time. Samples are taken often while a refresh is
+// under way and once a second otherwise, which the battery display's repaint asks for anyway.
+// TM1637 units have no power management chip, so only the phases' times are kept.
+//
+// the AXP192's ADCs update at 25Hz, so reading them any faster only repeats a sample
+#define ZWPOWER_ACTIVE_INTERVAL_MS 40
+#define ZWPOWER_IDLE_INTERVAL_MS 1000
+
+enum ZWPowerPhase
+{
+    ZWP_IDLE = 0,
+    ZWP_WIFI,
+    ZWP_REDIS,
+    ZWP_RENDER,
+    ZWP_PHASE_COUNT
+};
+
+struct ZWPowerReading
+{
+    float vbat;
+    float vbus;
+    // battery charge and discharge, USB input; mA
+    float chargeMa;
+    float dischargeMa;
+    float busMa;
+    float tempC;
+    // the whole unit's, from whichever of the battery and USB is supplying it
+    float drawMw;
+    bool lowBattery;
+};
+
+struct ZWPowerStats
+{
+    uint32_t samples;
+    uint64_t phaseUj[ZWP_PHASE_COUNT];
+    uint64_t phaseUs[ZWP_PHASE_COUNT];
+    uint32_t refreshes;
+    uint64_t refreshUj;
+    uint32_t lastRefreshUj;
+};
+
+// samples the AXP192 if one is due (or force), returning the latest reading
+const ZWPowerReading &zwPowerSample(bool force = false);
+
+// switches the phase that time (and so energy) is attributed to, returning the previous one;
+// sample as for zwPowerSample() on the way, which other tasks mustn't (the I2C bus isn't theirs)
+ZWPowerPhase zwPowerEnter(ZWPowerPhase phase, bool sample = true);
+
+// bracket a refresh, for its energy
+void zwPowerRefreshStart();
+void zwPowerRefreshEnd();
+
+// a copy, as the network bring-up's task may be updating them; they're kept over deep
+// sleep, so in that mode they add up every wake since the last reset (but not the sleeps)
+ZWPowerStats zwPowerStats();
+
+// average draw since boot, while awake
+float zwPowerAverageMw();
+
+// "{ "mV": .., "mW": .., "avgMw": .., "refreshMj": .., "lastRefreshMj": .., "phases": { "idle": { "mJ": .., "ms": .. }, .. } }"
+int zwPowerAsJson(char *buf, size_t bufLen);
+
+// Attributes time in scope to the given phase. Scopes nest; the phase is global, so an
+// overlapping scope on another task (the network bring-up) takes over until it ends.
+class ZWPowerScope
+{
+protected:
+    ZWPowerPhase previous;
+    bool sample;
+
+public:
+    ZWPowerScope(ZWPowerPhase phase, bool sampled = true) : previous(zwPowerEnter(phase, sampled)), sample(sampled) {}
+    ~ZWPowerScope() { zwPowerEnter(previous, sample); }
+
+    ZWPowerScope(const ZWPowerScope &) = delete;
+    ZWPowerScope &operator=(const ZWPowerScope &) = delete;
+};
+
+#endif
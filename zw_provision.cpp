@@ -4,6 +4,7 @@
 #include "zw_redis.h"
 
 #include <WiFi.h>
+#include <nvs.h>
 
 char *EEPROMCFG_WiFiSSID = NULL;
 char *EEPROMCFG_WiFiPass = NULL;
@@ -12,103 +13,240 @@ char *EEPROMCFG_RedisPass = NULL;
 char *EEPROMCFG_OTAHost = NULL;
 uint16_t EEPROMCFG_RedisPort = 0;
 String gHostname;
-char __hnShadowBuf[ZW_EEPROM_SIZE];
+
+// The blob: this header, then CFG_STRINGS NUL-terminated strings in ZWProvString
+// order. The CRC covers everything after the header.
+struct ZWProvBlobHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;
+    uint32_t crc;
+    uint16_t redisPort;
+    uint16_t reserved;
+};
+
+enum ZWProvString
+{
+    PROV_HOSTNAME = 0,
+    PROV_WIFI_SSID,
+    PROV_WIFI_PASS,
+    PROV_REDIS_HOST,
+    PROV_REDIS_PASS,
+    PROV_OTA_HOST,
+    CFG_STRINGS
+};
+
+// the only provisioning allocation, kept for the life of the process
+static uint8_t *__provBlob = NULL;
 
 void __debugClearEEPROM()
 {
     dprint("__debugClearEEPROM()\n");
+    nvs_handle handle;
+    if (nvs_open(ZWPROV_NVS_NAMESPACE, NVS_READWRITE, &handle) == ESP_OK)
+    {
+        nvs_erase_key(handle, ZWPROV_NVS_KEY);
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+
     // not the quickest, but the most memory-efficient, algorithm
+    EEPROM.begin(EEPROM_SIZE);
     for (int i = 0; i < EEPROM_SIZE; i++)
         EEPROM.write(i, 0);
     EEPROM.commit();
+    EEPROM.end();
 }
 
-void EEPROM_setup()
+static uint32_t __blobCrc(const uint8_t *blob, size_t length)
 {
-    EEPROM.begin(EEPROM_SIZE);
+    return zwCrc32(blob + sizeof(ZWProvBlobHeader), length - sizeof(ZWProvBlobHeader));
 }
 
-#define CFG_ELEMENTS 6
-#define CFG_HEADER_SIZE (CFG_ELEMENTS * sizeof(uint16_t))
-
-void CFG_EEPROM_read()
+// lengths exclude the NULs the blob adds
+static bool __writeBlob(const char *strings[CFG_STRINGS], const size_t lengths[CFG_STRINGS], uint16_t redisPort)
 {
-    uint16_t lengths[CFG_ELEMENTS];
-    dprint("CFG_EEPROM_read: reading %d for lengths\n", CFG_HEADER_SIZE);
-    zwassert(EEPROM.readBytes(CFG_EEPROM_ADDR, lengths, CFG_HEADER_SIZE) == CFG_HEADER_SIZE);
+    size_t length = sizeof(ZWProvBlobHeader);
+    for (int i = 0; i < CFG_STRINGS; i++)
+        length += lengths[i] + 1;
 
-    String lengthsStr = "";
-    for (int i = 0; i < CFG_ELEMENTS; i++)
+    if (length > ZWPROV_BLOB_MAX)
     {
-        lengthsStr += String(lengths[i]) + " ";
+        dprint("*** ZeroWatch provisioning ERROR: %d bytes exceeds ZWPROV_BLOB_MAX\n", length);
+        return false;
     }
-    dprint("CFG_EEPROM_read: LENGTHS: %s\n", lengthsStr.c_str());
-
-    EEPROMCFG_WiFiSSID = (char *)malloc(lengths[0] + 1);
-    bzero(EEPROMCFG_WiFiSSID, lengths[0] + 1);
-    auto offset = CFG_EEPROM_ADDR + CFG_HEADER_SIZE;
-    zwassert(EEPROM.readBytes(offset, EEPROMCFG_WiFiSSID, lengths[0]) == lengths[0]);
-    offset += lengths[0];
-    dprint("CFG_EEPROM_read: WIFI SSID: %s\n", EEPROMCFG_WiFiSSID);
-
-    EEPROMCFG_WiFiPass = (char *)malloc(lengths[1] + 1);
-    bzero(EEPROMCFG_WiFiPass, lengths[1] + 1);
-    zwassert(EEPROM.readBytes(offset, EEPROMCFG_WiFiPass, lengths[1]) == lengths[1]);
-    offset += lengths[1];
-    dprint("CFG_EEPROM_read: WIFI PASS: %s\n", EEPROMCFG_WiFiPass);
-
-    EEPROMCFG_RedisHost = (char *)malloc(lengths[2] + 1);
-    bzero(EEPROMCFG_RedisHost, lengths[2] + 1);
-    zwassert(EEPROM.readBytes(offset, EEPROMCFG_RedisHost, lengths[2]) == lengths[2]);
-    offset += lengths[2];
-    dprint("CFG_EEPROM_read: REDIS IP: %s\n", EEPROMCFG_RedisHost);
-
-    zwassert(EEPROM.readBytes(offset, &EEPROMCFG_RedisPort, lengths[3]) == lengths[3]);
-    offset += lengths[3];
-    dprint("CFG_EEPROM_read: REDIS PORT: %d\n", EEPROMCFG_RedisPort);
-
-    EEPROMCFG_RedisPass = (char *)malloc(lengths[4] + 1);
-    bzero(EEPROMCFG_RedisPass, lengths[4] + 1);
-    zwassert(EEPROM.readBytes(offset, EEPROMCFG_RedisPass, lengths[4]) == lengths[4]);
-    offset += lengths[4];
-    dprint("CFG_EEPROM_read: REDIS PASS: %s\n", EEPROMCFG_RedisPass);
-
-    EEPROMCFG_OTAHost = (char *)malloc(lengths[5] + 1);
-    bzero(EEPROMCFG_OTAHost, lengths[5] + 1);
-    zwassert(EEPROM.readBytes(offset, EEPROMCFG_OTAHost, lengths[5]) == lengths[5]);
-    offset += lengths[5];
-    dprint("CFG_EEPROM_read: OTA HOST: %s\n", EEPROMCFG_OTAHost);
-}
 
-#define PSTRING_LENGTH_LIMIT (CFG_EEPROM_SIZE / 2)
+    uint8_t blob[ZWPROV_BLOB_MAX];
+    auto walk = blob + sizeof(ZWProvBlobHeader);
+    for (int i = 0; i < CFG_STRINGS; i++)
+    {
+        memcpy(walk, strings[i], lengths[i]);
+        walk[lengths[i]] = '\0';
+        walk += lengths[i] + 1;
+    }
+
+    auto header = (ZWProvBlobHeader *)blob;
+    header->magic = ZWPROV_BLOB_MAGIC;
+    header->version = ZWPROV_BLOB_VERSION;
+    header->length = length;
+    header->redisPort = redisPort;
+    header->reserved = 0;
+    header->crc = __blobCrc(blob, length);
+
+    nvs_handle handle;
+    if (nvs_open(ZWPROV_NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        return false;
 
-inline bool __provStrCheck(const char *str)
+    auto ok = nvs_set_blob(handle, ZWPROV_NVS_KEY, blob, length) == ESP_OK && nvs_commit(handle) == ESP_OK;
+    nvs_close(handle);
+    return ok;
+}
+
+// Reads and checks the blob into a new allocation, pointing strings into it.
+// NULL if absent; halts if present but corrupt, rather than booting with garbage,
+// unless !haltIfCorrupt (which returns NULL instead).
+static uint8_t *__loadBlob(size_t &length, char *strings[CFG_STRINGS], bool haltIfCorrupt)
 {
-    return str && strnlen(str, CFG_EEPROM_SIZE - CFG_HEADER_SIZE) <= PSTRING_LENGTH_LIMIT;
+    nvs_handle handle;
+    if (nvs_open(ZWPROV_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        return NULL;
+
+    length = 0;
+    auto err = nvs_get_blob(handle, ZWPROV_NVS_KEY, NULL, &length);
+    if (err != ESP_OK || length < sizeof(ZWProvBlobHeader) || length > ZWPROV_BLOB_MAX)
+    {
+        nvs_close(handle);
+        return NULL;
+    }
+
+    auto blob = (uint8_t *)malloc(length);
+    err = blob ? nvs_get_blob(handle, ZWPROV_NVS_KEY, blob, &length) : ESP_FAIL;
+    nvs_close(handle);
+
+    auto header = (ZWProvBlobHeader *)blob;
+    if (err != ESP_OK || header->magic != ZWPROV_BLOB_MAGIC || header->version != ZWPROV_BLOB_VERSION ||
+        header->length != length || header->crc != __blobCrc(blob, length) || blob[length - 1])
+    {
+        zlog("ERROR: provisioning blob is corrupt (err %d, %d bytes, version %d)\n",
+             err, length, header ? header->version : -1);
+        if (haltIfCorrupt)
+            __haltOrCatchFire();
+        free(blob);
+        return NULL;
+    }
+
+    auto walk = (char *)blob + sizeof(ZWProvBlobHeader);
+    for (int i = 0; i < CFG_STRINGS; i++)
+    {
+        // the CRC passed and the blob ends in a NUL, so running off the end means a bad writer
+        if (walk >= (char *)blob + length)
+        {
+            zlog("ERROR: provisioning blob has %d of %d strings\n", i, CFG_STRINGS);
+            if (haltIfCorrupt)
+                __haltOrCatchFire();
+            free(blob);
+            return NULL;
+        }
+        strings[i] = walk;
+        walk += strlen(walk) + 1;
+    }
+
+    return blob;
 }
 
-bool checkUnitProvisioning()
+// Reads the blob into its one allocation and points the EEPROMCFG_* globals into it.
+// false if absent; halts if present but corrupt.
+static bool __readBlob()
 {
-    auto eeHnLength = EEPROM.readBytes(ZW_EEPROM_HOSTNAME_ADDR, __hnShadowBuf, ZW_EEPROM_SIZE);
+    size_t length;
+    char *strings[CFG_STRINGS];
+    auto blob = __loadBlob(length, strings, true);
+    if (!blob)
+        return false;
+
+    free(__provBlob);
+    __provBlob = blob;
 
-    if (!eeHnLength || eeHnLength > ZW_EEPROM_SIZE)
+    gHostname = String(strings[PROV_HOSTNAME]);
+    EEPROMCFG_WiFiSSID = strings[PROV_WIFI_SSID];
+    EEPROMCFG_WiFiPass = strings[PROV_WIFI_PASS];
+    EEPROMCFG_RedisHost = strings[PROV_REDIS_HOST];
+    EEPROMCFG_RedisPass = strings[PROV_REDIS_PASS];
+    EEPROMCFG_OTAHost = strings[PROV_OTA_HOST];
+    EEPROMCFG_RedisPort = ((ZWProvBlobHeader *)blob)->redisPort;
+
+    dprint("Provisioning: %d-byte blob, hostname %s, SSID %s, Redis %s:%d, OTA %s\n", length,
+           gHostname.c_str(), EEPROMCFG_WiFiSSID, EEPROMCFG_RedisHost, EEPROMCFG_RedisPort, EEPROMCFG_OTAHost);
+    return true;
+}
+
+bool zwProvisionCheck()
+{
+    size_t length;
+    char *strings[CFG_STRINGS];
+    auto blob = __loadBlob(length, strings, false);
+    if (!blob)
         return false;
 
-    gHostname = String(__hnShadowBuf);
+    free(blob);
+    return true;
+}
 
-    // it's possible for eeHnLength to be valid while the hostname itself
-    // contains garbade data, in which case gHostname may have length
-    // larger than the allowed size
-    if (gHostname.length() > ZW_EEPROM_SIZE)
+#define CFG_ELEMENTS 6
+#define CFG_HEADER_SIZE (CFG_ELEMENTS * sizeof(uint16_t))
+#define PSTRING_LENGTH_LIMIT (CFG_EEPROM_SIZE / 2)
+
+// Converts the original EEPROM layout (hostname, then six length-prefixed fields)
+// into the blob. The EEPROM mirror only exists for the duration of this call.
+static bool __migrateLegacyEEPROM()
+{
+    if (!EEPROM.begin(EEPROM_SIZE))
         return false;
 
-    dprint("EEPROM HOSTNAME (%db, %db) %s\n", eeHnLength, gHostname.length(), gHostname.c_str());
+    auto data = EEPROM.getDataPtr();
+    uint16_t lengths[CFG_ELEMENTS];
+    memcpy(lengths, data + CFG_EEPROM_ADDR, CFG_HEADER_SIZE);
+
+    size_t total = 0;
+    for (int i = 0; i < CFG_ELEMENTS; i++)
+        total += lengths[i];
 
-    CFG_EEPROM_read();
+    bool ok = data[ZW_EEPROM_HOSTNAME_ADDR] && strnlen((char *)data, ZW_EEPROM_SIZE) < ZW_EEPROM_SIZE &&
+              lengths[3] == sizeof(uint16_t) && total <= CFG_EEPROM_SIZE - CFG_HEADER_SIZE;
+    for (int i = 0; ok && i < CFG_ELEMENTS; i++)
+        ok = lengths[i] <= PSTRING_LENGTH_LIMIT;
 
-    return __provStrCheck(EEPROMCFG_WiFiSSID) && __provStrCheck(EEPROMCFG_WiFiPass) &&
-           __provStrCheck(EEPROMCFG_RedisHost) && __provStrCheck(EEPROMCFG_RedisPass) &&
-           __provStrCheck(EEPROMCFG_OTAHost) && EEPROMCFG_RedisPort > 0;
+    if (ok)
+    {
+        const char *fields[CFG_ELEMENTS];
+        auto offset = CFG_EEPROM_ADDR + CFG_HEADER_SIZE;
+        for (int i = 0; i < CFG_ELEMENTS; i++)
+        {
+            fields[i] = (char *)data + offset;
+            offset += lengths[i];
+        }
+
+        uint16_t port;
+        memcpy(&port, fields[3], sizeof(port));
+        const char *strings[CFG_STRINGS] = {(char *)data, fields[0], fields[1], fields[2], fields[4], fields[5]};
+        const size_t stringLengths[CFG_STRINGS] = {strlen((char *)data), lengths[0], lengths[1], lengths[2],
+                                                   lengths[4], lengths[5]};
+        ok = port > 0 && __writeBlob(strings, stringLengths, port);
+        zlog("%s legacy EEPROM provisioning for '%s'\n", ok ? "Migrated" : "ERROR: failed to migrate", strings[0]);
+    }
+
+    EEPROM.end();
+    return ok;
+}
+
+bool checkUnitProvisioning()
+{
+    if (!__readBlob() && !(__migrateLegacyEEPROM() && __readBlob()))
+        return false;
+
+    return gHostname.length() && gHostname.length() < ZW_EEPROM_SIZE && *EEPROMCFG_WiFiSSID &&
+           *EEPROMCFG_RedisHost && EEPROMCFG_RedisPort > 0;
 }
 
 #if ZEROWATCH_PROVISIONING_MODE
@@ -122,74 +260,37 @@ void provisionUnit()
     dprint("\tRedis password: \t%s\n", ZWPROV_REDIS_PASSWORD);
     dprint("\tRedis port:     \t%u\n", ZWPROV_REDIS_PORT);
     dprint("\tOTA host:       \t%s\n", ZWPROV_OTA_HOST);
-    dprint("***** WILL COMMIT THESE VALUES TO EEPROM IN %d SECONDS.... *****\n", ZWPROV_MODE_WRITE_DELAY);
+    dprint("***** WILL COMMIT THESE VALUES TO NVS IN %d SECONDS.... *****\n", ZWPROV_MODE_WRITE_DELAY);
     delay(ZWPROV_MODE_WRITE_DELAY * 1000);
-    dprint("***** COMMITTING ABOVE VALUES TO EEPROM: *****\n");
-
-    auto hostname = String(ZWPROV_HOSTNAME);
-    zwassert(EEPROM.writeString(ZW_EEPROM_HOSTNAME_ADDR, hostname) == hostname.length());
-
-    uint16_t lengths[CFG_ELEMENTS];
-
-    auto _local_port = ZWPROV_REDIS_PORT;
-    lengths[0] = strlen(ZWPROV_WIFI_SSID);
-    lengths[1] = strlen(ZWPROV_WIFI_PASSWORD);
-    lengths[2] = strlen(ZWPROV_REDIS_HOST);
-    lengths[3] = sizeof(_local_port); // redis port, always 16 bits
-    lengths[4] = strlen(ZWPROV_REDIS_PASSWORD);
-    lengths[5] = strlen(ZWPROV_OTA_HOST);
-
-    dprint("*** ZeroWatch provisioning: lengths: ");
-    for (int i = 0; i < CFG_ELEMENTS; i++)
-    {
-        dprint("%d ", lengths[i]);
-    }
-    dprint("\n");
+    dprint("***** COMMITTING ABOVE VALUES TO NVS: *****\n");
 
-    auto writeLen = EEPROM.writeBytes(CFG_EEPROM_ADDR, lengths, CFG_HEADER_SIZE);
-    if (writeLen != CFG_HEADER_SIZE)
-    {
-        dprint("*** ZeroWatch provisioning ERROR: Config write (%d) failed\n", writeLen);
-        return;
-    }
-
-    auto offset = CFG_EEPROM_ADDR + CFG_HEADER_SIZE;
+    zwassert(strlen(ZWPROV_HOSTNAME) < ZW_EEPROM_SIZE);
 
-    void **ptrptrs = (void **)malloc(sizeof(void *) * CFG_ELEMENTS);
-    ptrptrs[0] = (void *)ZWPROV_WIFI_SSID;
-    ptrptrs[1] = (void *)ZWPROV_WIFI_PASSWORD;
-    ptrptrs[2] = (void *)ZWPROV_REDIS_HOST;
-    ptrptrs[3] = (void *)&_local_port;
-    ptrptrs[4] = (void *)ZWPROV_REDIS_PASSWORD;
-    ptrptrs[5] = (void *)ZWPROV_OTA_HOST;
+    const char *strings[CFG_STRINGS] = {
+        ZWPROV_HOSTNAME,
+        ZWPROV_WIFI_SSID,
+        ZWPROV_WIFI_PASSWORD,
+        ZWPROV_REDIS_HOST,
+        ZWPROV_REDIS_PASSWORD,
+        ZWPROV_OTA_HOST};
 
-    for (int i = 0; i < CFG_ELEMENTS; i++)
-    {
-        dprint("*** ZeroWatch provisioning: Writing %d bytes of element %d to address %d\n",
-               lengths[i], i, offset);
-        writeLen = EEPROM.writeBytes(offset, ptrptrs[i], lengths[i]);
-        if (writeLen != lengths[i])
-        {
-            dprint("*** ZeroWatch provisioning ERROR: element %d failed to write (%d != %d)\n", i, writeLen, lengths[i]);
-            return;
-        }
-        offset += lengths[i];
-    }
+    size_t lengths[CFG_STRINGS];
+    for (int i = 0; i < CFG_STRINGS; i++)
+        lengths[i] = strlen(strings[i]);
 
-    if (EEPROM.commit())
+    if (__writeBlob(strings, lengths, ZWPROV_REDIS_PORT))
     {
         dprint("*** ZeroWatch provisioning: Write complete, verifying data...\n");
 
         if (checkUnitProvisioning())
         {
-            auto hnVerify = EEPROM.readString(ZW_EEPROM_HOSTNAME_ADDR);
-            zwassert(!memcmp(ZWPROV_HOSTNAME, hnVerify.c_str(), strlen(ZWPROV_HOSTNAME)));
-            zwassert(!memcmp(ptrptrs[0], EEPROMCFG_WiFiSSID, lengths[0]));
-            zwassert(!memcmp(ptrptrs[1], EEPROMCFG_WiFiPass, lengths[1]));
-            zwassert(!memcmp(ptrptrs[2], EEPROMCFG_RedisHost, lengths[2]));
-            zwassert(!memcmp(ptrptrs[3], &EEPROMCFG_RedisPort, lengths[3]));
-            zwassert(!memcmp(ptrptrs[4], EEPROMCFG_RedisPass, lengths[4]));
-            zwassert(!memcmp(ptrptrs[5], EEPROMCFG_OTAHost, lengths[5]));
+            zwassert(gHostname.equals(ZWPROV_HOSTNAME));
+            zwassert(!strcmp(strings[PROV_WIFI_SSID], EEPROMCFG_WiFiSSID));
+            zwassert(!strcmp(strings[PROV_WIFI_PASS], EEPROMCFG_WiFiPass));
+            zwassert(!strcmp(strings[PROV_REDIS_HOST], EEPROMCFG_RedisHost));
+            zwassert(ZWPROV_REDIS_PORT == EEPROMCFG_RedisPort);
+            zwassert(!strcmp(strings[PROV_REDIS_PASS], EEPROMCFG_RedisPass));
+            zwassert(!strcmp(strings[PROV_OTA_HOST], EEPROMCFG_OTAHost));
 
             dprint("*** ZeroWatch provisioning: data verified correctly!\n");
 
@@ -197,7 +298,7 @@ void provisionUnit()
             dprint("*** ZeroWatch provisioning: starting functional check...\n");
 
             ZWAppConfig blankConfig;
-            if (!zwWiFiInit(hnVerify.c_str(), blankConfig))
+            if (!zwWiFiInit(gHostname.c_str(), blankConfig))
             {
                 dprint("*** ZeroWatch provisioning: WiFi check failed\n");
                 __haltOrCatchFire();
@@ -207,7 +308,7 @@ void provisionUnit()
                 .host = EEPROMCFG_RedisHost,
                 .port = EEPROMCFG_RedisPort,
                 .password = EEPROMCFG_RedisPass};
-            ZWRedis redisCheck(hnVerify, redisConfig);
+            ZWRedis redisCheck(gHostname, redisConfig);
 
             if (!redisCheck.connect())
             {
@@ -249,8 +350,6 @@ void provisionUnit()
 
 void verifyProvisioning()
 {
-    EEPROM_setup();
-
 #if ZEROWATCH_DEL_PROVISIONS
     dprint("***** ZEROWATCH_DEL_PROVISIONS is set! Waiting %d seconds... *****\n", ZWPROV_MODE_WRITE_DELAY);
     delay(ZWPROV_MODE_WRITE_DELAY * 1000);
@@ -267,4 +366,4 @@ void verifyProvisioning()
         zlog("\n\nThis device is not provisioned! Please use ZEROWATCH_PROVISIONING_MODE to initialize it.");
         __haltOrCatchFire();
     }
-}
\ No newline at end of file
+}
@@ -3,8 +3,11 @@
 
 #include <EEPROM.h>
 
-// provisioning definitions
+// provisioning definitions (each may instead be given on the command line, as host/Makefile's
+// "provision" target does)
+#ifndef ZEROWATCH_PROVISIONING_MODE
 #define ZEROWATCH_PROVISIONING_MODE 0
+#endif
 
 #if ZEROWATCH_PROVISIONING_MODE
 
@@ -19,16 +22,39 @@
 #endif
 
 // these will be written to EEPROM
+#ifndef ZWPROV_HOSTNAME
 #define ZWPROV_HOSTNAME ""
+#endif
+#ifndef ZWPROV_WIFI_SSID
 #define ZWPROV_WIFI_SSID ""
+#endif
+#ifndef ZWPROV_WIFI_PASSWORD
 #define ZWPROV_WIFI_PASSWORD ""
+#endif
+#ifndef ZWPROV_REDIS_HOST
 #define ZWPROV_REDIS_HOST ""
+#endif
+#ifndef ZWPROV_REDIS_PASSWORD
 #define ZWPROV_REDIS_PASSWORD ""
+#endif
+#ifndef ZWPROV_REDIS_PORT
 #define ZWPROV_REDIS_PORT 6379
+#endif
+#ifndef ZWPROV_OTA_HOST
 #define ZWPROV_OTA_HOST ""
+#endif
 
 #endif
 
+// Provisioning lives in one versioned, CRC-checked NVS blob (see zw_provision.cpp),
+// read straight into a single allocation that the EEPROMCFG_* strings point into.
+#define ZWPROV_NVS_NAMESPACE "zw"
+#define ZWPROV_NVS_KEY "prov"
+#define ZWPROV_BLOB_MAGIC 0x5A575052
+#define ZWPROV_BLOB_VERSION 1
+#define ZWPROV_BLOB_MAX 1024
+
+// the original EEPROM layout: only read, to migrate units provisioned before the blob
 #define ZW_EEPROM_SIZE 32
 #define ZW_EEPROM_HOSTNAME_ADDR 0
 #define CFG_EEPROM_SIZE 3192
@@ -50,4 +76,8 @@ extern String gHostname;
 
 void verifyProvisioning();
 
+// reads and checks the provisioning blob as boot does, leaving the one in use untouched
+// (for zw_bench.h); false if it's absent or corrupt
+bool zwProvisionCheck();
+
 #endif
@@ -1,31 +1,49 @@
 #include "zw_redis.h"
 #include "zw_logging.h"
+#include "zw_wifi.h"
+#include "zw_critlog.h"
+#include "zw_metrics.h"
+#include "zw_trace.h"
+#include "zw_heap.h"
+#include "zw_arena.h"
+#include "zw_capture.h"
+#include "zw_budget.h"
+#include "zw_power.h"
+#include <esp_timer.h>
 #include <errno.h>
 
-#define REDIS_KEY(x) String(hostname + x).c_str()
+// keys (and other transient strings) live in the per-pass arena, see zw_arena.h
+#if ZWREDIS_CLUSTER
+#define HOST_KEY_FMT "{%s}"
+#else
+#define HOST_KEY_FMT "%s"
+#endif
+#define REDIS_KEY(x) zwArenaPrintf(HOST_KEY_FMT "%s", hostname.c_str(), (x))
 
-#define REDIS_KEY_CREATE_LOCAL(x)                               \
-    auto redisKey_local__String_capture = String(hostname + x); \
-    auto redisKey_local = redisKey_local__String_capture.c_str();
+#define REDIS_KEY_CREATE_LOCAL(x) \
+    auto redisKey_local = REDIS_KEY(x);
 
-bool ZWRedis::connect()
+// every Arduino-Redis call goes through here so its latency lands in the command's histogram
+#define REDIS_CMD(histogram, call) zwMetricTime(histogram, [&]() { return connection.redis->call; })
+
+bool ZWRedis::open(ZWRedisConnection &conn, WiFiClient *client, const char *host, uint16_t port)
 {
-    connection.wifi = new WiFiClient();
+    conn.wifi = client;
 
-    if (!connection.wifi->connect(configuration.host, configuration.port))
+    if (!conn.wifi->connect(host, port))
     {
-        dprint("Redis connection failed (wifi): %s (%d)\n", strerror(errno), errno);
+        dprint("Redis connection to %s:%u failed (wifi): %s (%d)\n", host, port, strerror(errno), errno);
         perror("redis: wifi");
-        delete connection.wifi, connection.wifi = nullptr;
+        delete conn.wifi, conn.wifi = nullptr;
         return false;
     }
     else
     {
-        connection.redis = new Redis(*connection.wifi);
-        if (connection.redis->authenticate(configuration.password) != RedisSuccess)
+        conn.redis = new Redis(*conn.wifi);
+        if (zwMetricTime(ZWH_REDIS_AUTH, [&]() { return conn.redis->authenticate(configuration.password); }) != RedisSuccess)
         {
             dprint("Redis auth failed");
-            delete connection.redis, connection.redis = nullptr;
+            delete conn.redis, conn.redis = nullptr;
             return false;
         }
     }
@@ -33,7 +51,207 @@ bool ZWRedis::connect()
     return true;
 }
 
+void ZWRedis::close(ZWRedisConnection &conn)
+{
+    if (conn.wifi)
+        conn.wifi->stop();
+    delete conn.redis, conn.redis = nullptr;
+    delete conn.wifi, conn.wifi = nullptr;
+}
+
+bool ZWRedis::reopen(ZWRedisConnection &conn)
+{
+    close(conn);
+    if (&conn != &connection)
+        return false;
+
+    auto host = configuration.host;
+    uint16_t port = configuration.port;
+#if ZWREDIS_CLUSTER
+    if (connectionNode >= 0)
+    {
+        auto &addr = zwClusterNode(connectionNode);
+        host = addr.host;
+        port = addr.port;
+    }
+#endif
+    if (open(connection, new ZWCaptureClient(), host, port))
+    {
+        zwCaptureConnected();
+        return true;
+    }
+
+    // until the unit reconnects, commands fail as they would over a dropped connection
+    if (!connection.wifi)
+        connection.wifi = new ZWCaptureClient();
+    if (!connection.redis)
+        connection.redis = new Redis(*connection.wifi);
+    return false;
+}
+
+bool ZWRedis::connect()
+{
+    if (!open(connection, new ZWCaptureClient(), configuration.host, configuration.port))
+        return false;
+
+    zwCaptureConnected();
+#if ZWREDIS_CLUSTER
+    zwClusterSetHome(hostname.c_str());
+    if (!loadSlots())
+        zlog("WARNING: no slot map from %s:%u, sending everything there\n", configuration.host, configuration.port);
+#endif
+    return true;
+}
+
+ZWRedisConnection *ZWRedis::connectionFor(const char *key)
+{
+#if ZWREDIS_CLUSTER
+    auto node = key ? zwClusterNodeForKey(key) : -1;
+    if (node >= 0 && node != connectionNode)
+        return nodeConnection(node);
+#endif
+    return &connection;
+}
+
+#if ZWREDIS_CLUSTER
+const char *ZWRedis::nodeHost(const char *announced)
+{
+    // a cluster run on one box for testing announces its loopback address, or none at all
+    if (!*announced || !strcmp(announced, "127.0.0.1") || !strcmp(announced, "::1") || !strcmp(announced, "localhost"))
+        return configuration.host;
+    return announced;
+}
+
+ZWRedisConnection *ZWRedis::nodeConnection(int node)
+{
+    if (node == connectionNode)
+        return &connection;
+
+    auto &conn = nodeConnections[node];
+    if (!conn.redis)
+    {
+        // not a ZWCaptureClient: captures (and zw-replay) are of the home connection alone
+        auto &addr = zwClusterNode(node);
+        if (!open(conn, new WiFiClient(), addr.host, addr.port))
+        {
+            // the node may have failed over, which a new map would show
+            zwMetricInc(ZWC_REDIS_FAILURES);
+            slotsStale = true;
+            return nullptr;
+        }
+    }
+
+    return &conn;
+}
+
+bool ZWRedis::loadSlots()
+{
+    ZWRedisPipeline pipeline(*this);
+    const char *argv[] = {"CLUSTER", "SLOTS"};
+    pipeline.command(2, argv);
+
+    zwClusterBeginLoad();
+    auto ranges = pipeline.readSlots([&](uint16_t first, uint16_t last, const char *host, uint16_t port) {
+        zwClusterAddRange(first, last, nodeHost(host), port);
+    });
+    zwClusterEndLoad(ranges > 0);
+    slotsStale = false;
+
+    if (ranges <= 0)
+        return false;
+
+    auto home = zwClusterHomeNode();
+    if (connectionNode < 0)
+        connectionNode = zwClusterNodeIndex(configuration.host, configuration.port);
+    if (home < 0 || home == connectionNode)
+        return true;
+
+    // move to the home node, replacing any (uncaptured) connection to it already open
+    auto &addr = zwClusterNode(home);
+    dprint("Redis home slot %u is on %s:%u\n", zwClusterStats().homeSlot, addr.host, addr.port);
+    close(nodeConnections[home]);
+
+    ZWRedisConnection moved;
+    if (!open(moved, new ZWCaptureClient(), addr.host, addr.port))
+    {
+        zwMetricInc(ZWC_REDIS_FAILURES);
+        slotsStale = true;
+        return false;
+    }
+
+    close(connection);
+    connection = moved;
+    connectionNode = home;
+    zwCaptureConnected();
+    return true;
+}
+
+ZWRedisConnection *ZWRedis::redirected(const char *error, bool follow)
+{
+    // "MOVED 3999 127.0.0.1:6381" or "ASK 3999 127.0.0.1:6381"
+    auto ask = !strncmp(error, "ASK ", 4);
+    zwClusterNoteRedirect(ask);
+    zwMetricInc(ZWC_REDIS_REDIRECTS);
+    if (!ask)
+        slotsStale = true;
+
+    auto addr = strchr(strchr(error, ' ') + 1, ' ');
+    auto colon = addr ? strrchr(addr, ':') : NULL;
+    if (!follow || !colon)
+        return nullptr;
+
+    char host[ZWCLUSTER_HOST_MAX];
+    snprintf(host, sizeof(host), "%.*s", (int)(colon - addr - 1), addr + 1);
+    auto node = zwClusterNodeIndex(nodeHost(host), atoi(colon + 1));
+    return node < 0 ? nullptr : nodeConnection(node);
+}
+#endif
+
 extern int _last_free;
+ZWCheckinData ZWRedis::checkinData(
+    unsigned long ticks,
+    const char *localIp,
+    unsigned long immediateLatency,
+    unsigned long averageLatency)
+{
+    auto heap = zwHeapStats();
+    auto &budget = zwBudgetStats();
+    unsigned long deferred = 0;
+    for (auto d : budget.deferred)
+        deferred += d;
+    auto power = zwPowerStats();
+
+    return {
+        .host = hostname.c_str(),
+        .version = ZEROWATCH_VER,
+        .ticks = ticks,
+        .localIp = localIp,
+        .immediateLatency = immediateLatency,
+        .averageLatency = averageLatency,
+        .connectCached = gWiFiConnectStats.cacheUsed,
+        .connectFast = gWiFiConnectStats.fastConnected,
+        .connectFastMs = gWiFiConnectStats.fastMs,
+        .connectFullMs = gWiFiConnectStats.fullMs,
+        .connectTotalMs = gWiFiConnectStats.totalMs,
+        .memCurrent = (int)heap.free,
+        .memLast = _last_free,
+        .memHeap = (int)heap.size,
+        .memLowWater = (int)heap.lowWater,
+        .memLargestBlock = (int)heap.largestBlock,
+        .allocsPerTick = ZWHEAP_TRACK_NEW ? (int)heap.allocsLastTick : -1,
+        .budgetMs = budget.budgetMs,
+        .budgetOverruns = budget.overruns,
+        .budgetDeferred = deferred,
+        .budgetWorstMs = budget.worstMs,
+        .powerMv = (unsigned long)(zwPowerSample().vbat * 1000),
+        .powerAvgMw = zwPowerAverageMw(),
+        .powerRefreshMj = power.refreshes ? power.refreshUj / 1000.0f / power.refreshes : 0.0f,
+        .powerIdleMj = power.phaseUj[ZWP_IDLE] / 1000.0f,
+        .powerWifiMj = power.phaseUj[ZWP_WIFI] / 1000.0f,
+        .powerRedisMj = power.phaseUj[ZWP_REDIS] / 1000.0f,
+        .powerRenderMj = power.phaseUj[ZWP_RENDER] / 1000.0f};
+}
+
 void ZWRedis::checkin(
     unsigned long ticks,
     const char *localIp,
@@ -41,39 +259,81 @@ void ZWRedis::checkin(
     unsigned long averageLatency,
     int expireMessage)
 {
-    auto rKey = String("rpjios.checkin." + hostname);
-    const char *key = rKey.c_str();
+    ZWMetricScope timed(ZWH_CHECKIN);
+    ZWTraceScope traced(ZWT_CHECKIN);
+    auto key = zwArenaPrintf("rpjios.checkin." HOST_KEY_FMT, hostname.c_str());
+    auto data = checkinData(ticks, localIp, immediateLatency, averageLatency);
+
+#if ZWREDIS_TELEMETRY_MSGPACK
+    uint8_t _mpbuf[ZWREDIS_CHECKIN_MSGPACK_MAX];
+    auto mpLen = zwTelemetryCheckinMsgPack(_mpbuf, ZWREDIS_CHECKIN_MSGPACK_MAX, data);
+    if (!mpLen)
+    {
+        zlog("ERROR: checkin overflowed %d bytes\n", ZWREDIS_CHECKIN_MSGPACK_MAX);
+        return;
+    }
 
+    char expStr[12];
+    snprintf(expStr, sizeof(expStr), "%d", expireMessage);
+    const char *hsetArgv[] = {"HSET", key, "mp", (const char *)_mpbuf};
+    size_t hsetLens[] = {4, strlen(key), 2, mpLen};
+    const char *expireArgv[] = {"EXPIRE", key, expStr};
+
+    ZWRedisPipeline pipeline(*this);
+    pipeline.command(4, hsetArgv, hsetLens);
+    pipeline.command(3, expireArgv);
+    if (pipeline.exec())
+        zlog("WARNING: checkin failed\n");
+#else
     // TODO: error check!
-    connection.redis->hset(key, "host", hostname.c_str());
-    connection.redis->hset(key, "up", String(ticks).c_str());
-    connection.redis->hset(key, "ver", ZEROWATCH_VER);
+    REDIS_CMD(ZWH_REDIS_HSET, hset(key, "host", hostname.c_str()));
+    REDIS_CMD(ZWH_REDIS_HSET, hset(key, "up", zwArenaPrintf("%lu", ticks)));
+    REDIS_CMD(ZWH_REDIS_HSET, hset(key, "ver", ZEROWATCH_VER));
 
 #define BL 1024
-    auto cur_free = ESP.getFreeHeap();
     char _ifbuf[BL];
     bzero(_ifbuf, BL);
-    snprintf(_ifbuf, BL,
-             "{ \"wifi\": { \"address\": \"%s\", \"latency\": "
-             "{ \"immediate\": %ld, \"rollingAvg\": %ld } },"
-             " \"mem\": { \"current\": %d, \"last\": %d, \"delta\": %d, \"heap\": %d }"
-             "}",
-             localIp, immediateLatency, averageLatency,
-             cur_free, _last_free, cur_free - _last_free, ESP.getHeapSize());
-    connection.redis->hset(key, "ifaces", _ifbuf);
-    connection.redis->expire(key, expireMessage);
+    zwTelemetryCheckinJson(_ifbuf, BL, data);
+    REDIS_CMD(ZWH_REDIS_HSET, hset(key, "ifaces", _ifbuf));
+    REDIS_CMD(ZWH_REDIS_EXPIRE, expire(key, expireMessage));
+#endif
+
+#if ZWREDIS_CHECKIN_METRICS
+    auto metricsBuf = (char *)malloc(ZWREDIS_CHECKIN_METRICS_MAX);
+    if (metricsBuf)
+    {
+        zwMetricsAsJson(metricsBuf, ZWREDIS_CHECKIN_METRICS_MAX, false);
+        REDIS_CMD(ZWH_REDIS_HSET, hset(key, "metrics", metricsBuf));
+        free(metricsBuf);
+    }
+#endif
 }
 
 bool ZWRedis::heartbeat(int expire)
 {
+    ZWMetricScope timed(ZWH_HEARTBEAT);
     REDIS_KEY_CREATE_LOCAL(":heartbeat");
-    if (!connection.redis->set(redisKey_local, String(micros()).c_str()))
+
+#if ZWREDIS_TELEMETRY_MSGPACK
+    uint8_t _mpbuf[9];
+    char expStr[12];
+    snprintf(expStr, sizeof(expStr), "%d", expire > 0 ? expire : ZWREDIS_DEFAULT_EXPIRY);
+    const char *argv[] = {"SET", redisKey_local, (const char *)_mpbuf, "EX", expStr};
+    size_t argLens[] = {3, strlen(redisKey_local), zwTelemetryHeartbeatMsgPack(_mpbuf, sizeof(_mpbuf), micros()), 2,
+                        strlen(expStr)};
+
+    ZWRedisPipeline pipeline(*this);
+    pipeline.command(expire ? 5 : 3, argv, argLens);
+    return pipeline.exec() == 0;
+#else
+    if (!REDIS_CMD(ZWH_REDIS_SET, set(redisKey_local, zwArenaPrintf("%lu", micros()))))
         return false;
 
     if (expire)
-        connection.redis->expire(redisKey_local, expire);
+        REDIS_CMD(ZWH_REDIS_EXPIRE, expire(redisKey_local, expire));
 
     return true;
+#endif
 }
 
 int ZWRedis::incrementBootcount(bool reset)
@@ -83,10 +343,10 @@ int ZWRedis::incrementBootcount(bool reset)
 
     if (!reset)
     {
-        bcNext = connection.redis->get(redisKey_local).toInt() + 1;
+        bcNext = REDIS_CMD(ZWH_REDIS_GET, get(redisKey_local)).toInt() + 1;
     }
 
-    if (connection.redis->set(redisKey_local, String(bcNext).c_str()))
+    if (REDIS_CMD(ZWH_REDIS_SET, set(redisKey_local, zwArenaPrintf("%d", bcNext))))
     {
         return bcNext;
     }
@@ -96,19 +356,55 @@ int ZWRedis::incrementBootcount(bool reset)
 
 ZWAppConfig ZWRedis::readConfig()
 {
+#if ZWREDIS_CLUSTER
+    // the keys share a slot, so can be read together
+    ZWMetricScope timed(ZWH_REDIS_GET);
+    auto prefix = REDIS_KEY(":config:");
+    const char *argv[] = {"MGET",
+                          zwArenaPrintf("%sbrightness", prefix),
+                          zwArenaPrintf("%srefresh", prefix),
+                          zwArenaPrintf("%sdebug", prefix),
+                          zwArenaPrintf("%spublishLogs", prefix),
+                          zwArenaPrintf("%spauseRefresh", prefix),
+                          zwArenaPrintf("%sdeepSleepMode", prefix),
+                          zwArenaPrintf("%srefreshBudget", prefix)};
+    long long values[7] = {0, 0, 0, 0, 0, 0, 0};
+    ZWRedisPipeline pipeline(*this);
+    pipeline.command(8, argv);
+    if (pipeline.readIntegers(values, 7) != 7)
+    {
+        zwMetricInc(ZWC_REDIS_FAILURES);
+        memset(values, 0, sizeof(values));
+    }
+
+    _lastReadConfig.brightness = (int)values[0];
+    _lastReadConfig.refresh = (int)values[1];
+    _lastReadConfig.debug = (bool)values[2];
+    _lastReadConfig.publishLogs = (bool)values[3];
+    _lastReadConfig.pauseRefresh = (bool)values[4];
+    _lastReadConfig.deepSleepMode = (bool)values[5];
+    _lastReadConfig.refreshBudget = (int)values[6];
+
+    // a redirect since the last refresh means the map is out of date; reload it now, so the
+    // rest of this refresh goes to the right nodes
+    if (slotsStale)
+        loadSlots();
+#else
     // TODO: error check!
-    auto bc = connection.redis->get(REDIS_KEY(":config:brightness"));
-    auto rc = connection.redis->get(REDIS_KEY(":config:refresh"));
-    auto dg = connection.redis->get(REDIS_KEY(":config:debug"));
-    auto pl = connection.redis->get(REDIS_KEY(":config:publishLogs"));
-    auto pu = connection.redis->get(REDIS_KEY(":config:pauseRefresh"));
+    auto bc = REDIS_CMD(ZWH_REDIS_GET, get(REDIS_KEY(":config:brightness")));
+    auto rc = REDIS_CMD(ZWH_REDIS_GET, get(REDIS_KEY(":config:refresh")));
+    auto dg = REDIS_CMD(ZWH_REDIS_GET, get(REDIS_KEY(":config:debug")));
+    auto pl = REDIS_CMD(ZWH_REDIS_GET, get(REDIS_KEY(":config:publishLogs")));
+    auto pu = REDIS_CMD(ZWH_REDIS_GET, get(REDIS_KEY(":config:pauseRefresh")));
 
     _lastReadConfig.brightness = bc.toInt();
     _lastReadConfig.refresh = rc.toInt();
     _lastReadConfig.debug = (bool)dg.toInt();
     _lastReadConfig.publishLogs = (bool)pl.toInt();
     _lastReadConfig.pauseRefresh = (bool)pu.toInt();
-    _lastReadConfig.deepSleepMode = (bool)connection.redis->get(REDIS_KEY(":config:deepSleepMode")).toInt();
+    _lastReadConfig.deepSleepMode = (bool)REDIS_CMD(ZWH_REDIS_GET, get(REDIS_KEY(":config:deepSleepMode"))).toInt();
+    _lastReadConfig.refreshBudget = REDIS_CMD(ZWH_REDIS_GET, get(REDIS_KEY(":config:refreshBudget"))).toInt();
+#endif
 
     return _lastReadConfig;
 }
@@ -117,10 +413,11 @@ int ZWRedis::updateConfig(ZWAppConfig newConfig)
 {
     int badCount = 0;
 
-#define UPDATE_CHECK_THEN_SET(field)                                                                       \
-    if (_lastReadConfig.field != newConfig.field)                                                          \
-    {                                                                                                      \
-        badCount += !connection.redis->set(REDIS_KEY(":config:" #field), String(newConfig.field).c_str()); \
+#define UPDATE_CHECK_THEN_SET(field)                                                     \
+    if (_lastReadConfig.field != newConfig.field)                                        \
+    {                                                                                    \
+        auto value = zwArenaPrintf("%d", (int)newConfig.field);                          \
+        badCount += !REDIS_CMD(ZWH_REDIS_SET, set(REDIS_KEY(":config:" #field), value)); \
     }
 
     UPDATE_CHECK_THEN_SET(brightness);
@@ -128,6 +425,7 @@ int ZWRedis::updateConfig(ZWAppConfig newConfig)
     UPDATE_CHECK_THEN_SET(debug);
     UPDATE_CHECK_THEN_SET(publishLogs);
     UPDATE_CHECK_THEN_SET(pauseRefresh);
+    UPDATE_CHECK_THEN_SET(refreshBudget);
 
     return badCount;
 }
@@ -140,11 +438,11 @@ bool ZWRedis::handleUserKey(const char *keyPostfix, ZWRedisUserKeyHandler handle
         return false;
     }
 
-    auto getReturn = connection.redis->get(REDIS_KEY(keyPostfix));
+    auto getReturn = REDIS_CMD(ZWH_REDIS_GET, get(REDIS_KEY(keyPostfix)));
 
     if (getReturn && getReturn.length())
     {
-        REDIS_KEY_CREATE_LOCAL(keyPostfix + ":" + getReturn);
+        auto redisKey_local = zwArenaPrintf(HOST_KEY_FMT "%s:%s", hostname.c_str(), keyPostfix, getReturn.c_str());
         ///
         // TODO: handle this wierd print on things like 'update'...
         // and make sure they never write to keys like that!
@@ -158,10 +456,10 @@ bool ZWRedis::handleUserKey(const char *keyPostfix, ZWRedisUserKeyHandler handle
         ///
         dprint("ZWRedis::handleUserKey(%s) (key=%s) has return path '%s'\n",
                hostname.c_str(), keyPostfix, redisKey_local);
-        ZWRedisResponder responder(*this, redisKey_local__String_capture);
+        ZWRedisResponder responder(*this, redisKey_local);
         if (handler(getReturn, responder))
         {
-            return connection.redis->del(REDIS_KEY(keyPostfix));
+            return REDIS_CMD(ZWH_REDIS_DEL, del(REDIS_KEY(keyPostfix)));
         }
     }
 
@@ -170,9 +468,10 @@ bool ZWRedis::handleUserKey(const char *keyPostfix, ZWRedisUserKeyHandler handle
 
 void ZWRedis::responderHelper(const char *key, const char *msg, int expire)
 {
-    connection.redis->publish(key, msg);
-    if (!connection.redis->set(key, msg))
+    REDIS_CMD(ZWH_REDIS_PUBLISH, publish(key, msg));
+    if (!REDIS_CMD(ZWH_REDIS_SET, set(key, msg)))
     {
+        zwMetricInc(ZWC_REDIS_FAILURES);
         zlog("ERROR: ZWRedis::responderHelper() set of %s failed\n", key);
         return;
     }
@@ -180,59 +479,282 @@ void ZWRedis::responderHelper(const char *key, const char *msg, int expire)
     if (expire > 0)
     {
         dprint("ZWRedis::responderHelper expiring %s at %d\n", key, expire);
-        connection.redis->expire(key, expire);
+        REDIS_CMD(ZWH_REDIS_EXPIRE, expire(key, expire));
     }
 }
 
-void ZWRedis::publishLog(const char *msg)
+#define PUBLISH_LOGS_MSG_LEN 384
+#if ZWLOG_BINARY
+#define PUBLISH_LOGS_KEY ":info:publishLogs:bin"
+#else
+#define PUBLISH_LOGS_KEY ":info:publishLogs"
+#endif
+
+int ZWRedis::publishLogs(std::function<size_t(char *msgBuf, size_t msgBufLen)> nextMessage)
 {
-    connection.redis->publish(REDIS_KEY(":info:publishLogs"), msg);
+    REDIS_KEY_CREATE_LOCAL(PUBLISH_LOGS_KEY);
+    ZWRedisPipeline pipeline(*this);
+    char msg[PUBLISH_LOGS_MSG_LEN];
+    const char *argv[] = {"PUBLISH", redisKey_local, msg};
+    size_t argLens[] = {7, strlen(redisKey_local), 0};
+
+    while ((argLens[2] = nextMessage(msg, PUBLISH_LOGS_MSG_LEN)))
+        pipeline.command(3, argv, argLens);
+
+    auto count = pipeline.pending();
+    if (!count)
+        return 0;
+
+    return pipeline.exec() < 0 ? -1 : count;
 }
 
-bool ZWRedis::postCompletedUpdate()
+long ZWRedis::streamRange(const char *key, size_t offset, size_t size, std::function<bool(const uint8_t *data, size_t len)> sink)
 {
-    return connection.redis->del(REDIS_KEY(":config:update"));
+#if ZWREDIS_CLUSTER
+    // a redirect with chunks in flight fails the range (see readBulk()), so the caller's retry
+    // needs the map it made stale
+    if (slotsStale)
+        loadSlots();
+#endif
+    ZWRedisPipeline pipeline(*this, key);
+    size_t requested = offset, received = offset;
+    char start[12], end[12];
+    const char *argv[] = {"GETRANGE", key, start, end};
+
+    auto requestNext = [&]() {
+        auto chunkEnd = min(requested + ZWREDIS_RANGE_CHUNK, size);
+        snprintf(start, sizeof(start), "%u", requested);
+        snprintf(end, sizeof(end), "%u", chunkEnd - 1);
+        pipeline.command(4, argv);
+        requested = chunkEnd;
+    };
+
+    while (requested < size && pipeline.pending() < ZWREDIS_RANGE_INFLIGHT)
+        requestNext();
+
+    while (received < size)
+    {
+        auto expected = (long)min(size - received, (size_t)ZWREDIS_RANGE_CHUNK);
+        auto got = pipeline.readBulk(sink);
+
+        if (got != expected)
+        {
+            zlog("ERROR: ZWRedis::streamRange(%s) failed at %u of %u bytes\n", key, received, size);
+            zwMetricInc(ZWC_REDIS_FAILURES);
+            // a reply cut off mid-payload leaves the rest of it, and any replies still in
+            // flight, unread: rather than parse image bytes as replies, start over
+            pipeline.reopen();
+            return -1;
+        }
+
+        received += got;
+        if (requested < size)
+            requestNext();
+    }
+
+    return received - offset;
+}
+
+bool ZWRedis::postCompletedUpdate(const char *result)
+{
+    auto updateKey = REDIS_KEY(":config:update");
+    auto resultKey = REDIS_KEY(":info:lastUpdate");
+    char expStr[12];
+    snprintf(expStr, sizeof(expStr), "%d", ZWREDIS_LAST_UPDATE_EXPIRY);
+    const char *delArgv[] = {"DEL", updateKey};
+    const char *setArgv[] = {"SET", resultKey, result, "EX", expStr};
+
+    ZWRedisPipeline pipeline(*this);
+    pipeline.command(2, delArgv);
+    pipeline.command(5, setArgv);
+    return pipeline.exec() == 0;
+}
+
+bool ZWRedis::postBenchResults(const char *results)
+{
+    return REDIS_CMD(ZWH_REDIS_HSET, hset(REDIS_KEY(":info:bench"), ZEROWATCH_VER, results));
+}
+
+bool ZWRedis::postCapture(const uint8_t *trace, size_t len)
+{
+    char expStr[12];
+    snprintf(expStr, sizeof(expStr), "%d", ZWCAPTURE_EXPIRY);
+    const char *argv[] = {"SET", REDIS_KEY(":info:capture"), (const char *)trace, "EX", expStr};
+    const size_t argLens[] = {3, strlen(argv[1]), len, 2, strlen(expStr)};
+
+    ZWRedisPipeline pipeline(*this);
+    pipeline.command(5, argv, argLens);
+    return pipeline.exec() == 0;
 }
 
 std::vector<String> ZWRedis::getRange(const char *key, int start, int stop)
 {
-    return connection.redis->lrange(key, start, stop);
+#if ZWREDIS_CLUSTER
+    // usually on another node, and Arduino-Redis can't see a MOVED or ASK
+    ZWMetricScope timed(ZWH_REDIS_LRANGE);
+    std::vector<String> values;
+    char startStr[12], stopStr[12];
+    snprintf(startStr, sizeof(startStr), "%d", start);
+    snprintf(stopStr, sizeof(stopStr), "%d", stop);
+    const char *argv[] = {"LRANGE", key, startStr, stopStr};
+
+    ZWRedisPipeline pipeline(*this, key);
+    pipeline.command(4, argv);
+    if (pipeline.readStrings(values) < 0)
+    {
+        zwMetricInc(ZWC_REDIS_FAILURES);
+        values.clear();
+    }
+    return values;
+#else
+    return REDIS_CMD(ZWH_REDIS_LRANGE, lrange(key, start, stop));
+#endif
 }
 
 bool ZWRedis::clearControlPoint()
 {
-    return connection.redis->del(REDIS_KEY(":config:controlPoint"));
+    return REDIS_CMD(ZWH_REDIS_DEL, del(REDIS_KEY(":config:controlPoint")));
 }
 
 bool ZWRedis::registerDevice(const char *registryName, const char *hostname, const char *ident)
 {
-    return connection.redis->hset(registryName, ident, hostname);
+#if ZWREDIS_CLUSTER
+    ZWMetricScope timed(ZWH_REDIS_HSET);
+    const char *argv[] = {"HSET", registryName, ident, hostname};
+    ZWRedisPipeline pipeline(*this, registryName);
+    pipeline.command(4, argv);
+    return pipeline.exec() == 0;
+#else
+    return REDIS_CMD(ZWH_REDIS_HSET, hset(registryName, ident, hostname));
+#endif
 }
 
+extern unsigned long gBootCount;
 void ZWRedis::logCritical(const char *format, ...)
 {
-#define BUFLEN 2048
-    char _buf[BUFLEN];
-    bzero(_buf, BUFLEN);
+    char _buf[ZWCRITLOG_FORMAT_MAX];
+    bzero(_buf, ZWCRITLOG_FORMAT_MAX);
     va_list args;
     va_start(args, format);
-    vsnprintf(_buf, BUFLEN, format, args);
+    vsnprintf(_buf, ZWCRITLOG_FORMAT_MAX, format, args);
     va_end(args);
-    // SHIT! need LPUSH
-    //connection.redis->lset
-    // I guess this'll work ok for now...
-    static unsigned long __keyCount = 0;
-    connection.redis->hset(REDIS_KEY(":criticalLog"), String(++__keyCount).c_str(), _buf);
+
+    if (!zwCritLogAppend(gBootCount, _buf))
+        zlog("WARNING: critical event not persisted: %s\n", _buf);
+
+    if (connection.redis)
+        drainCriticalLog();
+}
+
+#define CRITICAL_STREAM_MAXLEN "500"
+int ZWRedis::drainCriticalLog()
+{
+    if (!connection.redis || !zwCritLogPending())
+        return 0;
+
+    REDIS_KEY_CREATE_LOCAL(":criticalStream");
+    ZWRedisPipeline pipeline(*this);
+    uint32_t lastSeq = 0;
+
+    auto count = zwCritLogForEachPending([&](const ZWCritLogEntry &entry) {
+        char seq[12], boot[12], uptime[12];
+        snprintf(seq, sizeof(seq), "%u", entry.seq);
+        snprintf(boot, sizeof(boot), "%u", entry.bootCount);
+        snprintf(uptime, sizeof(uptime), "%u", entry.uptimeMs);
+        const char *argv[] = {"XADD", redisKey_local, "MAXLEN", "~", CRITICAL_STREAM_MAXLEN, "*",
+                              "seq", seq, "boot", boot, "uptimeMs", uptime, "msg", entry.msg};
+        pipeline.command(14, argv);
+        lastSeq = entry.seq;
+        return true;
+    });
+
+    auto errors = pipeline.exec();
+    if (errors)
+    {
+        zlog("WARNING: critical log upload failed (%d of %d)\n", errors, count);
+        return -1;
+    }
+
+    zwCritLogMarkUploaded(lastSeq);
+    return count;
+}
+
+#define TRACE_STREAM_MAXLEN "200"
+int ZWRedis::flushTrace()
+{
+    const ZWTraceSpan *runs[2];
+    size_t counts[2];
+    auto runCount = zwTraceRuns(runs, counts);
+    if (!connection.redis || !runCount)
+        return 0;
+
+    REDIS_KEY_CREATE_LOCAL(":traceStream");
+    char boot[12];
+    snprintf(boot, sizeof(boot), "%lu", gBootCount);
+
+    // each entry carries the name table so the host tool needn't match firmware versions
+    ZWRedisPipeline pipeline(*this);
+    size_t total = 0;
+    for (int i = 0; i < runCount; i++)
+    {
+        const char *argv[] = {"XADD", redisKey_local, "MAXLEN", "~", TRACE_STREAM_MAXLEN, "*",
+                              "boot", boot, "names", zwTraceNames(), "spans", (const char *)runs[i]};
+        size_t argLens[12];
+        for (int a = 0; a < 11; a++)
+            argLens[a] = strlen(argv[a]);
+        argLens[11] = counts[i] * sizeof(ZWTraceSpan);
+        pipeline.command(12, argv, argLens);
+        total += counts[i];
+    }
+
+    if (pipeline.exec())
+    {
+        zlog("WARNING: trace upload of %d spans failed\n", total);
+        return -1;
+    }
+
+    zwTraceConsume(total);
+    return total;
 }
 
 void ZWRedis::getTime(uint8_t *hour, uint8_t *minute, uint8_t *second)
 {
+    ZWMetricScope timed(ZWH_REDIS_HGET);
+    ZWRedisPipeline pipeline(*this, "rpjios.__meta.time");
+    const char *argv[] = {"HMGET", "rpjios.__meta.time", "hour", "minute", "second"};
+    pipeline.command(5, argv);
+
+    long long hms[3] = {0, 0, 0};
+    if (pipeline.readIntegers(hms, 3) != 3)
+        hms[0] = hms[1] = hms[2] = 0;
+
     if (hour)
-        *hour = (uint8_t)connection.redis->hget("rpjios.__meta.time", "hour").toInt();
+        *hour = (uint8_t)hms[0];
     if (minute)
-        *minute = (uint8_t)connection.redis->hget("rpjios.__meta.time", "minute").toInt();
+        *minute = (uint8_t)hms[1];
     if (second)
-        *second = (uint8_t)connection.redis->hget("rpjios.__meta.time", "second").toInt();
+        *second = (uint8_t)hms[2];
+}
+
+bool ZWRedis::serverTime(uint64_t *epochUs, unsigned long *rttUs, int64_t *receivedUs)
+{
+    ZWMetricScope timed(ZWH_REDIS_TIME);
+    ZWRedisPipeline pipeline(*this);
+    const char *argv[] = {"TIME"};
+    pipeline.command(1, argv);
+
+    long long secUsec[2];
+    auto sent = esp_timer_get_time();
+    if (pipeline.readIntegers(secUsec, 2) != 2)
+    {
+        zwMetricInc(ZWC_REDIS_FAILURES);
+        return false;
+    }
+
+    *receivedUs = esp_timer_get_time();
+    *rttUs = (unsigned long)(*receivedUs - sent);
+    *epochUs = (uint64_t)secUsec[0] * 1000000 + secUsec[1];
+    return true;
 }
 
 void ZWRedisResponder::setValue(const char *format, ...)
@@ -244,5 +766,422 @@ void ZWRedisResponder::setValue(const char *format, ...)
     va_start(args, format);
     vsnprintf(_buf, BUFLEN, format, args);
     va_end(args);
-    redis.responderHelper(key.c_str(), _buf, expire);
-}
\ No newline at end of file
+    redis.responderHelper(key, _buf, expire);
+}
+
+void ZWRedisResponder::setValueRaw(const char *value)
+{
+    redis.responderHelper(key, value, expire);
+}
+
+ZWRedisPipeline::ZWRedisPipeline(ZWRedis &parent, const char *key) : redis(parent), conn(parent.connectionFor(key))
+{
+}
+
+void ZWRedisPipeline::append(const void *data, size_t len)
+{
+    auto walk = (const uint8_t *)data;
+    while (len)
+    {
+        auto chunk = min(len, (size_t)(ZWREDIS_PIPELINE_BUFLEN - used));
+        memcpy(buf + used, walk, chunk);
+        used += chunk;
+        walk += chunk;
+        len -= chunk;
+
+        if (used == ZWREDIS_PIPELINE_BUFLEN)
+        {
+            flushWrites();
+            overflowed = true;
+        }
+    }
+}
+
+bool ZWRedisPipeline::write(const void *data, size_t len)
+{
+    if (!conn || !conn->wifi || conn->wifi->write((const uint8_t *)data, len) != len)
+    {
+        dprint("ZWRedisPipeline write of %d bytes failed\n", len);
+        failed = true;
+    }
+    return !failed;
+}
+
+bool ZWRedisPipeline::flushWrites()
+{
+    // only a command whose reply is the next one read can be resent after a redirect
+    replayLen = 0;
+    if (used && !failed && write(buf, used) && buffered == 1 && queued == 1 && !overflowed)
+        replayLen = used;
+
+    used = 0;
+    buffered = 0;
+    overflowed = false;
+    return !failed;
+}
+
+void ZWRedisPipeline::command(int argc, const char *argv[], const size_t *argLens)
+{
+    char hdr[24];
+    append(hdr, snprintf(hdr, sizeof(hdr), "*%d\r\n", argc));
+
+    for (int i = 0; i < argc; i++)
+    {
+        auto len = argLens ? argLens[i] : strlen(argv[i]);
+        append(hdr, snprintf(hdr, sizeof(hdr), "$%u\r\n", (unsigned)len));
+        append(argv[i], len);
+        append("\r\n", 2);
+    }
+
+    ++queued;
+    ++buffered;
+}
+
+int ZWRedisPipeline::readLine(char *line, size_t lineLen, unsigned long deadline)
+{
+    size_t got = 0;
+    auto client = conn->wifi;
+
+    while (millis() < deadline)
+    {
+        if (!client->available())
+        {
+            delay(1);
+            continue;
+        }
+
+        auto c = client->read();
+        if (c == '\n' && got && line[got - 1] == '\r')
+        {
+            line[got - 1] = '\0';
+            return got - 1;
+        }
+
+        // overlong lines are truncated; only the type and length prefix matter
+        if (got < lineLen - 1)
+            line[got++] = (char)c;
+    }
+
+    return -1;
+}
+
+int ZWRedisPipeline::readHead(char *line, size_t lineLen, unsigned long deadline)
+{
+    auto got = readLine(line, lineLen, deadline);
+#if ZWREDIS_CLUSTER
+    // a redirect is followed by sending the command again, if it was sent alone
+    for (int redirects = 0; got > 0 && (!strncmp(line, "-MOVED ", 7) || !strncmp(line, "-ASK ", 5)); redirects++)
+    {
+        dprint("ZWRedisPipeline redirected: %s\n", line + 1);
+        auto replay = replayLen;
+        auto target = redis.redirected(line + 1, replay && redirects < ZWREDIS_CLUSTER_MAX_REDIRECTS);
+        if (!target && queued)
+        {
+            // the replies to later commands are still coming on this connection, and they may
+            // have been redirected too: fail, for the caller to reopen() and retry
+            zlog("ERROR: ZWRedisPipeline redirected with %d replies in flight\n", queued);
+            return -1;
+        }
+        if (!target)
+            break;
+
+        conn = target;
+        if (line[1] == 'A')
+        {
+            // the target only serves a slot it's importing to commands after an ASKING
+            static const char asking[] = "*1\r\n$6\r\nASKING\r\n";
+            if (!write(asking, sizeof(asking) - 1) || readLine(line, lineLen, deadline) < 1 || line[0] != '+')
+                return -1;
+        }
+
+        if (!write(buf, replay))
+            return -1;
+        got = readLine(line, lineLen, deadline);
+    }
+#endif
+    return got;
+}
+
+// returns 1 for success replies, 0 for error replies and -1 on I/O failure
+int ZWRedisPipeline::readReply(unsigned long deadline)
+{
+    char line[64];
+    if (readHead(line, sizeof(line), deadline) < 1)
+        return -1;
+
+    switch (line[0])
+    {
+    case '-':
+        dprint("ZWRedisPipeline error reply: %s\n", line + 1);
+        return 0;
+
+    case '$':
+    {
+        auto len = atoi(line + 1);
+        // skip the bulk payload and its CRLF
+        for (int skip = len >= 0 ? len + 2 : 0; skip > 0 && millis() < deadline;)
+        {
+            if (conn->wifi->read() != -1)
+                --skip;
+            else
+                delay(1);
+        }
+        return millis() < deadline ? 1 : -1;
+    }
+
+    case '*':
+    {
+        auto count = atoi(line + 1);
+        for (int i = 0; i < count; i++)
+            if (readReply(deadline) < 0)
+                return -1;
+        return 1;
+    }
+
+    default:
+        return 1;
+    }
+}
+
+long ZWRedisPipeline::readBulk(std::function<bool(const uint8_t *data, size_t len)> sink)
+{
+    if (!queued || !flushWrites())
+        return -1;
+    --queued;
+
+    ZWMetricScope timed(ZWH_REDIS_GETRANGE);
+    auto deadline = millis() + ZWREDIS_PIPELINE_TIMEOUT_MS;
+    char line[64];
+
+    if (readHead(line, sizeof(line), deadline) < 1 || line[0] != '$' || atol(line + 1) < 0)
+    {
+        dprint("ZWRedisPipeline expected a bulk reply\n");
+        return -1;
+    }
+
+    // writes were flushed above, so buf is free to read into until the next command()
+    auto client = conn->wifi;
+    auto len = atol(line + 1);
+    replayLen = 0;
+    auto sinking = true;
+    for (long left = len; left > 0;)
+    {
+        auto avail = client->available();
+        if (!avail)
+        {
+            if (millis() >= deadline || !client->connected())
+                return -1;
+            delay(1);
+            continue;
+        }
+
+        auto got = client->read(buf, min((long)avail, min(left, (long)ZWREDIS_PIPELINE_BUFLEN)));
+        if (got <= 0)
+            return -1;
+
+        // after sink refuses, keep reading so the connection stays in sync
+        sinking = sinking && sink(buf, got);
+        left -= got;
+    }
+
+    if (readLine(line, sizeof(line), deadline) < 0)
+        return -1;
+
+    return sinking ? len : -1;
+}
+
+int ZWRedisPipeline::readIntegers(long long *values, int maxValues)
+{
+    if (!queued || !flushWrites())
+        return -1;
+    --queued;
+
+    auto deadline = millis() + ZWREDIS_PIPELINE_TIMEOUT_MS;
+    char line[64];
+    if (readHead(line, sizeof(line), deadline) < 1 || line[0] != '*')
+    {
+        dprint("ZWRedisPipeline expected an array reply\n");
+        return -1;
+    }
+
+    auto count = atoi(line + 1);
+    for (int i = 0; i < count; i++)
+    {
+        if (readLine(line, sizeof(line), deadline) < 1)
+            return -1;
+
+        long long value = 0;
+        if (line[0] == ':')
+            value = atoll(line + 1);
+        else if (line[0] == '$' && atoi(line + 1) >= 0)
+        {
+            if (readLine(line, sizeof(line), deadline) < 0)
+                return -1;
+            value = atoll(line);
+        }
+        else if (line[0] != '$')
+            return -1;
+
+        if (i < maxValues)
+            values[i] = value;
+    }
+
+    return count;
+}
+
+int ZWRedisPipeline::readStrings(std::vector<String> &values)
+{
+    if (!queued || !flushWrites())
+        return -1;
+    --queued;
+
+    auto deadline = millis() + ZWREDIS_PIPELINE_TIMEOUT_MS;
+    char line[64];
+    if (readHead(line, sizeof(line), deadline) < 1 || line[0] != '*')
+    {
+        dprint("ZWRedisPipeline expected an array reply\n");
+        return -1;
+    }
+
+    auto count = atoi(line + 1);
+    auto client = conn->wifi;
+    values.reserve(values.size() + max(count, 0));
+    for (int i = 0; i < count; i++)
+    {
+        if (readLine(line, sizeof(line), deadline) < 1 || line[0] != '$')
+            return -1;
+
+        auto len = atol(line + 1);
+        String value;
+        if (len > 0 && !value.reserve(len))
+            return -1;
+
+        // the payload is read through buf, which is free once the command was written
+        for (long left = len; left > 0;)
+        {
+            auto avail = client->available();
+            if (!avail)
+            {
+                if (millis() >= deadline || !client->connected())
+                    return -1;
+                delay(1);
+                continue;
+            }
+
+            auto got = client->read(buf, min((long)avail, min(left, (long)ZWREDIS_PIPELINE_BUFLEN - 1)));
+            if (got <= 0)
+                return -1;
+            buf[got] = '\0';
+            value.concat((const char *)buf);
+            left -= got;
+        }
+
+        if (len >= 0 && readLine(line, sizeof(line), deadline) < 0)
+            return -1;
+        values.push_back(value);
+    }
+
+    replayLen = 0;
+    return count;
+}
+
+int ZWRedisPipeline::readSlots(std::function<void(uint16_t first, uint16_t last, const char *host, uint16_t port)> range)
+{
+    if (!queued || !flushWrites())
+        return -1;
+    --queued;
+
+    // [ [ first, last, [ host, port, id, .. ], replicas.. ], .. ]
+    auto deadline = millis() + ZWREDIS_PIPELINE_TIMEOUT_MS;
+    char line[64], host[ZWCLUSTER_HOST_MAX];
+    auto got = readLine(line, sizeof(line), deadline);
+    if (got < 1 || line[0] != '*')
+    {
+        dprint("ZWRedisPipeline expected CLUSTER SLOTS' reply: %s\n", got > 0 ? line : "(none)");
+        return -1;
+    }
+
+    auto count = atoi(line + 1);
+    for (int i = 0; i < count; i++)
+    {
+        if (readLine(line, sizeof(line), deadline) < 1 || line[0] != '*')
+            return -1;
+        auto fields = atoi(line + 1);
+
+        long bounds[2];
+        for (auto &bound : bounds)
+        {
+            if (readLine(line, sizeof(line), deadline) < 1 || line[0] != ':')
+                return -1;
+            bound = atol(line + 1);
+        }
+
+        // the master, then its replicas (skipped)
+        for (int f = 2; f < fields; f++)
+        {
+            if (f > 2)
+            {
+                if (readReply(deadline) < 0)
+                    return -1;
+                continue;
+            }
+
+            if (readLine(line, sizeof(line), deadline) < 1 || line[0] != '*')
+                return -1;
+            auto nodeFields = atoi(line + 1);
+            if (nodeFields < 2 || readLine(line, sizeof(line), deadline) < 1 || line[0] != '$' ||
+                readLine(host, sizeof(host), deadline) < 0 ||
+                readLine(line, sizeof(line), deadline) < 1 || line[0] != ':')
+                return -1;
+            auto port = atoi(line + 1);
+
+            for (int n = 2; n < nodeFields; n++)
+                if (readReply(deadline) < 0)
+                    return -1;
+
+            range((uint16_t)bounds[0], (uint16_t)bounds[1], host, (uint16_t)port);
+        }
+    }
+
+    return count;
+}
+
+int ZWRedisPipeline::exec()
+{
+    auto toRead = queued;
+    ZWMetricScope timed(ZWH_REDIS_PIPELINE);
+    auto flushed = flushWrites();
+    // every reply is read here, so a redirected one is only an error reply
+    queued = 0;
+    if (!flushed)
+    {
+        zwMetricInc(ZWC_REDIS_FAILURES);
+        return -1;
+    }
+
+    int errors = 0;
+    auto deadline = millis() + ZWREDIS_PIPELINE_TIMEOUT_MS;
+    for (int i = 0; i < toRead; i++)
+    {
+        auto rr = readReply(deadline);
+        if (rr < 0)
+        {
+            zlog("ERROR: ZWRedisPipeline lost %d of %d replies\n", toRead - i, toRead);
+            zwMetricInc(ZWC_REDIS_FAILURES);
+            return -1;
+        }
+        errors += !rr;
+    }
+
+    zwMetricInc(ZWC_REDIS_FAILURES, errors);
+    return errors;
+}
+
+void ZWRedisPipeline::reopen()
+{
+    used = queued = buffered = 0;
+    overflowed = false;
+    replayLen = 0;
+    if (conn && !redis.reopen(*conn) && conn == &redis.connection)
+        zlog("ERROR: ZWRedisPipeline couldn't reopen the connection\n");
+}
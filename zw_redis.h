@@ -4,10 +4,41 @@
 #include <Redis.h>
 #include <WiFiClient.h>
 #include <vector>
+#include <functional>
 
 #include "zw_common.h"
+#include "zw_telemetry.h"
+#include "zw_cluster.h"
 
 #define ZWREDIS_DEFAULT_EXPIRY 120
+#define ZWREDIS_PIPELINE_BUFLEN 1024
+#define ZWREDIS_PIPELINE_TIMEOUT_MS 2000
+#define ZWREDIS_LAST_UPDATE_EXPIRY 3600
+
+// streamRange() fetches in GETRANGE chunks of this size, keeping this many requests in flight
+#define ZWREDIS_RANGE_CHUNK 4096
+#define ZWREDIS_RANGE_INFLIGHT 3
+
+// 1 to write checkins (as one "mp" hash field) and heartbeats as MessagePack;
+// decode them on the host with tools/zw-telemetry (scripts/otp-generate.pl copes with either)
+#define ZWREDIS_TELEMETRY_MSGPACK 0
+#define ZWREDIS_CHECKIN_MSGPACK_MAX 512
+
+// 1 to also store the metrics summary (see zw_metrics.h) as the checkin's "metrics" hash field
+#define ZWREDIS_CHECKIN_METRICS 0
+#define ZWREDIS_CHECKIN_METRICS_MAX 3072
+
+// 1 to run against a Redis Cluster, starting from any of its nodes. The unit's own keys become
+// "{HOSTNAME}:..." and its checkin "rpjios.checkin.{HOSTNAME}", so their hash tag puts them all
+// in one slot (see zw_cluster.h) and so on one node, the unit's home, which the connection is
+// moved to; everything else (displays' lists, rpjios.__meta.time, OTA images) is sent to the
+// node serving it, over a connection opened when first needed. A MOVED reply reloads the slot
+// map at the next refresh; either redirect is followed for commands that go through
+// ZWRedisPipeline alone, which in these builds includes the config read (one MGET) and LRANGE.
+#ifndef ZWREDIS_CLUSTER
+#define ZWREDIS_CLUSTER 0
+#endif
+#define ZWREDIS_CLUSTER_MAX_REDIRECTS 2
 
 struct ZWRedisHostConfig
 {
@@ -16,16 +47,23 @@ struct ZWRedisHostConfig
     const char *password;
 };
 
+struct ZWRedisConnection
+{
+    Redis *redis = nullptr;
+    WiFiClient *wifi = nullptr;
+};
+
 class ZWRedis;
 
 class ZWRedisResponder {
 protected:
     ZWRedis& redis;
-    String key;
+    const char* key;
     int expire = ZWREDIS_DEFAULT_EXPIRY;
 
 public:
-    ZWRedisResponder(ZWRedis& parent, String currentKey) : 
+    // currentKey must outlive the responder
+    ZWRedisResponder(ZWRedis& parent, const char* currentKey) : 
         redis(parent), key(currentKey) {}
 
     ~ZWRedisResponder() {}
@@ -36,6 +74,76 @@ public:
     void setExpire(int newExpire) { expire = newExpire; }
 
     void setValue(const char* format, ...);
+
+    // for values that may exceed setValue()'s formatting buffer
+    void setValueRaw(const char* value);
+};
+
+// Writes RESP commands straight to the connection's socket so that many commands
+// go out in one round-trip; Arduino-Redis only supports request-then-reply.
+// Nothing else may use the connection between the first command() and exec().
+class ZWRedisPipeline {
+protected:
+    ZWRedis& redis;
+    ZWRedisConnection* conn;
+    uint8_t buf[ZWREDIS_PIPELINE_BUFLEN];
+    size_t used = 0;
+    int queued = 0;
+    bool failed = false;
+    // commands in buf, whether it has filled since the last flush, and the length of a lone
+    // command flushed whole with no other replies outstanding, which is still in buf to be
+    // resent after a redirect
+    int buffered = 0;
+    bool overflowed = false;
+    size_t replayLen = 0;
+
+    void append(const void* data, size_t len);
+    bool write(const void* data, size_t len);
+    bool flushWrites();
+    int readLine(char* line, size_t lineLen, unsigned long deadline);
+    int readHead(char* line, size_t lineLen, unsigned long deadline);
+    int readReply(unsigned long deadline);
+
+public:
+    // in a cluster, the pipeline goes to the node serving key; the unit's own keys' (the
+    // home connection) if NULL
+    ZWRedisPipeline(ZWRedis& parent, const char* key = NULL);
+
+    ~ZWRedisPipeline() {}
+
+    ZWRedisPipeline(const ZWRedisPipeline &) = delete;
+    ZWRedisPipeline &operator=(const ZWRedisPipeline &) = delete;
+
+    // argLens may be NULL if every argument is a C string
+    void command(int argc, const char* argv[], const size_t* argLens = NULL);
+
+    int pending() { return queued; }
+
+    // sends everything queued and consumes the replies: returns the number
+    // of error replies, or -1 if the connection failed
+    int exec();
+
+    // sends everything queued and reads only the next reply, which must be a bulk string,
+    // passing its payload to sink in pieces; returns the payload's length, or -1 if it
+    // wasn't a bulk string, the connection failed or sink returned false. In a cluster, a
+    // redirect is only followed if no later replies are outstanding; otherwise it's -1 too,
+    // and those replies are left unread for the caller to reopen()
+    long readBulk(std::function<bool(const uint8_t* data, size_t len)> sink);
+
+    // sends everything queued and reads only the next reply, which must be an array of
+    // integers or numeric bulk strings (nil ones read as 0), into at most maxValues values;
+    // returns the array's length, or -1 if it wasn't one or the connection failed
+    int readIntegers(long long* values, int maxValues);
+
+    // as readIntegers() for an array of bulk strings (nil ones read as empty)
+    int readStrings(std::vector<String>& values);
+
+    // sends everything queued and reads only the next reply, which must be CLUSTER SLOTS',
+    // passing each range's master to range; returns the number of ranges or -1
+    int readSlots(std::function<void(uint16_t first, uint16_t last, const char* host, uint16_t port)> range);
+
+    // drops whatever is queued or in flight by reopening the connection (see ZWRedis::reopen())
+    void reopen();
 };
 
 typedef bool (*ZWRedisUserKeyHandler)(String& userKeyValue, ZWRedisResponder& responder);
@@ -43,19 +151,43 @@ typedef bool (*ZWRedisUserKeyHandler)(String& userKeyValue, ZWRedisResponder& re
 class ZWRedis {
 protected:
     friend class ZWRedisResponder;
-
-    struct RedisClientConn
-    {
-        Redis *redis;
-        WiFiClient *wifi;
-    };
+    friend class ZWRedisPipeline;
 
     String &hostname;
     ZWRedisHostConfig configuration;
-    RedisClientConn connection;
+    // the unit's home node's, in a cluster
+    ZWRedisConnection connection;
 
     void responderHelper(const char* key, const char* msg, int expire = 0);
 
+    bool open(ZWRedisConnection& conn, WiFiClient* client, const char* host, uint16_t port);
+    void close(ZWRedisConnection& conn);
+
+    // for a connection whose replies can't be followed any more: the home connection is
+    // opened again, returning whether it was, and a node's on its next use
+    bool reopen(ZWRedisConnection& conn);
+
+    // the connection for key's node (see ZWRedisPipeline), or NULL if it couldn't be opened
+    ZWRedisConnection* connectionFor(const char* key);
+
+#if ZWREDIS_CLUSTER
+    ZWRedisConnection nodeConnections[ZWCLUSTER_MAX_NODES];
+    // the node connection is to, once known
+    int connectionNode = -1;
+    bool slotsStale = false;
+
+    // where a node the cluster announces is reached
+    const char* nodeHost(const char* announced);
+
+    ZWRedisConnection* nodeConnection(int node);
+
+    // loads the slot map over the connection, then moves it to the home node if that's elsewhere
+    bool loadSlots();
+
+    // notes a MOVED or ASK error reply; if follow, returns the connection to the node it names
+    ZWRedisConnection* redirected(const char* error, bool follow);
+#endif
+
 public:
     ZWRedis(String &hostname, ZWRedisHostConfig config) : 
         hostname(hostname), configuration(config)
@@ -70,6 +202,12 @@ public:
 
     bool connect();
 
+    ZWCheckinData checkinData(
+        unsigned long ticks,
+        const char* localIp,
+        unsigned long immediateLatency,
+        unsigned long averageLatency);
+
     void checkin(
         unsigned long ticks,
         const char* localIp,
@@ -87,9 +225,22 @@ public:
 
     bool handleUserKey(const char *keyPostfix, ZWRedisUserKeyHandler handler);
 
-    void publishLog(const char* msg);
+    // publishes every message nextMessage() produces (it returns each one's length,
+    // 0 when done) in one pipelined round-trip; returns the number published or -1
+    int publishLogs(std::function<size_t(char* msgBuf, size_t msgBufLen)> nextMessage);
+
+    // deletes HOSTNAME:config:update and stores result (JSON) at HOSTNAME:info:lastUpdate
+    bool postCompletedUpdate(const char* result);
 
-    bool postCompletedUpdate();
+    // stores zwBenchRun()'s results (JSON) in HOSTNAME:info:bench, under ZEROWATCH_VER
+    bool postBenchResults(const char* results);
+
+    // streams bytes offset through size of key to sink with pipelined GETRANGEs (see
+    // ZWREDIS_RANGE_CHUNK); returns the number of bytes streamed, or -1
+    long streamRange(const char* key, size_t offset, size_t size, std::function<bool(const uint8_t* data, size_t len)> sink);
+
+    // stores a zwCaptureTrace() at HOSTNAME:info:capture, for tools/zw-replay to fetch
+    bool postCapture(const uint8_t* trace, size_t len);
 
     std::vector<String> getRange(const char* key, int start, int stop);
 
@@ -97,10 +248,22 @@ public:
 
     bool registerDevice(const char* registryName, const char* hostname, const char* ident);
 
+    // persists to the flash critical-event ring first, then drains it if connected
     void logCritical(const char* fmt, ...);
 
+    // uploads every pending critical event to HOSTNAME:criticalStream in one pipelined burst
+    int drainCriticalLog();
+
+    // uploads the buffered trace spans to HOSTNAME:traceStream (see zw_trace.h); returns the count or -1
+    int flushTrace();
+
+    // rpjios.__meta.time's local time of day, in one round trip
     void getTime(uint8_t* hour, uint8_t* minute, uint8_t* second);
 
+    // the server's TIME (UTC, microseconds since the epoch), the round trip it took and
+    // esp_timer_get_time() when its reply arrived
+    bool serverTime(uint64_t* epochUs, unsigned long* rttUs, int64_t* receivedUs);
+
 private:
     ZWAppConfig _lastReadConfig;
 };
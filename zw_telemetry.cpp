@@ -0,0 +1,96 @@
+#include "zw_telemetry.h"
+#include "zw_msgpack.h"
+#include <stdio.h>
+
+int zwTelemetryCheckinJson(char *buf, size_t bufLen, const ZWCheckinData &data)
+{
+    char allocs[12] = "null";
+    if (data.allocsPerTick >= 0)
+        snprintf(allocs, sizeof(allocs), "%d", data.allocsPerTick);
+
+    return snprintf(buf, bufLen,
+                    "{ \"wifi\": { \"address\": \"%s\", \"latency\": "
+                    "{ \"immediate\": %ld, \"rollingAvg\": %ld },"
+                    " \"connect\": { \"cached\": %d, \"fast\": %d, \"fastMs\": %lu, \"fullMs\": %lu, \"totalMs\": %lu } },"
+                    " \"mem\": { \"current\": %d, \"last\": %d, \"delta\": %d, \"heap\": %d,"
+                    " \"lowWater\": %d, \"largestBlock\": %d, \"allocsPerTick\": %s },"
+                    " \"budget\": { \"ms\": %lu, \"overruns\": %lu, \"deferred\": %lu, \"worstMs\": %lu },"
+                    " \"power\": { \"mV\": %lu, \"avgMw\": %.1f, \"refreshMj\": %.3f,"
+                    " \"phasesMj\": { \"idle\": %.1f, \"wifi\": %.1f, \"redis\": %.1f, \"render\": %.1f } }"
+                    "}",
+                    data.localIp, data.immediateLatency, data.averageLatency,
+                    data.connectCached, data.connectFast, data.connectFastMs,
+                    data.connectFullMs, data.connectTotalMs,
+                    data.memCurrent, data.memLast, data.memCurrent - data.memLast, data.memHeap,
+                    data.memLowWater, data.memLargestBlock, allocs,
+                    data.budgetMs, data.budgetOverruns, data.budgetDeferred, data.budgetWorstMs,
+                    data.powerMv, data.powerAvgMw, data.powerRefreshMj,
+                    data.powerIdleMj, data.powerWifiMj, data.powerRedisMj, data.powerRenderMj);
+}
+
+size_t zwTelemetryCheckinMsgPack(uint8_t *buf, size_t bufLen, const ZWCheckinData &data)
+{
+    ZWMsgPackWriter mp(buf, bufLen);
+
+    mp.map(7);
+    mp.kv("host", data.host);
+    mp.kv("up", (uint64_t)data.ticks);
+    mp.kv("ver", data.version);
+
+    mp.str("wifi");
+    mp.map(3);
+    mp.kv("address", data.localIp);
+    mp.str("latency");
+    mp.map(2);
+    mp.kv("immediate", (uint64_t)data.immediateLatency);
+    mp.kv("rollingAvg", (uint64_t)data.averageLatency);
+    mp.str("connect");
+    mp.map(5);
+    mp.kvb("cached", data.connectCached);
+    mp.kvb("fast", data.connectFast);
+    mp.kv("fastMs", (uint64_t)data.connectFastMs);
+    mp.kv("fullMs", (uint64_t)data.connectFullMs);
+    mp.kv("totalMs", (uint64_t)data.connectTotalMs);
+
+    mp.str("mem");
+    mp.map(7);
+    mp.kvs("current", data.memCurrent);
+    mp.kvs("last", data.memLast);
+    mp.kvs("delta", data.memCurrent - data.memLast);
+    mp.kvs("heap", data.memHeap);
+    mp.kvs("lowWater", data.memLowWater);
+    mp.kvs("largestBlock", data.memLargestBlock);
+    mp.str("allocsPerTick");
+    if (data.allocsPerTick >= 0)
+        mp.sint(data.allocsPerTick);
+    else
+        mp.nil();
+
+    mp.str("budget");
+    mp.map(4);
+    mp.kv("ms", (uint64_t)data.budgetMs);
+    mp.kv("overruns", (uint64_t)data.budgetOverruns);
+    mp.kv("deferred", (uint64_t)data.budgetDeferred);
+    mp.kv("worstMs", (uint64_t)data.budgetWorstMs);
+
+    mp.str("power");
+    mp.map(4);
+    mp.kv("mV", (uint64_t)data.powerMv);
+    mp.kvf("avgMw", data.powerAvgMw);
+    mp.kvf("refreshMj", data.powerRefreshMj);
+    mp.str("phasesMj");
+    mp.map(4);
+    mp.kvf("idle", data.powerIdleMj);
+    mp.kvf("wifi", data.powerWifiMj);
+    mp.kvf("redis", data.powerRedisMj);
+    mp.kvf("render", data.powerRenderMj);
+
+    return mp.ok() ? mp.length() : 0;
+}
+
+size_t zwTelemetryHeartbeatMsgPack(uint8_t *buf, size_t bufLen, uint64_t micros)
+{
+    ZWMsgPackWriter mp(buf, bufLen);
+    mp.uint(micros);
+    return mp.ok() ? mp.length() : 0;
+}
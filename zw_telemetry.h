@@ -0,0 +1,54 @@
+#ifndef __ZW_TELEMETRY__H__
+#define __ZW_TELEMETRY__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Everything a checkin reports, gathered once so it can be encoded either as
+// the original JSON "ifaces" blob or as one compact MessagePack record. Kept
+// free of Arduino dependencies so tools/zw-telemetry can build it on the host.
+struct ZWCheckinData
+{
+    const char *host;
+    const char *version;
+    unsigned long ticks;
+    const char *localIp;
+    unsigned long immediateLatency;
+    unsigned long averageLatency;
+    bool connectCached;
+    bool connectFast;
+    unsigned long connectFastMs;
+    unsigned long connectFullMs;
+    unsigned long connectTotalMs;
+    int memCurrent;
+    int memLast;
+    int memHeap;
+    int memLowWater;
+    int memLargestBlock;
+    // -1 where allocations aren't counted (see ZWHEAP_TRACK_NEW), which encodes as null
+    int allocsPerTick;
+    // the refresh budget (see zw_budget.h), left 0 where there isn't one
+    unsigned long budgetMs;
+    unsigned long budgetOverruns;
+    unsigned long budgetDeferred;
+    unsigned long budgetWorstMs;
+    // energy (see zw_power.h): the battery's voltage, the average draw and per-refresh energy,
+    // and each phase's energy since boot; left 0 where there isn't an AXP192
+    unsigned long powerMv;
+    float powerAvgMw;
+    float powerRefreshMj;
+    float powerIdleMj;
+    float powerWifiMj;
+    float powerRedisMj;
+    float powerRenderMj;
+};
+
+// the original "ifaces" hash field's JSON
+int zwTelemetryCheckinJson(char *buf, size_t bufLen, const ZWCheckinData &data);
+
+// the whole checkin (host, up, ver and ifaces) as one MessagePack map; returns 0 on overflow
+size_t zwTelemetryCheckinMsgPack(uint8_t *buf, size_t bufLen, const ZWCheckinData &data);
+
+size_t zwTelemetryHeartbeatMsgPack(uint8_t *buf, size_t bufLen, uint64_t micros);
+
+#endif
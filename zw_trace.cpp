@@ -0,0 +1,61 @@
+#include "zw_trace.h"
+
+static ZWTraceSpan __spans[ZWTRACE_SPANS];
+static size_t __next = 0;
+static size_t __count = 0;
+static uint32_t __dropped = 0;
+static uint16_t __refresh = 0;
+
+void zwTraceSetRefresh(uint16_t refresh)
+{
+    __refresh = refresh;
+}
+
+// only the main loop records spans, so the ring needs no locking
+void zwTraceRecord(ZWTraceName name, uint8_t arg, uint32_t startUs, uint32_t durUs)
+{
+    __spans[__next] = {.startUs = startUs, .durUs = durUs, .name = (uint8_t)name, .arg = arg, .refresh = __refresh};
+    __next = (__next + 1) % ZWTRACE_SPANS;
+
+    if (__count < ZWTRACE_SPANS)
+        ++__count;
+    else
+        ++__dropped;
+}
+
+const char *zwTraceNames()
+{
+    return "refresh,readConfig,tick,updateDisplay,displayFetch,displayParse,displayRender,"
+           "statusRender,heartbeat,checkin,logFlush";
+}
+
+size_t zwTracePending()
+{
+    return __count;
+}
+
+uint32_t zwTraceDropped()
+{
+    return __dropped;
+}
+
+int zwTraceRuns(const ZWTraceSpan *runs[2], size_t counts[2])
+{
+    if (!__count)
+        return 0;
+
+    auto first = (__next + ZWTRACE_SPANS - __count) % ZWTRACE_SPANS;
+    runs[0] = __spans + first;
+    counts[0] = min(__count, (size_t)(ZWTRACE_SPANS - first));
+    if (counts[0] == __count)
+        return 1;
+
+    runs[1] = __spans;
+    counts[1] = __count - counts[0];
+    return 2;
+}
+
+void zwTraceConsume(size_t count)
+{
+    __count -= min(count, __count);
+}
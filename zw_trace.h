@@ -0,0 +1,72 @@
+#ifndef __ZW_TRACE__H__
+#define __ZW_TRACE__H__
+
+#include <Arduino.h>
+
+// Completed spans go into a fixed ring (the oldest are overwritten) until flushed
+// to HOSTNAME:traceStream; tools/zw-trace.cpp turns that into Chrome trace JSON.
+#define ZWTRACE_SPANS 128
+
+enum ZWTraceName
+{
+    ZWT_REFRESH = 0,
+    ZWT_READ_CONFIG,
+    ZWT_TICK,
+    ZWT_UPDATE_DISPLAY,
+    ZWT_DISPLAY_FETCH,
+    ZWT_DISPLAY_PARSE,
+    ZWT_DISPLAY_RENDER,
+    ZWT_STATUS_RENDER,
+    ZWT_HEARTBEAT,
+    ZWT_CHECKIN,
+    ZWT_LOG_FLUSH,
+    ZWT_NAME_COUNT
+};
+
+// the on-the-wire record too: uploaded as-is, little-endian
+struct __attribute__((packed)) ZWTraceSpan
+{
+    uint32_t startUs;
+    uint32_t durUs;
+    uint8_t name;
+    uint8_t arg; // e.g. the display index, 0xff if unused
+    uint16_t refresh;
+};
+
+#define ZWTRACE_NO_ARG 0xff
+
+// the refresh count recorded with each span
+void zwTraceSetRefresh(uint16_t refresh);
+
+void zwTraceRecord(ZWTraceName name, uint8_t arg, uint32_t startUs, uint32_t durUs);
+
+// comma-separated, in ZWTraceName order
+const char *zwTraceNames();
+
+size_t zwTracePending();
+
+uint32_t zwTraceDropped();
+
+// the buffered spans as (at most two, oldest first) contiguous runs; returns the number of runs
+int zwTraceRuns(const ZWTraceSpan *runs[2], size_t counts[2]);
+
+// discards the oldest count spans, once they've been uploaded
+void zwTraceConsume(size_t count);
+
+class ZWTraceScope
+{
+protected:
+    ZWTraceName name;
+    uint8_t arg;
+    unsigned long start;
+
+public:
+    ZWTraceScope(ZWTraceName spanName, uint8_t spanArg = ZWTRACE_NO_ARG) :
+        name(spanName), arg(spanArg), start(micros()) {}
+    ~ZWTraceScope() { zwTraceRecord(name, arg, start, micros() - start); }
+
+    ZWTraceScope(const ZWTraceScope &) = delete;
+    ZWTraceScope &operator=(const ZWTraceScope &) = delete;
+};
+
+#endif
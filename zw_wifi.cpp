@@ -1,10 +1,65 @@
 #include <WiFi.h>
+#include "zw_wifi.h"
 #include "zw_logging.h"
 #include "zw_displays.h"
 #include "zw_provision.h"
 
+#define ZW_WIFI_CACHE_MAGIC 0x5A57CAC4
+
+// lives in RTC slow memory: survives deep sleep, is lost on power-off (at which point we just scan)
+struct ZWWiFiCache
+{
+    uint32_t magic;
+    uint8_t bssid[6];
+    int32_t channel;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint16_t reuses;
+};
+
+RTC_DATA_ATTR static ZWWiFiCache __wifiCache;
+
+ZWWiFiConnectStats gWiFiConnectStats;
+
+static bool __waitForConnect(unsigned long timeoutMs)
+{
+    auto start = millis();
+    while (WiFi.status() != WL_CONNECTED)
+    {
+        if (millis() - start > timeoutMs)
+            return false;
+        delay(10);
+    }
+    return true;
+}
+
+static void __saveCache()
+{
+    auto bssid = WiFi.BSSID();
+    if (!bssid)
+        return;
+
+    // only a DHCP-negotiated lease restarts the reuse count
+    if (__wifiCache.magic != ZW_WIFI_CACHE_MAGIC || !gWiFiConnectStats.fastConnected)
+        __wifiCache.reuses = 0;
+
+    memcpy(__wifiCache.bssid, bssid, sizeof(__wifiCache.bssid));
+    __wifiCache.channel = WiFi.channel();
+    __wifiCache.ip = (uint32_t)WiFi.localIP();
+    __wifiCache.gateway = (uint32_t)WiFi.gatewayIP();
+    __wifiCache.subnet = (uint32_t)WiFi.subnetMask();
+    __wifiCache.dns = (uint32_t)WiFi.dnsIP();
+    __wifiCache.magic = ZW_WIFI_CACHE_MAGIC;
+}
+
 bool zwWiFiInit(const char *hostname, ZWAppConfig config)
 {
+    auto start = millis();
+    bzero(&gWiFiConnectStats, sizeof(gWiFiConnectStats));
+
+    WiFi.persistent(false);
     WiFi.mode(WIFI_MODE_STA);
     WiFi.enableAP(false);
 
@@ -13,13 +68,56 @@ bool zwWiFiInit(const char *hostname, ZWAppConfig config)
         dprint("WARNING: failed to set hostname\n");
     }
 
-    auto bstat = WiFi.begin(EEPROMCFG_WiFiSSID, EEPROMCFG_WiFiPass);
-    zlog("Connecting to '%s'\n", EEPROMCFG_WiFiSSID);
+    if (__wifiCache.magic == ZW_WIFI_CACHE_MAGIC && __wifiCache.reuses < ZW_WIFI_CACHE_MAX_REUSE)
+    {
+        gWiFiConnectStats.cacheUsed = true;
+        zlog("Fast-connecting to '%s' on channel %d (lease %s, reuse %d)\n", EEPROMCFG_WiFiSSID,
+             __wifiCache.channel, IPAddress(__wifiCache.ip).toString().c_str(), __wifiCache.reuses);
+
+        WiFi.config(IPAddress(__wifiCache.ip), IPAddress(__wifiCache.gateway),
+                    IPAddress(__wifiCache.subnet), IPAddress(__wifiCache.dns));
+        WiFi.begin(EEPROMCFG_WiFiSSID, EEPROMCFG_WiFiPass, __wifiCache.channel, __wifiCache.bssid);
+
+        gWiFiConnectStats.fastConnected = __waitForConnect(ZW_WIFI_FAST_CONNECT_TIMEOUT_MS);
+        gWiFiConnectStats.fastMs = millis() - start;
+
+        if (gWiFiConnectStats.fastConnected)
+        {
+            ++__wifiCache.reuses;
+        }
+        else
+        {
+            zlog("Fast-connect failed after %lums, falling back to full scan\n", gWiFiConnectStats.fastMs);
+            __wifiCache.magic = 0;
+            WiFi.disconnect();
+            // clearing the static config re-enables DHCP
+            WiFi.config(INADDR_NONE, INADDR_NONE, INADDR_NONE);
+        }
+    }
+
+    if (!gWiFiConnectStats.fastConnected)
+    {
+        auto fullStart = millis();
+        WiFi.begin(EEPROMCFG_WiFiSSID, EEPROMCFG_WiFiPass);
+        zlog("Connecting to '%s'\n", EEPROMCFG_WiFiSSID);
+
+        auto connected = __waitForConnect(ZW_WIFI_CONNECT_TIMEOUT_MS);
+        gWiFiConnectStats.fullMs = millis() - fullStart;
+
+        if (!connected)
+        {
+            gWiFiConnectStats.totalMs = millis() - start;
+            zlog("ERROR: WiFi connect timed out after %lums (status %d)\n",
+                 gWiFiConnectStats.totalMs, WiFi.status());
+            return false;
+        }
+    }
 
-    // TODO: timeout!
-    while (WiFi.status() != WL_CONNECTED) {}
+    __saveCache();
+    gWiFiConnectStats.totalMs = millis() - start;
 
-    zlog("Connected as %s\n", WiFi.localIP().toString().c_str());
+    zlog("Connected as %s in %lums (%s)\n", WiFi.localIP().toString().c_str(), gWiFiConnectStats.totalMs,
+         gWiFiConnectStats.fastConnected ? "cached" : "full scan");
 
     return true;
 }
@@ -4,6 +4,24 @@
 #include "zw_common.h"
 #include "zw_logging.h"
 
+// directed (cached BSSID/channel/lease) attempt gets this long before falling back to a full scan
+#define ZW_WIFI_FAST_CONNECT_TIMEOUT_MS 3000
+// hard deadline for the full scan + DHCP path
+#define ZW_WIFI_CONNECT_TIMEOUT_MS 20000
+// force a full DHCP negotiation after this many consecutive cached-lease connects
+#define ZW_WIFI_CACHE_MAX_REUSE 64
+
+struct ZWWiFiConnectStats
+{
+    bool cacheUsed;
+    bool fastConnected;
+    unsigned long fastMs;
+    unsigned long fullMs;
+    unsigned long totalMs;
+};
+
+extern ZWWiFiConnectStats gWiFiConnectStats;
+
 bool zwWiFiInit(const char *hostname, ZWAppConfig config);
 
-#endif
\ No newline at end of file
+#endif